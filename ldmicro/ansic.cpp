@@ -96,6 +96,14 @@ static void DeclareInt(FILE *f, char *str)
     fprintf(f, "STATIC SWORD %s = 0;\n", str);
 }
 
+//-----------------------------------------------------------------------------
+// And for an array of them, for the shift registers kept as ring buffers.
+//-----------------------------------------------------------------------------
+static void DeclareIntArray(FILE *f, char *str, int n)
+{
+    fprintf(f, "STATIC SWORD %s[%d];\n", str, n);
+}
+
 //-----------------------------------------------------------------------------
 // Generate a declaration for a bit var; three cases, input, output, and
 // internal relay. An internal relay is just a BOOL variable, but for an
@@ -123,12 +131,41 @@ static void DeclareBit(FILE *f, char *str)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Generate the routine that evaluates a piecewise linear table. The table is
+// the upper x of each segment, and then x0, y0, dy, dx for each segment; find
+// the first segment whose upper x is not less than x, by binary search, and
+// interpolate along it. Past the last point, return y unchanged.
+//-----------------------------------------------------------------------------
+static void DeclarePiecewiseLinear(FILE *f)
+{
+    fprintf(f,
+"\n"
+"static SWORD I_PiecewiseLinear(const SWORD *t, int n, SWORD x, SWORD y)\n"
+"{\n"
+"    int lo = 0, hi = n;\n"
+"    while(lo < hi) {\n"
+"        int mid = (lo + hi)/2;\n"
+"        if(x <= t[mid]) hi = mid; else lo = mid + 1;\n"
+"    }\n"
+"    if(lo < n) {\n"
+"        const SWORD *s = &t[n + 4*lo];\n"
+"        SWORD d = (SWORD)(x - s[0]);\n"
+"        y = (SWORD)(s[1] + (SWORD)(((long)d * s[2]) / s[3]));\n"
+"    }\n"
+"    return y;\n"
+"}\n"
+"\n"
+        );
+}
+
 //-----------------------------------------------------------------------------
 // Generate declarations for all the 16-bit/single bit variables in the ladder
 // program.
 //-----------------------------------------------------------------------------
 static void GenerateDeclarations(FILE *f)
 {
+    BOOL seenPiecewiseLinear = FALSE;
     int i;
     for(i = 0; i < IntCodeLen; i++) {
         char *bitVar1 = NULL, *bitVar2 = NULL;
@@ -154,16 +191,86 @@ static void GenerateDeclarations(FILE *f)
                 intVar2 = IntCode[i].name2;
                 break;
 
+            case INT_SET_VARIABLE_FROM_RING: {
+                char *ring = MapSym(IntCode[i].name2, ASINT);
+                if(!SeenVariable(ring)) {
+                    DeclareIntArray(f, ring,
+                        ShiftRegisterRingLength(IntCode[i].name2));
+                }
+                intVar1 = IntCode[i].name1;
+                intVar2 = IntCode[i].name3;
+                break;
+            }
+
+            case INT_SET_RING_FROM_VARIABLE: {
+                char *ring = MapSym(IntCode[i].name1, ASINT);
+                if(!SeenVariable(ring)) {
+                    DeclareIntArray(f, ring,
+                        ShiftRegisterRingLength(IntCode[i].name1));
+                }
+                intVar1 = IntCode[i].name2;
+                intVar2 = IntCode[i].name3;
+                break;
+            }
+
             case INT_SET_VARIABLE_DIVIDE:
             case INT_SET_VARIABLE_MULTIPLY:
             case INT_SET_VARIABLE_SUBTRACT:
             case INT_SET_VARIABLE_ADD:
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
                 intVar1 = IntCode[i].name1;
                 intVar2 = IntCode[i].name2;
                 intVar3 = IntCode[i].name3;
                 break;
 
+            case INT_SET_VARIABLE_ADD_LITERAL:
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                intVar1 = IntCode[i].name1;
+                intVar2 = IntCode[i].name2;
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                ElemLookUpTable *t = LookUpTables[IntCode[i].literal];
+                int j;
+                fprintf(f, "static const SWORD I_lookUpTable_%d[] = {",
+                    IntCode[i].literal);
+                for(j = 0; j < t->count; j++) {
+                    fprintf(f, "%s%d", j ? ", " : " ", t->vals[j]);
+                }
+                fprintf(f, " };\n");
+                intVar1 = IntCode[i].name1;
+                intVar2 = IntCode[i].name2;
+                break;
+            }
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                ElemPiecewiseLinear *t = PiecewiseLinears[IntCode[i].literal];
+                int j;
+                if(!seenPiecewiseLinear) {
+                    DeclarePiecewiseLinear(f);
+                    seenPiecewiseLinear = TRUE;
+                }
+                fprintf(f, "static const SWORD I_piecewiseLinear_%d[] = {",
+                    IntCode[i].literal);
+                for(j = 1; j < t->count; j++) {
+                    fprintf(f, "%s%d", (j > 1) ? ", " : " ", t->vals[j*2]);
+                }
+                for(j = 0; j < t->count - 1; j++) {
+                    SWORD seg[4];
+                    PiecewiseLinearSegment(t, j, seg);
+                    fprintf(f, ",\n    %d, %d, %d, %d", seg[0], seg[1], seg[2],
+                        seg[3]);
+                }
+                fprintf(f, " };\n");
+                intVar1 = IntCode[i].name1;
+                intVar2 = IntCode[i].name2;
+                break;
+            }
+
             case INT_INCREMENT_VARIABLE:
+            case INT_DECREMENT_VARIABLE:
             case INT_READ_ADC:
             case INT_SET_PWM:
                 intVar1 = IntCode[i].name1;
@@ -175,12 +282,36 @@ static void GenerateDeclarations(FILE *f)
                 bitVar1 = IntCode[i].name2;
                 break;
 
+            case INT_WRITE_FORMATTED_STRING:
+                intVar1 = IntCode[i].name1;
+                intVar2 = IntCode[i].name2;
+                break;
+
             case INT_IF_BIT_SET:
             case INT_IF_BIT_CLEAR:
                 bitVar1 = IntCode[i].name1;
                 break;
 
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[IntCode[i].literal];
+                int j;
+                for(j = 0; j < t->inputs; j++) {
+                    char *in = MapSym(t->input[j], ASBIT);
+                    if(!SeenVariable(in)) DeclareBit(f, in);
+                }
+                fprintf(f, "static const unsigned char I_truthTable_%d[] = {",
+                    IntCode[i].literal);
+                for(j = 0; j < ((1 << t->inputs) + 7)/8; j++) {
+                    fprintf(f, "%s0x%02x", j ? ", " : " ", t->bits[j]);
+                }
+                fprintf(f, " };\n");
+                bitVar1 = IntCode[i].name1;
+                break;
+            }
+
             case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+            case INT_IF_VARIABLE_GRT_LITERAL:
                 intVar1 = IntCode[i].name1;
                 break;
 
@@ -258,6 +389,30 @@ static void GenerateAnsiC(FILE *f)
                                          MapSym(IntCode[i].name2, ASINT));
                 break;
 
+            case INT_SET_VARIABLE_FROM_RING:
+            case INT_SET_RING_FROM_VARIABLE: {
+                BOOL from = (IntCode[i].op == INT_SET_VARIABLE_FROM_RING);
+                char *ring = from ? IntCode[i].name2 : IntCode[i].name1;
+                char *head = MapSym(from ? IntCode[i].name3 : IntCode[i].name2,
+                    ASINT);
+                char element[MAX_NAME_LEN*2+50];
+                if(IntCode[i].literal == 0) {
+                    sprintf(element, "%s[%s]", MapSym(ring, ASINT), head);
+                } else {
+                    sprintf(element, "%s[(%s + %d) %% %d]",
+                        MapSym(ring, ASINT), head, IntCode[i].literal,
+                        ShiftRegisterRingLength(ring));
+                }
+                if(from) {
+                    fprintf(f, "%s = %s;\n", MapSym(IntCode[i].name1, ASINT),
+                        element);
+                } else {
+                    fprintf(f, "%s = %s;\n", element,
+                        MapSym(IntCode[i].name3, ASINT));
+                }
+                break;
+            }
+
             {
                 char op;
                 case INT_SET_VARIABLE_ADD: op = '+'; goto arith;
@@ -273,10 +428,81 @@ static void GenerateAnsiC(FILE *f)
                     break;
             }
 
+            case INT_SET_VARIABLE_ADD_LITERAL:
+                fprintf(f, "%s = %s + %d;\n", MapSym(IntCode[i].name1, ASINT),
+                    MapSym(IntCode[i].name2, ASINT), IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+                fprintf(f, "%s = %s - %d;\n", MapSym(IntCode[i].name1, ASINT),
+                    MapSym(IntCode[i].name2, ASINT), IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                fprintf(f, "%s = %s * %d;\n", MapSym(IntCode[i].name1, ASINT),
+                    MapSym(IntCode[i].name2, ASINT), IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                fprintf(f, "%s = %s / %d;\n", MapSym(IntCode[i].name1, ASINT),
+                    MapSym(IntCode[i].name2, ASINT), IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                char *index = MapSym(IntCode[i].name2, ASINT);
+                fprintf(f, "if(%s >= 0 && %s < %d) ", index, index,
+                    LookUpTables[IntCode[i].literal]->count);
+                fprintf(f, "%s = I_lookUpTable_%d[%s];\n",
+                    MapSym(IntCode[i].name1, ASINT), IntCode[i].literal,
+                    MapSym(IntCode[i].name2, ASINT));
+                break;
+            }
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+                fprintf(f, "%s = I_PiecewiseLinear(I_piecewiseLinear_%d, %d, "
+                    "%s, %s);\n", MapSym(IntCode[i].name1, ASINT),
+                    IntCode[i].literal,
+                    PiecewiseLinears[IntCode[i].literal]->count - 1,
+                    MapSym(IntCode[i].name2, ASINT),
+                    MapSym(IntCode[i].name1, ASINT));
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                fprintf(f, "%s = (SWORD)(((long)%s * %s) / %d);\n",
+                    MapSym(IntCode[i].name1, ASINT),
+                    MapSym(IntCode[i].name2, ASINT),
+                    MapSym(IntCode[i].name3, ASINT),
+                    IntCode[i].literal);
+                break;
+
             case INT_INCREMENT_VARIABLE:
                 fprintf(f, "%s++;\n", MapSym(IntCode[i].name1, ASINT));
                 break;
 
+            case INT_DECREMENT_VARIABLE:
+                fprintf(f, "%s--;\n", MapSym(IntCode[i].name1, ASINT));
+                break;
+
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[IntCode[i].literal];
+                fprintf(f, "{\n");
+                for(j = 0; j <= indent; j++) fprintf(f, "    ");
+                fprintf(f, "int i = 0;\n");
+                int k;
+                for(k = 0; k < t->inputs; k++) {
+                    for(j = 0; j <= indent; j++) fprintf(f, "    ");
+                    fprintf(f, "if(Read_%s()) i |= %d;\n",
+                        MapSym(t->input[k], ASBIT), 1 << k);
+                }
+                for(j = 0; j <= indent; j++) fprintf(f, "    ");
+                fprintf(f, "Write_%s((I_truthTable_%d[i >> 3] >> (i & 7)) "
+                    "& 1);\n", MapSym(IntCode[i].name1, ASBIT),
+                    IntCode[i].literal);
+                for(j = 0; j < indent; j++) fprintf(f, "    ");
+                fprintf(f, "}\n");
+                break;
+            }
+
             case INT_IF_BIT_SET:
                 fprintf(f, "if(Read_%s()) {\n",
                     MapSym(IntCode[i].name1, ASBIT));
@@ -307,6 +533,18 @@ static void GenerateAnsiC(FILE *f)
                 indent++;
                 break;
 
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+                fprintf(f, "if(%s == %d) {\n", MapSym(IntCode[i].name1, ASINT),
+                    IntCode[i].literal);
+                indent++;
+                break;
+
+            case INT_IF_VARIABLE_GRT_LITERAL:
+                fprintf(f, "if(%s > %d) {\n", MapSym(IntCode[i].name1, ASINT),
+                    IntCode[i].literal);
+                indent++;
+                break;
+
             case INT_END_IF:
                 fprintf(f, "}\n");
                 break;
@@ -335,6 +573,7 @@ static void GenerateAnsiC(FILE *f)
             case INT_SET_PWM:
             case INT_UART_RECV:
             case INT_UART_SEND:
+            case INT_WRITE_FORMATTED_STRING:
                 Error(_("ANSI C target does not support peripherals "
                     "(UART, PWM, ADC, EEPROM). Skipping that instruction."));
                 break;
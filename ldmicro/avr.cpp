@@ -58,6 +58,7 @@ typedef enum AvrOpTag {
     OP_INC,
     OP_LDI,
     OP_LD_X,
+    OP_LPM,
     OP_MOV,
     OP_OUT,
     OP_RCALL,
@@ -74,14 +75,21 @@ typedef enum AvrOpTag {
     OP_ST_X,
     OP_SUB,
     OP_SUBI,
+    OP_SWAP,
     OP_TST,
     OP_WDR,
+    // not an instruction; a word of constant data, for tables in flash
+    OP_DW,
 } AvrOp;
 
 typedef struct AvrInstructionTag {
     AvrOp       op;
     DWORD       arg1;
     DWORD       arg2;
+    // For a call, the subroutine that it calls; and for a branch back to
+    // the top of a loop, the most times that it goes round
+    DWORD       callee;
+    int         loops;
 } AvrInstruction;
 
 #define MAX_PROGRAM_LEN 128*1024
@@ -106,6 +114,27 @@ static BOOL MultiplyUsed;
 static DWORD DivideAddress;
 static BOOL DivideUsed;
 
+static DWORD MultiplyDivideAddress;
+static BOOL MultiplyDivideUsed;
+
+static DWORD MultiplyUnsignedAddress;
+static BOOL MultiplyUnsignedUsed;
+
+static DWORD PiecewiseLinearAddress;
+static BOOL PiecewiseLinearUsed;
+
+static DWORD FormattedStringAddress;
+static BOOL FormattedStringUsed;
+
+// Truth tables for the combinational rungs, as constant data in flash
+static DWORD TruthTableAddress[MAX_TRUTH_TABLES];
+// and likewise the look-up tables, one word per entry
+static DWORD LookUpTableAddress[MAX_LOOK_UP_TABLES];
+// and the piecewise linear tables
+static DWORD PiecewiseLinearTableAddress[MAX_PIECEWISE_LINEARS];
+// and the formatted string templates, one word per character
+static DWORD FormattedStringTableAddress[MAX_FORMATTED_STRINGS];
+
 // For EEPROM: we queue up characters to send in 16-bit words (corresponding
 // to the integer variables), but we can actually just program 8 bits at a
 // time, so we need to store the high byte somewhere while we wait.
@@ -169,6 +198,8 @@ static void Instruction(AvrOp op, DWORD arg1, DWORD arg2)
     AvrProg[AvrProgWriteP].op = op;
     AvrProg[AvrProgWriteP].arg1 = arg1;
     AvrProg[AvrProgWriteP].arg2 = arg2;
+    AvrProg[AvrProgWriteP].callee = 0;
+    AvrProg[AvrProgWriteP].loops = 0;
     AvrProgWriteP++;
 }
 
@@ -200,6 +231,9 @@ static void FwdAddrIsNow(DWORD addr)
         } else if(AvrProg[i].arg2 == FWD_HI(addr)) {
             AvrProg[i].arg2 = AvrProgWriteP >> 8;
         }
+        if(AvrProg[i].callee == addr) {
+            AvrProg[i].callee = AvrProgWriteP;
+        }
     }
 }
 
@@ -416,6 +450,18 @@ static DWORD Assemble(DWORD addrAt, AvrOp op, DWORD arg1, DWORD arg2)
             CHECK(arg1, 5); CHECK(arg2, 0);
             return (0x49 << 9) | (arg1 << 4) | 12;
 
+        case OP_LPM:
+            CHECK(arg1, 0); CHECK(arg2, 0);
+            return 0x95c8;
+
+        case OP_SWAP:
+            CHECK(arg1, 5); CHECK(arg2, 0);
+            return (0x4a << 9) | (arg1 << 4) | 2;
+
+        case OP_DW:
+            CHECK(arg1, 16); CHECK(arg2, 0);
+            return arg1;
+
         case OP_WDR:
             CHECK(arg1, 0); CHECK(arg2, 0);
             return 0x95a8;
@@ -473,6 +519,33 @@ static void LoadXAddr(DWORD addr)
     Instruction(OP_LDI, 26, (addr & 0xff));
 }
 
+//-----------------------------------------------------------------------------
+// Point X at the low octet of a stage of a shift register that's kept as a
+// ring buffer; that's the element at the index in the variable at headAddr,
+// plus the stage, modulo the length of the ring. A ring is never longer than
+// 255 stages, so the index fits in an octet. Trashes r16 and r17.
+//-----------------------------------------------------------------------------
+static void LoadXAddrOfRingStage(DWORD base, int length, DWORD headAddr,
+    int stage)
+{
+    LoadXAddr(headAddr);
+    Instruction(OP_LD_X, 16, 0);
+    if(stage != 0) {
+        // head + stage - length, plus length again if that borrowed
+        DWORD noWrap = AllocFwdAddr();
+        Instruction(OP_SUBI, 16, length - stage);
+        Instruction(OP_BRCC, noWrap, 0);
+        Instruction(OP_SUBI, 16, (BYTE)(-length));
+        FwdAddrIsNow(noWrap);
+    }
+    Instruction(OP_LDI, 17, 0);
+    Instruction(OP_ADD, 16, 16);
+    Instruction(OP_ADC, 17, 17);
+    LoadXAddr(base);
+    Instruction(OP_ADD, 26, 16);
+    Instruction(OP_ADC, 27, 17);
+}
+
 //-----------------------------------------------------------------------------
 // Generate code to write an 8-bit value to a particular register.
 //-----------------------------------------------------------------------------
@@ -546,6 +619,69 @@ static void ClearBit(DWORD addr, int bit)
     Instruction(OP_ST_X, 16, 0);
 }
 
+//-----------------------------------------------------------------------------
+// Load a variable into a pair of registers, low octet in rl. A variable that
+// always fits in a byte has a high octet of zero, so don't bother to load
+// that.
+//-----------------------------------------------------------------------------
+static void LoadVariable(char *name, int rl, int rh)
+{
+    DWORD addrl, addrh;
+    MemForVariable(name, &addrl, &addrh);
+    LoadXAddr(addrl);
+    Instruction(OP_LD_X, rl, 0);
+    if(IntFlowVariableIsByte(name)) {
+        Instruction(OP_LDI, rh, 0);
+    } else {
+        LoadXAddr(addrh);
+        Instruction(OP_LD_X, rh, 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Store a pair of registers to a variable, low octet in rl. If the variable
+// always fits in a byte then the high octet must be zero, and it already
+// is, so leave it alone.
+//-----------------------------------------------------------------------------
+static void StoreVariable(char *name, int rl, int rh)
+{
+    DWORD addrl, addrh;
+    MemForVariable(name, &addrl, &addrh);
+    LoadXAddr(addrl);
+    Instruction(OP_ST_X, rl, 0);
+    if(!IntFlowVariableIsByte(name)) {
+        LoadXAddr(addrh);
+        Instruction(OP_ST_X, rh, 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Shift the pair of registers rh:rl left by n places, a whole octet at a time
+// where we can.
+//-----------------------------------------------------------------------------
+static void ShiftLeft(int rl, int rh, int n)
+{
+    for(; n >= 8; n -= 8) {
+        Instruction(OP_MOV, rh, rl);
+        Instruction(OP_EOR, rl, rl);
+    }
+    for(; n > 0; n--) {
+        Instruction(OP_ADD, rl, rl);
+        Instruction(OP_ADC, rh, rh);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Negate the pair of registers rh:rl, in place.
+//-----------------------------------------------------------------------------
+static void Negate(int rl, int rh)
+{
+    Instruction(OP_COM, rh, 0);
+    Instruction(OP_COM, rl, 0);
+    Instruction(OP_SUBI, rl, 0xff);
+    Instruction(OP_SBCI, rh, 0xff);
+}
+
 //-----------------------------------------------------------------------------
 // Configure AVR 16-bit Timer1 to do the timing for us.
 //-----------------------------------------------------------------------------
@@ -768,6 +904,134 @@ static void CallSubroutine(DWORD addr)
     } else {
         Instruction(OP_RCALL, addr, 0);
     }
+    AvrProg[AvrProgWriteP - 1].callee = addr;
+}
+
+//-----------------------------------------------------------------------------
+// Note that the branch that we just wrote goes back to the top of a loop, at
+// most the given number of times, for the estimate of the scan time.
+//-----------------------------------------------------------------------------
+static void LoopsAtMost(int times)
+{
+    AvrProg[AvrProgWriteP - 1].loops = times;
+}
+
+//-----------------------------------------------------------------------------
+// r19:18 := r17:16 times lit. Start from the top nonzero digit, and then for
+// each digit below it shift left, and add or subtract r17:16 if the digit is
+// nonzero. If there are a lot of nonzero digits then the multiply routine
+// is shorter, and not that much slower, so use that instead.
+//-----------------------------------------------------------------------------
+static void MultiplyByLiteral(SWORD lit)
+{
+    int digit[16];
+    int n = MultiplyByLiteralDigits(lit, digit);
+    if(n > 4) {
+        Instruction(OP_LDI, 18, lit & 0xff);
+        Instruction(OP_LDI, 19, (lit >> 8) & 0xff);
+        CallSubroutine(MultiplyAddress);
+        MultiplyUsed = TRUE;
+        return;
+    }
+
+    Instruction(OP_EOR, 18, 18);
+    Instruction(OP_EOR, 19, 19);
+    if(n == 0) return;
+
+    int k = 15;
+    while(digit[k] == 0) k--;
+    int shift = 0;
+    for(; k >= 0; k--) {
+        if(digit[k] > 0) {
+            ShiftLeft(18, 19, shift);
+            shift = 0;
+            Instruction(OP_ADD, 18, 16);
+            Instruction(OP_ADC, 19, 17);
+        } else if(digit[k] < 0) {
+            ShiftLeft(18, 19, shift);
+            shift = 0;
+            Instruction(OP_SUB, 18, 16);
+            Instruction(OP_SBC, 19, 17);
+        }
+        shift++;
+    }
+    ShiftLeft(18, 19, shift - 1);
+}
+
+//-----------------------------------------------------------------------------
+// r17:16 := r17:16 divided by lit, which is not zero, truncating toward zero
+// like the divide routine. By a power of two that's an arithmetic shift,
+// once a negative dividend has had the divisor less one added to it, so
+// that it rounds up; by anything else, multiply the magnitude of the
+// dividend by the reciprocal from DivideByLiteralReciprocal(), and then fix
+// up the sign.
+//-----------------------------------------------------------------------------
+static void DivideByLiteral(SWORD lit)
+{
+    DWORD d = (lit < 0) ? -lit : lit;
+    if((d & (d - 1)) == 0) {
+        int k = 0;
+        while((1ul << k) < d) k++;
+        if(k > 0) {
+            DWORD positive = AllocFwdAddr();
+            Instruction(OP_SBRS, 17, 7);
+            Instruction(OP_RJMP, positive, 0);
+            Instruction(OP_SUBI, 16, (-(d - 1)) & 0xff);
+            Instruction(OP_SBCI, 17, ((-(d - 1)) >> 8) & 0xff);
+            FwdAddrIsNow(positive);
+        }
+        if(k >= 8) {
+            Instruction(OP_MOV, 16, 17);
+            Instruction(OP_EOR, 17, 17);
+            Instruction(OP_SBRC, 16, 7);
+            Instruction(OP_COM, 17, 0);
+            k -= 8;
+        }
+        for(; k > 0; k--) {
+            Instruction(OP_ASR, 17, 0);
+            Instruction(OP_ROR, 16, 0);
+        }
+        if(lit < 0) Negate(16, 17);
+        return;
+    }
+
+    WORD m;
+    int shift;
+    DivideByLiteralReciprocal(lit, &m, &shift);
+
+    DWORD positive = AllocFwdAddr();
+    Instruction(OP_MOV, 13, 17);
+    Instruction(OP_SBRS, 17, 7);
+    Instruction(OP_RJMP, positive, 0);
+    Negate(16, 17);
+    FwdAddrIsNow(positive);
+
+    Instruction(OP_LDI, 18, m & 0xff);
+    Instruction(OP_LDI, 19, m >> 8);
+    CallSubroutine(MultiplyUnsignedAddress);
+    MultiplyUnsignedUsed = TRUE;
+
+    // The quotient is the high word of the product, shifted right; that's
+    // less than 2^31, so an arithmetic shift will do.
+    shift -= 16;
+    if(shift >= 8) {
+        Instruction(OP_MOV, 20, 21);
+        Instruction(OP_EOR, 21, 21);
+        shift -= 8;
+    }
+    for(; shift > 0; shift--) {
+        Instruction(OP_ASR, 21, 0);
+        Instruction(OP_ROR, 20, 0);
+    }
+    Instruction(OP_MOV, 16, 20);
+    Instruction(OP_MOV, 17, 21);
+
+    // Negative if exactly one of the dividend and divisor is.
+    DWORD done = AllocFwdAddr();
+    Instruction((lit < 0) ? OP_SBRC : OP_SBRS, 13, 7);
+    Instruction(OP_RJMP, done, 0);
+    Negate(16, 17);
+    FwdAddrIsNow(done);
 }
 
 //-----------------------------------------------------------------------------
@@ -782,6 +1046,7 @@ static void CompileFromIntermediate(void)
 
     for(; IntPc < IntCodeLen; IntPc++) {
         IntOp *a = &IntCode[IntPc];
+        SourceMapMark(AvrProgWriteP, a->rung);
         switch(a->op) {
             case INT_SET_BIT:   
                 MemForSingleBit(a->name1, FALSE, &addr, &bit);
@@ -802,11 +1067,21 @@ static void CompileFromIntermediate(void)
             case INT_SET_VARIABLE_TO_LITERAL:
                 MemForVariable(a->name1, &addrl, &addrh);
                 WriteMemory(addrl, a->literal & 0xff);
-                WriteMemory(addrh, a->literal >> 8);
+                if(!IntFlowVariableIsByte(a->name1)) {
+                    WriteMemory(addrh, a->literal >> 8);
+                }
                 break;
 
             case INT_INCREMENT_VARIABLE: {
                 MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1)) {
+                    // and it won't carry, or it wouldn't fit
+                    LoadXAddr(addrl);
+                    Instruction(OP_LD_X, 16, 0);
+                    Instruction(OP_INC, 16, 0);
+                    Instruction(OP_ST_X, 16, 0);
+                    break;
+                }
                 LoadXAddr(addrl);
                 Instruction(OP_LD_X, 16, 0);
                 LoadXAddr(addrh);
@@ -823,6 +1098,27 @@ static void CompileFromIntermediate(void)
                 Instruction(OP_ST_X, 16, 0);
                 break;
             }
+            case INT_DECREMENT_VARIABLE:
+                MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1)) {
+                    LoadXAddr(addrl);
+                    Instruction(OP_LD_X, 16, 0);
+                    Instruction(OP_DEC, 16, 0);
+                    Instruction(OP_ST_X, 16, 0);
+                    break;
+                }
+                LoadXAddr(addrl);
+                Instruction(OP_LD_X, 16, 0);
+                LoadXAddr(addrh);
+                Instruction(OP_LD_X, 17, 0);
+                Instruction(OP_SUBI, 16, 1);
+                Instruction(OP_SBCI, 17, 0);
+                // X is still addrh
+                Instruction(OP_ST_X, 17, 0);
+                LoadXAddr(addrl);
+                Instruction(OP_ST_X, 16, 0);
+                break;
+
             case INT_IF_BIT_SET: {
                 DWORD condFalse = AllocFwdAddr();
                 MemForSingleBit(a->name1, TRUE, &addr, &bit);
@@ -843,13 +1139,29 @@ static void CompileFromIntermediate(void)
                 DWORD notTrue = AllocFwdAddr();
 
                 MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1) && a->literal >= 0 &&
+                    a->literal <= 255)
+                {
+                    // Both from 0 to 255, so an unsigned compare of the
+                    // low octets will do.
+                    DWORD isTrue = AllocFwdAddr();
+                    LoadXAddr(addrl);
+                    Instruction(OP_LD_X, 16, 0);
+                    Instruction(OP_LDI, 18, a->literal);
+                    Instruction(OP_CP, 16, 18);
+                    Instruction(OP_BRLO, isTrue, 0);
+                    Instruction(OP_RJMP, notTrue, 0);
+                    FwdAddrIsNow(isTrue);
+                    CompileIfBody(notTrue);
+                    break;
+                }
                 LoadXAddr(addrl);
                 Instruction(OP_LD_X, 16, 0);
                 LoadXAddr(addrh);
                 Instruction(OP_LD_X, 17, 0);
 
                 Instruction(OP_LDI, 18, (a->literal & 0xff));
-                Instruction(OP_LDI, 19, (a->literal >> 8));
+                Instruction(OP_LDI, 19, (a->literal >> 8) & 0xff);
 
                 Instruction(OP_CP, 16, 18);
                 Instruction(OP_CPC, 17, 19);
@@ -858,20 +1170,62 @@ static void CompileFromIntermediate(void)
                 CompileIfBody(notTrue);
                 break;
             }
-            case INT_IF_VARIABLE_GRT_VARIABLE:
-            case INT_IF_VARIABLE_EQUALS_VARIABLE: {
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+            case INT_IF_VARIABLE_GRT_LITERAL: {
                 DWORD notTrue = AllocFwdAddr();
+                DWORD isTrue = AllocFwdAddr();
 
                 MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1) && a->literal >= 0 &&
+                    a->literal <= 255)
+                {
+                    LoadXAddr(addrl);
+                    Instruction(OP_LD_X, 16, 0);
+                    Instruction(OP_LDI, 18, a->literal);
+                    if(a->op == INT_IF_VARIABLE_EQUALS_LITERAL) {
+                        Instruction(OP_CP, 16, 18);
+                        Instruction(OP_BREQ, isTrue, 0);
+                    } else {
+                        Instruction(OP_CP, 18, 16);
+                        Instruction(OP_BRLO, isTrue, 0);
+                    }
+                    Instruction(OP_RJMP, notTrue, 0);
+                    FwdAddrIsNow(isTrue);
+                    CompileIfBody(notTrue);
+                    break;
+                }
                 LoadXAddr(addrl);
                 Instruction(OP_LD_X, 16, 0);
                 LoadXAddr(addrh);
                 Instruction(OP_LD_X, 17, 0);
-                MemForVariable(a->name2, &addrl, &addrh);
-                LoadXAddr(addrl);
-                Instruction(OP_LD_X, 18, 0);
-                LoadXAddr(addrh);
-                Instruction(OP_LD_X, 19, 0);
+
+                Instruction(OP_LDI, 18, (a->literal & 0xff));
+                Instruction(OP_LDI, 19, (a->literal >> 8) & 0xff);
+
+                // Branch over a long jump, since the body of the if might
+                // be out of range of the conditional branch.
+                if(a->op == INT_IF_VARIABLE_EQUALS_LITERAL) {
+                    Instruction(OP_CP, 16, 18);
+                    Instruction(OP_CPC, 17, 19);
+                    Instruction(OP_BREQ, isTrue, 0);
+                } else {
+                    // var > lit is lit < var
+                    Instruction(OP_CP, 18, 16);
+                    Instruction(OP_CPC, 19, 17);
+                    Instruction(OP_BRLT, isTrue, 0);
+                }
+                Instruction(OP_RJMP, notTrue, 0);
+                FwdAddrIsNow(isTrue);
+
+                CompileIfBody(notTrue);
+                break;
+            }
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+            case INT_IF_VARIABLE_EQUALS_VARIABLE: {
+                DWORD notTrue = AllocFwdAddr();
+
+                LoadVariable(a->name1, 16, 17);
+                LoadVariable(a->name2, 18, 19);
 
                 if(a->op == INT_IF_VARIABLE_EQUALS_VARIABLE) {
                     Instruction(OP_CP, 16, 18);
@@ -898,55 +1252,69 @@ static void CompileFromIntermediate(void)
                 LoadXAddr(addrl);
                 Instruction(OP_ST_X, 16, 0);
 
+                // If it fits in the destination then the high octet is zero.
+                if(IntFlowVariableIsByte(a->name1)) break;
                 LoadXAddr(addrh2);
                 Instruction(OP_LD_X, 16, 0);
                 LoadXAddr(addrh);
                 Instruction(OP_ST_X, 16, 0);
                 break;
 
-            case INT_SET_VARIABLE_DIVIDE:
-                // Do this one separately since the divide routine uses
-                // slightly different in/out registers and I don't feel like
-                // modifying it.
-                MemForVariable(a->name2, &addrl, &addrh);
+            case INT_SET_VARIABLE_FROM_RING: {
+                int length = ShiftRegisterRingLength(a->name2);
+                DWORD base = MemForArray(a->name2, length);
+                MemForVariable(a->name1, &addrl, &addrh);
                 MemForVariable(a->name3, &addrl2, &addrh2);
 
-                LoadXAddr(addrl2);
+                LoadXAddrOfRingStage(base, length, addrl2, a->literal);
                 Instruction(OP_LD_X, 18, 0);
-                LoadXAddr(addrh2);
+                Instruction(OP_SUBI, 26, 0xff);
+                Instruction(OP_SBCI, 27, 0xff);
                 Instruction(OP_LD_X, 19, 0);
 
                 LoadXAddr(addrl);
-                Instruction(OP_LD_X, 16, 0);
+                Instruction(OP_ST_X, 18, 0);
                 LoadXAddr(addrh);
-                Instruction(OP_LD_X, 17, 0);
+                Instruction(OP_ST_X, 19, 0);
+                break;
+            }
+            case INT_SET_RING_FROM_VARIABLE: {
+                int length = ShiftRegisterRingLength(a->name1);
+                DWORD base = MemForArray(a->name1, length);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                MemForVariable(a->name3, &addrl, &addrh);
+
+                LoadXAddr(addrl);
+                Instruction(OP_LD_X, 18, 0);
+                LoadXAddr(addrh);
+                Instruction(OP_LD_X, 19, 0);
+
+                LoadXAddrOfRingStage(base, length, addrl2, a->literal);
+                Instruction(OP_ST_X, 18, 0);
+                Instruction(OP_SUBI, 26, 0xff);
+                Instruction(OP_SBCI, 27, 0xff);
+                Instruction(OP_ST_X, 19, 0);
+                break;
+            }
+
+            case INT_SET_VARIABLE_DIVIDE:
+                // Do this one separately since the divide routine uses
+                // slightly different in/out registers and I don't feel like
+                // modifying it.
+                LoadVariable(a->name2, 16, 17);
+                LoadVariable(a->name3, 18, 19);
 
                 CallSubroutine(DivideAddress);
                 DivideUsed = TRUE;
-                
-                MemForVariable(a->name1, &addrl, &addrh);
 
-                LoadXAddr(addrl);
-                Instruction(OP_ST_X, 16, 0);
-                LoadXAddr(addrh);
-                Instruction(OP_ST_X, 17, 0);
+                StoreVariable(a->name1, 16, 17);
                 break;
 
             case INT_SET_VARIABLE_ADD:
             case INT_SET_VARIABLE_SUBTRACT:
             case INT_SET_VARIABLE_MULTIPLY:
-                MemForVariable(a->name2, &addrl, &addrh);
-                MemForVariable(a->name3, &addrl2, &addrh2);
-
-                LoadXAddr(addrl);
-                Instruction(OP_LD_X, 18, 0);
-                LoadXAddr(addrh);
-                Instruction(OP_LD_X, 19, 0);
-
-                LoadXAddr(addrl2);
-                Instruction(OP_LD_X, 16, 0);
-                LoadXAddr(addrh2);
-                Instruction(OP_LD_X, 17, 0);
+                LoadVariable(a->name2, 18, 19);
+                LoadVariable(a->name3, 16, 17);
 
                 if(a->op == INT_SET_VARIABLE_ADD) {
                     Instruction(OP_ADD, 18, 16);
@@ -959,14 +1327,112 @@ static void CompileFromIntermediate(void)
                     MultiplyUsed = TRUE;
                 } else oops();
 
-                MemForVariable(a->name1, &addrl, &addrh);
+                StoreVariable(a->name1, 18, 19);
+                break;
 
-                LoadXAddr(addrl);
-                Instruction(OP_ST_X, 18, 0);
-                LoadXAddr(addrh);
-                Instruction(OP_ST_X, 19, 0);
+            case INT_SET_VARIABLE_ADD_LITERAL:
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL: {
+                // There is no add-immediate, so add lit by subtracting -lit.
+                WORD lit = a->literal;
+                if(a->op == INT_SET_VARIABLE_ADD_LITERAL) lit = -lit;
+
+                LoadVariable(a->name2, 16, 17);
+
+                Instruction(OP_SUBI, 16, lit & 0xff);
+                Instruction(OP_SBCI, 17, lit >> 8);
+
+                StoreVariable(a->name1, 16, 17);
+                break;
+            }
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                LoadVariable(a->name2, 16, 17);
+                MultiplyByLiteral(a->literal);
+                StoreVariable(a->name1, 18, 19);
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                LoadVariable(a->name2, 16, 17);
+                DivideByLiteral(a->literal);
+                StoreVariable(a->name1, 16, 17);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                LoadVariable(a->name2, 16, 17);
+                LoadVariable(a->name3, 18, 19);
+
+                Instruction(OP_LDI, 24, (a->literal & 0xff));
+                Instruction(OP_LDI, 25, (a->literal >> 8) & 0xff);
+
+                CallSubroutine(MultiplyDivideAddress);
+                MultiplyDivideUsed = TRUE;
+
+                StoreVariable(a->name1, 18, 19);
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                ElemLookUpTable *t = LookUpTables[a->literal];
+                DWORD table = LookUpTableAddress[a->literal];
+                DWORD inRange = AllocFwdAddr();
+                DWORD outOfRange = AllocFwdAddr();
+
+                LoadVariable(a->name2, 16, 17);
+
+                // Unsigned compare against the length, so that negative
+                // indices are out of range too.
+                Instruction(OP_LDI, 18, t->count);
+                Instruction(OP_LDI, 19, 0);
+                Instruction(OP_CP, 16, 18);
+                Instruction(OP_CPC, 17, 19);
+                Instruction(OP_BRLO, inRange, 0);
+                Instruction(OP_RJMP, outOfRange, 0);
+                FwdAddrIsNow(inRange);
+
+                // Z := byte address of the table (twice its word address),
+                // plus twice the index.
+                Instruction(OP_LDI, 30, FWD_LO(table));
+                Instruction(OP_LDI, 31, FWD_HI(table));
+                Instruction(OP_ADD, 16, 16);
+                Instruction(OP_ADD, 30, 30);
+                Instruction(OP_ADC, 31, 31);
+                Instruction(OP_ADD, 30, 16);
+                Instruction(OP_ADC, 31, 19);
+                Instruction(OP_LPM, 0, 0);
+                Instruction(OP_MOV, 18, 0);
+                Instruction(OP_SUBI, 30, 0xff);
+                Instruction(OP_SBCI, 31, 0xff);
+                Instruction(OP_LPM, 0, 0);
+                Instruction(OP_MOV, 19, 0);
+
+                StoreVariable(a->name1, 18, 19);
+
+                FwdAddrIsNow(outOfRange);
                 break;
+            }
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                ElemPiecewiseLinear *t = PiecewiseLinears[a->literal];
+                DWORD table = PiecewiseLinearTableAddress[a->literal];
+                DWORD outside = AllocFwdAddr();
 
+                LoadVariable(a->name2, 16, 17);
+
+                // X := byte address of the table
+                Instruction(OP_LDI, 26, FWD_LO(table));
+                Instruction(OP_LDI, 27, FWD_HI(table));
+                Instruction(OP_ADD, 26, 26);
+                Instruction(OP_ADC, 27, 27);
+                Instruction(OP_LDI, 22, t->count - 1);
+
+                CallSubroutine(PiecewiseLinearAddress);
+                PiecewiseLinearUsed = TRUE;
+                MultiplyUsed = TRUE;
+                MultiplyDivideUsed = TRUE;
+                Instruction(OP_BRCS, outside, 0);
+
+                StoreVariable(a->name1, 18, 19);
+
+                FwdAddrIsNow(outside);
+                break;
+            }
             case INT_SET_PWM: {
                 int target = atoi(a->name2);
 
@@ -1194,6 +1660,100 @@ static void CompileFromIntermediate(void)
 
                 break;
             }
+            case INT_WRITE_FORMATTED_STRING: {
+                FormattedString *fs = &FormattedStrings[a->literal];
+                DWORD table = FormattedStringTableAddress[a->literal];
+                DWORD done = AllocFwdAddr();
+                DWORD notDone = AllocFwdAddr();
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForSingleBit(fs->isLeadingZero, FALSE, &addr, &bit);
+
+                // Nothing to do once we've sent the whole string, or until
+                // the UART can take another character.
+                LoadXAddr(addrl);
+                Instruction(OP_LD_X, 16, 0);
+                LoadXAddr(addrh);
+                Instruction(OP_LD_X, 17, 0);
+                Instruction(OP_LDI, 18, fs->steps);
+                Instruction(OP_LDI, 19, 0);
+                Instruction(OP_CP, 16, 18);
+                Instruction(OP_CPC, 17, 19);
+                Instruction(OP_BRLT, notDone, 0);
+                Instruction(OP_RJMP, done, 0);
+                FwdAddrIsNow(notDone);
+                IfBitClear(REG_UCSRA, 5); // UDRE, is 1 when tx buffer is empty
+                Instruction(OP_RJMP, done, 0);
+
+                // Z := byte address of the table, plus twice the sequencer;
+                // that is less than the number of steps, so just its low
+                // byte will do.
+                LoadXAddr(addrl);
+                Instruction(OP_LD_X, 16, 0);
+                Instruction(OP_LDI, 17, 0);
+                Instruction(OP_LDI, 30, FWD_LO(table));
+                Instruction(OP_LDI, 31, FWD_HI(table));
+                Instruction(OP_ADD, 30, 30);
+                Instruction(OP_ADC, 31, 31);
+                Instruction(OP_ADD, 16, 16);
+                Instruction(OP_ADD, 30, 16);
+                Instruction(OP_ADC, 31, 17);
+                Instruction(OP_LPM, 0, 0);
+                Instruction(OP_MOV, 22, 0);
+                Instruction(OP_SUBI, 30, 0xff);
+                Instruction(OP_SBCI, 31, 0xff);
+                Instruction(OP_LPM, 0, 0);
+                Instruction(OP_MOV, 23, 0);
+
+                IfBitSet(addr, bit);
+                Instruction(OP_SBR, 23, 0x80);
+                // (A string with nothing interpolated has no variable, but
+                // then the routine never looks at it.)
+                if(*(a->name2)) {
+                    MemForVariable(a->name2, &addrl2, &addrh2);
+                    LoadXAddr(addrl2);
+                    Instruction(OP_LD_X, 24, 0);
+                    LoadXAddr(addrh2);
+                    Instruction(OP_LD_X, 25, 0);
+                }
+                MemForVariable(fs->convertState, &addrl2, &addrh2);
+                LoadXAddr(addrl2);
+                Instruction(OP_LD_X, 16, 0);
+                LoadXAddr(addrh2);
+                Instruction(OP_LD_X, 17, 0);
+
+                CallSubroutine(FormattedStringAddress);
+                FormattedStringUsed = TRUE;
+                DivideUsed = TRUE;
+
+                LoadXAddr(addrl2);
+                Instruction(OP_ST_X, 16, 0);
+                LoadXAddr(addrh2);
+                Instruction(OP_ST_X, 17, 0);
+                LoadXAddr(addr);
+                Instruction(OP_LD_X, 16, 0);
+                Instruction(OP_CBR, 16, (1 << bit));
+                Instruction(OP_SBRC, 23, 7);
+                Instruction(OP_SBR, 16, (1 << bit));
+                Instruction(OP_ST_X, 16, 0);
+
+                LoadXAddr(REG_UDR);
+                Instruction(OP_ST_X, 22, 0);
+
+                LoadXAddr(addrl);
+                Instruction(OP_LD_X, 16, 0);
+                LoadXAddr(addrh);
+                Instruction(OP_LD_X, 17, 0);
+                Instruction(OP_SUBI, 16, 0xff);
+                Instruction(OP_SBCI, 17, 0xff);
+                // X is still addrh
+                Instruction(OP_ST_X, 17, 0);
+                LoadXAddr(addrl);
+                Instruction(OP_ST_X, 16, 0);
+
+                FwdAddrIsNow(done);
+                break;
+            }
             case INT_UART_RECV: {
                 MemForVariable(a->name1, &addrl, &addrh);
                 MemForSingleBit(a->name2, TRUE, &addr, &bit);
@@ -1217,6 +1777,59 @@ static void CompileFromIntermediate(void)
                 FwdAddrIsNow(noChar);
                 break;
             }
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[a->literal];
+                DWORD table = TruthTableAddress[a->literal];
+                int k;
+
+                // Z := byte address of the table (twice its word address),
+                // plus the byte offset picked by the inputs past the first
+                // three.
+                Instruction(OP_LDI, 30, FWD_LO(table));
+                Instruction(OP_LDI, 31, FWD_HI(table));
+                Instruction(OP_ADD, 30, 30);
+                Instruction(OP_ADC, 31, 31);
+                if(t->inputs > 3) {
+                    Instruction(OP_LDI, 20, 0);
+                    for(k = 3; k < t->inputs; k++) {
+                        MemForSingleBit(t->input[k], TRUE, &addr, &bit);
+                        IfBitSet(addr, bit);
+                        Instruction(OP_SBR, 20, (1 << (k - 3)));
+                    }
+                    Instruction(OP_ADD, 30, 20);
+                    Instruction(OP_LDI, 20, 0);
+                    Instruction(OP_ADC, 31, 20);
+                }
+                Instruction(OP_LPM, 0, 0);
+                Instruction(OP_MOV, 17, 0);
+
+                // The first three inputs pick the bit within that byte;
+                // shift it down into bit 0. IfBitSet leaves the input's
+                // octet in r16, so we can test it again for free.
+                for(k = 0; k < t->inputs && k < 3; k++) {
+                    MemForSingleBit(t->input[k], TRUE, &addr, &bit);
+                    IfBitSet(addr, bit);
+                    if(k == 2) {
+                        Instruction(OP_SWAP, 17, 0);
+                    } else {
+                        Instruction(OP_ROR, 17, 0);
+                        if(k == 1) {
+                            Instruction(OP_SBRC, 16, bit);
+                            Instruction(OP_ROR, 17, 0);
+                        }
+                    }
+                }
+
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+                LoadXAddr(addr);
+                Instruction(OP_LD_X, 16, 0);
+                Instruction(OP_SBRS, 17, 0);
+                Instruction(OP_CBR, 16, (1 << bit));
+                Instruction(OP_SBRC, 17, 0);
+                Instruction(OP_SBR, 16, (1 << bit));
+                Instruction(OP_ST_X, 16, 0);
+                break;
+            }
             case INT_END_IF:
             case INT_ELSE:
                 return;
@@ -1259,6 +1872,38 @@ static void MultiplyRoutine(void)
     Instruction(OP_ROR, 18, 0);
     Instruction(OP_DEC, 22, 0);
     Instruction(OP_BRNE, m16s_1, 0);
+    LoopsAtMost(15);
+    Instruction(OP_RET, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// 16x16 unsigned multiply, from the same app note, for the divides by a
+// literal. Multiplicand in r17:16, multiplier in r19:18, and the whole
+// product goes into r21:18.
+//-----------------------------------------------------------------------------
+static void MultiplyUnsignedRoutine(void)
+{
+    FwdAddrIsNow(MultiplyUnsignedAddress);
+
+    DWORD m16u_1;
+    DWORD m16u_2 = AllocFwdAddr();
+
+    Instruction(OP_SUB, 21, 21);
+    Instruction(OP_SUB, 20, 20);
+    Instruction(OP_LDI, 22, 16);
+    Instruction(OP_CLC, 0, 0);
+    Instruction(OP_ROR, 19, 0);
+    Instruction(OP_ROR, 18, 0);
+    m16u_1 = AvrProgWriteP; Instruction(OP_BRCC, m16u_2, 0);
+    Instruction(OP_ADD, 20, 16);
+    Instruction(OP_ADC, 21, 17);
+    FwdAddrIsNow(m16u_2); Instruction(OP_ROR, 21, 0);
+    Instruction(OP_ROR, 20, 0);
+    Instruction(OP_ROR, 19, 0);
+    Instruction(OP_ROR, 18, 0);
+    Instruction(OP_DEC, 22, 0);
+    Instruction(OP_BRNE, m16u_1, 0);
+    LoopsAtMost(15);
     Instruction(OP_RET, 0, 0);
 }
 
@@ -1315,26 +1960,493 @@ static void DivideRoutine(void)
     Instruction(OP_ADC, 15, 19);
     Instruction(OP_CLC, 0, 0);
     Instruction(OP_RJMP, d16s_3, 0);
+    LoopsAtMost(16);
     FwdAddrIsNow(d16s_6); Instruction(OP_SEC, 0, 0);
     Instruction(OP_RJMP, d16s_3, 0);
+    LoopsAtMost(16);
+}
+
+//-----------------------------------------------------------------------------
+// 16*16/16 signed multiply-then-divide, with all 32 bits of the product
+// kept for the divide. Factors in r17:16 and r19:18, divisor in r25:24,
+// result goes in r19:18. Works on the magnitudes, since the signed
+// multiply above can't form the high word of a product with -32768; the
+// unsigned multiply is the one from AVR200, and then the quotient gets
+// shifted into r21:18 as the product is shifted out of it. Remainder in
+// r15:14, sign of the result in r23.
+//-----------------------------------------------------------------------------
+static void MultiplyDivideRoutine(void)
+{
+    FwdAddrIsNow(MultiplyDivideAddress);
+
+    DWORD md_1 = AllocFwdAddr();
+    DWORD md_2 = AllocFwdAddr();
+    DWORD md_3 = AllocFwdAddr();
+    DWORD md_4;
+    DWORD md_5 = AllocFwdAddr();
+    DWORD md_6;
+    DWORD md_7 = AllocFwdAddr();
+    DWORD md_8 = AllocFwdAddr();
+
+    Instruction(OP_MOV, 23, 17);
+    Instruction(OP_EOR, 23, 19);
+    Instruction(OP_EOR, 23, 25);
+    Instruction(OP_SBRS, 17, 7);
+    Instruction(OP_RJMP, md_1, 0);
+    Instruction(OP_COM, 17, 0);
+    Instruction(OP_COM, 16, 0);
+    Instruction(OP_SUBI, 16, 0xff);
+    Instruction(OP_SBCI, 17, 0xff);
+    FwdAddrIsNow(md_1); Instruction(OP_SBRS, 19, 7);
+    Instruction(OP_RJMP, md_2, 0);
+    Instruction(OP_COM, 19, 0);
+    Instruction(OP_COM, 18, 0);
+    Instruction(OP_SUBI, 18, 0xff);
+    Instruction(OP_SBCI, 19, 0xff);
+    FwdAddrIsNow(md_2); Instruction(OP_SBRS, 25, 7);
+    Instruction(OP_RJMP, md_3, 0);
+    Instruction(OP_COM, 25, 0);
+    Instruction(OP_COM, 24, 0);
+    Instruction(OP_SUBI, 24, 0xff);
+    Instruction(OP_SBCI, 25, 0xff);
+
+    FwdAddrIsNow(md_3); Instruction(OP_EOR, 20, 20);
+    Instruction(OP_SUB, 21, 21);
+    Instruction(OP_LDI, 22, 16);
+    Instruction(OP_ROR, 19, 0);
+    Instruction(OP_ROR, 18, 0);
+    md_4 = AvrProgWriteP; Instruction(OP_BRCC, md_5, 0);
+    Instruction(OP_ADD, 20, 16);
+    Instruction(OP_ADC, 21, 17);
+    FwdAddrIsNow(md_5); Instruction(OP_ROR, 21, 0);
+    Instruction(OP_ROR, 20, 0);
+    Instruction(OP_ROR, 19, 0);
+    Instruction(OP_ROR, 18, 0);
+    Instruction(OP_DEC, 22, 0);
+    Instruction(OP_BRNE, md_4, 0);
+    LoopsAtMost(15);
+
+    // The magnitudes are at most 0x8000, so the remainder (which is less
+    // than the divisor) still fits in 16 bits after each shift.
+    Instruction(OP_EOR, 14, 14);
+    Instruction(OP_EOR, 15, 15);
+    Instruction(OP_LDI, 22, 32);
+
+    md_6 = AvrProgWriteP; Instruction(OP_ADD, 18, 18);
+    Instruction(OP_ADC, 19, 19);
+    Instruction(OP_ADC, 20, 20);
+    Instruction(OP_ADC, 21, 21);
+    Instruction(OP_ADC, 14, 14);
+    Instruction(OP_ADC, 15, 15);
+    Instruction(OP_SUB, 14, 24);
+    Instruction(OP_SBC, 15, 25);
+    Instruction(OP_BRCC, md_7, 0);
+    Instruction(OP_ADD, 14, 24);
+    Instruction(OP_ADC, 15, 25);
+    Instruction(OP_RJMP, md_8, 0);
+    FwdAddrIsNow(md_7); Instruction(OP_SBR, 18, 1);
+    FwdAddrIsNow(md_8); Instruction(OP_DEC, 22, 0);
+    Instruction(OP_BRNE, md_6, 0);
+    LoopsAtMost(31);
+
+    Instruction(OP_SBRS, 23, 7);
+    Instruction(OP_RET, 0, 0);
+    Instruction(OP_COM, 19, 0);
+    Instruction(OP_COM, 18, 0);
+    Instruction(OP_SUBI, 18, 0xff);
+    Instruction(OP_SBCI, 19, 0xff);
+    Instruction(OP_RET, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Evaluate a piecewise linear table. Call with the index in r17:16, the byte
+// address of the table in r27:26, and the number of segments in r22. The
+// table is the upper x of each segment, and then x0, y0, dy, dx for each
+// segment. Binary search (lo in r20, hi in r21) for the first segment whose
+// upper x is not less than the index, and interpolate along that one, with
+// the result in r19:18 and carry clear; or return with carry set if the
+// index is past the last point.
+//-----------------------------------------------------------------------------
+static void PiecewiseLinearRoutine(void)
+{
+    FwdAddrIsNow(PiecewiseLinearAddress);
+
+    DWORD loop;
+    DWORD greater = AllocFwdAddr();
+    DWORD found = AllocFwdAddr();
+    DWORD inRange = AllocFwdAddr();
+
+    // Each time round halves hi - lo, which starts at the number of
+    // segments, so we go round once for each bit of that, in the biggest
+    // table.
+    int i, rounds = 0;
+    for(i = 0; i < PiecewiseLinearsCount; i++) {
+        int bits = 0;
+        int n;
+        for(n = PiecewiseLinears[i]->count - 1; n > 0; n >>= 1) {
+            bits++;
+        }
+        if(bits > rounds) rounds = bits;
+    }
+
+    Instruction(OP_EOR, 25, 25);
+    Instruction(OP_EOR, 20, 20);
+    Instruction(OP_MOV, 21, 22);
+
+    loop = AvrProgWriteP; Instruction(OP_CP, 20, 21);
+    Instruction(OP_BREQ, found, 0);
+    Instruction(OP_MOV, 23, 20);
+    Instruction(OP_ADD, 23, 21);
+    Instruction(OP_ROR, 23, 0);
+    Instruction(OP_MOV, 24, 23);
+    Instruction(OP_ADD, 24, 24);
+    Instruction(OP_MOV, 30, 26);
+    Instruction(OP_MOV, 31, 27);
+    Instruction(OP_ADD, 30, 24);
+    Instruction(OP_ADC, 31, 25);
+    Instruction(OP_LPM, 0, 0);
+    Instruction(OP_MOV, 18, 0);
+    Instruction(OP_SUBI, 30, 0xff);
+    Instruction(OP_SBCI, 31, 0xff);
+    Instruction(OP_LPM, 0, 0);
+    Instruction(OP_MOV, 19, 0);
+    Instruction(OP_CP, 18, 16);
+    Instruction(OP_CPC, 19, 17);
+    Instruction(OP_BRLT, greater, 0);
+    Instruction(OP_MOV, 21, 23);
+    Instruction(OP_RJMP, loop, 0);
+    LoopsAtMost(rounds);
+    FwdAddrIsNow(greater); Instruction(OP_MOV, 20, 23);
+    Instruction(OP_INC, 20, 0);
+    Instruction(OP_RJMP, loop, 0);
+    LoopsAtMost(rounds);
+
+    FwdAddrIsNow(found); Instruction(OP_CP, 20, 22);
+    Instruction(OP_BRNE, inRange, 0);
+    Instruction(OP_SEC, 0, 0);
+    Instruction(OP_RET, 0, 0);
+
+    // Z := table + 2*segments + 8*lo, the segment's x0, y0, dy, dx; there
+    // are at most 29 segments, so those offsets fit in a byte.
+    FwdAddrIsNow(inRange); Instruction(OP_MOV, 30, 26);
+    Instruction(OP_MOV, 31, 27);
+    Instruction(OP_MOV, 24, 22);
+    Instruction(OP_ADD, 24, 24);
+    Instruction(OP_ADD, 30, 24);
+    Instruction(OP_ADC, 31, 25);
+    Instruction(OP_MOV, 24, 20);
+    Instruction(OP_ADD, 24, 24);
+    Instruction(OP_ADD, 24, 24);
+    Instruction(OP_ADD, 24, 24);
+    Instruction(OP_ADD, 30, 24);
+    Instruction(OP_ADC, 31, 25);
+
+    // x0 into r21:20, y0 into r27:26, dy into r19:18, dx into r25:24
+    static const int Regs[] = { 20, 21, 26, 27, 18, 19, 24, 25 };
+    for(i = 0; i < 8; i++) {
+        Instruction(OP_LPM, 0, 0);
+        Instruction(OP_MOV, Regs[i], 0);
+        if(i < 7) {
+            Instruction(OP_SUBI, 30, 0xff);
+            Instruction(OP_SBCI, 31, 0xff);
+        }
+    }
+
+    Instruction(OP_SUB, 16, 20);
+    Instruction(OP_SBC, 17, 21);
+
+    // A whole-number slope comes with dx = 1, and then we can skip the
+    // divide; the low word of the product is all that we want.
+    DWORD divide = AllocFwdAddr();
+    DWORD interpolated = AllocFwdAddr();
+    Instruction(OP_LDI, 20, 1);
+    Instruction(OP_EOR, 21, 21);
+    Instruction(OP_CP, 24, 20);
+    Instruction(OP_CPC, 25, 21);
+    Instruction(OP_BRNE, divide, 0);
+    CallSubroutine(MultiplyAddress);
+    Instruction(OP_RJMP, interpolated, 0);
+    FwdAddrIsNow(divide);
+    CallSubroutine(MultiplyDivideAddress);
+
+    FwdAddrIsNow(interpolated); Instruction(OP_ADD, 18, 26);
+    Instruction(OP_ADC, 19, 27);
+    Instruction(OP_CLC, 0, 0);
+    Instruction(OP_RET, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Work out the next character of a formatted string, shared by all of them.
+// Call with the template entry in r22 (character) and r23 (kind), with the
+// leading-zero flag in bit 7 of r23, the conversion state in r17:16, and the
+// variable in r25:24. The character to send comes back in r22, and the
+// updated flag and conversion state in the same places.
+//-----------------------------------------------------------------------------
+static void FormattedStringRoutine(void)
+{
+    FwdAddrIsNow(FormattedStringAddress);
+
+    DWORD minus = AllocFwdAddr();
+    DWORD loaded = AllocFwdAddr();
+    DWORD times10;
+    DWORD haveDivisor = AllocFwdAddr();
+    DWORD notZero = AllocFwdAddr();
+    DWORD suppressed = AllocFwdAddr();
+
+    // A literal character goes out as it is.
+    Instruction(OP_SBRC, 23, FMTD_MINUS);
+    Instruction(OP_RJMP, minus, 0);
+    Instruction(OP_SBRS, 23, FMTD_DIGIT);
+    Instruction(OP_RET, 0, 0);
+
+    Instruction(OP_SBRC, 23, FMTD_FIRST_DIGIT);
+    Instruction(OP_SBR, 23, 0x80);
+    Instruction(OP_SBRS, 23, FMTD_LOAD_VAR);
+    Instruction(OP_RJMP, loaded, 0);
+    Instruction(OP_MOV, 16, 24);
+    Instruction(OP_MOV, 17, 25);
+    FwdAddrIsNow(loaded);
+
+    // Divisor in r19:18 := 10^p, multiplying by ten as we count the power
+    // down in r20.
+    Instruction(OP_LDI, 18, 1);
+    Instruction(OP_LDI, 19, 0);
+    Instruction(OP_MOV, 20, 23);
+    Instruction(OP_CBR, 20, ~FMTD_POWER_MASK & 0xff);
+    times10 = AvrProgWriteP; Instruction(OP_BREQ, haveDivisor, 0);
+    Instruction(OP_ADD, 18, 18);
+    Instruction(OP_ADC, 19, 19);
+    Instruction(OP_MOV, 14, 18);
+    Instruction(OP_MOV, 15, 19);
+    Instruction(OP_ADD, 18, 18);
+    Instruction(OP_ADC, 19, 19);
+    Instruction(OP_ADD, 18, 18);
+    Instruction(OP_ADC, 19, 19);
+    Instruction(OP_ADD, 18, 14);
+    Instruction(OP_ADC, 19, 15);
+    Instruction(OP_DEC, 20, 0);
+    Instruction(OP_RJMP, times10, 0);
+    // at most 10^4, for a 16-bit variable
+    LoopsAtMost(4);
+    FwdAddrIsNow(haveDivisor);
+
+    // The quotient is the digit, and what's left is the remainder, which
+    // the divide gives us as a magnitude; it takes the sign of the
+    // dividend (in r13, since the divisor is positive).
+    CallSubroutine(DivideAddress);
+    Instruction(OP_MOV, 22, 16);
+    Instruction(OP_SUBI, 22, (BYTE)-'0');
+
+    // Suppress all but the last leading zero.
+    Instruction(OP_MOV, 20, 23);
+    Instruction(OP_CBR, 20, ~FMTD_POWER_MASK & 0xff);
+    Instruction(OP_BREQ, suppressed, 0);
+    Instruction(OP_TST, 16, 0);
+    Instruction(OP_BRNE, notZero, 0);
+    Instruction(OP_TST, 17, 0);
+    Instruction(OP_BRNE, notZero, 0);
+    Instruction(OP_SBRC, 23, 7);
+    Instruction(OP_LDI, 22, ' ');
+    Instruction(OP_RJMP, suppressed, 0);
+    FwdAddrIsNow(notZero);
+    Instruction(OP_CBR, 23, 0x80);
+    FwdAddrIsNow(suppressed);
+
+    Instruction(OP_MOV, 16, 14);
+    Instruction(OP_MOV, 17, 15);
+    Instruction(OP_SBRS, 13, 7);
+    Instruction(OP_RET, 0, 0);
+    Instruction(OP_COM, 17, 0);
+    Instruction(OP_COM, 16, 0);
+    Instruction(OP_SUBI, 16, 0xff);
+    Instruction(OP_SBCI, 17, 0xff);
+    Instruction(OP_RET, 0, 0);
+
+    // The sign also loads the conversion state with the magnitude.
+    FwdAddrIsNow(minus);
+    Instruction(OP_MOV, 16, 24);
+    Instruction(OP_MOV, 17, 25);
+    Instruction(OP_LDI, 22, ' ');
+    Instruction(OP_SBRS, 17, 7);
+    Instruction(OP_RET, 0, 0);
+    Instruction(OP_LDI, 22, '-');
+    Instruction(OP_COM, 17, 0);
+    Instruction(OP_COM, 16, 0);
+    Instruction(OP_SUBI, 16, 0xff);
+    Instruction(OP_SBCI, 17, 0xff);
+    Instruction(OP_RET, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Write the truth tables for the combinational rungs, and the tables for the
+// look-up table, piecewise linear and formatted string instructions, as
+// constant data that we can read back with lpm. That only reaches the first
+// 64k of flash, which is more than any program that we generate, but check
+// anyways.
+//-----------------------------------------------------------------------------
+static void WriteTables(void)
+{
+    int i;
+    for(i = 0; i < TruthTablesCount; i++) {
+        int bytes = ((1 << TruthTables[i].inputs) + 7) / 8;
+
+        if(AvrProgWriteP + (bytes + 1)/2 > 0x8000) {
+            Error(_("Program too large for lookup tables in flash; make "
+                "program smaller."));
+            CompileError();
+        }
+
+        FwdAddrIsNow(TruthTableAddress[i]);
+        int j;
+        for(j = 0; j < bytes; j += 2) {
+            BYTE hi = (j + 1 < bytes) ? TruthTables[i].bits[j + 1] : 0;
+            Instruction(OP_DW, TruthTables[i].bits[j] | (hi << 8), 0);
+        }
+    }
+    for(i = 0; i < LookUpTablesCount; i++) {
+        ElemLookUpTable *t = LookUpTables[i];
+
+        if(AvrProgWriteP + t->count > 0x8000) {
+            Error(_("Program too large for lookup tables in flash; make "
+                "program smaller."));
+            CompileError();
+        }
+
+        FwdAddrIsNow(LookUpTableAddress[i]);
+        int j;
+        for(j = 0; j < t->count; j++) {
+            Instruction(OP_DW, (WORD)t->vals[j], 0);
+        }
+    }
+    for(i = 0; i < PiecewiseLinearsCount; i++) {
+        ElemPiecewiseLinear *t = PiecewiseLinears[i];
+        int n = t->count - 1;
+
+        if(AvrProgWriteP + n*5 > 0x8000) {
+            Error(_("Program too large for lookup tables in flash; make "
+                "program smaller."));
+            CompileError();
+        }
+
+        FwdAddrIsNow(PiecewiseLinearTableAddress[i]);
+        int j;
+        for(j = 1; j <= n; j++) {
+            Instruction(OP_DW, (WORD)t->vals[j*2], 0);
+        }
+        for(j = 0; j < n; j++) {
+            SWORD seg[4];
+            PiecewiseLinearSegment(t, j, seg);
+            int k;
+            for(k = 0; k < 4; k++) {
+                Instruction(OP_DW, (WORD)seg[k], 0);
+            }
+        }
+    }
+    for(i = 0; i < FormattedStringsCount; i++) {
+        FormattedString *fs = &FormattedStrings[i];
+
+        if(AvrProgWriteP + fs->steps > 0x8000) {
+            Error(_("Program too large for lookup tables in flash; make "
+                "program smaller."));
+            CompileError();
+        }
+
+        FwdAddrIsNow(FormattedStringTableAddress[i]);
+        int j;
+        for(j = 0; j < fs->steps; j++) {
+            Instruction(OP_DW, fs->chars[j], 0);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Where the instruction at addr can go next, and how many cycles it takes to
+// get there, and what it calls, for ReportScanTime(). Anything that doesn't
+// go forward (a return, or an indirect jump) ends the path.
+//-----------------------------------------------------------------------------
+static int NextInstruction(DWORD addr, DWORD *to, int *cycles,
+    DWORD *call, int *loops)
+{
+    AvrInstruction *p = &AvrProg[addr];
+
+    *call = p->callee;
+    *loops = p->loops;
+    to[0] = addr + 1;
+    cycles[0] = 1;
+    switch(p->op) {
+        case OP_BRCC:
+        case OP_BRCS:
+        case OP_BREQ:
+        case OP_BRGE:
+        case OP_BRLO:
+        case OP_BRLT:
+        case OP_BRNE:
+            to[1] = p->arg1;
+            cycles[1] = 2;
+            return 2;
+
+        case OP_SBRC:
+        case OP_SBRS:
+            to[1] = addr + 2;
+            cycles[1] = 2;
+            return 2;
+
+        case OP_RJMP:
+            to[0] = p->arg1;
+            cycles[0] = 2;
+            break;
+
+        case OP_IJMP:
+            to[0] = addr;
+            cycles[0] = 2;
+            break;
+
+        case OP_RET:
+        case OP_RETI:
+            to[0] = addr;
+            cycles[0] = 4;
+            break;
+
+        case OP_RCALL:
+        case OP_ICALL:
+            cycles[0] = 3;
+            break;
+
+        case OP_LD_X:
+        case OP_ST_X:
+            cycles[0] = 2;
+            break;
+
+        case OP_LPM:
+            cycles[0] = 3;
+            break;
+
+        default:
+            break;
+    }
+    return 1;
 }
 
 //-----------------------------------------------------------------------------
 // Compile the program to REG code for the currently selected processor
 // and write it to the given file. Produce an error message if we cannot
 // write to the file, or if there is something inconsistent about the
-// program.
+// program. If outFile is NULL then don't write anything, but estimate the
+// scan time and report it instead.
 //-----------------------------------------------------------------------------
 void CompileAvr(char *outFile)
 {
-    FILE *f = fopen(outFile, "w");
-    if(!f) {
-        Error(_("Couldn't open file '%s'"), outFile);
-        return;
+    FILE *f = NULL;
+    if(outFile) {
+        f = fopen(outFile, "w");
+        if(!f) {
+            Error(_("Couldn't open file '%s'"), outFile);
+            return;
+        }
     }
 
     if(setjmp(CompileErrorBuf) != 0) {
-        fclose(f);
+        if(f) fclose(f);
         return;
     }
 
@@ -1367,6 +2479,27 @@ void CompileAvr(char *outFile)
     MultiplyAddress = AllocFwdAddr();
     DivideUsed = FALSE;
     DivideAddress = AllocFwdAddr();
+    MultiplyDivideUsed = FALSE;
+    MultiplyDivideAddress = AllocFwdAddr();
+    MultiplyUnsignedUsed = FALSE;
+    MultiplyUnsignedAddress = AllocFwdAddr();
+    PiecewiseLinearUsed = FALSE;
+    PiecewiseLinearAddress = AllocFwdAddr();
+    FormattedStringUsed = FALSE;
+    FormattedStringAddress = AllocFwdAddr();
+    int i;
+    for(i = 0; i < TruthTablesCount; i++) {
+        TruthTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < LookUpTablesCount; i++) {
+        LookUpTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < PiecewiseLinearsCount; i++) {
+        PiecewiseLinearTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < FormattedStringsCount; i++) {
+        FormattedStringTableAddress[i] = AllocFwdAddr();
+    }
     AllocStart();
 
     // Where we hold the high byte to program in EEPROM while the low byte
@@ -1376,7 +2509,9 @@ void CompileAvr(char *outFile)
 
     WriteRuntime();
     IntPc = 0;
+    SourceMapStart();
     CompileFromIntermediate();
+    SourceMapMark(AvrProgWriteP, -1);
 
     if(Prog.mcu->avrUseIjmp) {
         Instruction(OP_LDI, 30, (BeginningOfCycleAddr & 0xff));
@@ -1388,11 +2523,25 @@ void CompileAvr(char *outFile)
 
     MemCheckForErrorsPostCompile();
 
+    // The piecewise linear routine calls the multiply-divide routine, and
+    // the formatted string routine calls the divide routine, so they must
+    // come first, while those addresses are still forward references.
+    if(PiecewiseLinearUsed) PiecewiseLinearRoutine();
+    if(FormattedStringUsed) FormattedStringRoutine();
     if(MultiplyUsed) MultiplyRoutine();
     if(DivideUsed) DivideRoutine();
+    if(MultiplyDivideUsed) MultiplyDivideRoutine();
+    if(MultiplyUnsignedUsed) MultiplyUnsignedRoutine();
+    WriteTables();
+
+    if(!outFile) {
+        ReportScanTime(NextInstruction, 1, AvrProgWriteP);
+        return;
+    }
 
     WriteHexFile(f);
     fclose(f);
+    WriteSourceMap(outFile);
 
     char str[MAX_PATH+500];
     sprintf(str, _("Compile successful; wrote IHEX for AVR to '%s'.\r\n\r\n"
@@ -648,6 +648,7 @@ void FreeEntireProgram(void)
     Prog.cycleTime = 10000;
     Prog.mcuClock = 4000000;
     Prog.baudRate = 2400;
+    Prog.deadlineTimers = FALSE;
     Prog.io.count = 0;
     Prog.mcu = NULL;
 }
@@ -948,3 +949,20 @@ BOOL PwmFunctionUsed(void)
     }
     return FALSE;
 }
+
+//-----------------------------------------------------------------------------
+// Is there a master control relay anywhere in the program? If not then $mcr
+// is always set, and the compiler can take advantage of that.
+//-----------------------------------------------------------------------------
+BOOL MasterRelayUsed(void)
+{
+    int i;
+    for(i = 0; i < Prog.numRungs; i++) {
+        if(ContainsWhich(ELEM_SERIES_SUBCKT, Prog.rungs[i], ELEM_MASTER_RELAY,
+            -1, -1))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
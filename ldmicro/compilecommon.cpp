@@ -27,8 +27,9 @@
 #include "ldmicro.h"
 
 // If we encounter an error while compiling then it's convenient to break
-// out of the possibly-deeply-recursed function we're in.
-jmp_buf CompileErrorBuf;
+// out of the possibly-deeply-recursed function we're in. Each thread has its
+// own, since the rungs can get generated on several threads at once.
+__declspec(thread) jmp_buf CompileErrorBuf;
 
 // Assignment of the internal relays to memory, efficient, one bit per
 // relay.
@@ -54,6 +55,40 @@ static DWORD    NextBitwiseAllocAddr;
 static int      NextBitwiseAllocBit;
 static int      MemOffset;
 
+// Which rung the code at each address in program memory came from, so that
+// we can write out a source map along with the program. Range i runs from
+// its start up to the start of range i+1; a rung of -1 is code that isn't
+// part of any rung.
+#define MAX_SOURCE_MAP_RANGES   (MAX_RUNGS*4)
+static struct {
+    DWORD   start;
+    int     rung;
+} SourceMap[MAX_SOURCE_MAP_RANGES];
+static int SourceMapCount;
+
+// And the RAM that each rung allocated first, for the estimate of the
+// memory used; the rung that we're generating code for now is the last
+// one passed to SourceMapMark().
+static int RamForRung[MAX_RUNGS];
+static int CurrentRung;
+
+// The worst case from the last estimate of the scan time, in us; and
+// whether ReportScanTime() should just leave it there, instead of telling
+// the user.
+double ScanTimeWorstCase;
+BOOL ScanTimeQuiet;
+
+// For the calls, the worst and typical cases from each address of the code
+// after the rungs, where the subroutines are.
+static DWORD SubroutinesStart;
+static DWORD SubroutinesEnd;
+static double *SubroutinesWorst;
+static double *SubroutinesTypical;
+
+// The most loops whose bottoms we might have passed, but not yet their tops,
+// as we work backwards through a range of addresses.
+#define MAX_OPEN_LOOPS 16
+
 //-----------------------------------------------------------------------------
 // Forget what memory has been allocated on the target, so we start from
 // everything free.
@@ -62,6 +97,8 @@ void AllocStart(void)
 {
     NextBitwiseAllocAddr = NO_MEMORY;
     MemOffset = 0;
+    memset(RamForRung, 0, sizeof(RamForRung));
+    CurrentRung = -1;
     InternalRelayCount = 0;
     VariableCount = 0;
 }
@@ -79,6 +116,7 @@ DWORD AllocOctetRam(void)
     }
 
     MemOffset++;
+    if(CurrentRung >= 0) RamForRung[CurrentRung]++;
     return Prog.mcu->ram[0].start + MemOffset - 1;
 }
 
@@ -171,7 +209,10 @@ BYTE MuxForAdcVariable(char *name)
 
 //-----------------------------------------------------------------------------
 // Allocate the two octets (16-bit count) for a variable, used for a variety
-// of purposes.
+// of purposes. A variable that always fits in a byte (see
+// IntFlowVariableIsByte()) gets both octets too; the back end may skip the
+// stores to its high octet, which then stays at zero, from when the RAM is
+// cleared at startup.
 //-----------------------------------------------------------------------------
 void MemForVariable(char *name, DWORD *addrl, DWORD *addrh)
 {
@@ -193,6 +234,27 @@ void MemForVariable(char *name, DWORD *addrl, DWORD *addrh)
     *addrh = Variables[i].addrh;
 }
 
+//-----------------------------------------------------------------------------
+// Allocate an array of n variables, in consecutive memory, two octets each
+// with the low octet first; or retrieve it, if it was already allocated.
+// Returns the address of the first octet.
+//-----------------------------------------------------------------------------
+DWORD MemForArray(char *name, int n)
+{
+    int i;
+    for(i = 0; i < VariableCount; i++) {
+        if(strcmp(name, Variables[i].name)==0) return Variables[i].addrl;
+    }
+
+    DWORD addrl, addrh;
+    MemForVariable(name, &addrl, &addrh);
+    for(i = 1; i < n; i++) {
+        AllocOctetRam();
+        AllocOctetRam();
+    }
+    return addrl;
+}
+
 //-----------------------------------------------------------------------------
 // Allocate or retrieve the bit of memory assigned to an internal relay or
 // other thing that requires a single bit of storage.
@@ -371,3 +433,280 @@ void ComplainAboutBaudRateOverflow(void)
         "Code will be generated anyways but serial will likely be "
         "completely broken."));
 }
+
+//-----------------------------------------------------------------------------
+// Forget the source map, before we start to generate code.
+//-----------------------------------------------------------------------------
+void SourceMapStart(void)
+{
+    SourceMapCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Note that the code generated from now on, starting at address addr, comes
+// from the given rung (or -1 for none).
+//-----------------------------------------------------------------------------
+void SourceMapMark(DWORD addr, int rung)
+{
+    CurrentRung = rung;
+    if(SourceMapCount > 0) {
+        if(SourceMap[SourceMapCount-1].rung == rung) return;
+        if(SourceMap[SourceMapCount-1].start == addr) {
+            // the previous one didn't generate any code
+            SourceMapCount--;
+            if(SourceMapCount > 0 &&
+                SourceMap[SourceMapCount-1].rung == rung)
+            {
+                return;
+            }
+        }
+    }
+    if(SourceMapCount >= MAX_SOURCE_MAP_RANGES) return;
+
+    SourceMap[SourceMapCount].start = addr;
+    SourceMap[SourceMapCount].rung = rung;
+    SourceMapCount++;
+}
+
+//-----------------------------------------------------------------------------
+// Write the source map for the program that we just wrote to outFile, to
+// a file with the same name but the extension .map: a line for each range
+// of addresses in program memory that came from a rung, giving the first
+// address, the address just past the last one (both in words, in hex),
+// and the rung, counting from one.
+//-----------------------------------------------------------------------------
+void WriteSourceMap(char *outFile)
+{
+    char mapFile[MAX_PATH];
+    if(strlen(outFile) + 5 > sizeof(mapFile)) return;
+    strcpy(mapFile, outFile);
+    char *dot = strrchr(mapFile, '.');
+    if(!dot || strchr(dot, '\\') || strchr(dot, '/')) {
+        dot = mapFile + strlen(mapFile);
+    }
+    strcpy(dot, ".map");
+
+    FILE *f = fopen(mapFile, "w");
+    if(!f) {
+        Error(_("Couldn't write source map to '%s'."), mapFile);
+        return;
+    }
+
+    fprintf(f, "; program memory (word addresses) generated for each rung\n");
+    int i;
+    for(i = 0; i < SourceMapCount - 1; i++) {
+        if(SourceMap[i].rung < 0) continue;
+        fprintf(f, "%04x %04x %d\n", SourceMap[i].start,
+            SourceMap[i+1].start, SourceMap[i].rung + 1);
+    }
+    fclose(f);
+}
+
+//-----------------------------------------------------------------------------
+// Work out the worst and typical cases from each address in start..end-1
+// up to the end of the range, into w[] and t[], which have room for end -
+// start + 1 each. The range gets worked backwards from its end: the worst
+// case at an instruction is the longest of the paths from its successors,
+// and the typical case their average, as though every branch went each way
+// half the time. A successor that isn't forward within the range ends the
+// path there, so a busy-wait counts just once.
+//
+// A call costs whatever the subroutine does, from SubroutinesWorst[], so it
+// must be to somewhere after the call that we've worked out already. And a
+// branch back that says how many times it goes round its loop adds that
+// many more trips round it at the top, each the worst from the top to the
+// last branch back, working that out as a range of its own; except for the
+// loop at top, which is the one whose trip that range is.
+//-----------------------------------------------------------------------------
+static void PathCycles(NextInstructionFn *next, DWORD start, DWORD end,
+    DWORD top, double *w, double *t)
+{
+    DWORD loopTop[MAX_OPEN_LOOPS];
+    DWORD loopBottom[MAX_OPEN_LOOPS];
+    int loopTimes[MAX_OPEN_LOOPS];
+    int openLoops = 0;
+
+    w[end - start] = 0;
+    t[end - start] = 0;
+    DWORD a;
+    for(a = end; a-- > start;) {
+        DWORD to[2];
+        int cycles[2];
+        DWORD call;
+        int loops;
+        int n = next(a, to, cycles, &call, &loops);
+
+        double wc = 0, tc = 0;
+        if(call) {
+            if(call <= a || call < SubroutinesStart ||
+                call >= SubroutinesEnd)
+            {
+                oops();
+            }
+            wc = SubroutinesWorst[call - SubroutinesStart];
+            tc = SubroutinesTypical[call - SubroutinesStart];
+        }
+
+        double wa = 0, ta = 0;
+        int j, k;
+        for(k = 0; k < n; k++) {
+            double wk = cycles[k] + wc, tk = cycles[k] + tc;
+            if(to[k] > a && to[k] <= end) {
+                wk += w[to[k] - start];
+                tk += t[to[k] - start];
+            } else if(loops > 0 && to[k] < a && to[k] >= start &&
+                to[k] != top)
+            {
+                // The first branch back that we see to a top is the last
+                // one in its loop.
+                for(j = 0; j < openLoops; j++) {
+                    if(loopTop[j] == to[k]) break;
+                }
+                if(j < openLoops) {
+                    if(loops > loopTimes[j]) loopTimes[j] = loops;
+                } else if(openLoops < MAX_OPEN_LOOPS) {
+                    loopTop[openLoops] = to[k];
+                    loopBottom[openLoops] = a;
+                    loopTimes[openLoops] = loops;
+                    openLoops++;
+                }
+            }
+            if(wk > wa) wa = wk;
+            ta += tk / n;
+        }
+
+        for(j = 0; j < openLoops; j++) {
+            if(loopTop[j] != a) continue;
+
+            DWORD bottom = loopBottom[j] + 1;
+            double *lw = (double *)CheckMalloc((bottom - a + 1)*
+                sizeof(double));
+            double *lt = (double *)CheckMalloc((bottom - a + 1)*
+                sizeof(double));
+            PathCycles(next, a, bottom, a, lw, lt);
+            wa += loopTimes[j]*lw[0];
+            ta += loopTimes[j]*lt[0];
+            CheckFree(lw);
+            CheckFree(lt);
+
+            openLoops--;
+            loopTop[j] = loopTop[openLoops];
+            loopBottom[j] = loopBottom[openLoops];
+            loopTimes[j] = loopTimes[openLoops];
+            j--;
+        }
+
+        w[a - start] = wa;
+        t[a - start] = ta;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Estimate how long one scan of the program that we just generated takes,
+// and tell the user, along with how much flash and RAM each rung uses. The
+// back end passes a function that says where each of its instructions can
+// go next, and how many instruction cycles that takes; and, for a call, the
+// subroutine that it calls (or zero if it isn't a call), and for a branch
+// back to the top of a loop, the most times that it goes round (or zero if
+// we can't say, or if it isn't one). And how many clocks make a cycle.
+//
+// The code after the rungs, with the subroutines, gets done first, all as
+// one range, so that each call can cost whatever that subroutine takes;
+// that works because each subroutine comes after any that call it. Then
+// each range of the source map gets done on its own; see PathCycles().
+//-----------------------------------------------------------------------------
+void ReportScanTime(NextInstructionFn *next, int clocksPerCycle,
+    DWORD progLen)
+{
+    static double WorstForRung[MAX_RUNGS];
+    static double TypicalForRung[MAX_RUNGS];
+    static DWORD FlashForRung[MAX_RUNGS];
+    double worst = 0, typical = 0;
+    int i;
+
+    for(i = 0; i < MAX_RUNGS; i++) {
+        WorstForRung[i] = 0;
+        TypicalForRung[i] = 0;
+        FlashForRung[i] = 0;
+    }
+
+    SubroutinesStart = progLen;
+    if(SourceMapCount > 0) {
+        SubroutinesStart = SourceMap[SourceMapCount - 1].start;
+    }
+    SubroutinesEnd = progLen;
+    SubroutinesWorst = (double *)CheckMalloc((progLen - SubroutinesStart + 1)*
+        sizeof(double));
+    SubroutinesTypical = (double *)CheckMalloc((progLen - SubroutinesStart
+        + 1)*sizeof(double));
+    PathCycles(next, SubroutinesStart, progLen, progLen, SubroutinesWorst,
+        SubroutinesTypical);
+
+    for(i = 0; i < SourceMapCount - 1; i++) {
+        DWORD start = SourceMap[i].start;
+        DWORD end = SourceMap[i+1].start;
+        double *w = (double *)CheckMalloc((end - start + 1)*sizeof(double));
+        double *t = (double *)CheckMalloc((end - start + 1)*sizeof(double));
+
+        PathCycles(next, start, end, end, w, t);
+
+        int r = SourceMap[i].rung;
+        if(r >= 0) {
+            WorstForRung[r] += w[0];
+            TypicalForRung[r] += t[0];
+            FlashForRung[r] += end - start;
+        }
+        worst += w[0];
+        typical += t[0];
+        CheckFree(w);
+        CheckFree(t);
+    }
+    CheckFree(SubroutinesWorst);
+    CheckFree(SubroutinesTypical);
+
+    double usPerCycle = (1e6*clocksPerCycle)/Prog.mcuClock;
+    double available = Prog.cycleTime/usPerCycle;
+
+    ScanTimeWorstCase = worst*usPerCycle;
+    if(ScanTimeQuiet) return;
+
+    static char str[MAX_RUNGS*64 + 1024];
+    char *s = str;
+    s += sprintf(s, _("Estimated time for one scan, at %.3f MHz:\r\n"
+        "    worst case %.0f cycles, %.1f us\r\n"
+        "    typical case %.0f cycles, %.1f us\r\n"
+        "The cycle time is %.1f ms, so that is %d%% of it at worst.\r\n\r\n"
+        "Used %d/%d words of program flash, and %d/%d bytes of RAM.\r\n\r\n"
+        "rung    worst  typical  flash  RAM\r\n"),
+            Prog.mcuClock/1e6, worst, worst*usPerCycle,
+            typical, typical*usPerCycle, Prog.cycleTime/1000.0,
+            (int)((100*worst)/available), progLen, Prog.mcu->flashWords,
+            MemOffset, Prog.mcu->ram[0].len);
+
+    double worstInRungs = 0, typicalInRungs = 0;
+    DWORD flashInRungs = 0;
+    int ramInRungs = 0;
+    for(i = 0; i < Prog.numRungs && i < MAX_RUNGS; i++) {
+        if(FlashForRung[i] == 0 && RamForRung[i] == 0) continue;
+        s += sprintf(s, "%4d %8.0f %8.0f %6d %4d\r\n", i + 1,
+            WorstForRung[i], TypicalForRung[i], FlashForRung[i],
+            RamForRung[i]);
+        worstInRungs += WorstForRung[i];
+        typicalInRungs += TypicalForRung[i];
+        flashInRungs += FlashForRung[i];
+        ramInRungs += RamForRung[i];
+    }
+    // and whatever isn't part of any rung: the runtime, the subroutines,
+    // and the tables
+    s += sprintf(s, _("rest %8.0f %8.0f %6d %4d\r\n"),
+        worst - worstInRungs, typical - typicalInRungs,
+        progLen - flashInRungs, MemOffset - ramInRungs);
+
+    BOOL overrun = (worst > available);
+    if(overrun) {
+        s += sprintf(s, _("\r\nThe worst case is longer than the cycle "
+            "time, so the scan may overrun. Make the cycle time longer, or "
+            "the program smaller."));
+    }
+    ReportMessage(_("Estimated Scan Time"), str, overrun);
+}
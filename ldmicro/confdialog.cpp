@@ -34,6 +34,7 @@ static HWND ConfDialog;
 static HWND CrystalTextbox;
 static HWND CycleTextbox;
 static HWND BaudTextbox;
+static HWND DeadlineTimersCheckbox;
 
 static LONG_PTR PrevCrystalProc;
 static LONG_PTR PrevCycleProc;
@@ -97,6 +98,13 @@ static void MakeControls(void)
         155, 72, 85, 21, ConfDialog, NULL, Instance, NULL);
     NiceFont(BaudTextbox);
 
+    DeadlineTimersCheckbox = CreateWindowEx(0, WC_BUTTON,
+        _("Deadline timers (faster, but a timer's variable holds the tick "
+        "when it will be done)"),
+        WS_CHILD | BS_AUTOCHECKBOX | BS_MULTILINE | WS_TABSTOP | WS_VISIBLE,
+        11, 102, 317, 34, ConfDialog, NULL, Instance, NULL);
+    NiceFont(DeadlineTimersCheckbox);
+
     if(!UartFunctionUsed()) {   
         EnableWindow(BaudTextbox, FALSE);
         EnableWindow(textLabel3, FALSE);
@@ -150,7 +158,7 @@ static void MakeControls(void)
 
     HWND textLabel4 = CreateWindowEx(0, WC_STATIC, explanation,
         WS_CHILD | WS_CLIPSIBLINGS | WS_VISIBLE,
-        11, 104, 310, 400, ConfDialog, NULL, Instance, NULL);
+        11, 144, 310, 400, ConfDialog, NULL, Instance, NULL);
     NiceFont(textLabel4);
 
     // Measure the explanation string, so that we know how to size our window
@@ -161,7 +169,7 @@ static void MakeControls(void)
     DrawText(hdc, explanation, -1, &tr, DT_CALCRECT |
                                         DT_LEFT | DT_TOP | DT_WORDBREAK);
     DeleteDC(hdc);
-    int h = 104 + tr.bottom + 10;
+    int h = 144 + tr.bottom + 10;
     SetWindowPos(ConfDialog, NULL, 0, 0, 344, h, SWP_NOMOVE);
     // h is the desired client height, but SetWindowPos includes title bar;
     // so fix it up by hand
@@ -199,6 +207,10 @@ void ShowConfDialog(void)
     sprintf(buf, "%d", Prog.baudRate);
     SendMessage(BaudTextbox, WM_SETTEXT, 0, (LPARAM)buf);
 
+    if(Prog.deadlineTimers) {
+        SendMessage(DeadlineTimersCheckbox, BM_SETCHECK, BST_CHECKED, 0);
+    }
+
     EnableWindow(MainWindow, FALSE);
     ShowWindow(ConfDialog, TRUE);
     SetFocus(CycleTextbox);
@@ -241,6 +253,9 @@ void ShowConfDialog(void)
         SendMessage(BaudTextbox, WM_GETTEXT, (WPARAM)sizeof(buf),
             (LPARAM)(buf));
         Prog.baudRate = atoi(buf);
+
+        Prog.deadlineTimers = (SendMessage(DeadlineTimersCheckbox,
+            BM_GETSTATE, 0, 0) & BST_CHECKED) ? TRUE : FALSE;
     }
 
     EnableWindow(MainWindow, TRUE);
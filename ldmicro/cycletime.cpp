@@ -0,0 +1,262 @@
+//-----------------------------------------------------------------------------
+// Copyright 2007 Jonathan Westhues
+//
+// This file is part of LDmicro.
+// 
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Work out the cycle time for the program from what its timers and its
+// UART need, instead of leaving the user to guess; the longest cycle time
+// that does everything wastes the least of the processor on scanning.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ldmicro.h"
+
+// Each timer must count at least this many cycles, so that it's good to
+// about one part in this many.
+#define MIN_CYCLES_PER_TIMER    10
+
+// Every input gets looked at just once a cycle, so don't propose anything
+// slower than this (in us), whatever the timers would allow.
+#define MAX_PROPOSED_CYCLE      100000
+
+// What the program needs from the cycle time: the delays of its timers,
+// in us, and whether it receives from the UART or sends formatted strings.
+static int TimerCount;
+static int ShortestDelay;
+static int LongestDelay;
+static int DelaysGcd;
+static BOOL ReceivesFromUart;
+static BOOL SendsFormattedStrings;
+
+//-----------------------------------------------------------------------------
+// Greatest common divisor, for the longest cycle that divides every delay.
+//-----------------------------------------------------------------------------
+static int Gcd(int a, int b)
+{
+    while(b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+//-----------------------------------------------------------------------------
+// Note what the given subcircuit needs from the cycle time, recursing into
+// anything that it contains.
+//-----------------------------------------------------------------------------
+static void CollectNeeds(int which, void *any)
+{
+    switch(which) {
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            int i;
+            for(i = 0; i < p->count; i++) {
+                CollectNeeds(p->contents[i].which, p->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            int i;
+            for(i = 0; i < s->count; i++) {
+                CollectNeeds(s->contents[i].which, s->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_TON:
+        case ELEM_TOF:
+        case ELEM_RTO: {
+            ElemLeaf *l = (ElemLeaf *)any;
+            int delay = l->d.timer.delay;
+            if(delay <= 0) break;
+            if(TimerCount == 0 || delay < ShortestDelay) ShortestDelay = delay;
+            if(TimerCount == 0 || delay > LongestDelay) LongestDelay = delay;
+            DelaysGcd = Gcd(delay, DelaysGcd);
+            TimerCount++;
+            break;
+        }
+        case ELEM_UART_RECV:
+            ReceivesFromUart = TRUE;
+            break;
+
+        case ELEM_FORMATTED_STRING:
+            SendsFormattedStrings = TRUE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Propose the longest cycle time that still times every timer to a whole
+// number of cycles, within their range, that polls the UART often enough
+// not to lose characters, and that the processor's timer can make; explain
+// why, along with the estimated scan time at that cycle time, and let the
+// user take it or leave it.
+//-----------------------------------------------------------------------------
+void SuggestCycleTime(void)
+{
+    if(!Prog.mcu) {
+        Error(_("Must choose a target microcontroller before choosing the "
+            "cycle time."));
+        return;
+    }
+
+    TimerCount = 0;
+    DelaysGcd = 0;
+    ReceivesFromUart = FALSE;
+    SendsFormattedStrings = FALSE;
+    int i;
+    for(i = 0; i < Prog.numRungs; i++) {
+        CollectNeeds(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
+    }
+
+    // The reasons for the cycle time that we pick, to explain it.
+    char why[2048];
+    char *s = why;
+
+    // The configuration dialog holds the cycle time to a tenth of a ms, so
+    // that's the step in which we work.
+    int lower = 100;
+    int upper = MAX_PROPOSED_CYCLE;
+
+    // The limits of the cycle timer, as ConfigureTimer1() works them out in
+    // each back end.
+    double fastest = 0, slowest = 0;
+    if(Prog.mcuClock > 0) {
+        switch(Prog.mcu->whichIsa) {
+            case ISA_PIC16:
+                fastest = (1000*4e6)/Prog.mcuClock;
+                slowest = (65535*4e6*8)/Prog.mcuClock;
+                break;
+
+            case ISA_AVR:
+            case ISA_ARDUINO:
+                fastest = 1001e6/Prog.mcuClock;
+                slowest = (65536e6*1024)/Prog.mcuClock;
+                break;
+
+            default:
+                break;
+        }
+    }
+    if(slowest > 0) {
+        if(fastest > lower) lower = (int)(fastest + 1);
+        if(slowest < upper) upper = (int)slowest;
+        s += sprintf(s, _("The %s at %.3f MHz can time cycles from %.1f ms to "
+            "%.1f ms.\r\n"), Prog.mcu->mcuName, Prog.mcuClock/1e6,
+            fastest/1000, slowest/1000);
+    }
+
+    if(TimerCount > 0) {
+        if(ShortestDelay/MIN_CYCLES_PER_TIMER < upper) {
+            upper = ShortestDelay/MIN_CYCLES_PER_TIMER;
+        }
+        // A long delay just counts in a slower timebase (see TimerPeriod()),
+        // so only the shortest one matters.
+        s += sprintf(s, _("The program has %d timer(s), from %.1f ms to "
+            "%.1f ms; each must count at least %d cycles.\r\n"),
+            TimerCount, ShortestDelay/1000.0, LongestDelay/1000.0,
+            MIN_CYCLES_PER_TIMER);
+    }
+
+    if(ReceivesFromUart && Prog.baudRate > 0) {
+        // The UART holds two received characters, of ten bits each, before
+        // it starts to lose them.
+        int atMost = (int)((2*10*1e6)/Prog.baudRate);
+        if(atMost < upper) upper = atMost;
+        s += sprintf(s, _("The UART receives at %d baud, so it must be read "
+            "at least every %.1f ms.\r\n"), Prog.baudRate, atMost/1000.0);
+    }
+
+    lower = ((lower + 99)/100)*100;
+    upper = (upper/100)*100;
+    if(lower > upper) {
+        Error(_("%s\r\nSo no cycle time will do for this program; change the "
+            "timers' delays, the crystal, or the baud rate."),
+            why);
+        return;
+    }
+
+    // The longest cycle that is a whole number of tenths of a ms, and
+    // divides every timer's delay exactly; or failing that, the longest
+    // that will do, with the delays rounded to whole cycles.
+    int cycle;
+    for(cycle = upper; cycle >= lower; cycle -= 100) {
+        if(DelaysGcd % cycle == 0) break;
+    }
+    BOOL exact = TRUE;
+    if(cycle < lower) {
+        cycle = upper;
+        exact = FALSE;
+    }
+
+    static char str[4096];
+    s = str;
+    s += sprintf(s, _("The longest cycle time that suits this program is "
+        "%.1f ms.\r\n\r\n%s"), cycle/1000.0, why);
+    if(TimerCount > 0 && !exact) {
+        s += sprintf(s, _("The timers' delays can't all be whole numbers of "
+            "cycles, so some of them will be rounded down.\r\n"));
+    }
+    if(SendsFormattedStrings) {
+        s += sprintf(s, _("The formatted strings go out one character per "
+            "cycle, or %d characters a second.\r\n"), 1000000/cycle);
+    }
+
+    // And see how much of that cycle a scan would take, if we can.
+    if(Prog.mcu->whichIsa == ISA_AVR || Prog.mcu->whichIsa == ISA_PIC16 ||
+        Prog.mcu->whichIsa == ISA_ARDUINO)
+    {
+        int prevCycleTime = Prog.cycleTime;
+        Prog.cycleTime = cycle;
+        ScanTimeWorstCase = -1;
+        ScanTimeQuiet = TRUE;
+        if(GenerateIntermediateCode()) {
+            switch(Prog.mcu->whichIsa) {
+                case ISA_AVR:       CompileAvr(NULL); break;
+                case ISA_PIC16:     CompilePic16(NULL); break;
+                case ISA_ARDUINO:   CompileArduino(NULL); break;
+            }
+        }
+        ScanTimeQuiet = FALSE;
+        Prog.cycleTime = prevCycleTime;
+
+        if(ScanTimeWorstCase >= 0) {
+            s += sprintf(s, _("\r\nA scan takes at most %.2f ms, which is "
+                "%d%% of that cycle.\r\n"), ScanTimeWorstCase/1000,
+                (int)((100*ScanTimeWorstCase)/cycle));
+            if(ScanTimeWorstCase > cycle) {
+                s += sprintf(s, _("That's longer than the cycle, so the "
+                    "scan may overrun; use a faster crystal, or simplify "
+                    "the program.\r\n"));
+            }
+        }
+    }
+
+    s += sprintf(s, _("\r\nUse this cycle time (instead of %.1f ms)?"),
+        Prog.cycleTime/1000.0);
+    if(MessageBox(MainWindow, str, _("Suggested Cycle Time"),
+        MB_YESNO | MB_ICONQUESTION) == IDYES)
+    {
+        Prog.cycleTime = cycle;
+    }
+}
@@ -33,15 +33,163 @@
 IntOp IntCode[MAX_INT_OPS];
 int IntCodeLen;
 
-static DWORD GenSymCountParThis;
-static DWORD GenSymCountParOut;
-static DWORD GenSymCountOneShot;
-static DWORD GenSymCountFormattedString;
-
-static WORD EepromAddrFree;
+TruthTable TruthTables[MAX_TRUTH_TABLES];
+int TruthTablesCount;
+
+ElemLookUpTable *LookUpTables[MAX_LOOK_UP_TABLES];
+int LookUpTablesCount;
+ElemPiecewiseLinear *PiecewiseLinears[MAX_PIECEWISE_LINEARS];
+int PiecewiseLinearsCount;
+FormattedString FormattedStrings[MAX_FORMATTED_STRINGS];
+int FormattedStringsCount;
+
+static __declspec(thread) DWORD GenSymCountParThis;
+static __declspec(thread) DWORD GenSymCountParOut;
+static __declspec(thread) DWORD GenSymCountOneShot;
+static __declspec(thread) DWORD GenSymCountFormattedString;
+static __declspec(thread) DWORD GenSymCountTemp;
+
+// The shift registers in the program. Those with enough stages that it's
+// worth it are kept as a ring buffer, instead of copying each stage along
+// on every shift; any op that names a stage of one of those gets the ring
+// access code wrapped around it. Each of those accesses costs about as much
+// as a few of the copies, so a register whose stages get used a lot stays
+// as it was.
+#define SHIFT_REGISTER_RING_MIN_STAGES  24
+#define RING_STAGES_PER_REFERENCE       4
+#define MAX_SHIFT_REGISTERS             64
+typedef struct ShiftRegisterTag {
+    char    name[MAX_NAME_LEN];
+    int     stages;
+    BOOL    candidate;
+    BOOL    ring;
+} ShiftRegister;
+static ShiftRegister ShiftRegisters[MAX_SHIFT_REGISTERS];
+static int ShiftRegistersCount;
+
+// Each timer counts the cycles for itself, in its own variable, if its
+// period fits in 16 bits of them. A longer one counts the ticks of a slower
+// timebase instead: timebase k ticks once every 2^k cycles, in $tick<k>,
+// and the timer keeps the tick when it started in $<name>_start, so that
+// its variable still holds how long it has run for, in ticks. If the
+// program asks for deadline timers, then they all work from the ticks, and
+// the variable holds the tick when the timer will be done; then a running
+// timer just compares that with the tick, and a stopped or a done one does
+// no work at all. To reset a timer we need to know which kind it is and
+// which timebase it uses, so keep a list of them.
+#define MAX_TIMEBASES       16
+#define MAX_TIMERS          MAX_IO
+typedef struct TimerInfoTag {
+    char    name[MAX_NAME_LEN];
+    int     which;
+    int     timebase;
+} TimerInfo;
+static TimerInfo Timers[MAX_TIMERS];
+static int TimersCount;
+static BOOL TimebaseUsed[MAX_TIMEBASES];
+
+static __declspec(thread) WORD EepromAddrFree;
+
+// The code for each rung is generated on its own, as if it were the whole
+// program, and kept, along with the rung as it would be saved; then if there
+// is a rung just like that the next time that we generate code, wherever it
+// is, we can use the code again. So nothing in the code depends on where
+// the rung is. Its tables are numbered from zero and its EEPROM addresses
+// from zero, the names that we make up for it have GENSYM_RUNG where the
+// rung number goes, and the ops don't say which rung they're from; all of
+// that gets filled in when we splice it into the program. It keeps its own
+// copies of the look-up tables, since the elements that they came from
+// might not be there by then.
+#define GENSYM_RUNG "??"
+typedef struct RungCodeTag {
+    BOOL                    valid;
+    char                   *source;
+    int                     sourceLen;
+    // The rung that it was generated for, which the simulator's code
+    // points into.
+    int                     rung;
+    IntOp                  *code;
+    int                     codeLen;
+    TruthTable             *truthTables;
+    int                     truthTablesCount;
+    ElemLookUpTable        *lookUpTables;
+    int                     lookUpTablesCount;
+    ElemPiecewiseLinear    *piecewiseLinears;
+    int                     piecewiseLinearsCount;
+    FormattedString        *formattedStrings;
+    int                     formattedStringsCount;
+    WORD                    eepromBytes;
+    // Which shift registers it shifts or names a stage of, and whether
+    // each was a ring buffer when we generated it; and how many times it
+    // names their stages, which is what decides that.
+    BOOL                    usesRegister[MAX_SHIFT_REGISTERS];
+    BOOL                    ring[MAX_SHIFT_REGISTERS];
+    int                     references[MAX_SHIFT_REGISTERS];
+} RungCode;
+
+// What else the code depends on, apart from the rung itself; if that
+// changes then we must start again. There's a set for the simulator and one
+// for the compilers, since they get different code.
+static struct {
+    BOOL            valid;
+    BOOL            mcrUsed;
+    int             cycleTime;
+    BOOL            deadlineTimers;
+    int             shiftRegistersCount;
+    ShiftRegister   shiftRegisters[MAX_SHIFT_REGISTERS];
+    int             timersCount;
+    TimerInfo       timers[MAX_TIMERS];
+    RungCode        rungs[MAX_RUNGS];
+} RungCodeCache[2];
+
+// What we've seen the rung that we're generating code for do with the shift
+// registers; and the leaf element within it that we're on, and how many
+// we've been through.
+static __declspec(thread) int GenElem;
+static __declspec(thread) int GenElemCount;
+static __declspec(thread) BOOL RungUsesRegister[MAX_SHIFT_REGISTERS];
+static __declspec(thread) int RungReferences[MAX_SHIFT_REGISTERS];
+
+// Where the code for that rung goes, until we keep a copy of it. The rungs
+// can get generated on several threads at once, so each thread has its own
+// of these, and everything else that they use is only read while they run.
+// Most rungs are short, so the space for the code starts small and grows as
+// it needs to, up to MAX_INT_OPS.
+#define RUNG_SCRATCH_MIN_OPS    256
+typedef struct RungScratchTag {
+    IntOp                  *code;
+    int                     codeLen;
+    int                     codeMax;
+    TruthTable              truthTables[MAX_TRUTH_TABLES];
+    int                     truthTablesCount;
+    ElemLookUpTable        *lookUpTables[MAX_LOOK_UP_TABLES];
+    int                     lookUpTablesCount;
+    ElemPiecewiseLinear    *piecewiseLinears[MAX_PIECEWISE_LINEARS];
+    int                     piecewiseLinearsCount;
+    FormattedString         formattedStrings[MAX_FORMATTED_STRINGS];
+    int                     formattedStringsCount;
+} RungScratch;
+static __declspec(thread) RungScratch *Gen;
+
+// It's only worth starting threads if each gets a few rungs to do. Unless
+// RungThreads says how many to use instead (up to MAX_RUNG_THREADS), which
+// is for testing that we get the same code however many there are.
+#define MIN_RUNGS_PER_THREAD    4
+#define MAX_RUNG_THREADS        8
+int RungThreads;
+
+// The rungs that the threads have to generate code for, in order; each
+// thread takes the next one that nobody has started on.
+static int RungsToGenerate[MAX_RUNGS];
+static int RungsToGenerateCount;
+static volatile LONG RungsToGenerateNext;
+static RungCode *RungsToGenerateCode;
+static BOOL RungsToGenerateMcrUsed;
 
 //-----------------------------------------------------------------------------
-// Pretty-print the intermediate code to a file, for debugging purposes.
+// Pretty-print the intermediate code to a file, for debugging purposes. Each
+// op is shown with where it came from, as rung.element, both counting from
+// one like on the screen.
 //-----------------------------------------------------------------------------
 void IntDumpListing(char *outFile)
 {
@@ -57,7 +205,15 @@ void IntDumpListing(char *outFile)
         if(IntCode[i].op == INT_END_IF) indent--;
         if(IntCode[i].op == INT_ELSE) indent--;
     
-        fprintf(f, "%3d:", i);
+        char source[30];
+        if(IntCode[i].rung < 0) {
+            strcpy(source, "");
+        } else if(IntCode[i].elem < 0) {
+            sprintf(source, "%d", IntCode[i].rung+1);
+        } else {
+            sprintf(source, "%d.%d", IntCode[i].rung+1, IntCode[i].elem+1);
+        }
+        fprintf(f, "%3d:%-7s", i, source);
         int j;
         for(j = 0; j < indent; j++) fprintf(f, "    ");
 
@@ -105,10 +261,67 @@ void IntDumpListing(char *outFile)
                     IntCode[i].name2, IntCode[i].name3);
                 break;
 
+            case INT_SET_VARIABLE_ADD_LITERAL:
+                fprintf(f, "let var '%s' := '%s' + %d", IntCode[i].name1,
+                    IntCode[i].name2, IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+                fprintf(f, "let var '%s' := '%s' - %d", IntCode[i].name1,
+                    IntCode[i].name2, IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                fprintf(f, "let var '%s' := '%s' * %d", IntCode[i].name1,
+                    IntCode[i].name2, IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                fprintf(f, "let var '%s' := '%s' / %d", IntCode[i].name1,
+                    IntCode[i].name2, IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                fprintf(f, "let var '%s' := '%s' * '%s' / %d",
+                    IntCode[i].name1, IntCode[i].name2, IntCode[i].name3,
+                    IntCode[i].literal);
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE:
+                fprintf(f, "let var '%s' := table %d ['%s']",
+                    IntCode[i].name1, IntCode[i].literal, IntCode[i].name2);
+                break;
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+                fprintf(f, "let var '%s' := pwl %d ['%s']",
+                    IntCode[i].name1, IntCode[i].literal, IntCode[i].name2);
+                break;
+
+            case INT_WRITE_FORMATTED_STRING:
+                fprintf(f, "write formatted string %d ['%s'], var '%s'",
+                    IntCode[i].literal, IntCode[i].name1, IntCode[i].name2);
+                break;
+
+            case INT_SET_VARIABLE_FROM_RING:
+                fprintf(f, "let var '%s' := ring '%s' stage %d from '%s'",
+                    IntCode[i].name1, IntCode[i].name2, IntCode[i].literal,
+                    IntCode[i].name3);
+                break;
+
+            case INT_SET_RING_FROM_VARIABLE:
+                fprintf(f, "let ring '%s' stage %d from '%s' := '%s'",
+                    IntCode[i].name1, IntCode[i].literal, IntCode[i].name2,
+                    IntCode[i].name3);
+                break;
+
             case INT_INCREMENT_VARIABLE:
                 fprintf(f, "increment '%s'", IntCode[i].name1);
                 break;
 
+            case INT_DECREMENT_VARIABLE:
+                fprintf(f, "decrement '%s'", IntCode[i].name1);
+                break;
+
             case INT_READ_ADC:
                 fprintf(f, "read adc '%s'", IntCode[i].name1);
                 break;
@@ -142,6 +355,18 @@ void IntDumpListing(char *outFile)
                     IntCode[i].name1, IntCode[i].name2);
                 break;
 
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[IntCode[i].literal];
+                fprintf(f, "let bit '%s' := truth table %d [",
+                    IntCode[i].name1, IntCode[i].literal);
+                int k;
+                for(k = 0; k < t->inputs; k++) {
+                    fprintf(f, "%s'%s'", k ? " " : "", t->input[k]);
+                }
+                fprintf(f, "]");
+                break;
+            }
+
             case INT_IF_BIT_SET:
                 fprintf(f, "if '%s' {", IntCode[i].name1); indent++;
                 break;
@@ -165,6 +390,16 @@ void IntDumpListing(char *outFile)
                     IntCode[i].name2); indent++;
                 break;
 
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+                fprintf(f, "if '%s' == %d {", IntCode[i].name1,
+                    IntCode[i].literal); indent++;
+                break;
+
+            case INT_IF_VARIABLE_GRT_LITERAL:
+                fprintf(f, "if '%s' > %d {", IntCode[i].name1,
+                    IntCode[i].literal); indent++;
+                break;
+
             case INT_END_IF:
                 fprintf(f, "}");
                 break;
@@ -208,40 +443,261 @@ int HexDigit(int c)
 
 //-----------------------------------------------------------------------------
 // Generate a unique symbol (unique with each call) having the given prefix
-// guaranteed not to conflict with any user symbols.
+// guaranteed not to conflict with any user symbols. The count starts again
+// for each rung, and the rung number is part of the symbol, once we know it
+// (see RenameGenSym()).
 //-----------------------------------------------------------------------------
 static void GenSymParThis(char *dest)
 {
-    sprintf(dest, "$parThis_%04x", GenSymCountParThis);
+    sprintf(dest, "$parThis_" GENSYM_RUNG "_%04x", GenSymCountParThis);
     GenSymCountParThis++;
 }
 static void GenSymParOut(char *dest)
 {
-    sprintf(dest, "$parOut_%04x", GenSymCountParOut);
+    sprintf(dest, "$parOut_" GENSYM_RUNG "_%04x", GenSymCountParOut);
     GenSymCountParOut++;
 }
 static void GenSymOneShot(char *dest)
 {
-    sprintf(dest, "$oneShot_%04x", GenSymCountOneShot);
+    sprintf(dest, "$oneShot_" GENSYM_RUNG "_%04x", GenSymCountOneShot);
     GenSymCountOneShot++;
 }
 static void GenSymFormattedString(char *dest)
 {
-    sprintf(dest, "$formattedString_%04x", GenSymCountFormattedString);
+    sprintf(dest, "$formattedString_" GENSYM_RUNG "_%04x",
+        GenSymCountFormattedString);
     GenSymCountFormattedString++;
 }
+static void GenSymTemp(char *dest)
+{
+    sprintf(dest, INT_TEMP_PREFIX GENSYM_RUNG "_%04x", GenSymCountTemp);
+    GenSymCountTemp++;
+}
+
+//-----------------------------------------------------------------------------
+// Put the rung number into a name that we made up for the code for a rung,
+// now that we're splicing it into the program and know where it goes. The
+// user's names can't start with a $, so leave those alone.
+//-----------------------------------------------------------------------------
+static void RenameGenSym(char *name, int rung)
+{
+    if(name[0] != '$') return;
+    char *p = strstr(name, "_" GENSYM_RUNG "_");
+    if(!p) return;
+    char num[16];
+    sprintf(num, "%02x", rung);
+    if(strlen(num) != strlen(GENSYM_RUNG)) oops();
+    memcpy(p + 1, num, strlen(num));
+}
+
+//-----------------------------------------------------------------------------
+// Return the place for the next op in the code for the rung, with room made
+// for it if there wasn't any.
+//-----------------------------------------------------------------------------
+static IntOp *NextGenOp(void)
+{
+    if(Gen->codeLen >= Gen->codeMax) {
+        int max = Gen->codeMax ? Gen->codeMax*2 : RUNG_SCRATCH_MIN_OPS;
+        if(max > MAX_INT_OPS) max = MAX_INT_OPS;
+        if(Gen->codeLen >= max) oops();
+        IntOp *code = (IntOp *)CheckMalloc(max*sizeof(IntOp));
+        if(Gen->code) {
+            memcpy(code, Gen->code, Gen->codeLen*sizeof(IntOp));
+            CheckFree(Gen->code);
+        }
+        Gen->code = code;
+        Gen->codeMax = max;
+    }
+    return &(Gen->code[Gen->codeLen]);
+}
+
+//-----------------------------------------------------------------------------
+// Append an instruction to the program, as it is.
+//-----------------------------------------------------------------------------
+static void EmitOp(int op, char *name1, char *name2, char *name3, SWORD lit)
+{
+    IntOp *a = NextGenOp();
+    memset(a, 0, sizeof(*a));
+    a->op = op;
+    if(name1) strcpy(a->name1, name1);
+    if(name2) strcpy(a->name2, name2);
+    if(name3) strcpy(a->name3, name3);
+    a->literal = lit;
+    a->elem = GenElem;
+    Gen->codeLen++;
+}
+
+//-----------------------------------------------------------------------------
+// Which of an op's names are integer variables that it reads, and which
+// ones that it writes; bit 0 for name1, bit 1 for name2, bit 2 for name3.
+// An op that only sometimes writes its destination counts as reading it
+// too, so that it keeps its old value otherwise.
+//-----------------------------------------------------------------------------
+static void IntVariableOperands(int op, int *reads, int *writes)
+{
+    *reads = 0;
+    *writes = 0;
+    switch(op) {
+        case INT_SET_VARIABLE_TO_LITERAL:
+        case INT_READ_ADC:
+        case INT_EEPROM_READ:
+            *writes = 1;
+            break;
+
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+            *reads = 2;
+            *writes = 1;
+            break;
+
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+            *reads = 2 | 4;
+            *writes = 1;
+            break;
+
+        case INT_SET_VARIABLE_DIVIDE:
+            *reads = 1 | 2 | 4;
+            *writes = 1;
+            break;
+
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+        case INT_WRITE_FORMATTED_STRING:
+            *reads = 1 | 2;
+            *writes = 1;
+            break;
+
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+        case INT_UART_RECV:
+            *reads = 1;
+            *writes = 1;
+            break;
+
+        case INT_SET_PWM:
+        case INT_UART_SEND:
+        case INT_EEPROM_WRITE:
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+        case INT_IF_VARIABLE_GRT_LITERAL:
+            *reads = 1;
+            break;
+
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            *reads = 1 | 2;
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// If name is a stage of one of the shift registers that we might keep as a
+// ring buffer, then return that shift register and the stage number; else
+// -1.
+//-----------------------------------------------------------------------------
+static int ShiftRegisterForStage(char *name, int *stage)
+{
+    int i;
+    for(i = 0; i < ShiftRegistersCount; i++) {
+        if(!ShiftRegisters[i].candidate) continue;
+        int n = strlen(ShiftRegisters[i].name);
+        if(strncmp(name, ShiftRegisters[i].name, n) != 0) continue;
+
+        // same format as the stage names, so no leading zeros
+        char *s = name + n;
+        if(!isdigit(*s) || (s[0] == '0' && s[1] != '\0')) continue;
+        int k = 0;
+        for(; isdigit(*s); s++) {
+            k = k*10 + (*s - '0');
+            if(k >= ShiftRegisters[i].stages) break;
+        }
+        if(*s != '\0') continue;
+
+        *stage = k;
+        return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// The names of the array that holds a ring buffer, and of the variable that
+// says which element of it holds stage 0.
+//-----------------------------------------------------------------------------
+static void RingNames(int r, char *ring, char *head)
+{
+    sprintf(ring, "$%s_ring", ShiftRegisters[r].name);
+    sprintf(head, "$%s_head", ShiftRegisters[r].name);
+}
+
+//-----------------------------------------------------------------------------
+// How many stages there are in a ring buffer, given its name; for the back
+// ends, which have to allocate it and wrap the index around its end.
+//-----------------------------------------------------------------------------
+int ShiftRegisterRingLength(char *ring)
+{
+    char name[MAX_NAME_LEN+10], head[MAX_NAME_LEN+10];
+    int i;
+    for(i = 0; i < ShiftRegistersCount; i++) {
+        if(!ShiftRegisters[i].ring) continue;
+        RingNames(i, name, head);
+        if(strcmp(name, ring)==0) return ShiftRegisters[i].stages;
+    }
+    oops();
+    return 0;
+}
 
 //-----------------------------------------------------------------------------
-// Compile an instruction to the program.
+// Compile an instruction to the program. If it names a stage of a shift
+// register that we keep as a ring buffer, then it works on a temporary
+// instead, which gets loaded from the ring before and stored back after.
 //-----------------------------------------------------------------------------
 static void Op(int op, char *name1, char *name2, char *name3, SWORD lit)
 {
-    IntCode[IntCodeLen].op = op;
-    if(name1) strcpy(IntCode[IntCodeLen].name1, name1);
-    if(name2) strcpy(IntCode[IntCodeLen].name2, name2);
-    if(name3) strcpy(IntCode[IntCodeLen].name3, name3);
-    IntCode[IntCodeLen].literal = lit;
-    IntCodeLen++;
+    char *names[3] = { name1, name2, name3 };
+    char temps[3][MAX_NAME_LEN];
+    char ring[MAX_NAME_LEN+10], head[MAX_NAME_LEN+10];
+    int r[3];
+    int stage[3];
+    int reads, writes;
+    int i;
+
+    IntVariableOperands(op, &reads, &writes);
+    for(i = 0; i < 3; i++) {
+        r[i] = -1;
+        if(!names[i] || !((reads | writes) & (1 << i))) continue;
+
+        r[i] = ShiftRegisterForStage(names[i], &stage[i]);
+        if(r[i] < 0) continue;
+        RungUsesRegister[r[i]] = TRUE;
+        RungReferences[r[i]]++;
+        if(!ShiftRegisters[r[i]].ring) {
+            r[i] = -1;
+            continue;
+        }
+
+        GenSymTemp(temps[i]);
+        if(reads & (1 << i)) {
+            RingNames(r[i], ring, head);
+            EmitOp(INT_SET_VARIABLE_FROM_RING, temps[i], ring, head,
+                stage[i]);
+        }
+        names[i] = temps[i];
+    }
+
+    EmitOp(op, names[0], names[1], names[2], lit);
+
+    for(i = 0; i < 3; i++) {
+        if(r[i] < 0 || !(writes & (1 << i))) continue;
+
+        RingNames(r[i], ring, head);
+        EmitOp(INT_SET_RING_FROM_VARIABLE, ring, head, temps[i], stage[i]);
+    }
 }
 static void Op(int op, char *name1, char *name2, SWORD lit)
 {
@@ -271,10 +727,13 @@ static void Op(int op)
 //-----------------------------------------------------------------------------
 static void SimState(BOOL *b, char *name)
 {
-    IntCode[IntCodeLen].op = INT_SIMULATE_NODE_STATE;
-    strcpy(IntCode[IntCodeLen].name1, name);
-    IntCode[IntCodeLen].poweredAfter = b;
-    IntCodeLen++;
+    IntOp *a = NextGenOp();
+    memset(a, 0, sizeof(*a));
+    a->op = INT_SIMULATE_NODE_STATE;
+    strcpy(a->name1, name);
+    a->poweredAfter = b;
+    a->elem = GenElem;
+    Gen->codeLen++;
 }
 
 //-----------------------------------------------------------------------------
@@ -290,24 +749,75 @@ void Comment(char *str, ...)
 }
 
 //-----------------------------------------------------------------------------
-// Calculate the period in scan units from the period in microseconds, and
-// raise an error if the given period is unachievable.
+// The timebase for a timer with the given delay, in microseconds: the
+// fastest one in whose ticks the period fits in 16 bits.
+//-----------------------------------------------------------------------------
+static int TimerTimebase(int delay)
+{
+    int cycles = delay / Prog.cycleTime;
+    int k = 0;
+    while((cycles >> k) - 1 >= (1 << 15)) {
+        k++;
+    }
+    return k;
+}
+
+//-----------------------------------------------------------------------------
+// Does a timer of the given timebase work from the ticks, instead of
+// counting the cycles itself?
+//-----------------------------------------------------------------------------
+static BOOL TimebaseTicks(int k)
+{
+    return Prog.deadlineTimers || k > 0;
+}
+
+//-----------------------------------------------------------------------------
+// The name of the counter of ticks of the given timebase.
+//-----------------------------------------------------------------------------
+static void TimebaseName(char *dest, int k)
+{
+    sprintf(dest, "$tick%d", k);
+}
+
+//-----------------------------------------------------------------------------
+// Calculate the period in ticks of the timer's timebase from the period in
+// microseconds, and get the name of that timebase's counter, or an empty
+// string if the timer counts the cycles itself; raise an error if the given
+// period is unachievable.
 //-----------------------------------------------------------------------------
-static int TimerPeriod(ElemLeaf *l)
+static int TimerPeriod(ElemLeaf *l, char *tick)
 {
-    int period = (l->d.timer.delay / Prog.cycleTime) - 1;
+    int cycles = l->d.timer.delay / Prog.cycleTime;
 
-    if(period < 1)  {
+    if(cycles < 2)  {
         Error(_("Timer period too short (needs faster cycle time)."));
         CompileError();
     }
-    if(period >= (1 << 15)) {
-        Error(_("Timer period too long (max 32767 times cycle time); use a "
-            "slower cycle time."));
+    int k = TimerTimebase(l->d.timer.delay);
+    if(k >= MAX_TIMEBASES) {
+        Error(_("Timer period too long; use a slower cycle time."));
         CompileError();
     }
 
-    return period;
+    if(TimebaseTicks(k)) {
+        TimebaseName(tick, k);
+    } else {
+        strcpy(tick, "");
+    }
+    return (cycles >> k) - 1;
+}
+
+//-----------------------------------------------------------------------------
+// The timer with the given name, or NULL if there isn't one (and it's a
+// counter, say).
+//-----------------------------------------------------------------------------
+static TimerInfo *TimerByName(char *name)
+{
+    int i;
+    for(i = 0; i < TimersCount; i++) {
+        if(strcmp(Timers[i].name, name)==0) return &Timers[i];
+    }
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -358,7 +868,7 @@ SWORD CheckMakeNumber(char *str)
 //-----------------------------------------------------------------------------
 // Return an integer power of ten.
 //-----------------------------------------------------------------------------
-static int TenToThe(int x)
+int TenToThe(int x)
 {
     int i;
     int r = 1;
@@ -368,6 +878,68 @@ static int TenToThe(int x)
     return r;
 }
 
+//-----------------------------------------------------------------------------
+// Get x0, y0, dy, dx for segment k of a piecewise linear table (from point k
+// to point k+1), as the back ends store it. A whole-number slope is given as
+// dy with dx = 1, which the target can do with a multiply and no divide.
+//-----------------------------------------------------------------------------
+void PiecewiseLinearSegment(ElemPiecewiseLinear *t, int k, SWORD *seg)
+{
+    int dx = t->vals[(k+1)*2] - t->vals[k*2];
+    int dy = t->vals[(k+1)*2 + 1] - t->vals[k*2 + 1];
+    if(dy % dx == 0) {
+        dy /= dx;
+        dx = 1;
+    }
+    seg[0] = t->vals[k*2];
+    seg[1] = t->vals[k*2 + 1];
+    seg[2] = dy;
+    seg[3] = dx;
+}
+
+//-----------------------------------------------------------------------------
+// Write a multiply by lit as shifts and adds, for the back ends: the product
+// (to 16 bits) is the sum over k of digit[k] times the other operand shifted
+// left by k, for k from 0 to 15, and each digit is -1, 0, or +1. No two
+// neighbouring digits are both nonzero (the non-adjacent form), so there are
+// as few adds and subtracts as can be. Returns the number of them.
+//-----------------------------------------------------------------------------
+int MultiplyByLiteralDigits(SWORD lit, int *digit)
+{
+    int m = (WORD)lit;
+    int k, n = 0;
+    for(k = 0; k < 16; k++) {
+        if(m & 1) {
+            // +1 if the next bit up is clear, else -1, which carries.
+            digit[k] = 2 - (m & 3);
+            m -= digit[k];
+            n++;
+        } else {
+            digit[k] = 0;
+        }
+        m >>= 1;
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// For a divide by a literal whose magnitude d is neither zero nor a power of
+// two: find m and shift such that n/d is (n*m) >> shift for every n from 0 to
+// 32768 (the magnitude of any dividend). m fits in 16 bits, and shift is at
+// least 17, so the back ends can do it with an unsigned 16x16 multiply, and
+// then shift the high word; and the product is less than 2^31. That takes
+// m = ceil(2^shift / d), with shift = 15 + ceil(log2(d)), since then m*d
+// exceeds 2^shift by less than d, and n times that by less than 2^shift.
+//-----------------------------------------------------------------------------
+void DivideByLiteralReciprocal(SWORD lit, WORD *m, int *shift)
+{
+    DWORD d = (lit < 0) ? -lit : lit;
+    int s = 0;
+    while((1ul << s) < d) s++;
+    *shift = 15 + s;
+    *m = (WORD)(((1ul << *shift) + d - 1) / d);
+}
+
 //-----------------------------------------------------------------------------
 // Compile code to evaluate the given bit of ladder logic. The rung input
 // state is in stateInOut before calling and will be in stateInOut after
@@ -376,6 +948,7 @@ static int TenToThe(int x)
 static char *VarFromExpr(char *expr, char *tempName)
 {
     if(IsNumber(expr)) {
+        GenSymTemp(tempName);
         Op(INT_SET_VARIABLE_TO_LITERAL, tempName, CheckMakeNumber(expr));
         return tempName;
     } else {
@@ -386,6 +959,11 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
 {
     ElemLeaf *l = (ElemLeaf *)any;
 
+    int elemBefore = GenElem;
+    if(which != ELEM_SERIES_SUBCKT && which != ELEM_PARALLEL_SUBCKT) {
+        GenElem = GenElemCount++;
+    }
+
     switch(which) {
         case ELEM_SERIES_SUBCKT: {
             int i;
@@ -458,50 +1036,206 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             break;
         }
         case ELEM_RTO: {
-            int period = TimerPeriod(l);
+            char tick[MAX_NAME_LEN];
+            int period = TimerPeriod(l, tick);
+            char running[MAX_NAME_LEN];
+            sprintf(running, "$%s_running", l->d.timer.name);
 
-            Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
-
-            Op(INT_IF_BIT_SET, stateInOut);
-            Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
-            Op(INT_END_IF);
-            Op(INT_CLEAR_BIT, stateInOut);
+            if(!*tick) {
+                Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
 
-            Op(INT_ELSE);
+                Op(INT_IF_BIT_SET, stateInOut);
+                Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
+                Op(INT_END_IF);
+                Op(INT_CLEAR_BIT, stateInOut);
 
-            Op(INT_SET_BIT, stateInOut);
+                Op(INT_ELSE);
 
-            Op(INT_END_IF);
+                Op(INT_SET_BIT, stateInOut);
 
+                Op(INT_END_IF);
+            } else if(!Prog.deadlineTimers) {
+                // When it starts again, move the start back by the time
+                // that it has run for already.
+                char start[MAX_NAME_LEN];
+                sprintf(start, "$%s_start", l->d.timer.name);
+
+                Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                    Op(INT_IF_BIT_SET, stateInOut);
+                        Op(INT_IF_BIT_CLEAR, running);
+                            Op(INT_SET_VARIABLE_SUBTRACT, start, tick,
+                                l->d.timer.name, 0);
+                            Op(INT_SET_BIT, running);
+                        Op(INT_END_IF);
+                        Op(INT_SET_VARIABLE_SUBTRACT, l->d.timer.name, tick,
+                            start, 0);
+                    Op(INT_ELSE);
+                        Op(INT_CLEAR_BIT, running);
+                    Op(INT_END_IF);
+                    Op(INT_CLEAR_BIT, stateInOut);
+                Op(INT_ELSE);
+                    Op(INT_SET_BIT, stateInOut);
+                Op(INT_END_IF);
+            } else {
+                // While it's stopped the variable holds the ticks that it
+                // has run for, and while it's running the tick when it will
+                // be done; tick - x + period takes either one to the other.
+                char done[MAX_NAME_LEN];
+                sprintf(done, "$%s_done", l->d.timer.name);
+
+                Op(INT_IF_BIT_CLEAR, done);
+                    Op(INT_IF_BIT_SET, running);
+                        Op(INT_IF_VARIABLE_EQUALS_VARIABLE, l->d.timer.name,
+                            tick);
+                            Op(INT_SET_BIT, done);
+                        Op(INT_ELSE);
+                            Op(INT_IF_BIT_CLEAR, stateInOut);
+                                Op(INT_SET_VARIABLE_SUBTRACT,
+                                    l->d.timer.name, tick, l->d.timer.name,
+                                    0);
+                                Op(INT_SET_VARIABLE_ADD_LITERAL,
+                                    l->d.timer.name, l->d.timer.name,
+                                    period);
+                                Op(INT_CLEAR_BIT, running);
+                            Op(INT_END_IF);
+                        Op(INT_END_IF);
+                    Op(INT_ELSE);
+                        Op(INT_IF_BIT_SET, stateInOut);
+                            Op(INT_SET_VARIABLE_SUBTRACT, l->d.timer.name,
+                                tick, l->d.timer.name, 0);
+                            Op(INT_SET_VARIABLE_ADD_LITERAL, l->d.timer.name,
+                                l->d.timer.name, period);
+                            Op(INT_SET_BIT, running);
+                        Op(INT_END_IF);
+                    Op(INT_END_IF);
+                Op(INT_END_IF);
+                Op(INT_COPY_BIT_TO_BIT, stateInOut, done);
+            }
             break;
         }
-        case ELEM_RES:
+        case ELEM_RES: {
+            // A timer that works from the ticks has to start again from
+            // the current tick too.
+            TimerInfo *t = TimerByName(l->d.reset.name);
+            char running[MAX_NAME_LEN];
+            sprintf(running, "$%s_running", l->d.reset.name);
+            char other[MAX_NAME_LEN];
+
             Op(INT_IF_BIT_SET, stateInOut);
             Op(INT_SET_VARIABLE_TO_LITERAL, l->d.reset.name);
+            if(!t || !TimebaseTicks(t->timebase)) {
+                // it counts for itself, or it isn't a timer at all
+            } else if(Prog.deadlineTimers && t->which == ELEM_TOF) {
+                sprintf(other, "$%s_live", l->d.reset.name);
+                Op(INT_CLEAR_BIT, running);
+                Op(INT_SET_BIT, other);
+            } else if(Prog.deadlineTimers) {
+                sprintf(other, "$%s_done", l->d.reset.name);
+                Op(INT_CLEAR_BIT, running);
+                Op(INT_CLEAR_BIT, other);
+            } else if(t->which == ELEM_RTO) {
+                Op(INT_CLEAR_BIT, running);
+            } else {
+                char tick[MAX_NAME_LEN];
+                sprintf(other, "$%s_start", l->d.reset.name);
+                TimebaseName(tick, t->timebase);
+                Op(INT_SET_VARIABLE_TO_VARIABLE, other, tick);
+            }
             Op(INT_END_IF);
             break;
-
+        }
         case ELEM_TON: {
-            int period = TimerPeriod(l);
+            char tick[MAX_NAME_LEN];
+            int period = TimerPeriod(l, tick);
 
-            Op(INT_IF_BIT_SET, stateInOut);
+            if(!*tick) {
+                Op(INT_IF_BIT_SET, stateInOut);
 
-            Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
 
-            Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
-            Op(INT_CLEAR_BIT, stateInOut);
-            Op(INT_END_IF);
+                Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
+                Op(INT_CLEAR_BIT, stateInOut);
+                Op(INT_END_IF);
 
-            Op(INT_ELSE);
+                Op(INT_ELSE);
 
-            Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name);
+                Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name);
 
-            Op(INT_END_IF);
+                Op(INT_END_IF);
+            } else if(!Prog.deadlineTimers) {
+                char start[MAX_NAME_LEN];
+                sprintf(start, "$%s_start", l->d.timer.name);
+
+                Op(INT_IF_BIT_SET, stateInOut);
+                    Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
+                        Op(INT_SET_VARIABLE_SUBTRACT, l->d.timer.name, tick,
+                            start, 0);
+                        Op(INT_CLEAR_BIT, stateInOut);
+                    Op(INT_END_IF);
+                Op(INT_ELSE);
+                    Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name);
+                    Op(INT_SET_VARIABLE_TO_VARIABLE, start, tick);
+                Op(INT_END_IF);
+            } else {
+                char running[MAX_NAME_LEN];
+                sprintf(running, "$%s_running", l->d.timer.name);
+                char done[MAX_NAME_LEN];
+                sprintf(done, "$%s_done", l->d.timer.name);
 
+                Op(INT_IF_BIT_SET, stateInOut);
+                    Op(INT_IF_BIT_CLEAR, done);
+                        Op(INT_IF_BIT_CLEAR, running);
+                            Op(INT_SET_VARIABLE_ADD_LITERAL, l->d.timer.name,
+                                tick, period);
+                            Op(INT_SET_BIT, running);
+                        Op(INT_ELSE);
+                            Op(INT_IF_VARIABLE_EQUALS_VARIABLE,
+                                l->d.timer.name, tick);
+                                Op(INT_SET_BIT, done);
+                            Op(INT_END_IF);
+                        Op(INT_END_IF);
+                    Op(INT_END_IF);
+                    Op(INT_COPY_BIT_TO_BIT, stateInOut, done);
+                Op(INT_ELSE);
+                    Op(INT_CLEAR_BIT, running);
+                    Op(INT_CLEAR_BIT, done);
+                Op(INT_END_IF);
+            }
             break;
         }
         case ELEM_TOF: {
-            int period = TimerPeriod(l);
+            char tick[MAX_NAME_LEN];
+            int period = TimerPeriod(l, tick);
+
+            if(Prog.deadlineTimers) {
+                // Its output is live from when its input goes true until
+                // the deadline after it goes false again; and it starts out
+                // dead, like the others.
+                char running[MAX_NAME_LEN];
+                sprintf(running, "$%s_running", l->d.timer.name);
+                char live[MAX_NAME_LEN];
+                sprintf(live, "$%s_live", l->d.timer.name);
+
+                Op(INT_IF_BIT_CLEAR, stateInOut);
+                    Op(INT_IF_BIT_SET, live);
+                        Op(INT_IF_BIT_CLEAR, running);
+                            Op(INT_SET_VARIABLE_ADD_LITERAL, l->d.timer.name,
+                                tick, period);
+                            Op(INT_SET_BIT, running);
+                        Op(INT_ELSE);
+                            Op(INT_IF_VARIABLE_EQUALS_VARIABLE,
+                                l->d.timer.name, tick);
+                                Op(INT_CLEAR_BIT, live);
+                            Op(INT_END_IF);
+                        Op(INT_END_IF);
+                    Op(INT_END_IF);
+                    Op(INT_COPY_BIT_TO_BIT, stateInOut, live);
+                Op(INT_ELSE);
+                    Op(INT_CLEAR_BIT, running);
+                    Op(INT_SET_BIT, live);
+                Op(INT_END_IF);
+                break;
+            }
 
             // All variables start at zero by default, so by default the
             // TOF timer would start out with its output forced HIGH, until
@@ -514,17 +1248,28 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             Op(INT_END_IF);
             Op(INT_SET_BIT, antiGlitchName);
             
+            char start[MAX_NAME_LEN];
+            sprintf(start, "$%s_start", l->d.timer.name);
+
             Op(INT_IF_BIT_CLEAR, stateInOut);
 
             Op(INT_IF_VARIABLE_LES_LITERAL, l->d.timer.name, period);
 
-            Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
+            if(!*tick) {
+                Op(INT_INCREMENT_VARIABLE, l->d.timer.name);
+            } else {
+                Op(INT_SET_VARIABLE_SUBTRACT, l->d.timer.name, tick, start,
+                    0);
+            }
             Op(INT_SET_BIT, stateInOut);
             Op(INT_END_IF);
 
             Op(INT_ELSE);
 
             Op(INT_SET_VARIABLE_TO_LITERAL, l->d.timer.name);
+            if(*tick) {
+                Op(INT_SET_VARIABLE_TO_VARIABLE, start, tick);
+            }
 
             Op(INT_END_IF);
             break;
@@ -556,9 +1301,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
 
             Op(INT_IF_BIT_SET, stateInOut);
                 Op(INT_IF_BIT_CLEAR, storeName);
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", 1);
-                    Op(INT_SET_VARIABLE_SUBTRACT, l->d.counter.name,
-                        l->d.counter.name, "$scratch", 0);
+                    Op(INT_DECREMENT_VARIABLE, l->d.counter.name);
                 Op(INT_END_IF);
             Op(INT_END_IF);
             Op(INT_COPY_BIT_TO_BIT, storeName, stateInOut);
@@ -575,11 +1318,14 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             char storeName[MAX_NAME_LEN];
             GenSymOneShot(storeName);
 
+            // Test before stepping, so that it never holds more than max,
+            // even for a moment, and so fits in a byte if max does; and
+            // max+1 would overflow for a max of 32767.
             Op(INT_IF_BIT_SET, stateInOut);
                 Op(INT_IF_BIT_CLEAR, storeName);
-                    Op(INT_INCREMENT_VARIABLE, l->d.counter.name);
                     Op(INT_IF_VARIABLE_LES_LITERAL, l->d.counter.name,
-                        l->d.counter.max+1);
+                        l->d.counter.max);
+                        Op(INT_INCREMENT_VARIABLE, l->d.counter.name);
                     Op(INT_ELSE);
                         Op(INT_SET_VARIABLE_TO_LITERAL, l->d.counter.name,
                             (SWORD)0);
@@ -595,8 +1341,48 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
         case ELEM_LEQ:
         case ELEM_NEQ:
         case ELEM_EQU: {
-            char *op1 = VarFromExpr(l->d.cmp.op1, "$scratch");
-            char *op2 = VarFromExpr(l->d.cmp.op2, "$scratch2");
+            if(IsNumber(l->d.cmp.op1) != IsNumber(l->d.cmp.op2)) {
+                // Comparing a variable against a constant, so we can use
+                // the ops that take a literal. Put the variable first; that
+                // reverses the sense of the inequalities if it was second.
+                char *var = l->d.cmp.op1;
+                char *lit = l->d.cmp.op2;
+                int cmp = which;
+                if(IsNumber(var)) {
+                    var = l->d.cmp.op2;
+                    lit = l->d.cmp.op1;
+                    if(cmp == ELEM_GRT) cmp = ELEM_LES;
+                    else if(cmp == ELEM_GEQ) cmp = ELEM_LEQ;
+                    else if(cmp == ELEM_LES) cmp = ELEM_GRT;
+                    else if(cmp == ELEM_LEQ) cmp = ELEM_GEQ;
+                }
+                SWORD v = CheckMakeNumber(lit);
+
+                if(cmp == ELEM_GRT) {
+                    Op(INT_IF_VARIABLE_GRT_LITERAL, var, v);
+                    Op(INT_ELSE);
+                } else if(cmp == ELEM_GEQ) {
+                    Op(INT_IF_VARIABLE_LES_LITERAL, var, v);
+                } else if(cmp == ELEM_LES) {
+                    Op(INT_IF_VARIABLE_LES_LITERAL, var, v);
+                    Op(INT_ELSE);
+                } else if(cmp == ELEM_LEQ) {
+                    Op(INT_IF_VARIABLE_GRT_LITERAL, var, v);
+                } else if(cmp == ELEM_EQU) {
+                    Op(INT_IF_VARIABLE_EQUALS_LITERAL, var, v);
+                    Op(INT_ELSE);
+                } else if(cmp == ELEM_NEQ) {
+                    Op(INT_IF_VARIABLE_EQUALS_LITERAL, var, v);
+                } else oops();
+
+                Op(INT_CLEAR_BIT, stateInOut);
+                Op(INT_END_IF);
+                break;
+            }
+
+            char temp1[MAX_NAME_LEN], temp2[MAX_NAME_LEN];
+            char *op1 = VarFromExpr(l->d.cmp.op1, temp1);
+            char *op2 = VarFromExpr(l->d.cmp.op2, temp2);
             
             if(which == ELEM_GRT) {
                 Op(INT_IF_VARIABLE_GRT_VARIABLE, op1, op2);
@@ -622,19 +1408,23 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
         case ELEM_ONE_SHOT_RISING: {
             char storeName[MAX_NAME_LEN];
             GenSymOneShot(storeName);
+            char temp[MAX_NAME_LEN];
+            GenSymTemp(temp);
 
-            Op(INT_COPY_BIT_TO_BIT, "$scratch", stateInOut);
+            Op(INT_COPY_BIT_TO_BIT, temp, stateInOut);
             Op(INT_IF_BIT_SET, storeName);
             Op(INT_CLEAR_BIT, stateInOut);
             Op(INT_END_IF);
-            Op(INT_COPY_BIT_TO_BIT, storeName, "$scratch");
+            Op(INT_COPY_BIT_TO_BIT, storeName, temp);
             break;
         }
         case ELEM_ONE_SHOT_FALLING: {
             char storeName[MAX_NAME_LEN];
             GenSymOneShot(storeName);
+            char temp[MAX_NAME_LEN];
+            GenSymTemp(temp);
         
-            Op(INT_COPY_BIT_TO_BIT, "$scratch", stateInOut);
+            Op(INT_COPY_BIT_TO_BIT, temp, stateInOut);
 
             Op(INT_IF_BIT_CLEAR, stateInOut);
             Op(INT_IF_BIT_SET, storeName);
@@ -644,7 +1434,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             Op(INT_CLEAR_BIT, stateInOut);
             Op(INT_END_IF);
 
-            Op(INT_COPY_BIT_TO_BIT, storeName, "$scratch");
+            Op(INT_COPY_BIT_TO_BIT, storeName, temp);
             break;
         }
         case ELEM_MOVE: {
@@ -689,10 +1479,12 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                 // At startup, get the persistent variable from flash.
                 char isInit[MAX_NAME_LEN];
                 GenSymOneShot(isInit);
+                char busy[MAX_NAME_LEN];
+                GenSymTemp(busy);
                 Op(INT_IF_BIT_CLEAR, isInit);
-                    Op(INT_CLEAR_BIT, "$scratch");
-                    Op(INT_EEPROM_BUSY_CHECK, "$scratch");
-                    Op(INT_IF_BIT_CLEAR, "$scratch");
+                    Op(INT_CLEAR_BIT, busy);
+                    Op(INT_EEPROM_BUSY_CHECK, busy);
+                    Op(INT_IF_BIT_CLEAR, busy);
                         Op(INT_SET_BIT, isInit);
                         Op(INT_EEPROM_READ, l->d.persist.var, EepromAddrFree);
                     Op(INT_END_IF);
@@ -701,11 +1493,14 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                 // While running, continuously compare the EEPROM copy of
                 // the variable against the RAM one; if they are different,
                 // write the RAM one to EEPROM. 
-                Op(INT_CLEAR_BIT, "$scratch");
-                Op(INT_EEPROM_BUSY_CHECK, "$scratch");
-                Op(INT_IF_BIT_CLEAR, "$scratch");
-                    Op(INT_EEPROM_READ, "$scratch", EepromAddrFree);
-                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch",
+                char stored[MAX_NAME_LEN];
+                GenSymTemp(busy);
+                GenSymTemp(stored);
+                Op(INT_CLEAR_BIT, busy);
+                Op(INT_EEPROM_BUSY_CHECK, busy);
+                Op(INT_IF_BIT_CLEAR, busy);
+                    Op(INT_EEPROM_READ, stored, EepromAddrFree);
+                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, stored,
                         l->d.persist.var);
                     Op(INT_ELSE);
                         Op(INT_EEPROM_WRITE, l->d.persist.var, EepromAddrFree);
@@ -739,21 +1534,51 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             }
             Op(INT_IF_BIT_SET, stateInOut);
 
-            char *op1 = VarFromExpr(l->d.math.op1, "$scratch");
-            char *op2 = VarFromExpr(l->d.math.op2, "$scratch2");
-
-            int intOp;
-            if(which == ELEM_ADD) {
-                intOp = INT_SET_VARIABLE_ADD;
-            } else if(which == ELEM_SUB) {
-                intOp = INT_SET_VARIABLE_SUBTRACT;
-            } else if(which == ELEM_MUL) {
-                intOp = INT_SET_VARIABLE_MULTIPLY;
-            } else if(which == ELEM_DIV) {
-                intOp = INT_SET_VARIABLE_DIVIDE;
-            } else oops();
-
-            Op(intOp, l->d.math.dest, op1, op2, 0);
+            // Arithmetic with a constant has its own ops, which don't need
+            // the constant loaded into a scratch variable first. A divide by
+            // a constant zero stays general, to fail the way that it would
+            // with a variable.
+            char *src1 = l->d.math.op1;
+            char *src2 = l->d.math.op2;
+            if((which == ELEM_ADD || which == ELEM_MUL) && IsNumber(src1) &&
+                !IsNumber(src2))
+            {
+                Op(which == ELEM_ADD ? INT_SET_VARIABLE_ADD_LITERAL :
+                    INT_SET_VARIABLE_MULTIPLY_LITERAL, l->d.math.dest, src2,
+                    CheckMakeNumber(src1));
+            } else if(IsNumber(src2) && !IsNumber(src1) &&
+                !(which == ELEM_DIV && CheckMakeNumber(src2) == 0))
+            {
+                int intOp;
+                if(which == ELEM_ADD) {
+                    intOp = INT_SET_VARIABLE_ADD_LITERAL;
+                } else if(which == ELEM_SUB) {
+                    intOp = INT_SET_VARIABLE_SUBTRACT_LITERAL;
+                } else if(which == ELEM_MUL) {
+                    intOp = INT_SET_VARIABLE_MULTIPLY_LITERAL;
+                } else if(which == ELEM_DIV) {
+                    intOp = INT_SET_VARIABLE_DIVIDE_LITERAL;
+                } else oops();
+
+                Op(intOp, l->d.math.dest, src1, CheckMakeNumber(src2));
+            } else {
+                char temp1[MAX_NAME_LEN], temp2[MAX_NAME_LEN];
+                char *op1 = VarFromExpr(src1, temp1);
+                char *op2 = VarFromExpr(src2, temp2);
+
+                int intOp;
+                if(which == ELEM_ADD) {
+                    intOp = INT_SET_VARIABLE_ADD;
+                } else if(which == ELEM_SUB) {
+                    intOp = INT_SET_VARIABLE_SUBTRACT;
+                } else if(which == ELEM_MUL) {
+                    intOp = INT_SET_VARIABLE_MULTIPLY;
+                } else if(which == ELEM_DIV) {
+                    intOp = INT_SET_VARIABLE_DIVIDE;
+                } else oops();
+
+                Op(intOp, l->d.math.dest, op1, op2, 0);
+            }
 
             Op(INT_END_IF);
             break;
@@ -773,6 +1598,34 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
         case ELEM_SHIFT_REGISTER: {
             char storeName[MAX_NAME_LEN];
             GenSymOneShot(storeName);
+            char stage0[MAX_NAME_LEN+10];
+            sprintf(stage0, "%s0", l->d.shiftRegister.name);
+            int stage;
+            int r = ShiftRegisterForStage(stage0, &stage);
+            if(r >= 0) RungUsesRegister[r] = TRUE;
+            if(r >= 0 && ShiftRegisters[r].ring) {
+                // Kept as a ring buffer, so step the index of stage 0 back
+                // by one, which makes every stage the old one before it.
+                // Stage 0 keeps its value, which is now stage 1.
+                char ring[MAX_NAME_LEN+10], head[MAX_NAME_LEN+10];
+                RingNames(r, ring, head);
+                char temp[MAX_NAME_LEN];
+                GenSymTemp(temp);
+                Op(INT_IF_BIT_SET, stateInOut);
+                    Op(INT_IF_BIT_CLEAR, storeName);
+                        Op(INT_IF_VARIABLE_LES_LITERAL, head, (SWORD)1);
+                            Op(INT_SET_VARIABLE_TO_LITERAL, head,
+                                ShiftRegisters[r].stages - 1);
+                        Op(INT_ELSE);
+                            Op(INT_DECREMENT_VARIABLE, head);
+                        Op(INT_END_IF);
+                        Op(INT_SET_VARIABLE_FROM_RING, temp, ring, head, 1);
+                        Op(INT_SET_RING_FROM_VARIABLE, ring, head, temp, 0);
+                    Op(INT_END_IF);
+                Op(INT_END_IF);
+                Op(INT_COPY_BIT_TO_BIT, storeName, stateInOut);
+                break;
+            }
             Op(INT_IF_BIT_SET, stateInOut);
                 Op(INT_IF_BIT_CLEAR, storeName);
                     int i;
@@ -788,24 +1641,28 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             break;
         }
         case ELEM_LOOK_UP_TABLE: {
-            // God this is stupid; but it will have to do, at least until I
-            // add new int code instructions for this.
-            int i;
-            Op(INT_IF_BIT_SET, stateInOut);
+            // The back ends write the table out as constant data and index
+            // into it, so this costs the same however long the table is.
             ElemLookUpTable *t = &(l->d.lookUpTable);
-            for(i = 0; i < t->count; i++) {
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", i);
-                Op(INT_IF_VARIABLE_EQUALS_VARIABLE, t->index, "$scratch");
-                    Op(INT_SET_VARIABLE_TO_LITERAL, t->dest, t->vals[i]);
-                Op(INT_END_IF);
+            if(t->count == 0) break;
+            if(Gen->lookUpTablesCount >= MAX_LOOK_UP_TABLES) {
+                Error(_("Too many look-up tables."));
+                CompileError();
             }
+            Gen->lookUpTables[Gen->lookUpTablesCount] = t;
+            Op(INT_IF_BIT_SET, stateInOut);
+                Op(INT_SET_VARIABLE_FROM_TABLE, t->dest, t->index,
+                    Gen->lookUpTablesCount);
             Op(INT_END_IF);
+            Gen->lookUpTablesCount++;
             break;
         }
         case ELEM_PIECEWISE_LINEAR: {
             // This one is not so obvious; we have to decide how best to
             // perform the linear interpolation, using our 16-bit fixed
-            // point math.
+            // point math. The back ends keep the table as constant data,
+            // search it for the right segment, and then do one fused
+            // multiply-divide along that segment.
             ElemPiecewiseLinear *t = &(l->d.piecewiseLinear);
             if(t->count == 0) {
                 Error(_("Piecewise linear lookup table with zero elements!"));
@@ -821,8 +1678,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                 }
                 xThis = t->vals[i*2];
             }
-            Op(INT_IF_BIT_SET, stateInOut);
-            for(i = t->count - 1; i >= 1; i--) {
+            for(i = 1; i < t->count; i++) {
                 int thisDx = t->vals[i*2] - t->vals[(i-1)*2];
                 int thisDy = t->vals[i*2 + 1] - t->vals[(i-1)*2 + 1];
                 // The output point is given by
@@ -832,44 +1688,46 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                 // by moving the PWL points closer together.
                
                 // Check for numerical problems, and fail if we have them.
-                if((thisDx*thisDy) >= 32767 || (thisDx*thisDy) <= -32768) {
+                // The multiply and divide are fused, with a 32-bit
+                // intermediate, so it is enough that dx and dy themselves
+                // fit in 16 bits.
+                if(thisDx > 32767 || thisDy > 32767 || thisDy < -32768) {
                     Error(_("Numerical problem with piecewise linear lookup "
                         "table. Either make the table entries smaller, "
                         "or space the points together more closely.\r\n\r\n"
                         "See the help file for details."));
                     CompileError();
                 }
+            }
+            // With a single point there is no segment, so nothing to do.
+            if(t->count < 2) break;
 
-                // Hack to avoid AVR brge issue again, since long jumps break
-                Op(INT_CLEAR_BIT, "$scratch");
-                Op(INT_IF_VARIABLE_LES_LITERAL, t->index, t->vals[i*2]+1);
-                    Op(INT_SET_BIT, "$scratch");
-                Op(INT_END_IF);
-                
-                Op(INT_IF_BIT_SET, "$scratch");
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", t->vals[(i-1)*2]);
-                Op(INT_SET_VARIABLE_SUBTRACT, "$scratch", t->index,
-                    "$scratch", 0);
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", thisDx);
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch3", thisDy);
-                Op(INT_SET_VARIABLE_MULTIPLY, t->dest, "$scratch", "$scratch3",
-                    0);
-                Op(INT_SET_VARIABLE_DIVIDE, t->dest, t->dest, "$scratch2", 0);
-
-                Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch",
-                    t->vals[(i-1)*2 + 1]);
-                Op(INT_SET_VARIABLE_ADD, t->dest, t->dest, "$scratch", 0);
-                Op(INT_END_IF);
+            if(Gen->piecewiseLinearsCount >= MAX_PIECEWISE_LINEARS) {
+                Error(_("Too many piecewise linear tables."));
+                CompileError();
             }
+            Gen->piecewiseLinears[Gen->piecewiseLinearsCount] = t;
+            Op(INT_IF_BIT_SET, stateInOut);
+                Op(INT_SET_VARIABLE_PIECEWISE_LINEAR, t->dest, t->index,
+                    Gen->piecewiseLinearsCount);
             Op(INT_END_IF);
+            Gen->piecewiseLinearsCount++;
             break;
         }
         case ELEM_FORMATTED_STRING: {
-            // Okay, this one is terrible and ineffcient, and it's a huge pain
-            // to implement, but people want it a lot. The hard part is that
-            // we have to let the PLC keep cycling, of course, and also that
-            // we must do the integer to ASCII conversion sensisbly, with
-            // only one divide per PLC cycle.
+            // People want this a lot. The hard part is that we have to let
+            // the PLC keep cycling, of course, so we send one character per
+            // cycle, and do the integer to ASCII conversion one digit (so
+            // one divide) at a time. The template goes out as constant
+            // data, and the back ends share the routine that works out each
+            // character, so another string costs little more than its
+            // template.
+            if(Gen->formattedStringsCount >= MAX_FORMATTED_STRINGS) {
+                Error(_("Too many formatted strings."));
+                CompileError();
+            }
+            FormattedString *fs =
+                &(Gen->formattedStrings[Gen->formattedStringsCount]);
 
             // This variable is basically our sequencer: it is a counter that
             // increments every time we send a character.
@@ -878,21 +1736,15 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
 
             // The variable whose value we might interpolate.
             char *var = l->d.fmtdStr.var;
+            strcpy(fs->var, var);
 
             // This is the state variable for our integer-to-string conversion.
             // It contains the absolute value of var, possibly with some
             // of the higher powers of ten missing.
-            char convertState[MAX_NAME_LEN];
-            GenSymFormattedString(convertState);
+            GenSymFormattedString(fs->convertState);
 
             // We might need to suppress some leading zeros.
-            char isLeadingZero[MAX_NAME_LEN];
-            GenSymFormattedString(isLeadingZero);
-
-            // This is a table of characters to transmit, as a function of the
-            // sequencer position (though we might have a hole in the middle
-            // for the variable output)
-            char outputChars[MAX_LOOK_UP_TABLE_LEN];
+            GenSymFormattedString(fs->isLeadingZero);
 
             BOOL mustDoMinus = FALSE;
 
@@ -903,8 +1755,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             // The total number of digits to convert.
             int digits = -1;
 
-            // So count that now, and build up our table of fixed things to
-            // send.
+            // So count that now, and build up our table of things to send.
             steps = 0;
             char *p = l->d.fmtdStr.string;
             while(*p) {
@@ -917,7 +1768,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                     p++;
                     if(*p == '-') {
                         mustDoMinus = TRUE;
-                        outputChars[steps++] = 1;
+                        fs->chars[steps++] = (1 << FMTD_MINUS) << 8;
                         p++;
                     }
                     if(!isdigit(*p) || (*p - '0') > 5 || *p == '0') {
@@ -928,16 +1779,21 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                     digits = (*p - '0');
                     int i;
                     for(i = 0; i < digits; i++) {
-                        outputChars[steps++] = 0;
+                        WORD kind = (1 << FMTD_DIGIT) | (digits - i - 1);
+                        if(i == 0) {
+                            kind |= (1 << FMTD_FIRST_DIGIT);
+                            if(!mustDoMinus) kind |= (1 << FMTD_LOAD_VAR);
+                        }
+                        fs->chars[steps++] = kind << 8;
                     }
                 } else if(*p == '\\') {
                     p++;
                     switch(*p) {
-                        case 'r': outputChars[steps++] = '\r'; break;
-                        case 'n': outputChars[steps++] = '\n'; break;
-                        case 'b': outputChars[steps++] = '\b'; break;
-                        case 'f': outputChars[steps++] = '\f'; break;
-                        case '\\': outputChars[steps++] = '\\'; break;
+                        case 'r': fs->chars[steps++] = '\r'; break;
+                        case 'n': fs->chars[steps++] = '\n'; break;
+                        case 'b': fs->chars[steps++] = '\b'; break;
+                        case 'f': fs->chars[steps++] = '\f'; break;
+                        case '\\': fs->chars[steps++] = '\\'; break;
                         case 'x': {
                             int h, l;
                             p++;
@@ -946,7 +1802,7 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                                 p++;
                                 l = HexDigit(*p);
                                 if(l >= 0) {
-                                    outputChars[steps++] = (h << 4) | l;
+                                    fs->chars[steps++] = (h << 4) | l;
                                     break;
                                 }
                             }
@@ -960,10 +1816,11 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
                             break;
                     }
                 } else {
-                    outputChars[steps++] = *p;
+                    fs->chars[steps++] = (BYTE)*p;
                 }
                 if(*p) p++;
             }
+            fs->steps = steps;
 
             if(digits >= 0 && (strlen(var) == 0)) {
                 Error(_("Variable is interpolated into formatted string, but "
@@ -987,121 +1844,9 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
             Op(INT_END_IF);
             Op(INT_COPY_BIT_TO_BIT, oneShot, stateInOut);
 
-            // Everything that involves seqScratch is a terrible hack to
-            // avoid an if statement with a big body, which is the risk
-            // factor for blowing up on PIC16 page boundaries.
-
-            char *seqScratch = "$scratch3";
-
-            Op(INT_SET_VARIABLE_TO_VARIABLE, seqScratch, seq);
-
-            // No point doing any math unless we'll get to transmit this
-            // cycle, so check that first.
-
-            Op(INT_IF_VARIABLE_LES_LITERAL, seq, steps);
-            Op(INT_ELSE);
-                Op(INT_SET_VARIABLE_TO_LITERAL, seqScratch, -1);
-            Op(INT_END_IF);
-
-            Op(INT_CLEAR_BIT, "$scratch");
-            Op(INT_UART_SEND, "$scratch", "$scratch");
-            Op(INT_IF_BIT_SET, "$scratch");
-                Op(INT_SET_VARIABLE_TO_LITERAL, seqScratch, -1);
-            Op(INT_END_IF);
-
-            // So we transmit this cycle, so check out which character.
-            int i;
-            int digit = 0;
-            for(i = 0; i < steps; i++) {
-                if(outputChars[i] == 0) {
-                    // Note gross hack to work around limit of range for
-                    // AVR brne op, which is +/- 64 instructions.
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", i);
-                    Op(INT_CLEAR_BIT, "$scratch");
-                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", seqScratch);
-                        Op(INT_SET_BIT, "$scratch");
-                    Op(INT_END_IF);
-
-                    Op(INT_IF_BIT_SET, "$scratch");
-
-                    // Start the integer-to-string
-
-                    // If there's no minus, then we have to load up
-                    // convertState ourselves the first time.
-                    if(digit == 0 && !mustDoMinus) {
-                        Op(INT_SET_VARIABLE_TO_VARIABLE, convertState, var);
-                    }
-                    if(digit == 0) {
-                        Op(INT_SET_BIT, isLeadingZero);
-                    }
-                    
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch",
-                        TenToThe((digits-digit)-1));
-                    Op(INT_SET_VARIABLE_DIVIDE, "$scratch2", convertState,
-                        "$scratch", 0);
-                    Op(INT_SET_VARIABLE_MULTIPLY, "$scratch", "$scratch",
-                        "$scratch2", 0);
-                    Op(INT_SET_VARIABLE_SUBTRACT, convertState,
-                        convertState, "$scratch", 0);
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", '0');
-                    Op(INT_SET_VARIABLE_ADD, "$scratch2", "$scratch2",
-                        "$scratch", 0);
-
-                    // Suppress all but the last leading zero.
-                    if(digit != (digits - 1)) {
-                        Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch",
-                            "$scratch2");
-                            Op(INT_IF_BIT_SET, isLeadingZero);
-                                Op(INT_SET_VARIABLE_TO_LITERAL,
-                                    "$scratch2", ' ');
-                            Op(INT_END_IF);
-                        Op(INT_ELSE);
-                            Op(INT_CLEAR_BIT, isLeadingZero);
-                        Op(INT_END_IF);
-                    }
-
-                    Op(INT_END_IF);
-
-                    digit++;
-                } else if(outputChars[i] == 1) {
-                    // do the minus; ugliness to get around the BRNE jump
-                    // size limit, though
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", i);
-                    Op(INT_CLEAR_BIT, "$scratch");
-                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", seqScratch);
-                        Op(INT_SET_BIT, "$scratch");
-                    Op(INT_END_IF);
-                    Op(INT_IF_BIT_SET, "$scratch");
-                       
-                        // Also do the `absolute value' calculation while
-                        // we're at it.
-                        Op(INT_SET_VARIABLE_TO_VARIABLE, convertState, var);
-                        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", ' ');
-                        Op(INT_IF_VARIABLE_LES_LITERAL, var, (SWORD)0);
-                            Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", '-');
-                            Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch",
-                                (SWORD)0);
-                            Op(INT_SET_VARIABLE_SUBTRACT, convertState,
-                                "$scratch", var, 0);
-                        Op(INT_END_IF);
-
-                    Op(INT_END_IF);
-                } else {
-                    // just another character
-                    Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch", i);
-                    Op(INT_IF_VARIABLE_EQUALS_VARIABLE, "$scratch", seqScratch);
-                        Op(INT_SET_VARIABLE_TO_LITERAL, "$scratch2", 
-                            outputChars[i]);
-                    Op(INT_END_IF);
-                }
-            }
-
-            Op(INT_IF_VARIABLE_LES_LITERAL, seqScratch, (SWORD)0);
-            Op(INT_ELSE);
-                Op(INT_SET_BIT, "$scratch");
-                Op(INT_UART_SEND, "$scratch2", "$scratch");
-                Op(INT_INCREMENT_VARIABLE, seq);
-            Op(INT_END_IF);
+            Op(INT_WRITE_FORMATTED_STRING, seq, var,
+                Gen->formattedStringsCount);
+            Gen->formattedStringsCount++;
     
             // Rung-out state: true if we're still running, else false
             Op(INT_CLEAR_BIT, stateInOut);
@@ -1134,46 +1879,823 @@ static void IntCodeFromCircuit(int which, void *any, char *stateInOut)
         // should be updating for display purposes
         SimState(&(l->poweredAfter), stateInOut);
     }
+    GenElem = elemBefore;
 }
 
 //-----------------------------------------------------------------------------
-// Generate intermediate code for the entire program. Return TRUE if it worked,
-// else FALSE.
+// Can the given subcircuit be evaluated by table lookup? That means that it
+// contains only contacts, shorts, and opens, in some series/parallel
+// combination. Add the names of its contacts to the table's list of inputs,
+// if they are not there already, and note if there is any branching.
 //-----------------------------------------------------------------------------
-BOOL GenerateIntermediateCode(void)
+static BOOL TruthTableInputsOk(int which, void *any, TruthTable *t,
+    BOOL *branches)
 {
+    ElemLeaf *l = (ElemLeaf *)any;
+    int i;
+
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++) {
+                if(!TruthTableInputsOk(s->contents[i].which,
+                    s->contents[i].d.any, t, branches))
+                {
+                    return FALSE;
+                }
+            }
+            return TRUE;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            *branches = TRUE;
+            for(i = 0; i < p->count; i++) {
+                if(!TruthTableInputsOk(p->contents[i].which,
+                    p->contents[i].d.any, t, branches))
+                {
+                    return FALSE;
+                }
+            }
+            return TRUE;
+        }
+        case ELEM_CONTACTS:
+            for(i = 0; i < t->inputs; i++) {
+                if(strcmp(t->input[i], l->d.contacts.name)==0) return TRUE;
+            }
+            if(t->inputs >= MAX_TRUTH_TABLE_INPUTS) return FALSE;
+            strcpy(t->input[t->inputs], l->d.contacts.name);
+            t->inputs++;
+            return TRUE;
+
+        case ELEM_OPEN:
+        case ELEM_SHORT:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Evaluate a subcircuit that passed TruthTableInputsOk, with the inputs set
+// as given by the bits of index, and return its rung-out state.
+//-----------------------------------------------------------------------------
+static BOOL TruthTableEval(int which, void *any, BOOL powered, TruthTable *t,
+    int index)
+{
+    ElemLeaf *l = (ElemLeaf *)any;
+    int i;
+
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++) {
+                powered = TruthTableEval(s->contents[i].which,
+                    s->contents[i].d.any, powered, t, index);
+            }
+            return powered;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            BOOL out = FALSE;
+            for(i = 0; i < p->count; i++) {
+                if(TruthTableEval(p->contents[i].which, p->contents[i].d.any,
+                    powered, t, index))
+                {
+                    out = TRUE;
+                }
+            }
+            return out;
+        }
+        case ELEM_CONTACTS: {
+            for(i = 0; i < t->inputs; i++) {
+                if(strcmp(t->input[i], l->d.contacts.name)==0) break;
+            }
+            if(i >= t->inputs) oops();
+            BOOL on = (index & (1 << i)) ? TRUE : FALSE;
+            if(l->d.contacts.negated) on = !on;
+            return powered && on;
+        }
+        case ELEM_OPEN:
+            return FALSE;
+
+        case ELEM_SHORT:
+            return powered;
+
+        default:
+            oops();
+            return FALSE;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// If a rung is a pure boolean function of a few bits (contacts, in series
+// and parallel, driving one ordinary coil) then evaluate it for every
+// combination of its inputs now, and compile it to a single table lookup
+// that takes the same time however the contacts are wired. That is only
+// worth it if there is some branching to flatten out; a plain string of
+// contacts is already about as cheap as it gets. Returns TRUE if the rung
+// was compiled this way, else FALSE and nothing has been generated.
+//-----------------------------------------------------------------------------
+static BOOL TruthTableFromRung(ElemSubcktSeries *s, BOOL mcrUsed)
+{
+    if(s->count < 2) return FALSE;
+    if(s->contents[s->count-1].which != ELEM_COIL) return FALSE;
+    ElemLeaf *coil = (ElemLeaf *)s->contents[s->count-1].d.any;
+    if(coil->d.coil.setOnly || coil->d.coil.resetOnly) return FALSE;
+
+    if(Gen->truthTablesCount >= MAX_TRUTH_TABLES) return FALSE;
+    TruthTable *t = &(Gen->truthTables[Gen->truthTablesCount]);
+    memset(t, 0, sizeof(*t));
+
+    BOOL branches = FALSE;
+    int i;
+    for(i = 0; i < s->count - 1; i++) {
+        if(!TruthTableInputsOk(s->contents[i].which, s->contents[i].d.any, t,
+            &branches))
+        {
+            return FALSE;
+        }
+    }
+    if(!branches) return FALSE;
+
+    int index;
+    for(index = 0; index < (1 << t->inputs); index++) {
+        BOOL powered = TRUE;
+        for(i = 0; i < s->count - 1; i++) {
+            powered = TruthTableEval(s->contents[i].which,
+                s->contents[i].d.any, powered, t, index);
+        }
+        if(coil->d.coil.negated) powered = !powered;
+        if(powered) {
+            t->bits[index >> 3] |= (1 << (index & 7));
+        }
+    }
+
+    char *name = coil->d.coil.name;
+    if(mcrUsed) {
+        // With the master control relay off the rung has no power, so the
+        // coil goes to its unpowered state whatever the inputs say.
+        Op(INT_IF_BIT_SET, "$mcr");
+            Op(INT_SET_BIT_FROM_TRUTH_TABLE, name, Gen->truthTablesCount);
+        Op(INT_ELSE);
+            Op(coil->d.coil.negated ? INT_SET_BIT : INT_CLEAR_BIT, name);
+        Op(INT_END_IF);
+    } else {
+        Op(INT_SET_BIT_FROM_TRUTH_TABLE, name, Gen->truthTablesCount);
+    }
+    Gen->truthTablesCount++;
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Make a list of the shift registers in the program; a name can be used for
+// more than one, and then they shift the same stages.
+//-----------------------------------------------------------------------------
+static void FindShiftRegisters(int which, void *any)
+{
+    int i;
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++) {
+                FindShiftRegisters(s->contents[i].which,
+                    s->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            for(i = 0; i < p->count; i++) {
+                FindShiftRegisters(p->contents[i].which,
+                    p->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_SHIFT_REGISTER: {
+            ElemLeaf *l = (ElemLeaf *)any;
+            for(i = 0; i < ShiftRegistersCount; i++) {
+                if(strcmp(ShiftRegisters[i].name,
+                        l->d.shiftRegister.name)==0 &&
+                    ShiftRegisters[i].stages == l->d.shiftRegister.stages)
+                {
+                    return;
+                }
+            }
+            if(i >= MAX_SHIFT_REGISTERS) {
+                // can't check them all against each other, so play safe
+                ShiftRegistersCount = -1;
+                return;
+            }
+            strcpy(ShiftRegisters[i].name, l->d.shiftRegister.name);
+            ShiftRegisters[i].stages = l->d.shiftRegister.stages;
+            ShiftRegisters[i].candidate =
+                (ShiftRegisters[i].stages >= SHIFT_REGISTER_RING_MIN_STAGES);
+            ShiftRegisters[i].ring = ShiftRegisters[i].candidate;
+            ShiftRegistersCount++;
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Decide which shift registers we might keep as ring buffers: the deep ones,
+// but not if the name of one is a prefix of the name of another, because
+// then `reg12' might be either `reg' stage 12 or `reg1' stage 2 (and the two
+// share that variable). The same goes for one name with two different
+// numbers of stages. For now they're all rings; which ones stay rings
+// depends on how often the code names their stages.
+//-----------------------------------------------------------------------------
+static void FindShiftRegisterCandidates(void)
+{
+    ShiftRegistersCount = 0;
+    // The simulator shows each stage by name, so it always gets them as
+    // separate variables.
+    if(InSimulationMode) return;
+
+    int i, j;
+    for(i = 0; i < Prog.numRungs; i++) {
+        FindShiftRegisters(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
+        if(ShiftRegistersCount < 0) {
+            ShiftRegistersCount = 0;
+            return;
+        }
+    }
+    for(i = 0; i < ShiftRegistersCount; i++) {
+        for(j = 0; j < ShiftRegistersCount; j++) {
+            if(i == j) continue;
+            char *a = ShiftRegisters[i].name;
+            char *b = ShiftRegisters[j].name;
+            if(strncmp(a, b, strlen(b))==0) {
+                ShiftRegisters[i].candidate = FALSE;
+                ShiftRegisters[j].candidate = FALSE;
+                ShiftRegisters[i].ring = FALSE;
+                ShiftRegisters[j].ring = FALSE;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Make a list of the timers in the program, and which timebases they use.
+//-----------------------------------------------------------------------------
+static void FindTimers(int which, void *any)
+{
+    int i;
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++) {
+                FindTimers(s->contents[i].which, s->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            for(i = 0; i < p->count; i++) {
+                FindTimers(p->contents[i].which, p->contents[i].d.any);
+            }
+            break;
+        }
+        case ELEM_TON:
+        case ELEM_TOF:
+        case ELEM_RTO: {
+            ElemLeaf *l = (ElemLeaf *)any;
+            int k = TimerTimebase(l->d.timer.delay);
+            if(k < MAX_TIMEBASES && TimebaseTicks(k)) {
+                TimebaseUsed[k] = TRUE;
+            }
+            if(TimerByName(l->d.timer.name)) break;
+            if(TimersCount >= MAX_TIMERS) break;
+            memset(&Timers[TimersCount], 0, sizeof(Timers[TimersCount]));
+            strcpy(Timers[TimersCount].name, l->d.timer.name);
+            Timers[TimersCount].which = which;
+            Timers[TimersCount].timebase = k;
+            TimersCount++;
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Append an op that isn't part of any rung to the program, for what the
+// program does at the start of every cycle.
+//-----------------------------------------------------------------------------
+static void ProgramOp(int op, char *name1, SWORD lit)
+{
+    IntOp *a = &IntCode[IntCodeLen];
+    memset(a, 0, sizeof(*a));
+    a->op = op;
+    if(name1) strcpy(a->name1, name1);
+    a->literal = lit;
+    a->rung = -1;
+    a->elem = -1;
+    IntCodeLen++;
+}
+
+//-----------------------------------------------------------------------------
+// The addresses of all the elements in a circuit, which the code for the
+// simulator points into, written into buf; or with buf NULL, just return
+// how many bytes they take.
+//-----------------------------------------------------------------------------
+static int ElementAddresses(int which, void *any, char *buf)
+{
+    int n = sizeof(any);
+    int i;
+    if(buf) memcpy(buf, &any, sizeof(any));
+    switch(which) {
+        case ELEM_SERIES_SUBCKT: {
+            ElemSubcktSeries *s = (ElemSubcktSeries *)any;
+            for(i = 0; i < s->count; i++) {
+                n += ElementAddresses(s->contents[i].which,
+                    s->contents[i].d.any, buf ? buf + n : NULL);
+            }
+            break;
+        }
+        case ELEM_PARALLEL_SUBCKT: {
+            ElemSubcktParallel *p = (ElemSubcktParallel *)any;
+            for(i = 0; i < p->count; i++) {
+                n += ElementAddresses(p->contents[i].which,
+                    p->contents[i].d.any, buf ? buf + n : NULL);
+            }
+            break;
+        }
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// Everything about a rung that goes into its code: the rung as it would be
+// saved, and for the simulator the addresses of its elements too. Returns
+// a new buffer, and its length in *len.
+//-----------------------------------------------------------------------------
+static char *RungSource(int rung, int *len)
+{
+    ElemSubcktSeries *s = Prog.rungs[rung];
+    int n = SaveElemToBuffer(ELEM_SERIES_SUBCKT, s, NULL);
+    int m = 0;
+    if(InSimulationMode) m = ElementAddresses(ELEM_SERIES_SUBCKT, s, NULL);
+    char *source = (char *)CheckMalloc(n + m);
+    SaveElemToBuffer(ELEM_SERIES_SUBCKT, s, source);
+    if(m) ElementAddresses(ELEM_SERIES_SUBCKT, s, source + n);
+    *len = n + m;
+    return source;
+}
+
+//-----------------------------------------------------------------------------
+// Forget the code that we kept for a rung.
+//-----------------------------------------------------------------------------
+static void FreeRungCode(RungCode *rc)
+{
+    if(rc->source) CheckFree(rc->source);
+    if(rc->code) CheckFree(rc->code);
+    if(rc->truthTables) CheckFree(rc->truthTables);
+    if(rc->lookUpTables) CheckFree(rc->lookUpTables);
+    if(rc->piecewiseLinears) CheckFree(rc->piecewiseLinears);
+    if(rc->formattedStrings) CheckFree(rc->formattedStrings);
+    memset(rc, 0, sizeof(*rc));
+}
+
+//-----------------------------------------------------------------------------
+// Copy n things of the given size into a new buffer, or return NULL if there
+// aren't any.
+//-----------------------------------------------------------------------------
+static void *KeepCopy(void *p, int n, int size)
+{
+    if(n == 0) return NULL;
+    void *copy = CheckMalloc(n*size);
+    memcpy(copy, p, n*size);
+    return copy;
+}
+
+//-----------------------------------------------------------------------------
+// Is this a rung that doesn't generate any code?
+//-----------------------------------------------------------------------------
+static BOOL RungIsComment(int rung)
+{
+    return Prog.rungs[rung]->count == 1 &&
+        Prog.rungs[rung]->contents[0].which == ELEM_COMMENT;
+}
+
+//-----------------------------------------------------------------------------
+// Line the code that we kept up with the rungs as they are now: the code for
+// a rung goes in rungs[i] if it's rung i now, from wherever it was before.
+// So inserting or deleting a rung doesn't mean generating the ones after it
+// again. Whatever code doesn't belong to any rung now gets freed.
+//-----------------------------------------------------------------------------
+static void MatchKeptRungs(RungCode *rungs)
+{
+    static RungCode was[MAX_RUNGS];
+    memcpy(was, rungs, sizeof(was));
+    memset(rungs, 0, sizeof(was));
+
+    int i, j;
+    for(i = 0; i < Prog.numRungs; i++) {
+        if(RungIsComment(i)) continue;
+        int n;
+        char *source = RungSource(i, &n);
+        for(j = 0; j < MAX_RUNGS; j++) {
+            if(was[j].valid && was[j].sourceLen == n &&
+                memcmp(was[j].source, source, n)==0)
+            {
+                memcpy(&rungs[i], &was[j], sizeof(was[j]));
+                memset(&was[j], 0, sizeof(was[j]));
+                break;
+            }
+        }
+        CheckFree(source);
+    }
+    for(j = 0; j < MAX_RUNGS; j++) {
+        FreeRungCode(&was[j]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Is the code that we kept for a rung still right for it? It's for a rung
+// just like this one (see MatchKeptRungs()), but the shift registers that
+// it uses might have changed.
+//-----------------------------------------------------------------------------
+static BOOL RungCodeMatches(RungCode *rc)
+{
+    if(!rc->valid) return FALSE;
+
+    int r;
+    for(r = 0; r < ShiftRegistersCount; r++) {
+        if(rc->usesRegister[r] && rc->ring[r] != ShiftRegisters[r].ring) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// Generate the code for one rung, on its own, with the shift registers as
+// already chosen, and keep it.
+//-----------------------------------------------------------------------------
+static void GenerateRungCode(RungCode *rc, int rung, BOOL mcrUsed)
+{
+    FreeRungCode(rc);
+
+    GenElem = -1;
+    GenElemCount = 0;
     GenSymCountParThis = 0;
     GenSymCountParOut = 0;
     GenSymCountOneShot = 0;
     GenSymCountFormattedString = 0;
+    GenSymCountTemp = 0;
 
     // The EEPROM addresses for the `Make Persistent' op are assigned at
     // int code generation time.
     EepromAddrFree = 0;
-    
-    IntCodeLen = 0;
-    memset(IntCode, 0, sizeof(IntCode));
 
-    if(setjmp(CompileErrorBuf) != 0) {
-        return FALSE;
+    Gen->codeLen = 0;
+    Gen->truthTablesCount = 0;
+    Gen->lookUpTablesCount = 0;
+    Gen->piecewiseLinearsCount = 0;
+    Gen->formattedStringsCount = 0;
+    memset(RungUsesRegister, 0, sizeof(RungUsesRegister));
+    memset(RungReferences, 0, sizeof(RungReferences));
+
+    // The simulator needs the state of every element for display, so
+    // it always gets the element-by-element version.
+    if(InSimulationMode || !TruthTableFromRung(Prog.rungs[rung], mcrUsed)) {
+        Op(INT_COPY_BIT_TO_BIT, "$rung_top", "$mcr");
+        SimState(&(Prog.rungPowered[rung]), "$rung_top");
+        IntCodeFromCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[rung], "$rung_top");
+    }
+
+    rc->source = RungSource(rung, &(rc->sourceLen));
+    rc->rung = rung;
+
+    rc->codeLen = Gen->codeLen;
+    rc->code = (IntOp *)KeepCopy(Gen->code, Gen->codeLen, sizeof(IntOp));
+    rc->truthTablesCount = Gen->truthTablesCount;
+    rc->truthTables = (TruthTable *)KeepCopy(Gen->truthTables,
+        Gen->truthTablesCount, sizeof(TruthTable));
+    int i;
+    rc->lookUpTablesCount = Gen->lookUpTablesCount;
+    if(rc->lookUpTablesCount > 0) {
+        rc->lookUpTables = (ElemLookUpTable *)CheckMalloc(
+            rc->lookUpTablesCount*sizeof(ElemLookUpTable));
+    }
+    for(i = 0; i < rc->lookUpTablesCount; i++) {
+        rc->lookUpTables[i] = *(Gen->lookUpTables[i]);
+    }
+    rc->piecewiseLinearsCount = Gen->piecewiseLinearsCount;
+    if(rc->piecewiseLinearsCount > 0) {
+        rc->piecewiseLinears = (ElemPiecewiseLinear *)CheckMalloc(
+            rc->piecewiseLinearsCount*sizeof(ElemPiecewiseLinear));
+    }
+    for(i = 0; i < rc->piecewiseLinearsCount; i++) {
+        rc->piecewiseLinears[i] = *(Gen->piecewiseLinears[i]);
     }
+    rc->formattedStringsCount = Gen->formattedStringsCount;
+    rc->formattedStrings = (FormattedString *)KeepCopy(Gen->formattedStrings,
+        Gen->formattedStringsCount, sizeof(FormattedString));
+    rc->eepromBytes = EepromAddrFree;
+
+    int r;
+    for(r = 0; r < ShiftRegistersCount; r++) {
+        rc->usesRegister[r] = RungUsesRegister[r];
+        rc->ring[r] = ShiftRegisters[r].ring;
+        rc->references[r] = RungReferences[r];
+    }
+    rc->valid = TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// What each of the threads that generate rungs does: take the next rung
+// and generate its code, until there are none left. A rung that has an
+// error is left without code, and doesn't say anything; the main thread
+// tries it again, so that the errors get reported in order.
+//-----------------------------------------------------------------------------
+static DWORD WINAPI RungCodeThread(LPVOID param)
+{
+    ErrorsSuppressed = TRUE;
+    Gen = (RungScratch *)CheckMalloc(sizeof(*Gen));
 
-    Op(INT_SET_BIT, "$mcr");
+    for(;;) {
+        int k = (int)InterlockedIncrement(&RungsToGenerateNext) - 1;
+        if(k >= RungsToGenerateCount) break;
+
+        RungCode *rc = &(RungsToGenerateCode[RungsToGenerate[k]]);
+        if(setjmp(CompileErrorBuf) != 0) {
+            FreeRungCode(rc);
+            continue;
+        }
+        GenerateRungCode(rc, RungsToGenerate[k], RungsToGenerateMcrUsed);
+    }
+
+    if(Gen->code) CheckFree(Gen->code);
+    CheckFree(Gen);
+    return 0;
+}
 
+//-----------------------------------------------------------------------------
+// Generate the code for each rung whose code we haven't kept. The rungs
+// don't depend on each other, so if there are enough of them then they get
+// shared out between threads, one per processor; then any that failed get
+// done again here, in order, which reports the first error just as if
+// we'd done them all here.
+//-----------------------------------------------------------------------------
+static void GenerateChangedRungs(RungCode *rungs, BOOL mcrUsed)
+{
     int i;
+
+    RungsToGenerateCount = 0;
     for(i = 0; i < Prog.numRungs; i++) {
-        if(Prog.rungs[i]->count == 1 && 
-            Prog.rungs[i]->contents[0].which == ELEM_COMMENT)
+        if(RungIsComment(i)) continue;
+        if(!RungCodeMatches(&rungs[i])) {
+            FreeRungCode(&rungs[i]);
+            RungsToGenerate[RungsToGenerateCount++] = i;
+        }
+    }
+
+    int threads;
+    if(RungThreads > 0) {
+        threads = RungThreads;
+    } else {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        threads = RungsToGenerateCount / MIN_RUNGS_PER_THREAD;
+        if(threads > (int)si.dwNumberOfProcessors) {
+            threads = (int)si.dwNumberOfProcessors;
+        }
+    }
+    if(threads > MAX_RUNG_THREADS) threads = MAX_RUNG_THREADS;
+
+    if(threads > 1) {
+        RungsToGenerateNext = 0;
+        RungsToGenerateCode = rungs;
+        RungsToGenerateMcrUsed = mcrUsed;
+
+        HANDLE h[MAX_RUNG_THREADS];
+        int started = 0;
+        for(i = 0; i < threads; i++) {
+            h[started] = CreateThread(NULL, 0, RungCodeThread, NULL, 0, NULL);
+            if(h[started]) started++;
+        }
+        if(started > 0) {
+            WaitForMultipleObjects(started, h, TRUE, INFINITE);
+        }
+        for(i = 0; i < started; i++) {
+            CloseHandle(h[i]);
+        }
+    }
+
+    for(i = 0; i < RungsToGenerateCount; i++) {
+        RungCode *rc = &rungs[RungsToGenerate[i]];
+        if(!rc->valid) GenerateRungCode(rc, RungsToGenerate[i], mcrUsed);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Append the code that we kept for a rung to the program, as rung number
+// rung, moving its tables and EEPROM addresses along after those of the
+// rungs before it.
+//-----------------------------------------------------------------------------
+static void SpliceRungCode(RungCode *rc, int rung)
+{
+    if(IntCodeLen + rc->codeLen + 2 > MAX_INT_OPS) oops();
+    if(LookUpTablesCount + rc->lookUpTablesCount > MAX_LOOK_UP_TABLES) {
+        Error(_("Too many look-up tables."));
+        CompileError();
+    }
+    if(PiecewiseLinearsCount + rc->piecewiseLinearsCount >
+        MAX_PIECEWISE_LINEARS)
+    {
+        Error(_("Too many piecewise linear tables."));
+        CompileError();
+    }
+    if(FormattedStringsCount + rc->formattedStringsCount >
+        MAX_FORMATTED_STRINGS)
+    {
+        Error(_("Too many formatted strings."));
+        CompileError();
+    }
+
+    char start[MAX_NAME_LEN];
+    sprintf(start, "start rung %d", rung+1);
+    ProgramOp(INT_COMMENT, "", 0);
+    IntCode[IntCodeLen-1].rung = rung;
+    ProgramOp(INT_COMMENT, start, 0);
+    IntCode[IntCodeLen-1].rung = rung;
+
+    int i;
+    for(i = 0; i < rc->codeLen; i++) {
+        IntOp *a = &IntCode[IntCodeLen + i];
+        memcpy(a, &(rc->code[i]), sizeof(*a));
+        a->rung = rung;
+        RenameGenSym(a->name1, rung);
+        RenameGenSym(a->name2, rung);
+        RenameGenSym(a->name3, rung);
+        switch(a->op) {
+            case INT_SET_BIT_FROM_TRUTH_TABLE:
+                a->literal += TruthTablesCount;
+                break;
+            case INT_SET_VARIABLE_FROM_TABLE:
+                a->literal += LookUpTablesCount;
+                break;
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+                a->literal += PiecewiseLinearsCount;
+                break;
+            case INT_WRITE_FORMATTED_STRING:
+                a->literal += FormattedStringsCount;
+                break;
+            case INT_EEPROM_READ:
+            case INT_EEPROM_WRITE:
+                a->literal += EepromAddrFree;
+                break;
+            case INT_SIMULATE_NODE_STATE:
+                // The rung might have moved since we generated its code.
+                if(a->poweredAfter == &(Prog.rungPowered[rc->rung])) {
+                    a->poweredAfter = &(Prog.rungPowered[rung]);
+                }
+                break;
+        }
+    }
+    IntCodeLen += rc->codeLen;
+
+    int j;
+    for(i = 0; i < rc->truthTablesCount; i++) {
+        TruthTable *t = &TruthTables[TruthTablesCount++];
+        *t = rc->truthTables[i];
+        for(j = 0; j < t->inputs; j++) {
+            RenameGenSym(t->input[j], rung);
+        }
+    }
+    for(i = 0; i < rc->lookUpTablesCount; i++) {
+        LookUpTables[LookUpTablesCount++] = &(rc->lookUpTables[i]);
+    }
+    for(i = 0; i < rc->piecewiseLinearsCount; i++) {
+        PiecewiseLinears[PiecewiseLinearsCount++] =
+            &(rc->piecewiseLinears[i]);
+    }
+    for(i = 0; i < rc->formattedStringsCount; i++) {
+        FormattedString *fs = &FormattedStrings[FormattedStringsCount++];
+        *fs = rc->formattedStrings[i];
+        RenameGenSym(fs->convertState, rung);
+        RenameGenSym(fs->isLeadingZero, rung);
+    }
+    EepromAddrFree += rc->eepromBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Generate intermediate code for the entire program. Return TRUE if it worked,
+// else FALSE. Only the rungs that have changed since last time get generated
+// again; the others come from what we kept.
+//-----------------------------------------------------------------------------
+BOOL GenerateIntermediateCode(void)
+{
+    int i, r;
+
+    if(setjmp(CompileErrorBuf) != 0) {
+        return FALSE;
+    }
+
+    BOOL mcrUsed = MasterRelayUsed();
+    FindShiftRegisterCandidates();
+    TimersCount = 0;
+    memset(TimebaseUsed, 0, sizeof(TimebaseUsed));
+    for(i = 0; i < Prog.numRungs; i++) {
+        FindTimers(ELEM_SERIES_SUBCKT, Prog.rungs[i]);
+    }
+
+    // If anything that isn't part of a rung has changed, then we have to
+    // start again. Otherwise the rings are most likely as they were last
+    // time, so start from that.
+    int which = InSimulationMode ? 1 : 0;
+    BOOL same = RungCodeCache[which].valid &&
+        RungCodeCache[which].mcrUsed == mcrUsed &&
+        RungCodeCache[which].cycleTime == Prog.cycleTime &&
+        RungCodeCache[which].deadlineTimers == Prog.deadlineTimers &&
+        RungCodeCache[which].shiftRegistersCount == ShiftRegistersCount &&
+        RungCodeCache[which].timersCount == TimersCount &&
+        memcmp(RungCodeCache[which].timers, Timers,
+            TimersCount*sizeof(Timers[0]))==0;
+    for(r = 0; same && r < ShiftRegistersCount; r++) {
+        ShiftRegister *was = &(RungCodeCache[which].shiftRegisters[r]);
+        if(strcmp(was->name, ShiftRegisters[r].name) != 0 ||
+            was->stages != ShiftRegisters[r].stages ||
+            was->candidate != ShiftRegisters[r].candidate)
         {
-            // nothing to do for this one
+            same = FALSE;
+        }
+    }
+    if(same) {
+        for(r = 0; r < ShiftRegistersCount; r++) {
+            ShiftRegisters[r].ring =
+                RungCodeCache[which].shiftRegisters[r].ring;
+        }
+    } else {
+        for(i = 0; i < MAX_RUNGS; i++) {
+            FreeRungCode(&(RungCodeCache[which].rungs[i]));
+        }
+        RungCodeCache[which].mcrUsed = mcrUsed;
+        RungCodeCache[which].cycleTime = Prog.cycleTime;
+        RungCodeCache[which].deadlineTimers = Prog.deadlineTimers;
+        RungCodeCache[which].shiftRegistersCount = ShiftRegistersCount;
+        RungCodeCache[which].timersCount = TimersCount;
+        memcpy(RungCodeCache[which].timers, Timers,
+            TimersCount*sizeof(Timers[0]));
+        RungCodeCache[which].valid = TRUE;
+    }
+    RungCode *rungs = RungCodeCache[which].rungs;
+    MatchKeptRungs(rungs);
+
+    if(!Gen) Gen = (RungScratch *)CheckMalloc(sizeof(*Gen));
+    GenerateChangedRungs(rungs, mcrUsed);
+
+    // Now we know how often the program names the stages of each shift
+    // register, which decides whether it should be a ring; that doesn't
+    // depend on whether it is, so if it changes then generating again for
+    // the rungs that use the register is enough.
+    for(r = 0; r < ShiftRegistersCount; r++) {
+        int references = 0;
+        for(i = 0; i < Prog.numRungs; i++) {
+            if(RungIsComment(i)) continue;
+            references += rungs[i].references[r];
+        }
+        ShiftRegisters[r].ring = ShiftRegisters[r].candidate &&
+            ShiftRegisters[r].stages >= references*RING_STAGES_PER_REFERENCE;
+    }
+    GenerateChangedRungs(rungs, mcrUsed);
+    memcpy(RungCodeCache[which].shiftRegisters, ShiftRegisters,
+        sizeof(ShiftRegisters));
+
+    IntCodeLen = 0;
+    TruthTablesCount = 0;
+    LookUpTablesCount = 0;
+    PiecewiseLinearsCount = 0;
+    FormattedStringsCount = 0;
+    EepromAddrFree = 0;
+
+    ProgramOp(INT_SET_BIT, "$mcr", 0);
+    // Then step the timebases along; timebase k counts its cycles in
+    // $tick<k>_prescale, and ticks instead of counting the 2^k-th. (That
+    // count never goes past 2^k - 1, so it fits for k = 15 too.)
+    for(i = 0; i < MAX_TIMEBASES; i++) {
+        if(!TimebaseUsed[i]) continue;
+        char tick[MAX_NAME_LEN];
+        TimebaseName(tick, i);
+        if(i == 0) {
+            ProgramOp(INT_INCREMENT_VARIABLE, tick, 0);
             continue;
         }
-        Comment("");
-        Comment("start rung %d", i+1);
-        Op(INT_COPY_BIT_TO_BIT, "$rung_top", "$mcr");
-        SimState(&(Prog.rungPowered[i]), "$rung_top");
-        IntCodeFromCircuit(ELEM_SERIES_SUBCKT, Prog.rungs[i], "$rung_top");
+        char prescale[MAX_NAME_LEN];
+        sprintf(prescale, "%s_prescale", tick);
+        ProgramOp(INT_IF_VARIABLE_EQUALS_LITERAL, prescale, (1 << i) - 1);
+        ProgramOp(INT_SET_VARIABLE_TO_LITERAL, prescale, 0);
+        ProgramOp(INT_INCREMENT_VARIABLE, tick, 0);
+        ProgramOp(INT_ELSE, NULL, 0);
+        ProgramOp(INT_INCREMENT_VARIABLE, prescale, 0);
+        ProgramOp(INT_END_IF, NULL, 0);
+    }
+    for(i = 0; i < Prog.numRungs; i++) {
+        if(RungIsComment(i)) continue;
+        SpliceRungCode(&rungs[i], i);
     }
 
+    AllocateIntTemporaries();
     return TRUE;
 }
@@ -47,12 +47,28 @@
 #define INT_EEPROM_READ                         16
 #define INT_EEPROM_WRITE                        17
 
+#define INT_SET_BIT_FROM_TRUTH_TABLE            18
+
+#define INT_SET_VARIABLE_ADD_LITERAL            19
+#define INT_SET_VARIABLE_SUBTRACT_LITERAL       20
+#define INT_DECREMENT_VARIABLE                  21
+#define INT_SET_VARIABLE_MULTIPLY_DIVIDE        22
+#define INT_SET_VARIABLE_FROM_TABLE             23
+#define INT_SET_VARIABLE_PIECEWISE_LINEAR       24
+#define INT_WRITE_FORMATTED_STRING              25
+#define INT_SET_VARIABLE_FROM_RING              26
+#define INT_SET_RING_FROM_VARIABLE              27
+#define INT_SET_VARIABLE_MULTIPLY_LITERAL       28
+#define INT_SET_VARIABLE_DIVIDE_LITERAL         29
+
 #define INT_IF_GROUP(x) (((x) >= 50) && ((x) < 60))
 #define INT_IF_BIT_SET                          50
 #define INT_IF_BIT_CLEAR                        51
 #define INT_IF_VARIABLE_LES_LITERAL             52
 #define INT_IF_VARIABLE_EQUALS_VARIABLE         53
 #define INT_IF_VARIABLE_GRT_VARIABLE            54
+#define INT_IF_VARIABLE_EQUALS_LITERAL          55
+#define INT_IF_VARIABLE_GRT_LITERAL             56
 
 #define INT_ELSE                                60
 #define INT_END_IF                              61
@@ -64,6 +80,103 @@
 // Only used for the interpretable code.
 #define INT_END_OF_PROGRAM                     255
 
+// Also only for the interpretable code, the superinstructions, which each
+// do the work of a short sequence of ops that comes up often, so that the
+// interpreter dispatches once instead of two or three times.
+// INT_SET_BIT_IF_SET sets name1 if name2 is set, and likewise for the
+// others of the four; INT_SET_BIT_AND sets name1 to name2 AND name3, and
+// INT_SET_BIT_AND_NOT to name2 AND NOT name3; and
+// INT_INCREMENT_VARIABLE_IF_LES increments name1 if name2 is less than the
+// literal.
+// The rest each do a bit op and then another, or an IF. Where a bit is
+// needed beyond the three names, its address goes in the literal.
+// INT_COPY_BIT_THEN_IF_SET sets name1 to name2, and then is an
+// INT_IF_BIT_SET on name1, whose END_IF or ELSE is at name3; likewise
+// INT_SET_BIT_AND_THEN_IF_SET, for name1 := name2 AND literal.
+// INT_SET_BIT_IF_SET_THEN_COPY sets name1 if name2 is set and then sets
+// name3 to literal; INT_CLEAR_BIT_THEN_COPY clears name1 and then sets name2
+// to name3; and INT_COPY_BIT_TO_BIT_TWICE sets name1 to name2 and then
+// name3 to literal.
+// Last, the mask ops, which each take a group of sixteen bits, from an
+// address that is a multiple of sixteen, and a mask on that group in the
+// literal, so that an interpreter that packs the bits into words can test
+// or change them all at once. INT_SET_BIT_AND_ALL sets name1 to name2 AND
+// all of the bits of the mask on group name3; INT_CLEAR_BIT_IF_ANY_CLEAR
+// clears name1 unless all of the bits of the mask on group name2 are set;
+// INT_SET_BIT_IF_ANY_SET sets name1 if any of them are; and INT_SET_BITS
+// and INT_CLEAR_BITS set or clear all of the bits of the mask on group
+// name1.
+#define INT_SET_BIT_IF_SET                     200
+#define INT_SET_BIT_IF_CLEAR                   201
+#define INT_CLEAR_BIT_IF_SET                   202
+#define INT_CLEAR_BIT_IF_CLEAR                 203
+#define INT_SET_BIT_AND                        204
+#define INT_SET_BIT_AND_NOT                    205
+#define INT_INCREMENT_VARIABLE_IF_LES          206
+#define INT_COPY_BIT_THEN_IF_SET               207
+#define INT_SET_BIT_AND_THEN_IF_SET            208
+#define INT_SET_BIT_IF_SET_THEN_COPY           209
+#define INT_CLEAR_BIT_THEN_COPY                210
+#define INT_COPY_BIT_TO_BIT_TWICE              211
+#define INT_SET_BIT_AND_ALL                    212
+#define INT_CLEAR_BIT_IF_ANY_CLEAR             213
+#define INT_SET_BIT_IF_ANY_SET                 214
+#define INT_SET_BITS                           215
+#define INT_CLEAR_BITS                         216
+
+// The binary form of the interpretable code, which an interpreter can map
+// into memory and run where it lies. It is little-endian throughout. The
+// file starts with an IntImageHeader (see interpreted.cpp), and the code
+// follows at an offset that is a multiple of INT_IMAGE_ALIGN. After that
+// is the symbol table, a pair of WORDs {address, name} for every bit and
+// then for every int16, in address order, where name is an offset into
+// the string pool; the pool is last, and holds the names NUL-terminated.
+#define INT_IMAGE_MAGIC                     "LDbc"
+#define INT_IMAGE_VERSION                        1
+#define INT_IMAGE_ALIGN                          8
+// The code is either the BinOp records, just as in the text form,
+#define INT_IMAGE_FIXED                          0
+// or else packed, for small targets: each op is a byte of opcode and then
+// only the operands that it uses, in the order of these flags. A name is
+// one byte if it is less than 0x80, else two with the top bit set, high
+// byte first. A literal is one byte if it is from -64 to 63 (sign-extended
+// from bit 6), else 0x80 and then two bytes. A jump is the two-byte offset
+// of the op to go to. The length of a ring is a name after the literal. A
+// table is its length in words, as a name, and then the words themselves,
+// from an even offset.
+#define INT_IMAGE_PACKED                         1
+#define INT_PACKED_NAME1                      0x01
+#define INT_PACKED_NAME2                      0x02
+#define INT_PACKED_NAME3                      0x04
+#define INT_PACKED_LITERAL                    0x08
+#define INT_PACKED_RING_LENGTH                0x10
+#define INT_PACKED_JUMP                       0x20
+#define INT_PACKED_TABLE                      0x40
+
+// In the interpretable code, the peripheral ops have their variable in
+// name1. INT_READ_ADC and INT_SET_PWM have the channel in the literal,
+// numbered from 0 in the order in which the program first uses each one,
+// and INT_SET_PWM has its frequency in Hz after it, as a table of two words,
+// low word first. INT_UART_SEND and INT_UART_RECV have their bit in name2,
+// and INT_EEPROM_BUSY_CHECK has its bit in name1. INT_EEPROM_READ and
+// INT_EEPROM_WRITE have the address of the low byte in the literal.
+// INT_WRITE_FORMATTED_STRING has the variable to interpolate in name2, and
+// the number of steps in the literal; the table after it is the addresses
+// of the conversion state (an int16) and of the leading-zero flag (a bit),
+// and then the template.
+
+// An entry in the template of a formatted string is a literal character in
+// its low byte, unless the high byte says that it is the sign of the
+// variable (which also loads the conversion state with its magnitude) or
+// the digit worth 10^p, p in the low bits. The first digit sets the
+// leading-zero flag, and loads the conversion state from the variable if
+// there is no sign.
+#define FMTD_POWER_MASK                       0x07
+#define FMTD_MINUS                               3
+#define FMTD_DIGIT                               4
+#define FMTD_FIRST_DIGIT                         5
+#define FMTD_LOAD_VAR                            6
+
 #if !defined(INTCODE_H_CONSTANTS_ONLY)
     typedef struct IntOpTag {
         int         op;
@@ -72,11 +185,107 @@
         char        name3[MAX_NAME_LEN];
         SWORD       literal;
         BOOL       *poweredAfter;
+        // Where in the ladder the op came from: the rung, and the number
+        // of the leaf element within the rung, counting from zero in the
+        // order that they're drawn (so along a series subcircuit, then
+        // down a parallel one). The bookkeeping for the subcircuits has
+        // elem -1, and whatever isn't part of any rung has rung -1 too.
+        SWORD       rung;
+        SWORD       elem;
     } IntOp;
 
     #define MAX_INT_OPS     (1024*16)
     extern IntOp IntCode[MAX_INT_OPS];
     extern int IntCodeLen;
+
+    // A rung that is a pure boolean function of a few bits gets compiled
+    // to a lookup into one of these, instead of to contact-by-contact
+    // tests. Input k contributes (1 << k) to the index, and the result for
+    // index i is bit (i & 7) of bits[i >> 3].
+    #define MAX_TRUTH_TABLE_INPUTS  8
+    typedef struct TruthTableTag {
+        int         inputs;
+        char        input[MAX_TRUTH_TABLE_INPUTS][MAX_NAME_LEN];
+        BYTE        bits[(1 << MAX_TRUTH_TABLE_INPUTS)/8];
+    } TruthTable;
+
+    #define MAX_TRUTH_TABLES    MAX_RUNGS
+    extern TruthTable TruthTables[MAX_TRUTH_TABLES];
+    extern int TruthTablesCount;
+
+    // The look-up table instructions, whose values get written out as
+    // constant data and indexed directly; INT_SET_VARIABLE_FROM_TABLE
+    // names one of these by its literal, and does nothing if the index
+    // is out of range.
+    #define MAX_LOOK_UP_TABLES  256
+    extern ElemLookUpTable *LookUpTables[MAX_LOOK_UP_TABLES];
+    extern int LookUpTablesCount;
+
+    // Likewise for the piecewise linear tables. Segment k runs from point
+    // k to point k+1; INT_SET_VARIABLE_PIECEWISE_LINEAR finds the first
+    // segment whose upper x is not less than the index, by binary search,
+    // and interpolates along that one. It does nothing if the index is
+    // past the last point.
+    #define MAX_PIECEWISE_LINEARS   256
+    extern ElemPiecewiseLinear *PiecewiseLinears[MAX_PIECEWISE_LINEARS];
+    extern int PiecewiseLinearsCount;
+
+    // And for the formatted strings. If name1 is short of the number of
+    // steps and the UART is free, INT_WRITE_FORMATTED_STRING sends the
+    // character at position name1 of the template, and increments name1;
+    // the back ends keep the template as constant data, and share one
+    // routine to work out the character. The entries are as for FMTD_xxx,
+    // above.
+    // The escape can expand to more characters than it takes.
+    #define MAX_FORMATTED_STRING_STEPS  (MAX_LOOK_UP_TABLE_LEN + 5)
+    typedef struct FormattedStringTag {
+        char        var[MAX_NAME_LEN];
+        char        convertState[MAX_NAME_LEN];
+        char        isLeadingZero[MAX_NAME_LEN];
+        int         steps;
+        WORD        chars[MAX_FORMATTED_STRING_STEPS];
+    } FormattedString;
+
+    #define MAX_FORMATTED_STRINGS   256
+    extern FormattedString FormattedStrings[MAX_FORMATTED_STRINGS];
+    extern int FormattedStringsCount;
+
+    // A deep shift register is kept as a ring buffer: an array of its
+    // stages, and the index of the element that holds stage 0, so that a
+    // shift steps that index back by one, instead of copying every stage
+    // along. INT_SET_VARIABLE_FROM_RING sets name1 to stage literal of the
+    // ring name2, whose stage 0 is at index name3; that is the element at
+    // name3 + literal, modulo the length of the ring. Likewise
+    // INT_SET_RING_FROM_VARIABLE sets stage literal of the ring name1,
+    // whose stage 0 is at index name2, to name3. The back ends get the
+    // length from ShiftRegisterRingLength().
+
+    // INT_SET_VARIABLE_MULTIPLY_LITERAL sets name1 to name2 times literal,
+    // and INT_SET_VARIABLE_DIVIDE_LITERAL to name2 divided by literal, which
+    // is never zero. The PIC and AVR back ends make those into shifts and
+    // adds, with MultiplyByLiteralDigits() and DivideByLiteralReciprocal(),
+    // instead of calling their general multiply and divide routines.
+
+    // The scratch bits and variables are generated as virtual temporaries,
+    // each a new name with this prefix, and then AllocateIntTemporaries()
+    // (in intflow.cpp) gives them real names, so the back ends never see
+    // them.
+    #define INT_TEMP_PREFIX     "$temp_"
+
+    // The program split into basic blocks, by IntFlowAnalyse(). Block b is
+    // ops first to last inclusive, and control leaves it to one of its
+    // succs successors; succ[0] is where an IF goes if its condition is
+    // true, and succ[1] where it goes if false. A successor of -1 is the
+    // end of the cycle. Every successor comes after its block.
+    typedef struct IntBlockTag {
+        int         first;
+        int         last;
+        int         succ[2];
+        int         succs;
+    } IntBlock;
+    extern IntBlock IntBlocks[MAX_INT_OPS];
+    extern int IntBlocksCount;
+    extern int IntBlockOfOp[MAX_INT_OPS];
 #endif
 
 
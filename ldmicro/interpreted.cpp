@@ -36,6 +36,14 @@ static int VariablesCount;
 static char InternalRelays[MAX_IO][MAX_NAME_LEN];
 static int InternalRelaysCount;
 
+// The ADC and PWM channels, numbered in the order in which the program first
+// uses each one, by the name of its variable; the interpreter tells the host
+// which is which.
+static char AdcChannels[MAX_IO][MAX_NAME_LEN];
+static int AdcChannelsCount;
+static char PwmChannels[MAX_IO][MAX_NAME_LEN];
+static int PwmChannelsCount;
+
 typedef struct {
     WORD    op;
     WORD    name1;
@@ -46,6 +54,31 @@ typedef struct {
 
 static BinOp OutProg[MAX_INT_OPS];
 
+// Leave the ops as they are, instead of fusing them into superinstructions;
+// for testing, and for counting what the superinstructions save.
+BOOL NoSuperinstructions;
+
+// The header of the binary form, described in intcode.h; ldinterp.c has its
+// own copy of this, as of BinOp, and the two must agree.
+typedef struct {
+    char    magic[4];
+    WORD    version;
+    WORD    encoding;
+    DWORD   cycleTime;
+    DWORD   codeOffset;
+    DWORD   codeLength;
+    WORD    bitsCount;
+    WORD    int16sCount;
+    DWORD   symbolsOffset;
+    DWORD   stringsOffset;
+    DWORD   length;
+} IntImageHeader;
+
+// The program in the packed encoding; no op takes more than sixteen bytes,
+// counting the tables, which take at least as many records in OutProg.
+static BYTE Packed[MAX_INT_OPS*16];
+static int PackedLen;
+
 static WORD AddrForInternalRelay(char *name)
 {
     int i;
@@ -72,6 +105,116 @@ static WORD AddrForVariable(char *name)
     return i;
 }
 
+static WORD AddrForArray(char *name, int n)
+{
+    int i;
+    for(i = 0; i < VariablesCount; i++) {
+        if(strcmp(Variables[i], name)==0) {
+            return i;
+        }
+    }
+    // The elements after the first get names that can't be looked up; the
+    // arrays are all internal, so they don't get listed either.
+    strcpy(Variables[i], name);
+    int j;
+    for(j = 1; j < n; j++) {
+        sprintf(Variables[i+j], "%s[%d]", name, j);
+    }
+    VariablesCount += n;
+    return i;
+}
+
+static int ChannelFor(char channels[][MAX_NAME_LEN], int *count, char *name)
+{
+    int i;
+    for(i = 0; i < *count; i++) {
+        if(strcmp(channels[i], name)==0) {
+            return i;
+        }
+    }
+    strcpy(channels[i], name);
+    (*count)++;
+    return i;
+}
+
+//-----------------------------------------------------------------------------
+// Give addresses to the internal relays that an op uses, in the same order
+// as CompileInterpreted() does.
+//-----------------------------------------------------------------------------
+static void AddrsForRelaysOf(IntOp *a)
+{
+    int i;
+    switch(a->op) {
+        case INT_SET_BIT:
+        case INT_CLEAR_BIT:
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+        case INT_EEPROM_BUSY_CHECK:
+            AddrForInternalRelay(a->name1);
+            break;
+
+        case INT_COPY_BIT_TO_BIT:
+            AddrForInternalRelay(a->name1);
+            AddrForInternalRelay(a->name2);
+            break;
+
+        case INT_UART_SEND:
+        case INT_UART_RECV:
+            AddrForInternalRelay(a->name2);
+            break;
+
+        case INT_WRITE_FORMATTED_STRING:
+            AddrForInternalRelay(FormattedStrings[a->literal].isLeadingZero);
+            break;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE: {
+            TruthTable *t = &TruthTables[a->literal];
+            for(i = 0; i < t->inputs; i++) {
+                AddrForInternalRelay(t->input[i]);
+            }
+            AddrForInternalRelay(a->name1);
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Give the internal relays their addresses ahead of time, a rung at a time,
+// so that the relays of a rung tend to share a group of sixteen, which one
+// of the mask ops can then test or set all at once. If the new relays of a
+// rung would straddle the end of a group, but would all fit in one, then
+// they start the next group instead, and the addresses that they skip are
+// left unused.
+//-----------------------------------------------------------------------------
+static void AllocateRelaysByRung(void)
+{
+    int start, end, i;
+    for(start = 0; start < IntCodeLen; start = end) {
+        int before = InternalRelaysCount;
+        for(end = start; end < IntCodeLen &&
+            IntCode[end].rung == IntCode[start].rung; end++)
+        {
+            AddrsForRelaysOf(&IntCode[end]);
+        }
+        int after = InternalRelaysCount;
+        if(after - before > 16 || after == before ||
+            before/16 == (after - 1)/16 ||
+            (before | 15) + after - before >= MAX_IO)
+        {
+            continue;
+        }
+
+        InternalRelaysCount = before;
+        while(InternalRelaysCount % 16) {
+            strcpy(InternalRelays[InternalRelaysCount], "$unused");
+            InternalRelaysCount++;
+        }
+        for(i = start; i < end; i++) {
+            AddrsForRelaysOf(&IntCode[i]);
+        }
+    }
+}
+
 static void Write(FILE *f, BinOp *op)
 {
     BYTE *b = (BYTE *)op;
@@ -82,9 +225,586 @@ static void Write(FILE *f, BinOp *op)
     fprintf(f, "\n");
 }
 
+//-----------------------------------------------------------------------------
+// How many records after an op are inline data, and not code.
+//-----------------------------------------------------------------------------
+static int DataRecords(BinOp *op)
+{
+    switch(op->op) {
+        case INT_SET_VARIABLE_FROM_RING:
+        case INT_SET_RING_FROM_VARIABLE:
+            return 1;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE:
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+        case INT_SET_PWM:
+        case INT_WRITE_FORMATTED_STRING:
+            return op->name3;
+
+        default:
+            return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Is the op a jump, with its target (less one) in name3?
+//-----------------------------------------------------------------------------
+static BOOL IsJump(int op)
+{
+    return INT_IF_GROUP(op) || op == INT_ELSE ||
+        op == INT_COPY_BIT_THEN_IF_SET || op == INT_SET_BIT_AND_THEN_IF_SET;
+}
+
+//-----------------------------------------------------------------------------
+// Do two relays fall in the same group of sixteen, for the mask ops? And the
+// mask of the relays that an op names in its group: just the relay at addr,
+// or for a mask op the literal.
+//-----------------------------------------------------------------------------
+static BOOL SameGroup(int a, int b)
+{
+    return (a / 16) == (b / 16);
+}
+static WORD MaskOf(BinOp *op, WORD addr, BOOL isMaskOp)
+{
+    return isMaskOp ? (WORD)op->literal : (WORD)(1 << (addr % 16));
+}
+
+//-----------------------------------------------------------------------------
+// Is there a contact at record i of OutProg: a copy of the rung-in to the
+// rung-out, then an if that skips just a clear of the rung-out?
+//-----------------------------------------------------------------------------
+static BOOL IsContact(int i, BOOL *isTarget)
+{
+    BinOp *a = &OutProg[i];
+    BinOp *b = &OutProg[i+1];
+    BinOp *c = &OutProg[i+2];
+    return a->op == INT_COPY_BIT_TO_BIT &&
+        (b->op == INT_IF_BIT_CLEAR || b->op == INT_IF_BIT_SET) &&
+        b->name3 == i+2 && c->op == INT_CLEAR_BIT &&
+        c->name1 == a->name1 && b->name1 != a->name1 &&
+        !isTarget[i+1] && !isTarget[i+2];
+}
+
+//-----------------------------------------------------------------------------
+// Replace the commonest short sequences of ops among the n records of
+// OutProg with superinstructions, and return the new number of records.
+// The sequences are the ones that the ladder elements make most of; in a
+// typical program, most of the ops that run are contacts (if the input is
+// clear then clear the rung), coils (copy the rung), and the bookkeeping
+// for parallel branches (if this branch is set then set the output). A
+// sequence is fused only if nothing jumps into the middle of it, and then
+// the jumps get renumbered to match.
+//-----------------------------------------------------------------------------
+static int FuseSuperinstructions(int n)
+{
+    static BOOL isTarget[MAX_INT_OPS+1];
+    static int newPc[MAX_INT_OPS+1];
+    static BinOp fused[MAX_INT_OPS];
+    int i, m;
+
+    // A jump goes to the record after the one that it names.
+    memset(isTarget, 0, sizeof(isTarget));
+    for(i = 0; i < n; i += 1 + DataRecords(&OutProg[i])) {
+        if(IsJump(OutProg[i].op)) {
+            isTarget[OutProg[i].name3 + 1] = TRUE;
+        }
+    }
+
+    m = 0;
+    for(i = 0; i < n; ) {
+        BinOp *a = &OutProg[i];
+        BinOp *b = &OutProg[i+1];
+        BinOp op = *a;
+        int len = 0;
+
+        // An if that skips just the one op after it.
+        BOOL ifOne = INT_IF_GROUP(a->op) && a->name3 == i+1 &&
+            !isTarget[i+1];
+
+        if(IsContact(i, isTarget)) {
+            op.op = (b->op == INT_IF_BIT_CLEAR) ? INT_SET_BIT_AND :
+                INT_SET_BIT_AND_NOT;
+            op.name3 = b->name1;
+            len = 3;
+        } else if(ifOne &&
+            (a->op == INT_IF_BIT_SET || a->op == INT_IF_BIT_CLEAR) &&
+            (b->op == INT_SET_BIT || b->op == INT_CLEAR_BIT))
+        {
+            if(b->op == INT_SET_BIT) {
+                op.op = (a->op == INT_IF_BIT_SET) ? INT_SET_BIT_IF_SET :
+                    INT_SET_BIT_IF_CLEAR;
+            } else {
+                op.op = (a->op == INT_IF_BIT_SET) ? INT_CLEAR_BIT_IF_SET :
+                    INT_CLEAR_BIT_IF_CLEAR;
+            }
+            op.name1 = b->name1;
+            op.name2 = a->name1;
+            op.name3 = 0;
+            len = 2;
+        } else if(ifOne && a->op == INT_IF_VARIABLE_LES_LITERAL &&
+            b->op == INT_INCREMENT_VARIABLE)
+        {
+            op.op = INT_INCREMENT_VARIABLE_IF_LES;
+            op.name1 = b->name1;
+            op.name2 = a->name1;
+            op.name3 = 0;
+            len = 2;
+        } else if(isTarget[i+1]) {
+            // and none of the rest can be fused either
+        } else if((a->op == INT_CLEAR_BIT_IF_CLEAR ||
+                a->op == INT_CLEAR_BIT_IF_ANY_CLEAR) &&
+            (b->op == INT_CLEAR_BIT_IF_CLEAR ||
+                b->op == INT_CLEAR_BIT_IF_ANY_CLEAR) &&
+            b->name1 == a->name1 && SameGroup(a->name2, b->name2))
+        {
+            op.op = INT_CLEAR_BIT_IF_ANY_CLEAR;
+            op.name2 = a->name2 & ~15;
+            op.literal = (SWORD)(
+                MaskOf(a, a->name2, a->op == INT_CLEAR_BIT_IF_ANY_CLEAR) |
+                MaskOf(b, b->name2, b->op == INT_CLEAR_BIT_IF_ANY_CLEAR));
+            len = 2;
+        } else if((a->op == INT_SET_BIT_IF_SET ||
+                a->op == INT_SET_BIT_IF_ANY_SET) &&
+            (b->op == INT_SET_BIT_IF_SET || b->op == INT_SET_BIT_IF_ANY_SET) &&
+            b->name1 == a->name1 && SameGroup(a->name2, b->name2))
+        {
+            op.op = INT_SET_BIT_IF_ANY_SET;
+            op.name2 = a->name2 & ~15;
+            op.literal = (SWORD)(
+                MaskOf(a, a->name2, a->op == INT_SET_BIT_IF_ANY_SET) |
+                MaskOf(b, b->name2, b->op == INT_SET_BIT_IF_ANY_SET));
+            len = 2;
+        } else if((a->op == INT_SET_BIT_AND ||
+                a->op == INT_SET_BIT_AND_ALL) &&
+            (b->op == INT_CLEAR_BIT_IF_CLEAR ||
+                b->op == INT_CLEAR_BIT_IF_ANY_CLEAR) &&
+            b->name1 == a->name1 && SameGroup(a->name3, b->name2) &&
+            !(SameGroup(a->name1, b->name2) &&
+                (MaskOf(b, b->name2, b->op == INT_CLEAR_BIT_IF_ANY_CLEAR) &
+                    MaskOf(a, a->name1, FALSE))))
+        {
+            // The mask op reads all of its bits before it writes name1, so
+            // name1 mustn't be one of the bits that the second op tests.
+            op.op = INT_SET_BIT_AND_ALL;
+            op.name3 = a->name3 & ~15;
+            op.literal = (SWORD)(
+                MaskOf(a, a->name3, a->op == INT_SET_BIT_AND_ALL) |
+                MaskOf(b, b->name2, b->op == INT_CLEAR_BIT_IF_ANY_CLEAR));
+            len = 2;
+        } else if((a->op == INT_SET_BIT || a->op == INT_SET_BITS) &&
+            (b->op == INT_SET_BIT || b->op == INT_SET_BITS) &&
+            SameGroup(a->name1, b->name1))
+        {
+            op.op = INT_SET_BITS;
+            op.name1 = a->name1 & ~15;
+            op.literal = (SWORD)(MaskOf(a, a->name1, a->op == INT_SET_BITS) |
+                MaskOf(b, b->name1, b->op == INT_SET_BITS));
+            len = 2;
+        } else if((a->op == INT_CLEAR_BIT || a->op == INT_CLEAR_BITS) &&
+            (b->op == INT_CLEAR_BIT || b->op == INT_CLEAR_BITS) &&
+            SameGroup(a->name1, b->name1))
+        {
+            op.op = INT_CLEAR_BITS;
+            op.name1 = a->name1 & ~15;
+            op.literal = (SWORD)(MaskOf(a, a->name1, a->op == INT_CLEAR_BITS) |
+                MaskOf(b, b->name1, b->op == INT_CLEAR_BITS));
+            len = 2;
+        } else if(a->op == INT_COPY_BIT_TO_BIT && b->op == INT_IF_BIT_SET &&
+            b->name1 == a->name1)
+        {
+            op.op = INT_COPY_BIT_THEN_IF_SET;
+            op.name3 = b->name3;
+            len = 2;
+        } else if(a->op == INT_SET_BIT_AND && b->op == INT_IF_BIT_SET &&
+            b->name1 == a->name1)
+        {
+            op.op = INT_SET_BIT_AND_THEN_IF_SET;
+            op.literal = a->name3;
+            op.name3 = b->name3;
+            len = 2;
+        } else if(IsContact(i+1, isTarget)) {
+            // which is better fused with the ops after it, as below
+        } else if(a->op == INT_SET_BIT_IF_SET &&
+            b->op == INT_COPY_BIT_TO_BIT)
+        {
+            op.op = INT_SET_BIT_IF_SET_THEN_COPY;
+            op.name3 = b->name1;
+            op.literal = b->name2;
+            len = 2;
+        } else if(a->op == INT_CLEAR_BIT && b->op == INT_COPY_BIT_TO_BIT) {
+            op.op = INT_CLEAR_BIT_THEN_COPY;
+            op.name2 = b->name1;
+            op.name3 = b->name2;
+            len = 2;
+        } else if(a->op == INT_COPY_BIT_TO_BIT &&
+            b->op == INT_COPY_BIT_TO_BIT)
+        {
+            op.op = INT_COPY_BIT_TO_BIT_TWICE;
+            op.name3 = b->name1;
+            op.literal = b->name2;
+            len = 2;
+        }
+
+        int j;
+        if(len) {
+            for(j = 0; j < len; j++) {
+                newPc[i+j] = m;
+            }
+            memcpy(&fused[m], &op, sizeof(op));
+            m++;
+        } else {
+            // Not fused, so copy it, and any data after it, as it is.
+            len = 1 + DataRecords(a);
+            for(j = 0; j < len; j++) {
+                newPc[i+j] = m;
+                memcpy(&fused[m], &OutProg[i+j], sizeof(BinOp));
+                m++;
+            }
+        }
+        i += len;
+    }
+
+    for(i = 0; i < m; i += 1 + DataRecords(&fused[i])) {
+        if(IsJump(fused[i].op)) {
+            fused[i].name3 = newPc[fused[i].name3 + 1] - 1;
+        }
+    }
+    memcpy(OutProg, fused, m*sizeof(BinOp));
+    return m;
+}
+
+//-----------------------------------------------------------------------------
+// Write the program in the text form: a line of hex for each record, and
+// then the addresses of the bits and the int16s that the user named.
+//-----------------------------------------------------------------------------
+static void WriteText(FILE *f, int n)
+{
+    fprintf(f, "$$LDcode\n");
+    int i;
+    for(i = 0; i < n; i++) {
+        Write(f, &OutProg[i]);
+    }
+
+    fprintf(f, "$$bits\n");
+    for(i = 0; i < InternalRelaysCount; i++) {
+        if(InternalRelays[i][0] != '$') {
+            fprintf(f, "%s,%d\n", InternalRelays[i], i);
+        }
+    }
+    fprintf(f, "$$int16s\n");
+    for(i = 0; i < VariablesCount; i++) {
+        if(Variables[i][0] != '$') {
+            fprintf(f, "%s,%d\n", Variables[i], i);
+        }
+    }
+
+    fprintf(f, "$$cycle %d us\n", Prog.cycleTime);
+}
+
+//-----------------------------------------------------------------------------
+// Which operands an op carries in the packed encoding, as INT_PACKED_xxx
+// flags. The copy of this in ldinterp.c must agree.
+//-----------------------------------------------------------------------------
+static int PackedOperands(int op)
+{
+    switch(op) {
+        case INT_SET_BIT:
+        case INT_CLEAR_BIT:
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+            return INT_PACKED_NAME1;
+
+        case INT_COPY_BIT_TO_BIT:
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_SET_BIT_IF_SET:
+        case INT_SET_BIT_IF_CLEAR:
+        case INT_CLEAR_BIT_IF_SET:
+        case INT_CLEAR_BIT_IF_CLEAR:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2;
+
+        case INT_SET_BIT_AND:
+        case INT_SET_BIT_AND_NOT:
+        case INT_CLEAR_BIT_THEN_COPY:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3;
+
+        case INT_SET_BIT_IF_SET_THEN_COPY:
+        case INT_COPY_BIT_TO_BIT_TWICE:
+        case INT_SET_BIT_AND_ALL:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL;
+
+        case INT_SET_BITS:
+        case INT_CLEAR_BITS:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_TO_LITERAL:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+        case INT_INCREMENT_VARIABLE_IF_LES:
+        case INT_CLEAR_BIT_IF_ANY_CLEAR:
+        case INT_SET_BIT_IF_ANY_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_DIVIDE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3;
+
+        case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_FROM_RING:
+        case INT_SET_RING_FROM_VARIABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL | INT_PACKED_RING_LENGTH;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_TABLE;
+
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+        case INT_WRITE_FORMATTED_STRING:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL |
+                INT_PACKED_TABLE;
+
+        case INT_READ_ADC:
+        case INT_EEPROM_READ:
+        case INT_EEPROM_WRITE:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_PWM:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL | INT_PACKED_TABLE;
+
+        case INT_UART_SEND:
+        case INT_UART_RECV:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2;
+
+        case INT_EEPROM_BUSY_CHECK:
+            return INT_PACKED_NAME1;
+
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+            return INT_PACKED_NAME1 | INT_PACKED_JUMP;
+
+        case INT_COPY_BIT_THEN_IF_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_JUMP;
+
+        case INT_SET_BIT_AND_THEN_IF_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL |
+                INT_PACKED_JUMP;
+
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+        case INT_IF_VARIABLE_GRT_LITERAL:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL | INT_PACKED_JUMP;
+
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_JUMP;
+
+        case INT_ELSE:
+            return INT_PACKED_JUMP;
+
+        default:
+            return 0;
+    }
+}
+
+static void PackByte(int b)
+{
+    Packed[PackedLen++] = (BYTE)b;
+}
+
+static void PackName(WORD name)
+{
+    if(name < 0x80) {
+        PackByte(name);
+    } else {
+        PackByte(0x80 | (name >> 8));
+        PackByte(name & 0xff);
+    }
+}
+
+static void PackLiteral(SWORD literal)
+{
+    if(literal >= -64 && literal <= 63) {
+        PackByte(literal & 0x7f);
+    } else {
+        PackByte(0x80);
+        PackByte(literal & 0xff);
+        PackByte((literal >> 8) & 0xff);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Pack the n records of OutProg into Packed[]. The jumps are to record
+// numbers there, and become byte offsets here, so they get filled in once
+// every op has been placed. Returns FALSE if a jump won't fit.
+//-----------------------------------------------------------------------------
+static BOOL PackProgram(int n)
+{
+    static int offsetOf[MAX_INT_OPS];
+    static int jumpAt[MAX_INT_OPS];
+    int i;
+
+    PackedLen = 0;
+    for(i = 0; i < n; i++) {
+        jumpAt[i] = -1;
+    }
+    for(i = 0; i < n; i++) {
+        BinOp *op = &OutProg[i];
+        int operands = PackedOperands(op->op);
+
+        offsetOf[i] = PackedLen;
+        PackByte(op->op);
+        if(operands & INT_PACKED_NAME1) PackName(op->name1);
+        if(operands & INT_PACKED_NAME2) PackName(op->name2);
+        if(operands & INT_PACKED_NAME3) PackName(op->name3);
+        if(operands & INT_PACKED_LITERAL) PackLiteral(op->literal);
+        if(operands & INT_PACKED_RING_LENGTH) {
+            PackName(OutProg[i+1].literal);
+            i++;
+        }
+        if(operands & INT_PACKED_JUMP) {
+            jumpAt[i] = PackedLen;
+            PackByte(0);
+            PackByte(0);
+        }
+        if(operands & INT_PACKED_TABLE) {
+            // Only as many words as the table holds, not the whole of its
+            // last record.
+            int words;
+            if(op->op == INT_SET_BIT_FROM_TRUTH_TABLE) {
+                words = op->name2 + (((1 << op->name2) + 7)/8 + 1)/2;
+            } else if(op->op == INT_SET_VARIABLE_FROM_TABLE) {
+                words = op->literal;
+            } else if(op->op == INT_SET_PWM) {
+                words = 2;
+            } else if(op->op == INT_WRITE_FORMATTED_STRING) {
+                words = 2 + op->literal;
+            } else {
+                words = op->literal*5;
+            }
+            PackName(words);
+            if(PackedLen & 1) PackByte(0);
+            memcpy(&Packed[PackedLen], &OutProg[i+1], words*sizeof(WORD));
+            PackedLen += words*sizeof(WORD);
+            i += op->name3;
+        }
+    }
+
+    for(i = 0; i < n; i++) {
+        if(jumpAt[i] < 0) continue;
+        // The record jumps to after the one named, as in the interpreter.
+        int to = offsetOf[OutProg[i].name3 + 1];
+        if(to > 0xffff) return FALSE;
+        Packed[jumpAt[i]] = to & 0xff;
+        Packed[jumpAt[i]+1] = to >> 8;
+    }
+    return TRUE;
+}
+
+static void WritePadding(FILE *f, DWORD from, DWORD to)
+{
+    for(; from < to; from++) {
+        fputc(0, f);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the program in the binary form, with its n records as they are or
+// packed, according to encoding. The symbol table has every bit and int16,
+// including the internal ones, so that a host can find any of them.
+//-----------------------------------------------------------------------------
+static BOOL WriteImage(FILE *f, int n, int encoding)
+{
+    IntImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INT_IMAGE_MAGIC, sizeof(h.magic));
+    h.version = INT_IMAGE_VERSION;
+    h.encoding = encoding;
+    h.cycleTime = Prog.cycleTime;
+
+    void *code;
+    if(encoding == INT_IMAGE_PACKED) {
+        if(!PackProgram(n)) {
+            Error(_("Program too long for the packed interpretable code."));
+            return FALSE;
+        }
+        code = Packed;
+        h.codeLength = PackedLen;
+    } else {
+        code = OutProg;
+        h.codeLength = n*sizeof(BinOp);
+    }
+    h.codeOffset = (sizeof(h) + INT_IMAGE_ALIGN - 1) & ~(INT_IMAGE_ALIGN - 1);
+
+    h.bitsCount = InternalRelaysCount;
+    h.int16sCount = VariablesCount;
+    h.symbolsOffset = (h.codeOffset + h.codeLength + 3) & ~3;
+    h.stringsOffset = h.symbolsOffset +
+        (InternalRelaysCount + VariablesCount)*2*sizeof(WORD);
+
+    int i;
+    DWORD strings = 0;
+    for(i = 0; i < InternalRelaysCount; i++) {
+        strings += strlen(InternalRelays[i]) + 1;
+    }
+    for(i = 0; i < VariablesCount; i++) {
+        strings += strlen(Variables[i]) + 1;
+    }
+    if(strings > 0xffff) {
+        Error(_("Too many names for the binary interpretable code."));
+        return FALSE;
+    }
+    h.length = h.stringsOffset + strings;
+
+    fwrite(&h, sizeof(h), 1, f);
+    WritePadding(f, sizeof(h), h.codeOffset);
+    fwrite(code, h.codeLength, 1, f);
+    WritePadding(f, h.codeOffset + h.codeLength, h.symbolsOffset);
+
+    WORD name = 0;
+    for(i = 0; i < InternalRelaysCount + VariablesCount; i++) {
+        WORD sym[2];
+        BOOL bit = (i < InternalRelaysCount);
+        sym[0] = bit ? i : i - InternalRelaysCount;
+        sym[1] = name;
+        fwrite(sym, sizeof(sym), 1, f);
+        name += strlen(bit ? InternalRelays[sym[0]] : Variables[sym[0]]) + 1;
+    }
+    for(i = 0; i < InternalRelaysCount; i++) {
+        fwrite(InternalRelays[i], strlen(InternalRelays[i]) + 1, 1, f);
+    }
+    for(i = 0; i < VariablesCount; i++) {
+        fwrite(Variables[i], strlen(Variables[i]) + 1, 1, f);
+    }
+    return TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// The form to write, from the extension of the output file: the binary
+// form for .intb, packed for .intp, and otherwise the text form.
+//-----------------------------------------------------------------------------
+static int EncodingForFile(char *outFile)
+{
+    char *dot = strrchr(outFile, '.');
+    if(dot && _stricmp(dot, ".intb")==0) return INT_IMAGE_FIXED;
+    if(dot && _stricmp(dot, ".intp")==0) return INT_IMAGE_PACKED;
+    return -1;
+}
+
 void CompileInterpreted(char *outFile)
 {
-    FILE *f = fopen(outFile, "w");
+    int encoding = EncodingForFile(outFile);
+    FILE *f = fopen(outFile, encoding < 0 ? "w" : "wb");
     if(!f) {
         Error(_("Couldn't write to '%s'"), outFile);
         return;
@@ -92,8 +812,9 @@ void CompileInterpreted(char *outFile)
 
     InternalRelaysCount = 0;
     VariablesCount = 0;
-
-    fprintf(f, "$$LDcode\n");
+    AdcChannelsCount = 0;
+    PwmChannelsCount = 0;
+    AllocateRelaysByRung();
 
     int ipc;
     int outPc;
@@ -137,9 +858,135 @@ void CompileInterpreted(char *outFile)
                 break;
 
             case INT_INCREMENT_VARIABLE:
+            case INT_DECREMENT_VARIABLE:
                 op.name1 = AddrForVariable(IntCode[ipc].name1);
                 break;
 
+            case INT_SET_VARIABLE_ADD_LITERAL:
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForVariable(IntCode[ipc].name2);
+                op.literal = IntCode[ipc].literal;
+                break;
+
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                // The input addresses and then the table itself follow the
+                // op inline, packed into as many extra records as they need;
+                // name2 is the number of inputs and name3 the number of
+                // extra records, for the interpreter to skip.
+                TruthTable *t = &TruthTables[IntCode[ipc].literal];
+                WORD data[MAX_TRUTH_TABLE_INPUTS + sizeof(t->bits)/2 +
+                    sizeof(BinOp)/sizeof(WORD)];
+                memset(data, 0, sizeof(data));
+                int i;
+                for(i = 0; i < t->inputs; i++) {
+                    data[i] = AddrForInternalRelay(t->input[i]);
+                }
+                int bytes = ((1 << t->inputs) + 7)/8;
+                memcpy(&data[t->inputs], t->bits, bytes);
+                int words = t->inputs + (bytes + 1)/2;
+                int perRecord = sizeof(BinOp)/sizeof(WORD);
+
+                op.name1 = AddrForInternalRelay(IntCode[ipc].name1);
+                op.name2 = t->inputs;
+                op.name3 = (words + perRecord - 1)/perRecord;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                for(i = 0; i < op.name3; i++) {
+                    memcpy(&OutProg[outPc], &data[i*perRecord], sizeof(op));
+                    outPc++;
+                }
+                continue;
+            }
+
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                // The table follows the op inline, like the truth tables;
+                // literal is its length, and name3 the number of extra
+                // records.
+                ElemLookUpTable *t = LookUpTables[IntCode[ipc].literal];
+                int perRecord = sizeof(BinOp)/sizeof(WORD);
+                WORD data[MAX_LOOK_UP_TABLE_LEN + sizeof(BinOp)/sizeof(WORD)];
+                memset(data, 0, sizeof(data));
+                int i;
+                for(i = 0; i < t->count; i++) {
+                    data[i] = (WORD)t->vals[i];
+                }
+
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForVariable(IntCode[ipc].name2);
+                op.name3 = (t->count + perRecord - 1)/perRecord;
+                op.literal = t->count;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                for(i = 0; i < op.name3; i++) {
+                    memcpy(&OutProg[outPc], &data[i*perRecord], sizeof(op));
+                    outPc++;
+                }
+                continue;
+            }
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                // The same again; the table is the upper x of each segment,
+                // and then x0, y0, dy, dx for each segment, and literal is
+                // the number of segments.
+                ElemPiecewiseLinear *t =
+                    PiecewiseLinears[IntCode[ipc].literal];
+                int perRecord = sizeof(BinOp)/sizeof(WORD);
+                WORD data[(MAX_LOOK_UP_TABLE_LEN/2)*5 +
+                    sizeof(BinOp)/sizeof(WORD)];
+                memset(data, 0, sizeof(data));
+                int n = t->count - 1;
+                int i;
+                for(i = 0; i < n; i++) {
+                    SWORD seg[4];
+                    PiecewiseLinearSegment(t, i, seg);
+                    data[i] = (WORD)t->vals[(i+1)*2];
+                    int k;
+                    for(k = 0; k < 4; k++) {
+                        data[n + i*4 + k] = (WORD)seg[k];
+                    }
+                }
+
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForVariable(IntCode[ipc].name2);
+                op.name3 = (n*5 + perRecord - 1)/perRecord;
+                op.literal = n;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                for(i = 0; i < op.name3; i++) {
+                    memcpy(&OutProg[outPc], &data[i*perRecord], sizeof(op));
+                    outPc++;
+                }
+                continue;
+            }
+
+            case INT_SET_VARIABLE_FROM_RING:
+            case INT_SET_RING_FROM_VARIABLE: {
+                // The length of the ring goes in the literal of one more
+                // record after the op.
+                BOOL from = (IntCode[ipc].op == INT_SET_VARIABLE_FROM_RING);
+                char *ring = from ? IntCode[ipc].name2 : IntCode[ipc].name1;
+                int length = ShiftRegisterRingLength(ring);
+                if(from) {
+                    op.name1 = AddrForVariable(IntCode[ipc].name1);
+                    op.name2 = AddrForArray(ring, length);
+                } else {
+                    op.name1 = AddrForArray(ring, length);
+                    op.name2 = AddrForVariable(IntCode[ipc].name2);
+                }
+                op.name3 = AddrForVariable(IntCode[ipc].name3);
+                op.literal = IntCode[ipc].literal;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                memset(&op, 0, sizeof(op));
+                op.literal = length;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                continue;
+            }
+
             case INT_SET_VARIABLE_ADD:
             case INT_SET_VARIABLE_SUBTRACT:
             case INT_SET_VARIABLE_MULTIPLY:
@@ -149,11 +996,20 @@ void CompileInterpreted(char *outFile)
                 op.name3 = AddrForVariable(IntCode[ipc].name3);
                 break;
 
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForVariable(IntCode[ipc].name2);
+                op.name3 = AddrForVariable(IntCode[ipc].name3);
+                op.literal = IntCode[ipc].literal;
+                break;
+
             case INT_IF_BIT_SET:
             case INT_IF_BIT_CLEAR:
                 op.name1 = AddrForInternalRelay(IntCode[ipc].name1);
                 goto finishIf;
             case INT_IF_VARIABLE_LES_LITERAL:
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+            case INT_IF_VARIABLE_GRT_LITERAL:
                 op.name1 = AddrForVariable(IntCode[ipc].name1);
                 op.literal = IntCode[ipc].literal;
                 goto finishIf;
@@ -190,52 +1046,112 @@ finishIf:
                 // But don't generate an instruction for this.
                 continue;
 
-            case INT_SIMULATE_NODE_STATE:
-            case INT_COMMENT:
-                // Don't care; ignore, and don't generate an instruction.
+            // The peripherals are the host's, which the interpreter calls
+            // once a cycle for all of them; the ops just name the channel.
+            case INT_READ_ADC:
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.literal = ChannelFor(AdcChannels, &AdcChannelsCount,
+                    IntCode[ipc].name1);
+                break;
+
+            case INT_SET_PWM: {
+                // The frequency, in Hz, won't fit in a WORD, so it follows
+                // inline as a table of two, low word first.
+                DWORD freq = atol(IntCode[ipc].name2);
+                WORD data[sizeof(BinOp)/sizeof(WORD)];
+                memset(data, 0, sizeof(data));
+                data[0] = (WORD)freq;
+                data[1] = (WORD)(freq >> 16);
+
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name3 = 1;
+                op.literal = ChannelFor(PwmChannels, &PwmChannelsCount,
+                    IntCode[ipc].name1);
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                memcpy(&OutProg[outPc], data, sizeof(op));
+                outPc++;
                 continue;
+            }
+
+            case INT_UART_SEND:
+            case INT_UART_RECV:
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = AddrForInternalRelay(IntCode[ipc].name2);
+                break;
 
             case INT_EEPROM_BUSY_CHECK:
+                op.name1 = AddrForInternalRelay(IntCode[ipc].name1);
+                break;
+
             case INT_EEPROM_READ:
             case INT_EEPROM_WRITE:
-            case INT_READ_ADC:
-            case INT_SET_PWM:
-            case INT_UART_SEND:
-            case INT_UART_RECV:
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.literal = IntCode[ipc].literal;
+                break;
+
+            case INT_WRITE_FORMATTED_STRING: {
+                // The template follows inline, after the addresses of the
+                // conversion state and the leading-zero flag; literal is the
+                // number of steps. With nothing to interpolate, name2 is
+                // never read, so it just repeats name1.
+                FormattedString *fs = &FormattedStrings[IntCode[ipc].literal];
+                int perRecord = sizeof(BinOp)/sizeof(WORD);
+                WORD data[2 + MAX_FORMATTED_STRING_STEPS +
+                    sizeof(BinOp)/sizeof(WORD)];
+                memset(data, 0, sizeof(data));
+                data[0] = AddrForVariable(fs->convertState);
+                data[1] = AddrForInternalRelay(fs->isLeadingZero);
+                memcpy(&data[2], fs->chars, fs->steps*sizeof(WORD));
+
+                op.name1 = AddrForVariable(IntCode[ipc].name1);
+                op.name2 = *(IntCode[ipc].name2) ?
+                    AddrForVariable(IntCode[ipc].name2) : op.name1;
+                op.name3 = (2 + fs->steps + perRecord - 1)/perRecord;
+                op.literal = fs->steps;
+                memcpy(&OutProg[outPc], &op, sizeof(op));
+                outPc++;
+                int i;
+                for(i = 0; i < op.name3; i++) {
+                    memcpy(&OutProg[outPc], &data[i*perRecord], sizeof(op));
+                    outPc++;
+                }
+                continue;
+            }
+
+            case INT_SIMULATE_NODE_STATE:
+            case INT_COMMENT:
+                // Don't care; ignore, and don't generate an instruction.
+                continue;
+
             default:
-                Error(_("Unsupported op (anything ADC, PWM, UART, EEPROM) for "
-                    "interpretable target."));
-                fclose(f);
-                return;
+                oops();
+                break;
         }
         
         memcpy(&OutProg[outPc], &op, sizeof(op));
         outPc++;
     }
 
-    int i;
-    for(i = 0; i < outPc; i++) {
-        Write(f, &OutProg[i]);
-    }
     memset(&op, 0, sizeof(op));
     op.op = INT_END_OF_PROGRAM;
-    Write(f, &op);
+    memcpy(&OutProg[outPc], &op, sizeof(op));
+    outPc++;
 
-
-    fprintf(f, "$$bits\n");
-    for(i = 0; i < InternalRelaysCount; i++) {
-        if(InternalRelays[i][0] != '$') {
-            fprintf(f, "%s,%d\n", InternalRelays[i], i);
-        }
-    }
-    fprintf(f, "$$int16s\n");
-    for(i = 0; i < VariablesCount; i++) {
-        if(Variables[i][0] != '$') {
-            fprintf(f, "%s,%d\n", Variables[i], i);
-        }
+    // Some superinstructions are made from others, so keep going until
+    // nothing more fuses.
+    while(!NoSuperinstructions) {
+        int fusedPc = FuseSuperinstructions(outPc);
+        if(fusedPc == outPc) break;
+        outPc = fusedPc;
     }
 
-    fprintf(f, "$$cycle %d us\n", Prog.cycleTime);
+    if(encoding < 0) {
+        WriteText(f, outPc);
+    } else if(!WriteImage(f, outPc, encoding)) {
+        fclose(f);
+        return;
+    }
 
     fclose(f);
 
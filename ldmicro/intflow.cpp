@@ -0,0 +1,1012 @@
+//-----------------------------------------------------------------------------
+// Copyright 2007 Jonathan Westhues
+//
+// This file is part of LDmicro.
+//
+// LDmicro is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LDmicro is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LDmicro.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Analyses of the intermediate code: split it into basic blocks, work out
+// which bits and variables are live where, which assignments reach each
+// op, and what range of values each variable can hold. The scratch
+// variables that intcode.cpp uses are generated as virtual temporaries, and
+// then given real names here, sharing storage wherever the analysis says
+// that they can.
+//-----------------------------------------------------------------------------
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ldmicro.h"
+#include "intcode.h"
+
+IntBlock IntBlocks[MAX_INT_OPS];
+int IntBlocksCount;
+int IntBlockOfOp[MAX_INT_OPS];
+
+// Every bit and variable that the program names. A bit and a variable can
+// have the same name, and are still different things.
+#define MAX_FLOW_NAMES  MAX_INT_OPS
+static struct {
+    char    name[MAX_NAME_LEN];
+    BOOL    isBit;
+    BOOL    isTemp;
+} FlowNames[MAX_FLOW_NAMES];
+static int FlowNamesCount;
+
+// The names that each op reads and writes. An op that only sometimes
+// writes a name also reads it, since otherwise it keeps its old value.
+#define MAX_OP_OPERANDS (MAX_TRUTH_TABLE_INPUTS + 3)
+typedef struct NameListTag {
+    int     n;
+    int     name[MAX_OP_OPERANDS];
+} NameList;
+static NameList OpReads[MAX_INT_OPS];
+static NameList OpWrites[MAX_INT_OPS];
+
+// A set of names, or of definitions, one bit each.
+typedef DWORD *FlowSet;
+#define SET_WORDS(n) (((n) + 31)/32)
+#define IN_SET(s, i) (((s)[(i) >> 5] >> ((i) & 31)) & 1)
+#define ADD_TO_SET(s, i) ((s)[(i) >> 5] |= ((DWORD)1 << ((i) & 31)))
+#define REMOVE_FROM_SET(s, i) ((s)[(i) >> 5] &= ~((DWORD)1 << ((i) & 31)))
+
+// Live on entry to and exit from each block, over the names.
+static FlowSet LiveIn[MAX_INT_OPS];
+static FlowSet LiveOut[MAX_INT_OPS];
+
+// The definitions are numbered with the value that each name has at the
+// start of the cycle first, so that definition n is name n from the
+// previous cycle, and then each write by an op.
+static int DefsCount;
+static int *DefOp;
+static int *DefName;
+static int *DefsOfNameStart;
+static int *DefsOfName;
+static FlowSet ReachIn[MAX_INT_OPS];
+
+// The smallest and largest values that each variable can ever hold, as far
+// as we can tell, even for a moment within the cycle; meaningless for the
+// bits.
+#define RANGE_MIN   (-32768)
+#define RANGE_MAX   32767
+static int RangeLo[MAX_FLOW_NAMES];
+static int RangeHi[MAX_FLOW_NAMES];
+
+//-----------------------------------------------------------------------------
+// Free everything from the last time that we analysed the program.
+//-----------------------------------------------------------------------------
+static void FreeFlowSets(void)
+{
+    int i;
+    for(i = 0; i < IntBlocksCount; i++) {
+        if(LiveIn[i]) CheckFree(LiveIn[i]);
+        if(LiveOut[i]) CheckFree(LiveOut[i]);
+        if(ReachIn[i]) CheckFree(ReachIn[i]);
+        LiveIn[i] = NULL;
+        LiveOut[i] = NULL;
+        ReachIn[i] = NULL;
+    }
+    if(DefOp) CheckFree(DefOp);
+    if(DefName) CheckFree(DefName);
+    if(DefsOfNameStart) CheckFree(DefsOfNameStart);
+    if(DefsOfName) CheckFree(DefsOfName);
+    DefOp = NULL;
+    DefName = NULL;
+    DefsOfNameStart = NULL;
+    DefsOfName = NULL;
+    DefsCount = 0;
+}
+
+static FlowSet NewSet(int n)
+{
+    FlowSet s = (FlowSet)CheckMalloc(SET_WORDS(n)*sizeof(DWORD));
+    memset(s, 0, SET_WORDS(n)*sizeof(DWORD));
+    return s;
+}
+
+//-----------------------------------------------------------------------------
+// Is this one of the virtual temporaries from GenSymTemp() in intcode.cpp?
+//-----------------------------------------------------------------------------
+static BOOL IsTemporary(char *name)
+{
+    return strncmp(name, INT_TEMP_PREFIX, strlen(INT_TEMP_PREFIX))==0;
+}
+
+//-----------------------------------------------------------------------------
+// Return the index of a name in our table, or -1 if the program doesn't use
+// it.
+//-----------------------------------------------------------------------------
+int IntFlowNameIndex(char *name, BOOL isBit)
+{
+    int i;
+    for(i = 0; i < FlowNamesCount; i++) {
+        if(FlowNames[i].isBit == isBit && strcmp(FlowNames[i].name, name)==0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void AddOperand(NameList *l, char *name, BOOL isBit)
+{
+    if(!name || !*name) return;
+
+    int i = IntFlowNameIndex(name, isBit);
+    if(i < 0) {
+        if(FlowNamesCount >= MAX_FLOW_NAMES) oops();
+        i = FlowNamesCount++;
+        strcpy(FlowNames[i].name, name);
+        FlowNames[i].isBit = isBit;
+        FlowNames[i].isTemp = IsTemporary(name);
+    }
+    if(l->n >= MAX_OP_OPERANDS) oops();
+    l->name[l->n++] = i;
+}
+
+//-----------------------------------------------------------------------------
+// Work out which names op i reads and writes.
+//-----------------------------------------------------------------------------
+static void Operands(int i)
+{
+    IntOp *a = &IntCode[i];
+    NameList *r = &OpReads[i];
+    NameList *w = &OpWrites[i];
+    r->n = 0;
+    w->n = 0;
+
+    switch(a->op) {
+        case INT_SET_BIT:
+        case INT_CLEAR_BIT:
+            AddOperand(w, a->name1, TRUE);
+            break;
+
+        case INT_COPY_BIT_TO_BIT:
+            AddOperand(w, a->name1, TRUE);
+            AddOperand(r, a->name2, TRUE);
+            break;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE: {
+            TruthTable *t = &TruthTables[a->literal];
+            int j;
+            for(j = 0; j < t->inputs; j++) {
+                AddOperand(r, t->input[j], TRUE);
+            }
+            AddOperand(w, a->name1, TRUE);
+            break;
+        }
+        case INT_EEPROM_BUSY_CHECK:
+            AddOperand(r, a->name1, TRUE);
+            AddOperand(w, a->name1, TRUE);
+            break;
+
+        case INT_SET_VARIABLE_TO_LITERAL:
+        case INT_READ_ADC:
+        case INT_EEPROM_READ:
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(r, a->name3, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_SET_VARIABLE_DIVIDE:
+            // unchanged on a divide by zero
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(r, a->name3, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_WRITE_FORMATTED_STRING: {
+            FormattedString *fs = &FormattedStrings[a->literal];
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(r, fs->convertState, FALSE);
+            AddOperand(r, fs->isLeadingZero, TRUE);
+            AddOperand(w, a->name1, FALSE);
+            AddOperand(w, fs->convertState, FALSE);
+            AddOperand(w, fs->isLeadingZero, TRUE);
+            break;
+        }
+        case INT_SET_VARIABLE_FROM_RING:
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(r, a->name3, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_SET_RING_FROM_VARIABLE:
+            // just one stage of the ring changes
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, FALSE);
+            AddOperand(r, a->name3, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            break;
+
+        case INT_UART_SEND:
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, TRUE);
+            AddOperand(w, a->name2, TRUE);
+            break;
+
+        case INT_UART_RECV:
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(w, a->name1, FALSE);
+            AddOperand(w, a->name2, TRUE);
+            break;
+
+        case INT_SET_PWM:
+            // name2 is the frequency, not a variable
+        case INT_EEPROM_WRITE:
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+        case INT_IF_VARIABLE_GRT_LITERAL:
+            AddOperand(r, a->name1, FALSE);
+            break;
+
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            AddOperand(r, a->name1, FALSE);
+            AddOperand(r, a->name2, FALSE);
+            break;
+
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+        case INT_SIMULATE_NODE_STATE:
+            AddOperand(r, a->name1, TRUE);
+            break;
+
+        case INT_ELSE:
+        case INT_END_IF:
+        case INT_COMMENT:
+            break;
+
+        default:
+            oops();
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Does op i write name n, and if so then is it sure to? An op that reads
+// the name too might leave it as it was, as far as we know.
+//-----------------------------------------------------------------------------
+static BOOL Reads(int i, int n)
+{
+    int j;
+    for(j = 0; j < OpReads[i].n; j++) {
+        if(OpReads[i].name[j] == n) return TRUE;
+    }
+    return FALSE;
+}
+static BOOL AlwaysWrites(int i, int n)
+{
+    return !Reads(i, n);
+}
+
+//-----------------------------------------------------------------------------
+// Split the program into basic blocks. A block starts at the first op, after
+// an IF or an ELSE, and at an END IF. Control leaves a block that ends with
+// an IF to the op after it if the condition is true, and else to the op
+// after its ELSE, or to its END IF if there isn't one; a block that ends
+// with an ELSE goes to the matching END IF; any other block goes on to the
+// next one, or ends the cycle if it's the last.
+//-----------------------------------------------------------------------------
+static void FindBasicBlocks(void)
+{
+    static int IfStack[MAX_INT_OPS];
+    static int ElseOf[MAX_INT_OPS];
+    static int EndIfOf[MAX_INT_OPS];
+    static BOOL Leader[MAX_INT_OPS+1];
+    int depth = 0;
+    int i;
+
+    for(i = 0; i <= IntCodeLen; i++) {
+        Leader[i] = FALSE;
+    }
+    Leader[0] = TRUE;
+    for(i = 0; i < IntCodeLen; i++) {
+        int op = IntCode[i].op;
+        if(INT_IF_GROUP(op)) {
+            IfStack[depth++] = i;
+            ElseOf[i] = -1;
+            Leader[i+1] = TRUE;
+        } else if(op == INT_ELSE) {
+            if(depth < 1) oops();
+            ElseOf[IfStack[depth-1]] = i;
+            Leader[i+1] = TRUE;
+        } else if(op == INT_END_IF) {
+            if(depth < 1) oops();
+            int j = IfStack[--depth];
+            EndIfOf[j] = i;
+            if(ElseOf[j] >= 0) EndIfOf[ElseOf[j]] = i;
+            Leader[i] = TRUE;
+        }
+    }
+    if(depth != 0) oops();
+
+    IntBlocksCount = 0;
+    for(i = 0; i < IntCodeLen; i++) {
+        if(Leader[i]) {
+            IntBlocks[IntBlocksCount].first = i;
+            IntBlocksCount++;
+        }
+        IntBlocks[IntBlocksCount-1].last = i;
+        IntBlockOfOp[i] = IntBlocksCount-1;
+    }
+
+    int b;
+    for(b = 0; b < IntBlocksCount; b++) {
+        IntBlock *bl = &IntBlocks[b];
+        int last = bl->last;
+        int op = IntCode[last].op;
+        int to[2];
+        int n;
+        if(INT_IF_GROUP(op)) {
+            to[0] = last + 1;
+            to[1] = (ElseOf[last] >= 0) ? ElseOf[last] + 1 : EndIfOf[last];
+            n = 2;
+        } else if(op == INT_ELSE) {
+            to[0] = EndIfOf[last];
+            n = 1;
+        } else {
+            to[0] = last + 1;
+            n = 1;
+        }
+        bl->succs = 0;
+        int j;
+        for(j = 0; j < n; j++) {
+            int s = (to[j] >= IntCodeLen) ? -1 : IntBlockOfOp[to[j]];
+            // Everything goes forward, which the analyses rely on.
+            if(s >= 0 && s <= b) oops();
+            if(bl->succs > 0 && bl->succ[0] == s) continue;
+            bl->succ[bl->succs++] = s;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Which names are live, going backwards through the blocks. At the end of
+// the cycle everything is live except for the temporaries, since it will be
+// read in the next cycle, or it's an output. Since control only goes
+// forward, one pass in reverse order is enough.
+//-----------------------------------------------------------------------------
+static void Liveness(void)
+{
+    int words = SET_WORDS(FlowNamesCount);
+    int b, i, j, k;
+
+    for(b = IntBlocksCount - 1; b >= 0; b--) {
+        IntBlock *bl = &IntBlocks[b];
+        FlowSet out = NewSet(FlowNamesCount);
+        for(j = 0; j < bl->succs; j++) {
+            if(bl->succ[j] < 0) {
+                for(i = 0; i < FlowNamesCount; i++) {
+                    if(!FlowNames[i].isTemp) ADD_TO_SET(out, i);
+                }
+            } else {
+                FlowSet in = LiveIn[bl->succ[j]];
+                for(k = 0; k < words; k++) out[k] |= in[k];
+            }
+        }
+        LiveOut[b] = out;
+
+        FlowSet live = NewSet(FlowNamesCount);
+        memcpy(live, out, words*sizeof(DWORD));
+        for(i = bl->last; i >= bl->first; i--) {
+            for(j = 0; j < OpWrites[i].n; j++) {
+                REMOVE_FROM_SET(live, OpWrites[i].name[j]);
+            }
+            for(j = 0; j < OpReads[i].n; j++) {
+                ADD_TO_SET(live, OpReads[i].name[j]);
+            }
+        }
+        LiveIn[b] = live;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Apply the effect of op i to a set of reaching definitions.
+//-----------------------------------------------------------------------------
+static void ReachThroughOp(int i, FlowSet s)
+{
+    int j, k;
+    for(j = 0; j < OpWrites[i].n; j++) {
+        int n = OpWrites[i].name[j];
+        int def = -1;
+        for(k = DefsOfNameStart[n]; k < DefsOfNameStart[n+1]; k++) {
+            int d = DefsOfName[k];
+            if(DefOp[d] == i) {
+                def = d;
+            } else if(AlwaysWrites(i, n)) {
+                REMOVE_FROM_SET(s, d);
+            }
+        }
+        if(def < 0) oops();
+        ADD_TO_SET(s, def);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Which definitions reach the start of each block, going forwards. At the
+// start of the cycle that is just the values from the previous cycle. Again
+// one pass in order is enough.
+//-----------------------------------------------------------------------------
+static void ReachingDefinitions(void)
+{
+    int i, j, k, n;
+
+    DefsCount = FlowNamesCount;
+    for(i = 0; i < IntCodeLen; i++) {
+        DefsCount += OpWrites[i].n;
+    }
+    DefOp = (int *)CheckMalloc(DefsCount*sizeof(int));
+    DefName = (int *)CheckMalloc(DefsCount*sizeof(int));
+    DefsOfName = (int *)CheckMalloc(DefsCount*sizeof(int));
+    DefsOfNameStart = (int *)CheckMalloc((FlowNamesCount+1)*sizeof(int));
+
+    int d = 0;
+    for(n = 0; n < FlowNamesCount; n++) {
+        DefOp[d] = -1;
+        DefName[d] = n;
+        d++;
+    }
+    for(i = 0; i < IntCodeLen; i++) {
+        for(j = 0; j < OpWrites[i].n; j++) {
+            DefOp[d] = i;
+            DefName[d] = OpWrites[i].name[j];
+            d++;
+        }
+    }
+
+    // and index them by name, so that we can find the ones a write kills
+    for(n = 0; n <= FlowNamesCount; n++) {
+        DefsOfNameStart[n] = 0;
+    }
+    for(d = 0; d < DefsCount; d++) {
+        DefsOfNameStart[DefName[d] + 1]++;
+    }
+    for(n = 0; n < FlowNamesCount; n++) {
+        DefsOfNameStart[n+1] += DefsOfNameStart[n];
+    }
+    int *fill = (int *)CheckMalloc((FlowNamesCount+1)*sizeof(int));
+    memcpy(fill, DefsOfNameStart, (FlowNamesCount+1)*sizeof(int));
+    for(d = 0; d < DefsCount; d++) {
+        DefsOfName[fill[DefName[d]]++] = d;
+    }
+    CheckFree(fill);
+
+    int words = SET_WORDS(DefsCount);
+    int b;
+    for(b = 0; b < IntBlocksCount; b++) {
+        ReachIn[b] = NewSet(DefsCount);
+    }
+    for(n = 0; n < FlowNamesCount; n++) {
+        ADD_TO_SET(ReachIn[0], n);
+    }
+    FlowSet s = NewSet(DefsCount);
+    for(b = 0; b < IntBlocksCount; b++) {
+        IntBlock *bl = &IntBlocks[b];
+        memcpy(s, ReachIn[b], words*sizeof(DWORD));
+        for(i = bl->first; i <= bl->last; i++) {
+            ReachThroughOp(i, s);
+        }
+        for(j = 0; j < bl->succs; j++) {
+            if(bl->succ[j] < 0) continue;
+            FlowSet in = ReachIn[bl->succ[j]];
+            for(k = 0; k < words; k++) in[k] |= s[k];
+        }
+    }
+    CheckFree(s);
+}
+
+//-----------------------------------------------------------------------------
+// What an IF that we're inside of says about a variable: that it's from lo
+// to hi, on the branch that we're in now. Until the branch writes the
+// variable, anyways; then valid goes false.
+//-----------------------------------------------------------------------------
+typedef struct RangeGuardTag {
+    int     name;
+    int     lo[2];
+    int     hi[2];
+    int     branch;
+    BOOL    valid;
+} RangeGuard;
+static RangeGuard RangeGuards[MAX_INT_OPS];
+static int RangeGuardsCount;
+
+static void PushRangeGuard(int op)
+{
+    IntOp *a = &IntCode[op];
+    RangeGuard *g = &RangeGuards[RangeGuardsCount++];
+    g->name = -1;
+    g->branch = 0;
+    g->valid = TRUE;
+    g->lo[0] = g->lo[1] = RANGE_MIN;
+    g->hi[0] = g->hi[1] = RANGE_MAX;
+
+    int lit = a->literal;
+    switch(a->op) {
+        case INT_IF_VARIABLE_LES_LITERAL:
+            g->hi[0] = lit - 1;
+            g->lo[1] = lit;
+            break;
+        case INT_IF_VARIABLE_GRT_LITERAL:
+            g->lo[0] = lit + 1;
+            g->hi[1] = lit;
+            break;
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+            g->lo[0] = g->hi[0] = lit;
+            break;
+        default:
+            return;
+    }
+    g->name = IntFlowNameIndex(a->name1, FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// The range of variable n where op i reads it: its range over the whole
+// program, narrowed by the IFs around the op. Empty (lo > hi) if the IFs
+// say that the op can never run.
+//-----------------------------------------------------------------------------
+static void RangeAt(int n, int *lo, int *hi)
+{
+    *lo = RangeLo[n];
+    *hi = RangeHi[n];
+    int j;
+    for(j = 0; j < RangeGuardsCount; j++) {
+        RangeGuard *g = &RangeGuards[j];
+        if(g->name != n || !g->valid) continue;
+        if(g->lo[g->branch] > *lo) *lo = g->lo[g->branch];
+        if(g->hi[g->branch] < *hi) *hi = g->hi[g->branch];
+    }
+}
+static void RangeOfOperand(char *name, int *lo, int *hi)
+{
+    int n = IntFlowNameIndex(name, FALSE);
+    if(n < 0) oops();
+    RangeAt(n, lo, hi);
+}
+
+//-----------------------------------------------------------------------------
+// The range of the values that op i might write to variable n, given the
+// ranges of what it reads; anything that we don't know about could be
+// anything.
+//-----------------------------------------------------------------------------
+static void RangeWritten(int i, int n, int *lo, int *hi)
+{
+    IntOp *a = &IntCode[i];
+    int lo2, hi2, lo3, hi3;
+    int j;
+
+    *lo = RANGE_MIN;
+    *hi = RANGE_MAX;
+    if(strcmp(FlowNames[n].name, a->name1)!=0) return;
+
+    switch(a->op) {
+        case INT_SET_VARIABLE_TO_LITERAL:
+            *lo = *hi = a->literal;
+            break;
+
+        case INT_SET_VARIABLE_TO_VARIABLE:
+            RangeOfOperand(a->name2, lo, hi);
+            break;
+
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+            RangeOfOperand(a->name1, lo, hi);
+            j = (a->op == INT_INCREMENT_VARIABLE) ? 1 : -1;
+            *lo += j;
+            *hi += j;
+            break;
+
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+            RangeOfOperand(a->name2, lo, hi);
+            j = (a->op == INT_SET_VARIABLE_ADD_LITERAL) ? a->literal :
+                -a->literal;
+            *lo += j;
+            *hi += j;
+            break;
+
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+            // Either is monotonic in the variable, so take the ends.
+            RangeOfOperand(a->name2, &lo2, &hi2);
+            if(lo2 > hi2) {
+                *lo = 1;
+                *hi = 0;
+                break;
+            }
+            if(a->op == INT_SET_VARIABLE_MULTIPLY_LITERAL) {
+                lo3 = lo2*a->literal;
+                hi3 = hi2*a->literal;
+            } else {
+                lo3 = lo2/a->literal;
+                hi3 = hi2/a->literal;
+            }
+            *lo = (lo3 < hi3) ? lo3 : hi3;
+            *hi = (lo3 < hi3) ? hi3 : lo3;
+            break;
+
+        case INT_SET_VARIABLE_ADD:
+            RangeOfOperand(a->name2, &lo2, &hi2);
+            RangeOfOperand(a->name3, &lo3, &hi3);
+            *lo = lo2 + lo3;
+            *hi = hi2 + hi3;
+            break;
+
+        case INT_SET_VARIABLE_SUBTRACT:
+            RangeOfOperand(a->name2, &lo2, &hi2);
+            RangeOfOperand(a->name3, &lo3, &hi3);
+            *lo = lo2 - hi3;
+            *hi = hi2 - lo3;
+            break;
+
+        case INT_SET_VARIABLE_MULTIPLY: {
+            RangeOfOperand(a->name2, &lo2, &hi2);
+            RangeOfOperand(a->name3, &lo3, &hi3);
+            if(lo2 > hi2 || lo3 > hi3) {
+                *lo = 1;
+                *hi = 0;
+                break;
+            }
+            int p[4] = { lo2*lo3, lo2*hi3, hi2*lo3, hi2*hi3 };
+            *lo = *hi = p[0];
+            for(j = 1; j < 4; j++) {
+                if(p[j] < *lo) *lo = p[j];
+                if(p[j] > *hi) *hi = p[j];
+            }
+            break;
+        }
+        case INT_SET_VARIABLE_DIVIDE:
+            // The quotient is no bigger than the dividend, and it's left
+            // alone on a divide by zero, which the join will take care of.
+            RangeOfOperand(a->name2, &lo2, &hi2);
+            RangeOfOperand(a->name3, &lo3, &hi3);
+            if(lo2 > hi2 || lo3 > hi3) {
+                *lo = 1;
+                *hi = 0;
+            } else if(lo2 >= 0 && lo3 >= 0) {
+                *lo = 0;
+                *hi = hi2;
+            } else {
+                *hi = (abs(lo2) > abs(hi2)) ? abs(lo2) : abs(hi2);
+                *lo = -*hi;
+            }
+            break;
+
+        case INT_SET_VARIABLE_FROM_TABLE: {
+            ElemLookUpTable *t = LookUpTables[a->literal];
+            *lo = RANGE_MAX;
+            *hi = RANGE_MIN;
+            for(j = 0; j < t->count; j++) {
+                if(t->vals[j] < *lo) *lo = t->vals[j];
+                if(t->vals[j] > *hi) *hi = t->vals[j];
+            }
+            break;
+        }
+        case INT_READ_ADC:
+            *lo = 0;
+            *hi = 1023;
+            break;
+
+        case INT_UART_RECV:
+            *lo = 0;
+            *hi = 255;
+            break;
+
+        case INT_WRITE_FORMATTED_STRING:
+            // The sequencer steps on only while it's short of the end.
+            RangeOfOperand(a->name1, lo, hi);
+            if(*hi > FormattedStrings[a->literal].steps - 1) {
+                *hi = FormattedStrings[a->literal].steps - 1;
+            }
+            (*lo)++;
+            (*hi)++;
+            break;
+    }
+
+    // If it might have overflowed then it might have wrapped around to
+    // anything.
+    if(*lo <= *hi && (*lo < RANGE_MIN || *hi > RANGE_MAX)) {
+        *lo = RANGE_MIN;
+        *hi = RANGE_MAX;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Work out the range of every variable. Everything starts at zero, and then
+// each op widens the range of whatever it writes to take in what it might
+// write, until nothing changes. A counter going up one at a time would take
+// a pass per count to get there, so after a few passes just widen to the
+// next size that a variable might fit in.
+//-----------------------------------------------------------------------------
+static void FindVariableRanges(void)
+{
+    int i, j, n;
+    for(n = 0; n < FlowNamesCount; n++) {
+        RangeLo[n] = 0;
+        RangeHi[n] = 0;
+    }
+
+    int pass;
+    BOOL changed = TRUE;
+    for(pass = 0; changed; pass++) {
+        changed = FALSE;
+        BOOL widen = (pass >= 8);
+        RangeGuardsCount = 0;
+        for(i = 0; i < IntCodeLen; i++) {
+            int op = IntCode[i].op;
+            if(INT_IF_GROUP(op)) {
+                PushRangeGuard(i);
+                continue;
+            } else if(op == INT_ELSE) {
+                RangeGuard *g = &RangeGuards[RangeGuardsCount-1];
+                g->branch = 1;
+                g->valid = TRUE;
+                continue;
+            } else if(op == INT_END_IF) {
+                RangeGuardsCount--;
+                continue;
+            }
+
+            for(j = 0; j < OpWrites[i].n; j++) {
+                n = OpWrites[i].name[j];
+                if(FlowNames[n].isBit) continue;
+
+                int lo, hi;
+                RangeWritten(i, n, &lo, &hi);
+                if(lo > hi) continue;
+
+                if(lo < RangeLo[n]) {
+                    if(widen) lo = (lo >= 0) ? 0 : RANGE_MIN;
+                    RangeLo[n] = lo;
+                    changed = TRUE;
+                }
+                if(hi > RangeHi[n]) {
+                    if(widen) hi = (hi <= 255) ? 255 : RANGE_MAX;
+                    RangeHi[n] = hi;
+                    changed = TRUE;
+                }
+            }
+            // and what the IFs said about it is out of date now
+            for(j = 0; j < OpWrites[i].n; j++) {
+                int k;
+                for(k = 0; k < RangeGuardsCount; k++) {
+                    if(RangeGuards[k].name == OpWrites[i].name[j]) {
+                        RangeGuards[k].valid = FALSE;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyse the intermediate code as it is now: find the basic blocks, and
+// work out liveness and reaching definitions for every bit and variable,
+// and the ranges of the variables.
+//-----------------------------------------------------------------------------
+void IntFlowAnalyse(void)
+{
+    FreeFlowSets();
+
+    FlowNamesCount = 0;
+    int i;
+    for(i = 0; i < IntCodeLen; i++) {
+        Operands(i);
+    }
+    FindBasicBlocks();
+    Liveness();
+    ReachingDefinitions();
+    FindVariableRanges();
+}
+
+//-----------------------------------------------------------------------------
+// Is the name live on entry to, or exit from, a block?
+//-----------------------------------------------------------------------------
+BOOL IntFlowLiveIn(int block, int name)
+{
+    return IN_SET(LiveIn[block], name);
+}
+BOOL IntFlowLiveOut(int block, int name)
+{
+    return IN_SET(LiveOut[block], name);
+}
+
+//-----------------------------------------------------------------------------
+// Does the variable always hold a value from 0 to 255, so that its high
+// octet is always zero, and the arithmetic on it can be done in one octet?
+//-----------------------------------------------------------------------------
+BOOL IntFlowVariableIsByte(char *name)
+{
+    int n = IntFlowNameIndex(name, FALSE);
+    if(n < 0) return FALSE;
+    return RangeLo[n] >= 0 && RangeHi[n] <= 255;
+}
+
+//-----------------------------------------------------------------------------
+// Find the assignments to name that might be the ones it has when op runs.
+// Each is the index of the op that makes it, or -1 for the value that it
+// had at the start of the cycle. Returns how many there are, of which at
+// most max get written to defs.
+//-----------------------------------------------------------------------------
+int IntFlowReachingDefinitions(int op, int name, int *defs, int max)
+{
+    int b = IntBlockOfOp[op];
+    FlowSet s = NewSet(DefsCount);
+    memcpy(s, ReachIn[b], SET_WORDS(DefsCount)*sizeof(DWORD));
+    int i;
+    for(i = IntBlocks[b].first; i < op; i++) {
+        ReachThroughOp(i, s);
+    }
+
+    int n = 0;
+    int k;
+    for(k = DefsOfNameStart[name]; k < DefsOfNameStart[name+1]; k++) {
+        int d = DefsOfName[k];
+        if(!IN_SET(s, d)) continue;
+        if(n < max) defs[n] = DefOp[d];
+        n++;
+    }
+    CheckFree(s);
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// Replace the virtual temporaries with real names. Two temporaries of the
+// same kind can share a name unless one of them is live where the other is
+// written; those that can't get told apart by a graph colouring, taking
+// them in the order that they first appear. The names are `$scratch',
+// `$scratch2', and so on, as bits or variables.
+//-----------------------------------------------------------------------------
+void AllocateIntTemporaries(void)
+{
+    IntFlowAnalyse();
+
+    int i, j, k, n;
+
+    // A temporary must be written before it is read, in every cycle, or it
+    // would be picking up another one's value.
+    for(i = 0; i < IntCodeLen; i++) {
+        for(j = 0; j < OpReads[i].n; j++) {
+            n = OpReads[i].name[j];
+            if(!FlowNames[n].isTemp) continue;
+            int defs[2];
+            int c = IntFlowReachingDefinitions(i, n, defs, 2);
+            for(k = 0; k < c && k < 2; k++) {
+                if(defs[k] < 0) oops();
+            }
+        }
+    }
+
+    // The interference graph, as a list of pairs; count them first.
+    int words = SET_WORDS(FlowNamesCount);
+    FlowSet live = NewSet(FlowNamesCount);
+    int *pairs = NULL;
+    int pairsCount = 0;
+    int pass;
+    for(pass = 0; pass < 2; pass++) {
+        int p = 0;
+        int b;
+        for(b = 0; b < IntBlocksCount; b++) {
+            memcpy(live, LiveOut[b], words*sizeof(DWORD));
+            for(i = IntBlocks[b].last; i >= IntBlocks[b].first; i--) {
+                for(j = 0; j < OpWrites[i].n; j++) {
+                    int w = OpWrites[i].name[j];
+                    if(!FlowNames[w].isTemp) continue;
+                    for(n = 0; n < FlowNamesCount; n++) {
+                        if(n == w || !FlowNames[n].isTemp) continue;
+                        if(FlowNames[n].isBit != FlowNames[w].isBit) continue;
+                        if(!IN_SET(live, n)) continue;
+                        if(pass == 1) {
+                            pairs[2*p] = w;
+                            pairs[2*p + 1] = n;
+                        }
+                        p++;
+                    }
+                }
+                for(j = 0; j < OpWrites[i].n; j++) {
+                    REMOVE_FROM_SET(live, OpWrites[i].name[j]);
+                }
+                for(j = 0; j < OpReads[i].n; j++) {
+                    ADD_TO_SET(live, OpReads[i].name[j]);
+                }
+            }
+        }
+        if(pass == 0) {
+            pairsCount = p;
+            pairs = (int *)CheckMalloc((2*p + 1)*sizeof(int));
+        }
+    }
+    CheckFree(live);
+
+    // The names come in the order that they first appear, so colour them
+    // in that order.
+    int *colour = (int *)CheckMalloc((FlowNamesCount + 1)*sizeof(int));
+    BOOL *used = (BOOL *)CheckMalloc((FlowNamesCount + 1)*sizeof(BOOL));
+    for(n = 0; n < FlowNamesCount; n++) {
+        colour[n] = -1;
+        if(!FlowNames[n].isTemp) continue;
+
+        memset(used, 0, (FlowNamesCount + 1)*sizeof(BOOL));
+        for(k = 0; k < pairsCount; k++) {
+            int other;
+            if(pairs[2*k] == n) {
+                other = pairs[2*k + 1];
+            } else if(pairs[2*k + 1] == n) {
+                other = pairs[2*k];
+            } else {
+                continue;
+            }
+            if(colour[other] >= 0) used[colour[other]] = TRUE;
+        }
+        for(k = 0; used[k]; k++)
+            ;
+        colour[n] = k;
+    }
+    CheckFree(used);
+    CheckFree(pairs);
+
+    for(i = 0; i < IntCodeLen; i++) {
+        IntOp *a = &IntCode[i];
+        char *names[3] = { a->name1, a->name2, a->name3 };
+        for(j = 0; j < 3; j++) {
+            if(!IsTemporary(names[j])) continue;
+            // Which kind it is depends on the op, but a temporary is only
+            // ever used as the one kind, so either will do to look it up.
+            n = IntFlowNameIndex(names[j], FALSE);
+            if(n < 0) n = IntFlowNameIndex(names[j], TRUE);
+            if(n < 0 || colour[n] < 0) oops();
+            if(colour[n] == 0) {
+                strcpy(names[j], "$scratch");
+            } else {
+                sprintf(names[j], "$scratch%d", colour[n] + 1);
+            }
+        }
+    }
+    CheckFree(colour);
+
+    // and the analyses must describe the code as it is now
+    IntFlowAnalyse();
+}
@@ -0,0 +1,2844 @@
+//-----------------------------------------------------------------------------
+// An interpreter for the .int files generated by LDmicro, as a library; see
+// ldinterp.h for how to use it, and ldinterpret.c for an example. These
+// files represent a ladder logic program for a simple 'virtual machine.' The
+// interpreter must simulate the virtual machine and for proper timing the
+// program must be run over and over, with the period specified when it was
+// compiled (in Settings -> MCU Parameters).
+//
+// LDmicro has converted all variables into addresses, for speed of
+// execution. However, the .int file includes the mapping between variable
+// names (same names that the user specifies, that are visible on the ladder
+// diagram) and addresses, which LdInterpBitAddr() and so on look up. You can
+// use this to establish specially-named variables that define the interface
+// between your ladder code and the rest of your program.
+//
+// Everything about a program, from its code to its variables, is kept in
+// its LdInterp, and nothing is global, so that any number of programs can be
+// loaded and run at once. The variables are sized for the addresses that the
+// program actually uses, so there are no fixed limits on the program or data
+// memory either. This uses only the standard C library, except to get
+// executable memory for the JIT.
+//
+// The disassembler is just for debugging, of course. Note the unintuitive
+// names for the condition ops; the INT_IFs are backwards, and the INT_ELSE
+// is actually an unconditional jump! This is because I reused the names
+// from the intermediate code that LDmicro uses, in which the if/then/else
+// constructs have not yet been resolved into (possibly conditional)
+// absolute jumps. It makes a lot of sense to me, but probably not so much
+// to you; oh well.
+//
+// If you define BENCHMARK when you build this, then it counts the ops that
+// it runs; see LdInterpOpsRun(). If you define PACKED_BITS, then it keeps
+// the internal relays packed into words; see BitWord. On x86-64, it
+// translates the program into native code when it loads it, unless you
+// define NO_JIT; see JitCompile().
+//
+// Jonathan Westhues, Aug 2005
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "ldinterp.h"
+
+#define INTCODE_H_CONSTANTS_ONLY
+#include "intcode.h"
+
+typedef unsigned char BYTE;     // 8-bit unsigned
+typedef unsigned short WORD;    // 16-bit unsigned
+typedef signed short SWORD;     // 16-bit signed
+#ifndef _WIN32
+typedef unsigned int DWORD;     // 32-bit unsigned
+#endif
+
+// This data structure represents a single instruction for the 'virtual
+// machine.' The .op field gives the opcode, and the other fields give
+// arguments. I have defined all of these as 16-bit fields for generality,
+// but if you want then you can crunch them down to 8-bit fields (and
+// limit yourself to 256 of each type of variable, of course). If you
+// crunch down .op then nothing bad happens at all. If you crunch down
+// .literal then you only have 8-bit literals now (so you can't move
+// 300 into 'var'). If you crunch down .name3 then that limits your code size,
+// because that is the field used to encode the jump addresses.
+// 
+// If space is a problem for you, then LDmicro can also write a more compact
+// variable-length encoding, which Fetch() unpacks one op at a time; see
+// INT_IMAGE_PACKED in intcode.h.
+typedef struct {
+    WORD    op;
+    WORD    name1;
+    WORD    name2;
+    WORD    name3;
+    SWORD   literal;
+} BinOp;
+
+// The header of the binary form; this must agree with the one in
+// interpreted.cpp, and intcode.h describes the rest of the file.
+typedef struct {
+    char    magic[4];
+    WORD    version;
+    WORD    encoding;
+    DWORD   cycleTime;
+    DWORD   codeOffset;
+    DWORD   codeLength;
+    WORD    bitsCount;
+    WORD    int16sCount;
+    DWORD   symbolsOffset;
+    DWORD   stringsOffset;
+    DWORD   length;
+} IntImageHeader;
+
+// But the interpreter runs the program in a threaded form, translated from
+// either encoding when it is loaded, one of these for each op. The names
+// and the literal are as in the BinOp; length is the length of a ring, data
+// points to any table that follows the op in the program, and jump is the
+// op to go to. With computed goto, handler is the address of the code for
+// the op.
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+typedef struct ThreadedOpTag {
+#ifdef COMPUTED_GOTO
+    void    *handler;
+#endif
+    WORD    op;
+    WORD    name1;
+    WORD    name2;
+    WORD    name3;
+    SWORD   literal;
+    WORD    length;
+    void    *data;
+    struct ThreadedOpTag *jump;
+} ThreadedOp;
+
+// On x86-64, the JIT translates the threaded form again, into native code,
+// which LdInterpRunCycle() runs instead if it can; see JitCompile().
+#if (defined(_M_X64) || defined(__x86_64__)) && !defined(NO_JIT) && \
+    !defined(PACKED_BITS)
+#define JIT
+typedef void JitFunction(void);
+#endif
+
+// The internal relays take a byte each, unless you define PACKED_BITS, and
+// then they are packed 64 to a machine word. That takes an eighth of the
+// memory, and lets the mask ops (INT_SET_BIT_AND_ALL and so on, described
+// in intcode.h) test or change a whole group of relays with an instruction
+// or two, instead of one at a time. Either way, get at the relays through
+// these macros, and not directly; they expect a local Bits, pointing to the
+// instance's relays.
+#ifdef PACKED_BITS
+#ifdef _MSC_VER
+typedef unsigned __int64 BitWord;
+#else
+typedef unsigned long long BitWord;
+#endif
+#define BIT_WORDS(n)        (((n) + 63)/64)
+
+#define RELAY_MASK(a)       ((BitWord)1 << ((a) & 63))
+#define RELAY(a)            ((Bits[(a) >> 6] & RELAY_MASK(a)) != 0)
+#define SET_RELAY(a)        (Bits[(a) >> 6] |= RELAY_MASK(a))
+#define CLEAR_RELAY(a)      (Bits[(a) >> 6] &= ~RELAY_MASK(a))
+#define PUT_RELAY(a, v)     (Bits[(a) >> 6] = (Bits[(a) >> 6] & \
+                                ~RELAY_MASK(a)) | ((BitWord)((v) != 0) << \
+                                ((a) & 63)))
+
+// A group of sixteen never straddles two words, since it starts at a
+// multiple of sixteen.
+#define GROUP_MASK(a, m)    ((BitWord)(WORD)(m) << ((a) & 63))
+#define ALL_RELAYS(a, m)    ((Bits[(a) >> 6] & GROUP_MASK(a, m)) == \
+                                GROUP_MASK(a, m))
+#define ANY_RELAYS(a, m)    ((Bits[(a) >> 6] & GROUP_MASK(a, m)) != 0)
+#define SET_RELAYS(a, m)    (Bits[(a) >> 6] |= GROUP_MASK(a, m))
+#define CLEAR_RELAYS(a, m)  (Bits[(a) >> 6] &= ~GROUP_MASK(a, m))
+#else
+typedef BYTE BitWord;
+#define BIT_WORDS(n)        (n)
+
+#define RELAY(a)            (Bits[a])
+#define SET_RELAY(a)        (Bits[a] = 1)
+#define CLEAR_RELAY(a)      (Bits[a] = 0)
+#define PUT_RELAY(a, v)     (Bits[a] = ((v) != 0))
+
+// Which of the relays of the mask m on the group from a are set, as a mask.
+static WORD RelaysSet(BitWord *Bits, WORD a, WORD m)
+{
+    WORD set = 0;
+    int i;
+    for(i = 0; i < 16; i++) {
+        if(((m >> i) & 1) && Bits[a + i]) set |= (1 << i);
+    }
+    return set;
+}
+static void PutRelays(BitWord *Bits, WORD a, WORD m, BYTE v)
+{
+    int i;
+    for(i = 0; i < 16; i++) {
+        if((m >> i) & 1) Bits[a + i] = v;
+    }
+}
+#define ALL_RELAYS(a, m)    (RelaysSet(Bits, a, m) == (WORD)(m))
+#define ANY_RELAYS(a, m)    (RelaysSet(Bits, a, m) != 0)
+#define SET_RELAYS(a, m)    PutRelays(Bits, a, m, 1)
+#define CLEAR_RELAYS(a, m)  PutRelays(Bits, a, m, 0)
+#endif
+
+//-----------------------------------------------------------------------------
+// Everything about a program that has been loaded. The program is either
+// BinOp records, from the text form or from the binary form in the fixed
+// encoding, or else bytes in the packed encoding; in the binary form, they
+// point into the image. codeLength is in records or in bytes, to match.
+// Anything that was allocated to hold them, or the file, is ours to free.
+//-----------------------------------------------------------------------------
+typedef struct {
+    const char  *name;
+    WORD        addr;
+    BYTE        isBit;
+} Symbol;
+
+// An ADC or a PWM: the variable that it reads into or writes from, and the
+// frequency of a PWM.
+typedef struct {
+    WORD        addr;
+    long        frequency;
+} Channel;
+
+// The bytes that the UART buffers in each direction, between cycles.
+#define UART_BUFFER     256
+
+struct LdInterpTag {
+    BinOp       *program;
+    BYTE        *packedProgram;
+    int         codeLength;
+    BinOp       *textProgram;
+    BYTE        *buffer;
+
+    ThreadedOp  *threaded;
+    int         threadedCount;
+
+    // The variables, sized for the highest addresses that the program uses.
+    BitWord     *bits;
+    int         bitsCount;
+    SWORD       *integers;
+    int         int16sCount;
+
+    // The named variables, from $$bits and $$int16s (or the symbol table of
+    // the binary form), hashed on the name; symbolsSize is a power of two,
+    // and at least twice the number of names, so there is always a free
+    // entry to stop a search.
+    Symbol      *symbols;
+    int         symbolsSize;
+
+    // The peripherals, which are the host's, through its callbacks; see
+    // StartCycle() and EndCycle(). The ops work on the copies here: the
+    // value of each ADC and PWM channel, the bytes that wait for the UART
+    // in each direction, and the EEPROM, of which the span from eepromLo
+    // to eepromHi has changed since it was last written.
+    LdInterpPeripherals periph;
+    Channel     *adcChannels;
+    SWORD       *adcs;
+    int         adcCount;
+    Channel     *pwmChannels;
+    SWORD       *pwms;
+    int         pwmCount;
+    int         pwmsChanged;
+    int         usesUart;
+    BYTE        rx[UART_BUFFER];
+    int         rxAt;
+    int         rxLen;
+    BYTE        tx[UART_BUFFER];
+    int         txLen;
+    BYTE        *eeprom;
+    int         eepromSize;
+    int         eepromLoaded;
+    int         eepromLo;
+    int         eepromHi;
+
+    long        cycleTime;
+    long        opsRun;
+#ifdef JIT
+    JitFunction *jitCode;
+    int         jitLength;
+#endif
+};
+
+//-----------------------------------------------------------------------------
+// The symbol table is an open hash table, with linear probing, so that the
+// host can look up the names that it shares with the ladder logic in a time
+// that doesn't depend on how many of them there are. A bit and an int16 can
+// have the same name.
+//-----------------------------------------------------------------------------
+static unsigned Hash(const char *name)
+{
+    // FNV-1a
+    unsigned h = 2166136261u;
+    while(*name) {
+        h = (h ^ (BYTE)*name++)*16777619u;
+    }
+    return h;
+}
+static int AllocSymbols(LdInterp *li, int count)
+{
+    li->symbolsSize = 16;
+    while(li->symbolsSize < 2*count) li->symbolsSize *= 2;
+    li->symbols = (Symbol *)calloc(li->symbolsSize, sizeof(Symbol));
+    return li->symbols ? LDINTERP_OK : LDINTERP_NO_MEMORY;
+}
+static Symbol *FindSymbol(LdInterp *li, const char *name, int isBit)
+{
+    unsigned mask = li->symbolsSize - 1;
+    unsigned i = Hash(name) & mask;
+    for(;;) {
+        Symbol *s = &li->symbols[i];
+        if(!s->name || (s->isBit == isBit && strcmp(s->name, name)==0)) {
+            return s;
+        }
+        i = (i + 1) & mask;
+    }
+}
+static void AddSymbol(LdInterp *li, const char *name, int addr, int isBit)
+{
+    Symbol *s = FindSymbol(li, name, isBit);
+    s->name = name;
+    s->addr = (WORD)addr;
+    s->isBit = (BYTE)isBit;
+}
+
+//-----------------------------------------------------------------------------
+// What follows are just routines to load the program, which I represent as
+// hex bytes, one instruction per line, into memory. You don't need to
+// remember the length of the program because the last instruction is a
+// special marker (INT_END_OF_PROGRAM).
+//
+static int HexDigit(int c)
+{
+    c = tolower(c);
+    if(isdigit(c)) {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return (c - 'a') + 10;
+    } else {
+        return -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Which operands an op carries in the packed encoding, as INT_PACKED_xxx
+// flags; this must agree with the one in interpreted.cpp.
+//-----------------------------------------------------------------------------
+static int PackedOperands(int op)
+{
+    switch(op) {
+        case INT_SET_BIT:
+        case INT_CLEAR_BIT:
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+            return INT_PACKED_NAME1;
+
+        case INT_COPY_BIT_TO_BIT:
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_SET_BIT_IF_SET:
+        case INT_SET_BIT_IF_CLEAR:
+        case INT_CLEAR_BIT_IF_SET:
+        case INT_CLEAR_BIT_IF_CLEAR:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2;
+
+        case INT_SET_BIT_AND:
+        case INT_SET_BIT_AND_NOT:
+        case INT_CLEAR_BIT_THEN_COPY:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3;
+
+        case INT_SET_BIT_IF_SET_THEN_COPY:
+        case INT_COPY_BIT_TO_BIT_TWICE:
+        case INT_SET_BIT_AND_ALL:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL;
+
+        case INT_SET_BITS:
+        case INT_CLEAR_BITS:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_TO_LITERAL:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+        case INT_INCREMENT_VARIABLE_IF_LES:
+        case INT_CLEAR_BIT_IF_ANY_CLEAR:
+        case INT_SET_BIT_IF_ANY_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_DIVIDE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3;
+
+        case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL;
+
+        case INT_SET_VARIABLE_FROM_RING:
+        case INT_SET_RING_FROM_VARIABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_NAME3 |
+                INT_PACKED_LITERAL | INT_PACKED_RING_LENGTH;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_TABLE;
+
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+        case INT_WRITE_FORMATTED_STRING:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL |
+                INT_PACKED_TABLE;
+
+        case INT_READ_ADC:
+        case INT_EEPROM_READ:
+        case INT_EEPROM_WRITE:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL;
+
+        case INT_SET_PWM:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL | INT_PACKED_TABLE;
+
+        case INT_UART_SEND:
+        case INT_UART_RECV:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2;
+
+        case INT_EEPROM_BUSY_CHECK:
+            return INT_PACKED_NAME1;
+
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+            return INT_PACKED_NAME1 | INT_PACKED_JUMP;
+
+        case INT_COPY_BIT_THEN_IF_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_JUMP;
+
+        case INT_SET_BIT_AND_THEN_IF_SET:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_LITERAL |
+                INT_PACKED_JUMP;
+
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+        case INT_IF_VARIABLE_GRT_LITERAL:
+            return INT_PACKED_NAME1 | INT_PACKED_LITERAL | INT_PACKED_JUMP;
+
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            return INT_PACKED_NAME1 | INT_PACKED_NAME2 | INT_PACKED_JUMP;
+
+        case INT_ELSE:
+            return INT_PACKED_JUMP;
+
+        default:
+            return 0;
+    }
+}
+static WORD UnpackName(BYTE **b)
+{
+    WORD name = *(*b)++;
+    if(name & 0x80) {
+        name = ((name & 0x7f) << 8) | *(*b)++;
+    }
+    return name;
+}
+static SWORD UnpackLiteral(BYTE **b)
+{
+    BYTE c = *(*b)++;
+    SWORD literal;
+    if(c & 0x80) {
+        literal = (SWORD)((*b)[0] | ((*b)[1] << 8));
+        *b += 2;
+    } else {
+        literal = (c & 0x40) ? (SWORD)(c | 0xff80) : c;
+    }
+    return literal;
+}
+
+//-----------------------------------------------------------------------------
+// Get the op at pc, and step pc on past it. In the fixed encoding that is
+// just a pointer into the program, and pc counts records; in the packed
+// encoding pc counts bytes, and the op gets unpacked into buf, and the
+// length of a ring into buf[1].literal, where the fixed encoding keeps it.
+// Either way, *data points to any table that follows the op inline.
+//-----------------------------------------------------------------------------
+static BinOp *Fetch(LdInterp *li, int *pc, BinOp *buf, void **data)
+{
+    BYTE *b;
+    int operands;
+
+    if(!li->packedProgram) {
+        BinOp *p = &li->program[*pc];
+        *data = p + 1;
+        (*pc)++;
+        switch(p->op) {
+            case INT_SET_VARIABLE_FROM_RING:
+            case INT_SET_RING_FROM_VARIABLE:
+                (*pc)++;
+                break;
+
+            case INT_SET_BIT_FROM_TRUTH_TABLE:
+            case INT_SET_VARIABLE_FROM_TABLE:
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+            case INT_SET_PWM:
+            case INT_WRITE_FORMATTED_STRING:
+                *pc += p->name3;
+                break;
+        }
+        return p;
+    }
+
+    b = &li->packedProgram[*pc];
+    memset(buf, 0, 2*sizeof(*buf));
+    buf->op = *b++;
+    operands = PackedOperands(buf->op);
+    if(operands & INT_PACKED_NAME1) buf->name1 = UnpackName(&b);
+    if(operands & INT_PACKED_NAME2) buf->name2 = UnpackName(&b);
+    if(operands & INT_PACKED_NAME3) buf->name3 = UnpackName(&b);
+    if(operands & INT_PACKED_LITERAL) buf->literal = UnpackLiteral(&b);
+    if(operands & INT_PACKED_RING_LENGTH) buf[1].literal = UnpackName(&b);
+    if(operands & INT_PACKED_JUMP) {
+        buf->name3 = b[0] | (b[1] << 8);
+        b += 2;
+    }
+    if(operands & INT_PACKED_TABLE) {
+        int words = UnpackName(&b);
+        if((b - li->packedProgram) & 1) b++;
+        *data = b;
+        b += words*sizeof(WORD);
+    }
+    *pc = b - li->packedProgram;
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+// Where a jump goes: in the fixed encoding name3 is the record before the
+// one to run next, and in the packed encoding the offset of that one.
+//-----------------------------------------------------------------------------
+static int JumpTarget(LdInterp *li, BinOp *p)
+{
+    return li->packedProgram ? p->name3 : p->name3 + 1;
+}
+
+//-----------------------------------------------------------------------------
+// Whether the table that follows an op, which is words long, is as big as
+// the op will take it to be; and for a piecewise linear table, that no
+// segment has a dx of zero, to divide by. A formatted string's table is
+// two addresses, and then the template.
+//-----------------------------------------------------------------------------
+static int TableFits(ThreadedOp *t, int words)
+{
+    SWORD *d = (SWORD *)t->data;
+    int i;
+
+    switch(t->op) {
+        case INT_SET_BIT_FROM_TRUTH_TABLE:
+            return t->name2 < 16 &&
+                2*t->name2 + ((1 << t->name2) + 7)/8 <= 2*words;
+
+        case INT_SET_VARIABLE_FROM_TABLE:
+            return t->literal >= 0 && t->literal <= words;
+
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+            if(t->literal < 0 || 5*t->literal > words) return 0;
+            for(i = 0; i < t->literal; i++) {
+                if(d[t->literal + i*4 + 3] == 0) return 0;
+            }
+            return 1;
+
+        case INT_SET_PWM:
+            return words >= 2;
+
+        case INT_WRITE_FORMATTED_STRING:
+            return t->literal >= 0 && 2 + t->literal <= words;
+
+        default:
+            return 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Whether the literal makes sense for the op: not a divisor of zero, and not
+// negative where it is the address of a bit, or a channel.
+//-----------------------------------------------------------------------------
+static int LiteralFits(ThreadedOp *t)
+{
+    switch(t->op) {
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+            return t->literal != 0;
+
+        case INT_SET_BIT_IF_SET_THEN_COPY:
+        case INT_COPY_BIT_TO_BIT_TWICE:
+        case INT_SET_BIT_AND_THEN_IF_SET:
+        case INT_READ_ADC:
+        case INT_SET_PWM:
+            return t->literal >= 0;
+
+        default:
+            return 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Translate the program that was loaded into li->threaded, which is what the
+// interpreter runs. The jumps are found by where their targets were in the
+// program, with a binary search of pcOf[]. There can't be more ops than
+// units of codeLength, since each one takes at least one.
+//-----------------------------------------------------------------------------
+static int Thread(LdInterp *li)
+{
+    int max = li->codeLength;
+    int *pcOf = (int *)malloc((max + 1)*sizeof(int));
+    int *targetOf = (int *)malloc((max + 1)*sizeof(int));
+    int error = LDINTERP_OK;
+    int pc = 0, n, i;
+
+    li->threaded = (ThreadedOp *)calloc(max + 1, sizeof(ThreadedOp));
+    if(!pcOf || !targetOf || !li->threaded) {
+        error = LDINTERP_NO_MEMORY;
+        goto done;
+    }
+
+    for(n = 0; ; n++) {
+        BinOp buf[2], *p;
+        ThreadedOp *t = &li->threaded[n];
+        void *data;
+        BYTE *end;
+
+        if(pc >= max) {
+            error = LDINTERP_BAD_FORMAT;
+            goto done;
+        }
+        pcOf[n] = pc;
+        p = Fetch(li, &pc, buf, &data);
+        if(pc > max ||
+            (p->op != INT_END_OF_PROGRAM && !PackedOperands(p->op)))
+        {
+            error = LDINTERP_BAD_FORMAT;
+            goto done;
+        }
+
+        t->op = p->op;
+        t->name1 = p->name1;
+        t->name2 = p->name2;
+        t->name3 = p->name3;
+        t->literal = p->literal;
+        t->data = data;
+        if(!LiteralFits(t)) {
+            error = LDINTERP_BAD_FORMAT;
+            goto done;
+        }
+        if(PackedOperands(p->op) & INT_PACKED_RING_LENGTH) {
+            t->length = p[1].literal;
+            if(t->length == 0) {
+                error = LDINTERP_BAD_FORMAT;
+                goto done;
+            }
+        }
+        // Any table runs up to the next op.
+        end = li->packedProgram ? li->packedProgram + pc :
+            (BYTE *)&li->program[pc];
+        if((PackedOperands(p->op) & INT_PACKED_TABLE) &&
+            !TableFits(t, (end - (BYTE *)data)/2))
+        {
+            error = LDINTERP_BAD_FORMAT;
+            goto done;
+        }
+        targetOf[n] = (PackedOperands(p->op) & INT_PACKED_JUMP) ?
+            JumpTarget(li, p) : -1;
+
+        if(p->op == INT_END_OF_PROGRAM) break;
+    }
+    li->threadedCount = n + 1;
+
+    for(i = 0; i < li->threadedCount; i++) {
+        int lo = 0, hi = li->threadedCount - 1;
+        if(targetOf[i] < 0) continue;
+        while(lo < hi) {
+            int mid = (lo + hi)/2;
+            if(pcOf[mid] < targetOf[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if(pcOf[lo] != targetOf[i]) {
+            error = LDINTERP_BAD_FORMAT;
+            goto done;
+        }
+        li->threaded[i].jump = &li->threaded[lo];
+    }
+
+done:
+    free(pcOf);
+    free(targetOf);
+    return error;
+}
+
+//-----------------------------------------------------------------------------
+// Make *bits and *int16s big enough for every address that an op uses, so
+// that the variables can be sized to fit the program, and no op reaches past
+// the end of them, whatever is in the file.
+//-----------------------------------------------------------------------------
+static void Uses(int *count, int a)
+{
+    if(a + 1 > *count) *count = a + 1;
+}
+static void Extent(ThreadedOp *t, int *bits, int *int16s)
+{
+    WORD *d = (WORD *)t->data;
+    int i;
+
+    switch(t->op) {
+        case INT_SET_BIT:
+        case INT_CLEAR_BIT:
+        case INT_IF_BIT_SET:
+        case INT_IF_BIT_CLEAR:
+            Uses(bits, t->name1);
+            break;
+
+        case INT_COPY_BIT_TO_BIT:
+        case INT_SET_BIT_IF_SET:
+        case INT_SET_BIT_IF_CLEAR:
+        case INT_CLEAR_BIT_IF_SET:
+        case INT_CLEAR_BIT_IF_CLEAR:
+        case INT_COPY_BIT_THEN_IF_SET:
+            Uses(bits, t->name1);
+            Uses(bits, t->name2);
+            break;
+
+        case INT_SET_BIT_AND:
+        case INT_SET_BIT_AND_NOT:
+        case INT_CLEAR_BIT_THEN_COPY:
+            Uses(bits, t->name1);
+            Uses(bits, t->name2);
+            Uses(bits, t->name3);
+            break;
+
+        case INT_SET_BIT_IF_SET_THEN_COPY:
+        case INT_COPY_BIT_TO_BIT_TWICE:
+            Uses(bits, t->name3);
+            // fall through
+        case INT_SET_BIT_AND_THEN_IF_SET:
+            Uses(bits, t->name1);
+            Uses(bits, t->name2);
+            Uses(bits, (WORD)t->literal);
+            break;
+
+        // The mask ops reach the whole group of sixteen.
+        case INT_SET_BIT_AND_ALL:
+            Uses(bits, t->name1);
+            Uses(bits, t->name2);
+            Uses(bits, t->name3 + 15);
+            break;
+
+        case INT_CLEAR_BIT_IF_ANY_CLEAR:
+        case INT_SET_BIT_IF_ANY_SET:
+            Uses(bits, t->name1);
+            Uses(bits, t->name2 + 15);
+            break;
+
+        case INT_SET_BITS:
+        case INT_CLEAR_BITS:
+            Uses(bits, t->name1 + 15);
+            break;
+
+        case INT_SET_BIT_FROM_TRUTH_TABLE:
+            Uses(bits, t->name1);
+            for(i = 0; i < t->name2; i++) {
+                Uses(bits, d[i]);
+            }
+            break;
+
+        case INT_SET_VARIABLE_TO_LITERAL:
+        case INT_INCREMENT_VARIABLE:
+        case INT_DECREMENT_VARIABLE:
+        case INT_IF_VARIABLE_LES_LITERAL:
+        case INT_IF_VARIABLE_EQUALS_LITERAL:
+        case INT_IF_VARIABLE_GRT_LITERAL:
+        case INT_READ_ADC:
+        case INT_SET_PWM:
+        case INT_EEPROM_READ:
+        case INT_EEPROM_WRITE:
+            Uses(int16s, t->name1);
+            break;
+
+        case INT_EEPROM_BUSY_CHECK:
+            Uses(bits, t->name1);
+            break;
+
+        case INT_UART_SEND:
+        case INT_UART_RECV:
+            Uses(int16s, t->name1);
+            Uses(bits, t->name2);
+            break;
+
+        case INT_WRITE_FORMATTED_STRING:
+            Uses(int16s, t->name1);
+            Uses(int16s, t->name2);
+            Uses(int16s, d[0]);
+            Uses(bits, d[1]);
+            break;
+
+        case INT_SET_VARIABLE_TO_VARIABLE:
+        case INT_SET_VARIABLE_ADD_LITERAL:
+        case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+        case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+        case INT_SET_VARIABLE_DIVIDE_LITERAL:
+        case INT_INCREMENT_VARIABLE_IF_LES:
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+        case INT_SET_VARIABLE_FROM_TABLE:
+        case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+            Uses(int16s, t->name1);
+            Uses(int16s, t->name2);
+            break;
+
+        case INT_SET_VARIABLE_ADD:
+        case INT_SET_VARIABLE_SUBTRACT:
+        case INT_SET_VARIABLE_MULTIPLY:
+        case INT_SET_VARIABLE_DIVIDE:
+        case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+            Uses(int16s, t->name1);
+            Uses(int16s, t->name2);
+            Uses(int16s, t->name3);
+            break;
+
+        // The ring is length int16s, from name2 or from name1.
+        case INT_SET_VARIABLE_FROM_RING:
+            Uses(int16s, t->name1);
+            Uses(int16s, t->name2 + t->length - 1);
+            Uses(int16s, t->name3);
+            break;
+
+        case INT_SET_RING_FROM_VARIABLE:
+            Uses(int16s, t->name1 + t->length - 1);
+            Uses(int16s, t->name2);
+            Uses(int16s, t->name3);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The text form has a line of hex for each record, and then the addresses of
+// the named bits and int16s, and the cycle time. This works on a copy of the
+// file, with a NUL after it, and cuts it up into lines in place, so that the
+// names can stay where they are. There can't be more records or names than
+// lines, so that sizes the program and the symbol table.
+//-----------------------------------------------------------------------------
+static char *NextLine(char **at)
+{
+    char *line = *at, *end;
+
+    if(!*line) return NULL;
+    end = strchr(line, '\n');
+    if(end) {
+        *at = end + 1;
+    } else {
+        end = line + strlen(line);
+        *at = end;
+    }
+    *end = '\0';
+    if(end > line && end[-1] == '\r') end[-1] = '\0';
+    return line;
+}
+static int LoadText(LdInterp *li, char *text)
+{
+    int lines = 1, n = 0, isBit = 1;
+    char *at, *line;
+
+    for(at = text; *at; at++) {
+        if(*at == '\n') lines++;
+    }
+    li->textProgram = (BinOp *)malloc(lines*sizeof(BinOp));
+    if(!li->textProgram || AllocSymbols(li, lines) != LDINTERP_OK) {
+        return LDINTERP_NO_MEMORY;
+    }
+
+    at = text;
+    line = NextLine(&at);
+    if(!line || strcmp(line, "$$LDcode")!=0) return LDINTERP_BAD_FORMAT;
+
+    for(;;) {
+        BYTE *b = (BYTE *)&li->textProgram[n];
+        int i;
+
+        line = NextLine(&at);
+        if(!line) return LDINTERP_BAD_FORMAT;
+        if(strcmp(line, "$$bits")==0) break;
+        if(strlen(line) != sizeof(BinOp)*2) return LDINTERP_BAD_FORMAT;
+
+        for(i = 0; i < (int)sizeof(BinOp); i++) {
+            int hi = HexDigit(line[2*i]);
+            int lo = HexDigit(line[2*i + 1]);
+            if(hi < 0 || lo < 0) return LDINTERP_BAD_FORMAT;
+            b[i] = (BYTE)(lo | (hi << 4));
+        }
+        n++;
+    }
+    li->program = li->textProgram;
+    li->codeLength = n;
+
+    while((line = NextLine(&at))) {
+        char *comma = strchr(line, ',');
+        if(strcmp(line, "$$int16s")==0) {
+            isBit = 0;
+        } else if(strncmp(line, "$$cycle", 7)==0) {
+            li->cycleTime = atol(line + 7);
+        } else if(comma && strncmp(line, "$$", 2)!=0) {
+            *comma = '\0';
+            AddSymbol(li, line, atoi(comma + 1), isBit);
+        }
+    }
+    return LDINTERP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// The binary form needs no parsing at all: check the header, and point
+// li->program (or li->packedProgram) at the code, and the symbol table at
+// the names in the string pool. On a target that has the image in flash, it
+// can stay there. Nothing writes to the image, so it can be read-only.
+//-----------------------------------------------------------------------------
+static int LoadImage(LdInterp *li, BYTE *image, size_t len)
+{
+    IntImageHeader *h = (IntImageHeader *)image;
+    WORD *sym;
+    DWORD strings;
+    int i, count;
+
+    if(len < sizeof(*h)) return LDINTERP_BAD_FORMAT;
+    if(memcmp(h->magic, INT_IMAGE_MAGIC, sizeof(h->magic))!=0 ||
+        h->version != INT_IMAGE_VERSION || h->length != len ||
+        h->codeOffset > len || h->codeLength > len - h->codeOffset ||
+        h->stringsOffset > len || h->symbolsOffset > h->stringsOffset ||
+        (h->codeOffset % INT_IMAGE_ALIGN) != 0 || (h->symbolsOffset & 1) ||
+        4*((DWORD)h->bitsCount + h->int16sCount) >
+            h->stringsOffset - h->symbolsOffset)
+    {
+        return LDINTERP_BAD_FORMAT;
+    }
+
+    if(h->encoding == INT_IMAGE_PACKED) {
+        li->packedProgram = image + h->codeOffset;
+        li->codeLength = h->codeLength;
+    } else if(h->encoding == INT_IMAGE_FIXED) {
+        li->program = (BinOp *)(image + h->codeOffset);
+        li->codeLength = h->codeLength / sizeof(BinOp);
+    } else {
+        return LDINTERP_BAD_FORMAT;
+    }
+    li->cycleTime = h->cycleTime;
+
+    // The bits come first in the symbol table, and then the int16s.
+    count = h->bitsCount + h->int16sCount;
+    if(AllocSymbols(li, count) != LDINTERP_OK) return LDINTERP_NO_MEMORY;
+    sym = (WORD *)(image + h->symbolsOffset);
+    strings = len - h->stringsOffset;
+    for(i = 0; i < count; i++) {
+        char *name = (char *)(image + h->stringsOffset + sym[2*i + 1]);
+        if(sym[2*i + 1] >= strings ||
+            !memchr(name, '\0', strings - sym[2*i + 1]))
+        {
+            return LDINTERP_BAD_FORMAT;
+        }
+        AddSymbol(li, name, sym[2*i], i < h->bitsCount);
+    }
+    return LDINTERP_OK;
+}
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Disassemble the program and pretty-print it. This is just for debugging,
+// and it is also the only documentation for what each op does. The bit
+// variables (internal relays or whatever) live in a separate space from the
+// integer variables; I refer to those as bits[addr] and int16s[addr]
+// respectively.
+//-----------------------------------------------------------------------------
+void LdInterpDisassemble(LdInterp *li, FILE *f)
+{
+    int pc = 0;
+    for(;;) {
+        BinOp buf[2], *p;
+        void *data;
+
+        fprintf(f, "%03x: ", pc);
+        p = Fetch(li, &pc, buf, &data);
+
+        switch(p->op) {
+            case INT_SET_BIT:
+                fprintf(f, "bits[%03x] := 1", p->name1);
+                break;
+
+            case INT_CLEAR_BIT:
+                fprintf(f, "bits[%03x] := 0", p->name1);
+                break;
+
+            case INT_COPY_BIT_TO_BIT:
+                fprintf(f, "bits[%03x] := bits[%03x]", p->name1, p->name2);
+                break;
+
+            case INT_SET_BIT_IF_SET:
+                fprintf(f, "if (bits[%03x] set) bits[%03x] := 1", p->name2,
+                    p->name1);
+                break;
+
+            case INT_SET_BIT_IF_CLEAR:
+                fprintf(f, "if (bits[%03x] clear) bits[%03x] := 1", p->name2,
+                    p->name1);
+                break;
+
+            case INT_CLEAR_BIT_IF_SET:
+                fprintf(f, "if (bits[%03x] set) bits[%03x] := 0", p->name2,
+                    p->name1);
+                break;
+
+            case INT_CLEAR_BIT_IF_CLEAR:
+                fprintf(f, "if (bits[%03x] clear) bits[%03x] := 0", p->name2,
+                    p->name1);
+                break;
+
+            case INT_SET_BIT_AND:
+                fprintf(f, "bits[%03x] := bits[%03x] and bits[%03x]", p->name1,
+                    p->name2, p->name3);
+                break;
+
+            case INT_SET_BIT_AND_NOT:
+                fprintf(f, "bits[%03x] := bits[%03x] and not bits[%03x]",
+                    p->name1, p->name2, p->name3);
+                break;
+
+            case INT_SET_BIT_IF_SET_THEN_COPY:
+                fprintf(f, "if (bits[%03x] set) bits[%03x] := 1; "
+                    "bits[%03x] := bits[%03x]", p->name2, p->name1, p->name3,
+                    p->literal);
+                break;
+
+            case INT_CLEAR_BIT_THEN_COPY:
+                fprintf(f, "bits[%03x] := 0; bits[%03x] := bits[%03x]",
+                    p->name1, p->name2, p->name3);
+                break;
+
+            case INT_COPY_BIT_TO_BIT_TWICE:
+                fprintf(f, "bits[%03x] := bits[%03x]; bits[%03x] := bits[%03x]",
+                    p->name1, p->name2, p->name3, p->literal);
+                break;
+
+            case INT_SET_BIT_AND_ALL:
+                fprintf(f, "bits[%03x] := bits[%03x] and all of "
+                    "bits[%03x] & %04x", p->name1, p->name2, p->name3,
+                    (WORD)p->literal);
+                break;
+
+            case INT_CLEAR_BIT_IF_ANY_CLEAR:
+                fprintf(f, "if (any of bits[%03x] & %04x clear) "
+                    "bits[%03x] := 0", p->name2, (WORD)p->literal, p->name1);
+                break;
+
+            case INT_SET_BIT_IF_ANY_SET:
+                fprintf(f, "if (any of bits[%03x] & %04x set) bits[%03x] := 1",
+                    p->name2, (WORD)p->literal, p->name1);
+                break;
+
+            case INT_SET_BITS:
+                fprintf(f, "bits[%03x] & %04x := 1", p->name1,
+                    (WORD)p->literal);
+                break;
+
+            case INT_CLEAR_BITS:
+                fprintf(f, "bits[%03x] & %04x := 0", p->name1,
+                    (WORD)p->literal);
+                break;
+
+            case INT_SET_VARIABLE_TO_LITERAL:
+                fprintf(f, "int16s[%03x] := %d (0x%04x)", p->name1, p->literal,
+                    p->literal);
+                break;
+
+            case INT_SET_VARIABLE_TO_VARIABLE:
+                fprintf(f, "int16s[%03x] := int16s[%03x]", p->name1, p->name2);
+                break;
+
+            case INT_SET_VARIABLE_FROM_RING:
+                fprintf(f, "int16s[%03x] := int16s[%03x + (int16s[%03x] + %d) "
+                    "mod %d]", p->name1, p->name2, p->name3, p->literal,
+                    p[1].literal);
+                break;
+
+            case INT_SET_RING_FROM_VARIABLE:
+                fprintf(f, "int16s[%03x + (int16s[%03x] + %d) mod %d] := "
+                    "int16s[%03x]", p->name1, p->name2, p->literal,
+                    p[1].literal, p->name3);
+                break;
+
+            case INT_INCREMENT_VARIABLE:
+                fprintf(f, "(int16s[%03x])++", p->name1);
+                break;
+
+            case INT_DECREMENT_VARIABLE:
+                fprintf(f, "(int16s[%03x])--", p->name1);
+                break;
+
+            case INT_INCREMENT_VARIABLE_IF_LES:
+                fprintf(f, "if (int16s[%03x] < %d) (int16s[%03x])++", p->name2,
+                    p->literal, p->name1);
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                SWORD *d = (SWORD *)data;
+                int i;
+                fprintf(f, "int16s[%03x] := {", p->name1);
+                for(i = 0; i < p->literal; i++) {
+                    fprintf(f, "%s%d", i ? " " : "", d[i]);
+                }
+                fprintf(f, "}[int16s[%03x]]", p->name2);
+                break;
+            }
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                SWORD *d = (SWORD *)data;
+                int i;
+                fprintf(f, "int16s[%03x] := pwl {", p->name1);
+                for(i = 0; i < p->literal; i++) {
+                    fprintf(f, "%s(..%d: %d,%d +%d/%d)", i ? " " : "", d[i],
+                        d[p->literal + i*4], d[p->literal + i*4 + 1],
+                        d[p->literal + i*4 + 2], d[p->literal + i*4 + 3]);
+                }
+                fprintf(f, "}[int16s[%03x]]", p->name2);
+                break;
+            }
+
+            case INT_SET_VARIABLE_ADD_LITERAL:
+                fprintf(f, "int16s[%03x] := int16s[%03x] + %d", p->name1,
+                    p->name2, p->literal);
+                break;
+
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+                fprintf(f, "int16s[%03x] := int16s[%03x] - %d", p->name1,
+                    p->name2, p->literal);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                fprintf(f, "int16s[%03x] := int16s[%03x] * %d", p->name1,
+                    p->name2, p->literal);
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                fprintf(f, "int16s[%03x] := int16s[%03x] / %d", p->name1,
+                    p->name2, p->literal);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                fprintf(f, "int16s[%03x] := int16s[%03x] * int16s[%03x] / %d",
+                    p->name1, p->name2, p->name3, p->literal);
+                break;
+
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                WORD *d = (WORD *)data;
+                int i;
+                fprintf(f, "bits[%03x] := table[", p->name1);
+                for(i = 0; i < p->name2; i++) {
+                    fprintf(f, "%sbits[%03x]", i ? " " : "", d[i]);
+                }
+                fprintf(f, "]");
+                break;
+            }
+
+            case INT_READ_ADC:
+                fprintf(f, "int16s[%03x] := adc[%d]", p->name1, p->literal);
+                break;
+
+            case INT_SET_PWM: {
+                WORD *d = (WORD *)data;
+                fprintf(f, "pwm[%d] := int16s[%03x] at %ld Hz", p->literal,
+                    p->name1, (long)d[0] | ((long)d[1] << 16));
+                break;
+            }
+
+            case INT_UART_SEND:
+                fprintf(f, "if (bits[%03x] set) uart send int16s[%03x]; "
+                    "bits[%03x] := uart busy", p->name2, p->name1, p->name2);
+                break;
+
+            case INT_UART_RECV:
+                fprintf(f, "bits[%03x] := uart recv into int16s[%03x]",
+                    p->name2, p->name1);
+                break;
+
+            case INT_EEPROM_BUSY_CHECK:
+                fprintf(f, "bits[%03x] := eeprom busy", p->name1);
+                break;
+
+            case INT_EEPROM_READ:
+                fprintf(f, "int16s[%03x] := eeprom[%d]", p->name1,
+                    (WORD)p->literal);
+                break;
+
+            case INT_EEPROM_WRITE:
+                fprintf(f, "eeprom[%d] := int16s[%03x]", (WORD)p->literal,
+                    p->name1);
+                break;
+
+            case INT_WRITE_FORMATTED_STRING: {
+                WORD *d = (WORD *)data;
+                int i;
+                fprintf(f, "uart send step int16s[%03x] of \"", p->name1);
+                for(i = 0; i < p->literal; i++) {
+                    int c = d[2 + i] & 0xff, kind = d[2 + i] >> 8;
+                    if(kind & (1 << FMTD_MINUS)) {
+                        fprintf(f, "\\-");
+                    } else if(kind & (1 << FMTD_DIGIT)) {
+                        fprintf(f, "\\%d", kind & FMTD_POWER_MASK);
+                    } else if(isprint(c) && c != '\\' && c != '"') {
+                        fprintf(f, "%c", c);
+                    } else {
+                        fprintf(f, "\\x%02x", c);
+                    }
+                }
+                fprintf(f, "\" with int16s[%03x] (int16s[%03x], bits[%03x])",
+                    p->name2, d[0], d[1]);
+                break;
+            }
+
+            {
+                char c;
+                case INT_SET_VARIABLE_ADD: c = '+'; goto arith;
+                case INT_SET_VARIABLE_SUBTRACT: c = '-'; goto arith;
+                case INT_SET_VARIABLE_MULTIPLY: c = '*'; goto arith;
+                case INT_SET_VARIABLE_DIVIDE: c = '/'; goto arith;
+arith:
+                    fprintf(f, "int16s[%03x] := int16s[%03x] %c int16s[%03x]",
+                        p->name1, p->name2, c, p->name3);
+                    break;
+            }
+
+            case INT_IF_BIT_SET:
+                fprintf(f, "unless (bits[%03x] set)", p->name1);
+                goto cond;
+            case INT_IF_BIT_CLEAR:
+                fprintf(f, "unless (bits[%03x] clear)", p->name1);
+                goto cond;
+            case INT_COPY_BIT_THEN_IF_SET:
+                fprintf(f, "bits[%03x] := bits[%03x]; unless (bits[%03x] set)",
+                    p->name1, p->name2, p->name1);
+                goto cond;
+            case INT_SET_BIT_AND_THEN_IF_SET:
+                fprintf(f, "bits[%03x] := bits[%03x] and bits[%03x]; "
+                    "unless (bits[%03x] set)", p->name1, p->name2, p->literal,
+                    p->name1);
+                goto cond;
+            case INT_IF_VARIABLE_LES_LITERAL:
+                fprintf(f, "unless (int16s[%03x] < %d)", p->name1, p->literal);
+                goto cond;
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+                fprintf(f, "unless (int16s[%03x] == %d)", p->name1, p->literal);
+                goto cond;
+            case INT_IF_VARIABLE_GRT_LITERAL:
+                fprintf(f, "unless (int16s[%03x] > %d)", p->name1, p->literal);
+                goto cond;
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+                fprintf(f, "unless (int16s[%03x] == int16s[%03x])", p->name1,
+                    p->name2);
+                goto cond;
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                fprintf(f, "unless (int16s[%03x] > int16s[%03x])", p->name1,
+                    p->name2);
+                goto cond;
+cond:
+                fprintf(f, " jump %03x", JumpTarget(li, p));
+                break;
+
+            case INT_ELSE:
+                fprintf(f, "jump %03x", JumpTarget(li, p));
+                break;
+
+            case INT_END_OF_PROGRAM:
+                fprintf(f, "<end of program>\n");
+                return;
+
+            default:
+                fprintf(f, "<bad op %d>\n", p->op);
+                return;
+        }
+        fprintf(f, "\n");
+    }
+}
+//-----------------------------------------------------------------------------
+// The ops that work on a table or a ring, which are done here instead of in
+// RunProgram(), so that the JIT can call them too.
+//-----------------------------------------------------------------------------
+static void SetVariableFromRing(LdInterp *li, ThreadedOp *t)
+{
+    SWORD *Integers = li->integers;
+    // A shift register's stages, as a ring buffer, length elements long;
+    // the index is the program's own, but stay inside the ring whatever
+    // the host has done to it.
+    int n = t->length;
+    int i = (Integers[t->name3] + t->literal) % n;
+    if(i < 0) i += n;
+    Integers[t->name1] = Integers[t->name2 + i];
+}
+
+static void SetRingFromVariable(LdInterp *li, ThreadedOp *t)
+{
+    SWORD *Integers = li->integers;
+    int n = t->length;
+    int i = (Integers[t->name2] + t->literal) % n;
+    if(i < 0) i += n;
+    Integers[t->name1 + i] = Integers[t->name3];
+}
+
+static void SetVariableFromTable(LdInterp *li, ThreadedOp *t)
+{
+    SWORD *Integers = li->integers;
+    // The table is at data, literal entries long; leave the variable alone
+    // if the index is outside it.
+    SWORD *d = (SWORD *)t->data;
+    SWORD index = Integers[t->name2];
+    if(index >= 0 && index < t->literal) {
+        Integers[t->name1] = d[index];
+    }
+}
+
+static void SetVariablePiecewiseLinear(LdInterp *li, ThreadedOp *t)
+{
+    SWORD *Integers = li->integers;
+    // The table is at data: the upper x of each of the literal segments,
+    // and then x0, y0, dy, dx for each. Binary search for the first
+    // segment that reaches the index, and leave the variable alone if none
+    // does.
+    SWORD *d = (SWORD *)t->data;
+    SWORD x = Integers[t->name2];
+    int lo = 0, hi = t->literal;
+    while(lo < hi) {
+        int mid = (lo + hi)/2;
+        if(x <= d[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if(lo < t->literal) {
+        SWORD *s = &d[t->literal + lo*4];
+        SWORD off = (SWORD)(x - s[0]);
+        Integers[t->name1] = (SWORD)(s[1] +
+            (SWORD)(((long)off * s[2]) / s[3]));
+    }
+}
+
+static void SetVariableMultiplyDivide(LdInterp *li, ThreadedOp *t)
+{
+    SWORD *Integers = li->integers;
+    // The product is formed to 32 bits before the divide.
+    if(t->literal != 0) {
+        Integers[t->name1] = (SWORD)(((long)Integers[t->name2] *
+                        Integers[t->name3]) / t->literal);
+    }
+}
+
+static void SetBitFromTruthTable(LdInterp *li, ThreadedOp *t)
+{
+    BitWord *Bits = li->bits;
+    // At data are the addresses of the name2 input bits, and then the
+    // table, one bit per combination of the inputs.
+    WORD *d = (WORD *)t->data;
+    BYTE *table = (BYTE *)(d + t->name2);
+    int i, index = 0;
+    for(i = 0; i < t->name2; i++) {
+        if(RELAY(d[i])) index |= (1 << i);
+    }
+    PUT_RELAY(t->name1, (table[index >> 3] >> (index & 7)) & 1);
+}
+
+//-----------------------------------------------------------------------------
+// The ops on the peripherals, which work only on the instance's copies of
+// them; the host's callbacks get those once a cycle, in StartCycle() and
+// EndCycle(). The JIT calls these too.
+//-----------------------------------------------------------------------------
+static void ReadAdc(LdInterp *li, ThreadedOp *t)
+{
+    li->integers[t->name1] = li->adcs[t->literal];
+}
+
+static void SetPwm(LdInterp *li, ThreadedOp *t)
+{
+    SWORD duty = li->integers[t->name1];
+    if(li->pwms[t->literal] != duty) {
+        li->pwms[t->literal] = duty;
+        li->pwmsChanged = 1;
+    }
+}
+
+static void UartSend(LdInterp *li, ThreadedOp *t)
+{
+    BitWord *Bits = li->bits;
+    // Send if the rung is true and there is room, and then the rung says
+    // whether the UART is busy, which is only while its buffer is full.
+    if(RELAY(t->name2) && li->txLen < UART_BUFFER) {
+        li->tx[li->txLen++] = (BYTE)li->integers[t->name1];
+    }
+    PUT_RELAY(t->name2, li->txLen >= UART_BUFFER);
+}
+
+static void UartRecv(LdInterp *li, ThreadedOp *t)
+{
+    BitWord *Bits = li->bits;
+    if(li->rxAt < li->rxLen) {
+        li->integers[t->name1] = li->rx[li->rxAt++];
+        SET_RELAY(t->name2);
+    } else {
+        CLEAR_RELAY(t->name2);
+    }
+}
+
+static void EepromBusyCheck(LdInterp *li, ThreadedOp *t)
+{
+    BitWord *Bits = li->bits;
+    // Until the host has given us its EEPROM, it stays busy, so that the
+    // program leaves it alone; after that, it is never busy.
+    PUT_RELAY(t->name1, !li->eepromLoaded);
+}
+
+static void EepromRead(LdInterp *li, ThreadedOp *t)
+{
+    WORD a = (WORD)t->literal;
+    li->integers[t->name1] = (SWORD)(li->eeprom[a] | (li->eeprom[a+1] << 8));
+}
+
+static void EepromWrite(LdInterp *li, ThreadedOp *t)
+{
+    WORD a = (WORD)t->literal;
+    SWORD v = li->integers[t->name1];
+    li->eeprom[a] = (BYTE)v;
+    li->eeprom[a+1] = (BYTE)(v >> 8);
+    if(li->eepromLo >= li->eepromHi) {
+        li->eepromLo = a;
+        li->eepromHi = a + 2;
+    } else {
+        if(a < li->eepromLo) li->eepromLo = a;
+        if(a + 2 > li->eepromHi) li->eepromHi = a + 2;
+    }
+}
+
+static void WriteFormattedString(LdInterp *li, ThreadedOp *t)
+{
+    static const long TenToThe[] = { 1, 10, 100, 1000, 10000, 100000,
+        1000000, 10000000 };
+    BitWord *Bits = li->bits;
+    SWORD *Integers = li->integers;
+    // At data are the addresses of the conversion state and of the
+    // leading-zero flag, and then the template, as described in intcode.h;
+    // name1 is the step, from 0 to literal.
+    WORD *d = (WORD *)t->data;
+    SWORD *state = &Integers[d[0]];
+    SWORD i = Integers[t->name1];
+    int kind, power;
+    BYTE c;
+
+    if(i < 0 || i >= t->literal || li->txLen >= UART_BUFFER) return;
+    c = d[2 + i] & 0xff;
+    kind = d[2 + i] >> 8;
+
+    if(kind & (1 << FMTD_MINUS)) {
+        SWORD v = Integers[t->name2];
+        *state = v;
+        c = ' ';
+        if(v < 0) {
+            c = '-';
+            *state = (SWORD)(0 - v);
+        }
+    } else if(kind & (1 << FMTD_DIGIT)) {
+        SWORD q;
+        if(kind & (1 << FMTD_FIRST_DIGIT)) SET_RELAY(d[1]);
+        if(kind & (1 << FMTD_LOAD_VAR)) *state = Integers[t->name2];
+        power = kind & FMTD_POWER_MASK;
+        q = (SWORD)(*state / TenToThe[power]);
+        *state = (SWORD)(*state - q*TenToThe[power]);
+        c = (BYTE)(q + '0');
+
+        // Suppress all but the last leading zero.
+        if(power != 0) {
+            if(q == 0) {
+                if(RELAY(d[1])) c = ' ';
+            } else {
+                CLEAR_RELAY(d[1]);
+            }
+        }
+    }
+    li->tx[li->txLen++] = c;
+    Integers[t->name1]++;
+}
+
+#ifdef JIT
+//-----------------------------------------------------------------------------
+// The JIT, which translates the threaded form of the program into x86-64
+// code when it is loaded, so that LdInterpRunCycle() can just call that
+// instead, with no dispatch at all. The relays are addressed from r8 and the
+// int16s from r9, which both the Windows and the System V calling
+// conventions let us clobber; the IFs become conditional jumps, and the ops
+// that work on tables or rings, or on the peripherals, call the same
+// routines as the interpreter.
+// If it can't get executable memory, or it meets an op that it doesn't
+// know, then it gives up, and the interpreter runs the program instead.
+//
+// This needs the relays a byte each, so there is no JIT with PACKED_BITS,
+// and it takes them to be always 0 or 1, as PUT_RELAY() leaves them.
+//
+// Everything that it needs along the way is in a JitState, on the stack, so
+// that two threads can load programs at once.
+//-----------------------------------------------------------------------------
+#define JIT_MAX_OP_CODE     192
+typedef struct {
+    LdInterp    *li;
+    BYTE        *buf;
+    int         len;
+    int         max;
+    // Where each op's code starts, and the jumps to other ops, as the
+    // offset of each one's rel32 and the op that it goes to, to fill in at
+    // the end.
+    int         *opAt;
+    int         *fixupAt;
+    int         *fixupTo;
+    int         fixups;
+} JitState;
+
+// The condition codes, for Jcc.
+#define CC_E                0x4
+#define CC_NE               0x5
+#define CC_L                0xc
+#define CC_GE               0xd
+#define CC_G                0xf
+#define CC_ALWAYS           (-1)
+
+typedef void JitHelper(LdInterp *li, ThreadedOp *t);
+
+static void JitByte(JitState *j, int b)
+{
+    if(j->len < j->max) j->buf[j->len] = (BYTE)b;
+    j->len++;
+}
+static void JitInt32(JitState *j, long v)
+{
+    JitByte(j, v);
+    JitByte(j, v >> 8);
+    JitByte(j, v >> 16);
+    JitByte(j, v >> 24);
+}
+static void JitInt64(JitState *j, size_t v)
+{
+    int i;
+    for(i = 0; i < 8; i++) {
+        JitByte(j, (int)(v >> (8*i)));
+    }
+}
+
+// An operand in memory, at disp from r8 (base 0) or r9 (base 1), with reg
+// in the middle of the ModRM byte; the REX.B prefix is the caller's.
+static void JitMem(JitState *j, int reg, int base, long disp)
+{
+    JitByte(j, 0x80 | (reg << 3) | base);
+    JitInt32(j, disp);
+}
+
+// op reg, byte [r8 + a], for the relay at a.
+static void JitRelay(JitState *j, int op, int reg, int a)
+{
+    JitByte(j, 0x41);
+    JitByte(j, op);
+    JitMem(j, reg, 0, a);
+}
+static void JitSetRelay(JitState *j, int a, int v)
+{
+    JitRelay(j, 0xc6, 0, a);            // mov byte [a], v
+    JitByte(j, v);
+}
+static void JitTestRelay(JitState *j, int a)
+{
+    JitRelay(j, 0x80, 7, a);            // cmp byte [a], 0
+    JitByte(j, 0);
+}
+static void JitCopyRelay(JitState *j, int to, int from)
+{
+    JitRelay(j, 0x8a, 0, from);         // mov al, [from]
+    JitRelay(j, 0x88, 0, to);           // mov [to], al
+}
+
+// movsx reg, word [r9 + 2*n], for the int16 at n; and then the reverse,
+// mov word [r9 + 2*n], ax.
+static void JitLoad(JitState *j, int reg, int n)
+{
+    JitByte(j, 0x41);
+    JitByte(j, 0x0f);
+    JitByte(j, 0xbf);
+    JitMem(j, reg, 1, 2*n);
+}
+static void JitStore(JitState *j, int n)
+{
+    JitByte(j, 0x66);
+    JitByte(j, 0x41);
+    JitByte(j, 0x89);
+    JitMem(j, 0, 1, 2*n);
+}
+
+// A jump to op to, if cc, to fill in later.
+static void JitJump(JitState *j, int cc, ThreadedOp *to)
+{
+    if(cc == CC_ALWAYS) {
+        JitByte(j, 0xe9);
+    } else {
+        JitByte(j, 0x0f);
+        JitByte(j, 0x80 | cc);
+    }
+    j->fixupAt[j->fixups] = j->len;
+    j->fixupTo[j->fixups] = to - j->li->threaded;
+    j->fixups++;
+    JitInt32(j, 0);
+}
+
+// A jump over the code that follows, if cc, which JitLand() lands.
+static int JitSkip(JitState *j, int cc)
+{
+    JitByte(j, 0x0f);
+    JitByte(j, 0x80 | cc);
+    JitInt32(j, 0);
+    return j->len;
+}
+static void JitLand(JitState *j, int from)
+{
+    long rel = j->len - from;
+    if(from > j->max) return;
+    j->buf[from - 4] = (BYTE)rel;
+    j->buf[from - 3] = (BYTE)(rel >> 8);
+    j->buf[from - 2] = (BYTE)(rel >> 16);
+    j->buf[from - 1] = (BYTE)(rel >> 24);
+}
+
+static void JitBases(JitState *j)
+{
+    JitByte(j, 0x49);                   // mov r8, Bits
+    JitByte(j, 0xb8);
+    JitInt64(j, (size_t)j->li->bits);
+    JitByte(j, 0x49);                   // mov r9, Integers
+    JitByte(j, 0xb9);
+    JitInt64(j, (size_t)j->li->integers);
+}
+
+// Call fn(li, t); the caller's 40 bytes of stack (from the prologue) are the
+// shadow space that Windows wants, and keep the stack aligned. That
+// clobbers r8 and r9, so load them again after.
+static void JitCall(JitState *j, JitHelper *fn, ThreadedOp *t)
+{
+#ifdef _WIN32
+    JitByte(j, 0x48);                   // mov rcx, li
+    JitByte(j, 0xb9);
+    JitInt64(j, (size_t)j->li);
+    JitByte(j, 0x48);                   // mov rdx, t
+    JitByte(j, 0xba);
+#else
+    JitByte(j, 0x48);                   // mov rdi, li
+    JitByte(j, 0xbf);
+    JitInt64(j, (size_t)j->li);
+    JitByte(j, 0x48);                   // mov rsi, t
+    JitByte(j, 0xbe);
+#endif
+    JitInt64(j, (size_t)t);
+    JitByte(j, 0x48);                   // mov rax, fn
+    JitByte(j, 0xb8);
+    JitInt64(j, (size_t)fn);
+    JitByte(j, 0xff);                   // call rax
+    JitByte(j, 0xd0);
+    JitBases(j);
+}
+
+// The arithmetic on two int16s, which is op eax, ecx with eax from name2
+// and ecx from name3, and then eax into name1.
+static void JitArith(JitState *j, ThreadedOp *t, int op)
+{
+    JitLoad(j, 0, t->name2);
+    JitLoad(j, 1, t->name3);
+    if(op == 0xaf) JitByte(j, 0x0f);
+    JitByte(j, op);
+    JitByte(j, op == 0xaf ? 0xc1 : 0xc8);
+    JitStore(j, t->name1);
+}
+
+// An IF on int16s, which jumps to the op's target unless cc holds for
+// name1 against the literal, or against name2 if isVariable.
+static void JitIfVariable(JitState *j, ThreadedOp *t, int cc,
+    int isVariable)
+{
+    JitLoad(j, 0, t->name1);
+    if(isVariable) {
+        JitLoad(j, 1, t->name2);
+        JitByte(j, 0x39);               // cmp eax, ecx
+        JitByte(j, 0xc8);
+    } else {
+        JitByte(j, 0x3d);               // cmp eax, literal
+        JitInt32(j, t->literal);
+    }
+    JitJump(j, cc ^ 1, t->jump);
+}
+
+static void JitCompile(LdInterp *li)
+{
+    JitState js, *j = &js;
+    ThreadedOp *t;
+    BYTE *code;
+#ifdef _WIN32
+    DWORD oldProtect;
+#endif
+    int n = li->threadedCount;
+    int i, skip;
+
+    memset(j, 0, sizeof(*j));
+    j->li = li;
+    j->max = n*JIT_MAX_OP_CODE;
+    j->buf = (BYTE *)malloc(j->max);
+    j->opAt = (int *)malloc(n*sizeof(int));
+    j->fixupAt = (int *)malloc(n*sizeof(int));
+    j->fixupTo = (int *)malloc(n*sizeof(int));
+    if(!j->buf || !j->opAt || !j->fixupAt || !j->fixupTo) goto done;
+
+    JitByte(j, 0x48);                   // sub rsp, 40
+    JitByte(j, 0x83);
+    JitByte(j, 0xec);
+    JitByte(j, 40);
+    JitBases(j);
+
+    for(t = li->threaded; t < li->threaded + n; t++) {
+        j->opAt[t - li->threaded] = j->len;
+        switch(t->op) {
+            case INT_SET_BIT:
+                JitSetRelay(j, t->name1, 1);
+                break;
+
+            case INT_CLEAR_BIT:
+                JitSetRelay(j, t->name1, 0);
+                break;
+
+            case INT_COPY_BIT_TO_BIT:
+                JitCopyRelay(j, t->name1, t->name2);
+                break;
+
+            case INT_SET_BIT_IF_SET:
+            case INT_SET_BIT_IF_CLEAR:
+            case INT_CLEAR_BIT_IF_SET:
+            case INT_CLEAR_BIT_IF_CLEAR:
+                JitTestRelay(j, t->name2);
+                skip = JitSkip(j, (t->op == INT_SET_BIT_IF_SET ||
+                    t->op == INT_CLEAR_BIT_IF_SET) ? CC_E : CC_NE);
+                JitSetRelay(j, t->name1, (t->op == INT_SET_BIT_IF_SET ||
+                    t->op == INT_SET_BIT_IF_CLEAR));
+                JitLand(j, skip);
+                break;
+
+            case INT_SET_BIT_AND:
+                JitRelay(j, 0x8a, 0, t->name2); // mov al, [name2]
+                JitRelay(j, 0x22, 0, t->name3); // and al, [name3]
+                JitRelay(j, 0x88, 0, t->name1); // mov [name1], al
+                break;
+
+            case INT_SET_BIT_AND_NOT:
+                JitRelay(j, 0x8a, 0, t->name3); // mov al, [name3]
+                JitByte(j, 0x34);               // xor al, 1
+                JitByte(j, 1);
+                JitRelay(j, 0x22, 0, t->name2); // and al, [name2]
+                JitRelay(j, 0x88, 0, t->name1); // mov [name1], al
+                break;
+
+            case INT_SET_BIT_IF_SET_THEN_COPY:
+                JitTestRelay(j, t->name2);
+                skip = JitSkip(j, CC_E);
+                JitSetRelay(j, t->name1, 1);
+                JitLand(j, skip);
+                JitCopyRelay(j, t->name3, t->literal);
+                break;
+
+            case INT_CLEAR_BIT_THEN_COPY:
+                JitSetRelay(j, t->name1, 0);
+                JitCopyRelay(j, t->name2, t->name3);
+                break;
+
+            case INT_COPY_BIT_TO_BIT_TWICE:
+                JitCopyRelay(j, t->name1, t->name2);
+                JitCopyRelay(j, t->name3, t->literal);
+                break;
+
+            case INT_SET_BIT_AND_ALL:
+                JitRelay(j, 0x8a, 0, t->name2); // mov al, [name2]
+                for(i = 0; i < 16; i++) {
+                    if(((WORD)t->literal >> i) & 1) {
+                        JitRelay(j, 0x22, 0, t->name3 + i);
+                    }
+                }
+                JitRelay(j, 0x88, 0, t->name1);
+                break;
+
+            case INT_CLEAR_BIT_IF_ANY_CLEAR:
+            case INT_SET_BIT_IF_ANY_SET:
+                // Either AND together the bits of the mask, from 1, or
+                // else OR them, from 0.
+                if(t->op == INT_CLEAR_BIT_IF_ANY_CLEAR) {
+                    JitByte(j, 0xb0);           // mov al, 1
+                    JitByte(j, 1);
+                } else {
+                    JitByte(j, 0x31);           // xor eax, eax
+                    JitByte(j, 0xc0);
+                }
+                for(i = 0; i < 16; i++) {
+                    if(((WORD)t->literal >> i) & 1) {
+                        JitRelay(j, t->op == INT_CLEAR_BIT_IF_ANY_CLEAR ?
+                            0x22 : 0x0a, 0, t->name2 + i);
+                    }
+                }
+                skip = JitSkip(j, t->op == INT_CLEAR_BIT_IF_ANY_CLEAR ? CC_NE :
+                    CC_E);
+                JitSetRelay(j, t->name1, t->op == INT_SET_BIT_IF_ANY_SET);
+                JitLand(j, skip);
+                break;
+
+            case INT_SET_BITS:
+            case INT_CLEAR_BITS:
+                for(i = 0; i < 16; i++) {
+                    if(((WORD)t->literal >> i) & 1) {
+                        JitSetRelay(j, t->name1 + i, t->op == INT_SET_BITS);
+                    }
+                }
+                break;
+
+            case INT_SET_VARIABLE_TO_LITERAL:
+                JitByte(j, 0x66);               // mov word [name1], literal
+                JitByte(j, 0x41);
+                JitByte(j, 0xc7);
+                JitMem(j, 0, 1, 2*t->name1);
+                JitByte(j, t->literal);
+                JitByte(j, t->literal >> 8);
+                break;
+
+            case INT_SET_VARIABLE_TO_VARIABLE:
+                JitLoad(j, 0, t->name2);
+                JitStore(j, t->name1);
+                break;
+
+            case INT_INCREMENT_VARIABLE:
+            case INT_DECREMENT_VARIABLE:
+                JitByte(j, 0x66);               // inc or dec word [name1]
+                JitByte(j, 0x41);
+                JitByte(j, 0xff);
+                JitMem(j, t->op == INT_INCREMENT_VARIABLE ? 0 : 1, 1,
+                    2*t->name1);
+                break;
+
+            case INT_INCREMENT_VARIABLE_IF_LES:
+                JitLoad(j, 0, t->name2);
+                JitByte(j, 0x3d);               // cmp eax, literal
+                JitInt32(j, t->literal);
+                skip = JitSkip(j, CC_GE);
+                JitByte(j, 0x66);               // inc word [name1]
+                JitByte(j, 0x41);
+                JitByte(j, 0xff);
+                JitMem(j, 0, 1, 2*t->name1);
+                JitLand(j, skip);
+                break;
+
+            case INT_SET_VARIABLE_ADD_LITERAL:
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                JitLoad(j, 0, t->name2);
+                if(t->op == INT_SET_VARIABLE_ADD_LITERAL) {
+                    JitByte(j, 0x05);           // add eax, literal
+                } else if(t->op == INT_SET_VARIABLE_SUBTRACT_LITERAL) {
+                    JitByte(j, 0x2d);           // sub eax, literal
+                } else {
+                    JitByte(j, 0x69);           // imul eax, eax, literal
+                    JitByte(j, 0xc0);
+                }
+                JitInt32(j, t->literal);
+                JitStore(j, t->name1);
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                JitLoad(j, 0, t->name2);
+                JitByte(j, 0xb9);               // mov ecx, literal
+                JitInt32(j, t->literal);
+                JitByte(j, 0x99);               // cdq
+                JitByte(j, 0xf7);               // idiv ecx
+                JitByte(j, 0xf9);
+                JitStore(j, t->name1);
+                break;
+
+            case INT_SET_VARIABLE_ADD:
+                JitArith(j, t, 0x01);           // add eax, ecx
+                break;
+
+            case INT_SET_VARIABLE_SUBTRACT:
+                JitArith(j, t, 0x29);           // sub eax, ecx
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY:
+                JitArith(j, t, 0xaf);           // imul eax, ecx
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE:
+                JitLoad(j, 1, t->name3);
+                JitByte(j, 0x85);               // test ecx, ecx
+                JitByte(j, 0xc9);
+                skip = JitSkip(j, CC_E);
+                JitLoad(j, 0, t->name2);
+                JitByte(j, 0x99);               // cdq
+                JitByte(j, 0xf7);               // idiv ecx
+                JitByte(j, 0xf9);
+                JitStore(j, t->name1);
+                JitLand(j, skip);
+                break;
+
+            case INT_SET_VARIABLE_FROM_RING:
+                JitCall(j, SetVariableFromRing, t);
+                break;
+
+            case INT_SET_RING_FROM_VARIABLE:
+                JitCall(j, SetRingFromVariable, t);
+                break;
+
+            case INT_SET_VARIABLE_FROM_TABLE:
+                JitCall(j, SetVariableFromTable, t);
+                break;
+
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR:
+                JitCall(j, SetVariablePiecewiseLinear, t);
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                JitCall(j, SetVariableMultiplyDivide, t);
+                break;
+
+            case INT_SET_BIT_FROM_TRUTH_TABLE:
+                JitCall(j, SetBitFromTruthTable, t);
+                break;
+
+            case INT_READ_ADC:
+                JitCall(j, ReadAdc, t);
+                break;
+
+            case INT_SET_PWM:
+                JitCall(j, SetPwm, t);
+                break;
+
+            case INT_UART_SEND:
+                JitCall(j, UartSend, t);
+                break;
+
+            case INT_UART_RECV:
+                JitCall(j, UartRecv, t);
+                break;
+
+            case INT_EEPROM_BUSY_CHECK:
+                JitCall(j, EepromBusyCheck, t);
+                break;
+
+            case INT_EEPROM_READ:
+                JitCall(j, EepromRead, t);
+                break;
+
+            case INT_EEPROM_WRITE:
+                JitCall(j, EepromWrite, t);
+                break;
+
+            case INT_WRITE_FORMATTED_STRING:
+                JitCall(j, WriteFormattedString, t);
+                break;
+
+            case INT_IF_BIT_SET:
+            case INT_IF_BIT_CLEAR:
+                JitTestRelay(j, t->name1);
+                JitJump(j, t->op == INT_IF_BIT_SET ? CC_E : CC_NE, t->jump);
+                break;
+
+            case INT_COPY_BIT_THEN_IF_SET:
+                JitCopyRelay(j, t->name1, t->name2);
+                JitByte(j, 0x84);               // test al, al
+                JitByte(j, 0xc0);
+                JitJump(j, CC_E, t->jump);
+                break;
+
+            case INT_SET_BIT_AND_THEN_IF_SET:
+                // The mov leaves the flags from the and.
+                JitRelay(j, 0x8a, 0, t->name2);
+                JitRelay(j, 0x22, 0, t->literal);
+                JitRelay(j, 0x88, 0, t->name1);
+                JitJump(j, CC_E, t->jump);
+                break;
+
+            case INT_IF_VARIABLE_LES_LITERAL:
+                JitIfVariable(j, t, CC_L, 0);
+                break;
+
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+                JitIfVariable(j, t, CC_E, 0);
+                break;
+
+            case INT_IF_VARIABLE_GRT_LITERAL:
+                JitIfVariable(j, t, CC_G, 0);
+                break;
+
+            case INT_IF_VARIABLE_EQUALS_VARIABLE:
+                JitIfVariable(j, t, CC_E, 1);
+                break;
+
+            case INT_IF_VARIABLE_GRT_VARIABLE:
+                JitIfVariable(j, t, CC_G, 1);
+                break;
+
+            case INT_ELSE:
+                JitJump(j, CC_ALWAYS, t->jump);
+                break;
+
+            case INT_END_OF_PROGRAM:
+                JitByte(j, 0x48);               // add rsp, 40
+                JitByte(j, 0x83);
+                JitByte(j, 0xc4);
+                JitByte(j, 40);
+                JitByte(j, 0xc3);               // ret
+                break;
+
+            default:
+                goto done;
+        }
+    }
+    if(j->len > j->max) goto done;
+
+    for(i = 0; i < j->fixups; i++) {
+        int at = j->fixupAt[i];
+        long rel = j->opAt[j->fixupTo[i]] - (at + 4);
+        j->buf[at] = (BYTE)rel;
+        j->buf[at + 1] = (BYTE)(rel >> 8);
+        j->buf[at + 2] = (BYTE)(rel >> 16);
+        j->buf[at + 3] = (BYTE)(rel >> 24);
+    }
+
+#ifdef _WIN32
+    code = (BYTE *)VirtualAlloc(NULL, j->len, MEM_COMMIT | MEM_RESERVE,
+        PAGE_READWRITE);
+    if(!code) goto done;
+    memcpy(code, j->buf, j->len);
+    if(!VirtualProtect(code, j->len, PAGE_EXECUTE_READ, &oldProtect)) {
+        VirtualFree(code, 0, MEM_RELEASE);
+        goto done;
+    }
+#else
+    code = (BYTE *)mmap(NULL, j->len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == (BYTE *)MAP_FAILED) goto done;
+    memcpy(code, j->buf, j->len);
+    if(mprotect(code, j->len, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, j->len);
+        goto done;
+    }
+#endif
+    li->jitCode = (JitFunction *)code;
+    li->jitLength = j->len;
+
+done:
+    free(j->buf);
+    free(j->opAt);
+    free(j->fixupAt);
+    free(j->fixupTo);
+}
+
+static void JitFree(LdInterp *li)
+{
+    if(!li->jitCode) return;
+#ifdef _WIN32
+    VirtualFree((void *)li->jitCode, 0, MEM_RELEASE);
+#else
+    munmap((void *)li->jitCode, li->jitLength);
+#endif
+    li->jitCode = NULL;
+}
+#endif
+//-----------------------------------------------------------------------------
+// This is the actual interpreter. It runs the program, and needs no state
+// other than that kept in the instance's bits and int16s (and the copies of
+// the peripherals). If you specified a cycle time of 10 ms when you compiled
+// the program, then you would have to call LdInterpRunCycle() 100 times per
+// second for the timing to be correct.
+//
+// The execution time of this function depends mostly on the length of the
+// program. It will be a little bit data-dependent but not very.
+//
+// It runs the threaded form of the program, from Thread(). With GCC or
+// Clang, each op goes straight to the code for the next one, through the
+// address of that code in its handler; anywhere else, or if you define
+// NO_COMPUTED_GOTO, it goes back round a switch on the opcode instead. But
+// with the JIT, it just calls the native code, if there is any.
+//-----------------------------------------------------------------------------
+#ifdef BENCHMARK
+#define COUNT       ops++;
+#else
+#define COUNT
+#endif
+#ifdef COMPUTED_GOTO
+#define OP(x)       op_##x: COUNT
+#define NEXT        { t++; goto *t->handler; }
+#define GOTO(to)    { t = (to); goto *t->handler; }
+#else
+#define OP(x)       case x: COUNT
+#define NEXT        { t++; continue; }
+#define GOTO(to)    { t = (to); continue; }
+#endif
+static void RunProgram(LdInterp *li)
+{
+    ThreadedOp *t = li->threaded;
+    BitWord *Bits = li->bits;
+    SWORD *Integers = li->integers;
+#ifdef BENCHMARK
+    long ops = 0;
+#endif
+
+#ifdef JIT
+    if(li->jitCode) {
+        li->jitCode();
+        return;
+    }
+#endif
+
+#ifdef COMPUTED_GOTO
+    static void *Handlers[256] = {
+        [INT_SET_BIT]                       = &&op_INT_SET_BIT,
+        [INT_CLEAR_BIT]                     = &&op_INT_CLEAR_BIT,
+        [INT_COPY_BIT_TO_BIT]               = &&op_INT_COPY_BIT_TO_BIT,
+        [INT_SET_BIT_IF_SET]                = &&op_INT_SET_BIT_IF_SET,
+        [INT_SET_BIT_IF_CLEAR]              = &&op_INT_SET_BIT_IF_CLEAR,
+        [INT_CLEAR_BIT_IF_SET]              = &&op_INT_CLEAR_BIT_IF_SET,
+        [INT_CLEAR_BIT_IF_CLEAR]            = &&op_INT_CLEAR_BIT_IF_CLEAR,
+        [INT_SET_BIT_AND]                   = &&op_INT_SET_BIT_AND,
+        [INT_SET_BIT_AND_NOT]               = &&op_INT_SET_BIT_AND_NOT,
+        [INT_SET_BIT_IF_SET_THEN_COPY]      = &&op_INT_SET_BIT_IF_SET_THEN_COPY,
+        [INT_CLEAR_BIT_THEN_COPY]           = &&op_INT_CLEAR_BIT_THEN_COPY,
+        [INT_COPY_BIT_TO_BIT_TWICE]         = &&op_INT_COPY_BIT_TO_BIT_TWICE,
+        [INT_SET_BIT_AND_ALL]               = &&op_INT_SET_BIT_AND_ALL,
+        [INT_CLEAR_BIT_IF_ANY_CLEAR]        = &&op_INT_CLEAR_BIT_IF_ANY_CLEAR,
+        [INT_SET_BIT_IF_ANY_SET]            = &&op_INT_SET_BIT_IF_ANY_SET,
+        [INT_SET_BITS]                      = &&op_INT_SET_BITS,
+        [INT_CLEAR_BITS]                    = &&op_INT_CLEAR_BITS,
+        [INT_SET_VARIABLE_TO_LITERAL]       = &&op_INT_SET_VARIABLE_TO_LITERAL,
+        [INT_SET_VARIABLE_TO_VARIABLE]      = &&op_INT_SET_VARIABLE_TO_VARIABLE,
+        [INT_SET_VARIABLE_FROM_RING]        = &&op_INT_SET_VARIABLE_FROM_RING,
+        [INT_SET_RING_FROM_VARIABLE]        = &&op_INT_SET_RING_FROM_VARIABLE,
+        [INT_INCREMENT_VARIABLE]            = &&op_INT_INCREMENT_VARIABLE,
+        [INT_DECREMENT_VARIABLE]            = &&op_INT_DECREMENT_VARIABLE,
+        [INT_INCREMENT_VARIABLE_IF_LES]     =
+            &&op_INT_INCREMENT_VARIABLE_IF_LES,
+        [INT_SET_VARIABLE_FROM_TABLE]       = &&op_INT_SET_VARIABLE_FROM_TABLE,
+        [INT_SET_VARIABLE_PIECEWISE_LINEAR] =
+            &&op_INT_SET_VARIABLE_PIECEWISE_LINEAR,
+        [INT_SET_VARIABLE_ADD_LITERAL]      = &&op_INT_SET_VARIABLE_ADD_LITERAL,
+        [INT_SET_VARIABLE_SUBTRACT_LITERAL] =
+            &&op_INT_SET_VARIABLE_SUBTRACT_LITERAL,
+        [INT_SET_VARIABLE_MULTIPLY_LITERAL] =
+            &&op_INT_SET_VARIABLE_MULTIPLY_LITERAL,
+        [INT_SET_VARIABLE_DIVIDE_LITERAL]   =
+            &&op_INT_SET_VARIABLE_DIVIDE_LITERAL,
+        [INT_SET_VARIABLE_MULTIPLY_DIVIDE]  =
+            &&op_INT_SET_VARIABLE_MULTIPLY_DIVIDE,
+        [INT_SET_BIT_FROM_TRUTH_TABLE]      = &&op_INT_SET_BIT_FROM_TRUTH_TABLE,
+        [INT_READ_ADC]                      = &&op_INT_READ_ADC,
+        [INT_SET_PWM]                       = &&op_INT_SET_PWM,
+        [INT_UART_SEND]                     = &&op_INT_UART_SEND,
+        [INT_UART_RECV]                     = &&op_INT_UART_RECV,
+        [INT_EEPROM_BUSY_CHECK]             = &&op_INT_EEPROM_BUSY_CHECK,
+        [INT_EEPROM_READ]                   = &&op_INT_EEPROM_READ,
+        [INT_EEPROM_WRITE]                  = &&op_INT_EEPROM_WRITE,
+        [INT_WRITE_FORMATTED_STRING]        = &&op_INT_WRITE_FORMATTED_STRING,
+        [INT_SET_VARIABLE_ADD]              = &&op_INT_SET_VARIABLE_ADD,
+        [INT_SET_VARIABLE_SUBTRACT]         = &&op_INT_SET_VARIABLE_SUBTRACT,
+        [INT_SET_VARIABLE_MULTIPLY]         = &&op_INT_SET_VARIABLE_MULTIPLY,
+        [INT_SET_VARIABLE_DIVIDE]           = &&op_INT_SET_VARIABLE_DIVIDE,
+        [INT_IF_BIT_SET]                    = &&op_INT_IF_BIT_SET,
+        [INT_IF_BIT_CLEAR]                  = &&op_INT_IF_BIT_CLEAR,
+        [INT_COPY_BIT_THEN_IF_SET]          = &&op_INT_COPY_BIT_THEN_IF_SET,
+        [INT_SET_BIT_AND_THEN_IF_SET]       = &&op_INT_SET_BIT_AND_THEN_IF_SET,
+        [INT_IF_VARIABLE_LES_LITERAL]       = &&op_INT_IF_VARIABLE_LES_LITERAL,
+        [INT_IF_VARIABLE_EQUALS_LITERAL]    =
+            &&op_INT_IF_VARIABLE_EQUALS_LITERAL,
+        [INT_IF_VARIABLE_GRT_LITERAL]       = &&op_INT_IF_VARIABLE_GRT_LITERAL,
+        [INT_IF_VARIABLE_EQUALS_VARIABLE]   =
+            &&op_INT_IF_VARIABLE_EQUALS_VARIABLE,
+        [INT_IF_VARIABLE_GRT_VARIABLE]      =
+            &&op_INT_IF_VARIABLE_GRT_VARIABLE,
+        [INT_ELSE]                          = &&op_INT_ELSE,
+        [INT_END_OF_PROGRAM]                = &&op_INT_END_OF_PROGRAM,
+    };
+
+    // The handlers only have addresses in here, so fill them in the first
+    // time through.
+    if(!t->handler) {
+        ThreadedOp *u;
+        for(u = li->threaded; u < li->threaded + li->threadedCount; u++) {
+            u->handler = Handlers[u->op];
+        }
+    }
+    goto *t->handler;
+#else
+    for(;;) {
+        switch(t->op) {
+#endif
+            OP(INT_SET_BIT)
+                SET_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_CLEAR_BIT)
+                CLEAR_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_COPY_BIT_TO_BIT)
+                PUT_RELAY(t->name1, RELAY(t->name2));
+                NEXT;
+
+            OP(INT_SET_BIT_IF_SET)
+                if(RELAY(t->name2)) SET_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_SET_BIT_IF_CLEAR)
+                if(!RELAY(t->name2)) SET_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_CLEAR_BIT_IF_SET)
+                if(RELAY(t->name2)) CLEAR_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_CLEAR_BIT_IF_CLEAR)
+                if(!RELAY(t->name2)) CLEAR_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_SET_BIT_AND)
+                PUT_RELAY(t->name1, RELAY(t->name2) && RELAY(t->name3));
+                NEXT;
+
+            OP(INT_SET_BIT_AND_NOT)
+                PUT_RELAY(t->name1, RELAY(t->name2) && !RELAY(t->name3));
+                NEXT;
+
+            OP(INT_SET_BIT_IF_SET_THEN_COPY)
+                if(RELAY(t->name2)) SET_RELAY(t->name1);
+                PUT_RELAY(t->name3, RELAY(t->literal));
+                NEXT;
+
+            OP(INT_CLEAR_BIT_THEN_COPY)
+                CLEAR_RELAY(t->name1);
+                PUT_RELAY(t->name2, RELAY(t->name3));
+                NEXT;
+
+            OP(INT_COPY_BIT_TO_BIT_TWICE)
+                PUT_RELAY(t->name1, RELAY(t->name2));
+                PUT_RELAY(t->name3, RELAY(t->literal));
+                NEXT;
+
+            OP(INT_SET_BIT_AND_ALL)
+                PUT_RELAY(t->name1, RELAY(t->name2) &&
+                    ALL_RELAYS(t->name3, t->literal));
+                NEXT;
+
+            OP(INT_CLEAR_BIT_IF_ANY_CLEAR)
+                if(!ALL_RELAYS(t->name2, t->literal)) CLEAR_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_SET_BIT_IF_ANY_SET)
+                if(ANY_RELAYS(t->name2, t->literal)) SET_RELAY(t->name1);
+                NEXT;
+
+            OP(INT_SET_BITS)
+                SET_RELAYS(t->name1, t->literal);
+                NEXT;
+
+            OP(INT_CLEAR_BITS)
+                CLEAR_RELAYS(t->name1, t->literal);
+                NEXT;
+
+            OP(INT_SET_VARIABLE_TO_LITERAL)
+                Integers[t->name1] = t->literal;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_TO_VARIABLE)
+                Integers[t->name1] = Integers[t->name2];
+                NEXT;
+
+            OP(INT_SET_VARIABLE_FROM_RING)
+                SetVariableFromRing(li, t);
+                NEXT;
+
+            OP(INT_SET_RING_FROM_VARIABLE)
+                SetRingFromVariable(li, t);
+                NEXT;
+
+            OP(INT_INCREMENT_VARIABLE)
+                (Integers[t->name1])++;
+                NEXT;
+
+            OP(INT_DECREMENT_VARIABLE)
+                (Integers[t->name1])--;
+                NEXT;
+
+            OP(INT_INCREMENT_VARIABLE_IF_LES)
+                if(Integers[t->name2] < t->literal) (Integers[t->name1])++;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_FROM_TABLE)
+                SetVariableFromTable(li, t);
+                NEXT;
+
+            OP(INT_SET_VARIABLE_PIECEWISE_LINEAR)
+                SetVariablePiecewiseLinear(li, t);
+                NEXT;
+
+            OP(INT_SET_VARIABLE_ADD_LITERAL)
+                Integers[t->name1] = Integers[t->name2] + t->literal;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_SUBTRACT_LITERAL)
+                Integers[t->name1] = Integers[t->name2] - t->literal;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_MULTIPLY_LITERAL)
+                Integers[t->name1] = Integers[t->name2] * t->literal;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_DIVIDE_LITERAL)
+                Integers[t->name1] = Integers[t->name2] / t->literal;
+                NEXT;
+
+            OP(INT_SET_VARIABLE_MULTIPLY_DIVIDE)
+                SetVariableMultiplyDivide(li, t);
+                NEXT;
+
+            OP(INT_SET_BIT_FROM_TRUTH_TABLE)
+                SetBitFromTruthTable(li, t);
+                NEXT;
+
+            OP(INT_READ_ADC)
+                ReadAdc(li, t);
+                NEXT;
+
+            OP(INT_SET_PWM)
+                SetPwm(li, t);
+                NEXT;
+
+            OP(INT_UART_SEND)
+                UartSend(li, t);
+                NEXT;
+
+            OP(INT_UART_RECV)
+                UartRecv(li, t);
+                NEXT;
+
+            OP(INT_EEPROM_BUSY_CHECK)
+                EepromBusyCheck(li, t);
+                NEXT;
+
+            OP(INT_EEPROM_READ)
+                EepromRead(li, t);
+                NEXT;
+
+            OP(INT_EEPROM_WRITE)
+                EepromWrite(li, t);
+                NEXT;
+
+            OP(INT_WRITE_FORMATTED_STRING)
+                WriteFormattedString(li, t);
+                NEXT;
+
+            OP(INT_SET_VARIABLE_ADD)
+                Integers[t->name1] = Integers[t->name2] + Integers[t->name3];
+                NEXT;
+
+            OP(INT_SET_VARIABLE_SUBTRACT)
+                Integers[t->name1] = Integers[t->name2] - Integers[t->name3];
+                NEXT;
+
+            OP(INT_SET_VARIABLE_MULTIPLY)
+                Integers[t->name1] = Integers[t->name2] * Integers[t->name3];
+                NEXT;
+
+            OP(INT_SET_VARIABLE_DIVIDE)
+                if(Integers[t->name3] != 0) {
+                    Integers[t->name1] = Integers[t->name2] /
+                                                Integers[t->name3];
+                }
+                NEXT;
+
+            OP(INT_IF_BIT_SET)
+                if(!RELAY(t->name1)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_IF_BIT_CLEAR)
+                if(RELAY(t->name1)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_COPY_BIT_THEN_IF_SET)
+                PUT_RELAY(t->name1, RELAY(t->name2));
+                if(!RELAY(t->name1)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_SET_BIT_AND_THEN_IF_SET)
+                PUT_RELAY(t->name1, RELAY(t->name2) && RELAY(t->literal));
+                if(!RELAY(t->name1)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_IF_VARIABLE_LES_LITERAL)
+                if(!(Integers[t->name1] < t->literal)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_IF_VARIABLE_EQUALS_LITERAL)
+                if(!(Integers[t->name1] == t->literal)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_IF_VARIABLE_GRT_LITERAL)
+                if(!(Integers[t->name1] > t->literal)) GOTO(t->jump);
+                NEXT;
+
+            OP(INT_IF_VARIABLE_EQUALS_VARIABLE)
+                if(!(Integers[t->name1] == Integers[t->name2])) {
+                    GOTO(t->jump);
+                }
+                NEXT;
+
+            OP(INT_IF_VARIABLE_GRT_VARIABLE)
+                if(!(Integers[t->name1] > Integers[t->name2])) {
+                    GOTO(t->jump);
+                }
+                NEXT;
+
+            OP(INT_ELSE)
+                GOTO(t->jump);
+
+            OP(INT_END_OF_PROGRAM)
+#ifdef BENCHMARK
+                li->opsRun += ops;
+#endif
+                return;
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// The host's peripherals get called around each cycle, and never from the
+// middle of the program, so each callback is made at most once a cycle, for
+// all of its channels: before the program runs, to sample the ADCs, top up
+// the UART's receive buffer, and load the EEPROM the first time; and after
+// it, to write the PWMs if any changed, send what went into the UART's
+// transmit buffer, and write the part of the EEPROM that changed. The
+// callbacks are only for what the program uses.
+//-----------------------------------------------------------------------------
+static void StartCycle(LdInterp *li)
+{
+    LdInterpPeripherals *p = &li->periph;
+
+    if(li->adcCount > 0 && p->readAdcs) {
+        p->readAdcs(p->user, li->adcs, li->adcCount);
+    }
+    if(li->usesUart && p->uartRecv) {
+        int n;
+        li->rxLen -= li->rxAt;
+        memmove(li->rx, li->rx + li->rxAt, li->rxLen);
+        li->rxAt = 0;
+        n = p->uartRecv(p->user, li->rx + li->rxLen, UART_BUFFER - li->rxLen);
+        if(n > 0 && n <= UART_BUFFER - li->rxLen) li->rxLen += n;
+    }
+    if(li->eepromSize > 0 && !li->eepromLoaded && p->eepromRead) {
+        p->eepromRead(p->user, li->eeprom, li->eepromSize);
+        li->eepromLoaded = 1;
+    }
+}
+
+static void EndCycle(LdInterp *li)
+{
+    LdInterpPeripherals *p = &li->periph;
+
+    if(li->pwmsChanged && p->writePwms) {
+        p->writePwms(p->user, li->pwms, li->pwmCount);
+    }
+    li->pwmsChanged = 0;
+
+    // What the host doesn't take waits for the next cycle; with no host,
+    // it just goes.
+    if(li->txLen > 0) {
+        int n = p->uartSend ? p->uartSend(p->user, li->tx, li->txLen) :
+            li->txLen;
+        if(n > 0 && n <= li->txLen) {
+            li->txLen -= n;
+            memmove(li->tx, li->tx + n, li->txLen);
+        }
+    }
+
+    if(li->eepromLo < li->eepromHi && p->eepromWrite) {
+        p->eepromWrite(p->user, li->eepromLo, li->eeprom + li->eepromLo,
+            li->eepromHi - li->eepromLo);
+    }
+    li->eepromLo = li->eepromHi = 0;
+}
+
+void LdInterpRunCycle(LdInterp *li)
+{
+    StartCycle(li);
+    RunProgram(li);
+    EndCycle(li);
+}
+
+//-----------------------------------------------------------------------------
+// Find the ADC and PWM channels, and how much of the EEPROM the program
+// uses, and make room for them.
+//-----------------------------------------------------------------------------
+static int FindPeripherals(LdInterp *li)
+{
+    int i;
+
+    for(i = 0; i < li->threadedCount; i++) {
+        ThreadedOp *t = &li->threaded[i];
+        switch(t->op) {
+            case INT_READ_ADC:
+            case INT_SET_PWM:
+                Uses(t->op == INT_READ_ADC ? &li->adcCount : &li->pwmCount,
+                    t->literal);
+                break;
+
+            case INT_EEPROM_READ:
+            case INT_EEPROM_WRITE:
+                Uses(&li->eepromSize, (WORD)t->literal + 1);
+                break;
+
+            case INT_UART_SEND:
+            case INT_UART_RECV:
+            case INT_WRITE_FORMATTED_STRING:
+                li->usesUart = 1;
+                break;
+        }
+    }
+
+    li->adcChannels = (Channel *)calloc(li->adcCount + 1, sizeof(Channel));
+    li->adcs = (SWORD *)calloc(li->adcCount + 1, sizeof(SWORD));
+    li->pwmChannels = (Channel *)calloc(li->pwmCount + 1, sizeof(Channel));
+    li->pwms = (SWORD *)calloc(li->pwmCount + 1, sizeof(SWORD));
+    li->eeprom = (BYTE *)calloc(li->eepromSize + 1, 1);
+    if(!li->adcChannels || !li->adcs || !li->pwmChannels || !li->pwms ||
+        !li->eeprom)
+    {
+        return LDINTERP_NO_MEMORY;
+    }
+
+    for(i = 0; i < li->threadedCount; i++) {
+        ThreadedOp *t = &li->threaded[i];
+        WORD *d = (WORD *)t->data;
+        if(t->op == INT_READ_ADC) {
+            li->adcChannels[t->literal].addr = t->name1;
+        } else if(t->op == INT_SET_PWM) {
+            li->pwmChannels[t->literal].addr = t->name1;
+            li->pwmChannels[t->literal].frequency =
+                (long)d[0] | ((long)d[1] << 16);
+        }
+    }
+    return LDINTERP_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Load a program in either form, telling them apart by the first few bytes,
+// and then size its variables and thread it (and compile it, with the JIT).
+// buffer, if not NULL, is ours, to free along with the rest; a text program
+// has to be in one of those, with a NUL after it, since it gets cut up.
+//-----------------------------------------------------------------------------
+static LdInterp *Load(BYTE *image, size_t len, BYTE *buffer, int *error)
+{
+    LdInterp *li = (LdInterp *)calloc(1, sizeof(LdInterp));
+    int bits = 0, int16s = 0, err, i;
+
+    if(!li) {
+        free(buffer);
+        if(error) *error = LDINTERP_NO_MEMORY;
+        return NULL;
+    }
+    li->buffer = buffer;
+
+    if(len >= strlen(INT_IMAGE_MAGIC) &&
+        memcmp(image, INT_IMAGE_MAGIC, strlen(INT_IMAGE_MAGIC))==0)
+    {
+        err = LoadImage(li, image, len);
+    } else {
+        err = LoadText(li, (char *)image);
+    }
+    if(err == LDINTERP_OK) err = Thread(li);
+    if(err == LDINTERP_OK) err = FindPeripherals(li);
+    if(err != LDINTERP_OK) {
+        LdInterpFree(li);
+        if(error) *error = err;
+        return NULL;
+    }
+
+    for(i = 0; i < li->threadedCount; i++) {
+        Extent(&li->threaded[i], &bits, &int16s);
+    }
+    for(i = 0; i < li->symbolsSize; i++) {
+        Symbol *s = &li->symbols[i];
+        if(s->name) Uses(s->isBit ? &bits : &int16s, s->addr);
+    }
+    li->bitsCount = bits;
+    li->int16sCount = int16s;
+    li->bits = (BitWord *)calloc(BIT_WORDS(bits) + 1, sizeof(BitWord));
+    li->integers = (SWORD *)calloc(int16s + 1, sizeof(SWORD));
+    if(!li->bits || !li->integers) {
+        LdInterpFree(li);
+        if(error) *error = LDINTERP_NO_MEMORY;
+        return NULL;
+    }
+
+#ifdef JIT
+    JitCompile(li);
+#endif
+    if(error) *error = LDINTERP_OK;
+    return li;
+}
+
+LdInterp *LdInterpLoadMemory(const void *buf, size_t len, int *error)
+{
+    BYTE *copy;
+
+    if(len >= strlen(INT_IMAGE_MAGIC) &&
+        memcmp(buf, INT_IMAGE_MAGIC, strlen(INT_IMAGE_MAGIC))==0)
+    {
+        return Load((BYTE *)buf, len, NULL, error);
+    }
+    copy = (BYTE *)malloc(len + 1);
+    if(!copy) {
+        if(error) *error = LDINTERP_NO_MEMORY;
+        return NULL;
+    }
+    memcpy(copy, buf, len);
+    copy[len] = '\0';
+    return Load(copy, len, copy, error);
+}
+
+LdInterp *LdInterpLoadFile(const char *fileName, int *error)
+{
+    FILE *f = fopen(fileName, "rb");
+    BYTE *buf;
+    long len;
+
+    if(!f) {
+        if(error) *error = LDINTERP_CANT_OPEN;
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = (len < 0) ? NULL : (BYTE *)malloc(len + 1);
+    if(!buf || (long)fread(buf, 1, len, f) != len) {
+        fclose(f);
+        free(buf);
+        if(error) *error = buf ? LDINTERP_CANT_OPEN : LDINTERP_NO_MEMORY;
+        return NULL;
+    }
+    fclose(f);
+    buf[len] = '\0';
+    return Load(buf, len, buf, error);
+}
+
+void LdInterpFree(LdInterp *li)
+{
+    if(!li) return;
+#ifdef JIT
+    JitFree(li);
+#endif
+    free(li->threaded);
+    free(li->bits);
+    free(li->integers);
+    free(li->symbols);
+    free(li->adcChannels);
+    free(li->adcs);
+    free(li->pwmChannels);
+    free(li->pwms);
+    free(li->eeprom);
+    free(li->textProgram);
+    free(li->buffer);
+    free(li);
+}
+
+const char *LdInterpErrorString(int error)
+{
+    switch(error) {
+        case LDINTERP_OK:           return "no error";
+        case LDINTERP_CANT_OPEN:    return "couldn't read file";
+        case LDINTERP_BAD_FORMAT:   return "bad program format";
+        case LDINTERP_NO_MEMORY:    return "out of memory";
+        default:                    return "unknown error";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The host's way in to the variables. The addresses are checked here, but
+// not through the pointers, which are just into the arrays.
+//-----------------------------------------------------------------------------
+long LdInterpCycleTime(LdInterp *li)
+{
+    return li->cycleTime;
+}
+
+int LdInterpBitAddr(LdInterp *li, const char *name)
+{
+    Symbol *s = FindSymbol(li, name, 1);
+    return s->name ? s->addr : -1;
+}
+
+int LdInterpInt16Addr(LdInterp *li, const char *name)
+{
+    Symbol *s = FindSymbol(li, name, 0);
+    return s->name ? s->addr : -1;
+}
+
+int LdInterpGetBit(LdInterp *li, int addr)
+{
+    BitWord *Bits = li->bits;
+    if(addr < 0 || addr >= li->bitsCount) return 0;
+    return RELAY(addr);
+}
+
+void LdInterpSetBit(LdInterp *li, int addr, int v)
+{
+    BitWord *Bits = li->bits;
+    if(addr < 0 || addr >= li->bitsCount) return;
+    PUT_RELAY(addr, v);
+}
+
+unsigned char *LdInterpBitPointer(LdInterp *li, const char *name)
+{
+#ifdef PACKED_BITS
+    (void)li;
+    (void)name;
+    return NULL;
+#else
+    int addr = LdInterpBitAddr(li, name);
+    return (addr < 0) ? NULL : &li->bits[addr];
+#endif
+}
+
+unsigned char *LdInterpBits(LdInterp *li)
+{
+#ifdef PACKED_BITS
+    (void)li;
+    return NULL;
+#else
+    return li->bits;
+#endif
+}
+
+short *LdInterpInt16Pointer(LdInterp *li, const char *name)
+{
+    int addr = LdInterpInt16Addr(li, name);
+    return (addr < 0) ? NULL : &li->integers[addr];
+}
+
+short *LdInterpInt16s(LdInterp *li)
+{
+    return li->integers;
+}
+
+int LdInterpInt16sCount(LdInterp *li)
+{
+    return li->int16sCount;
+}
+
+int LdInterpBitsCount(LdInterp *li)
+{
+    return li->bitsCount;
+}
+
+int LdInterpNextSymbol(LdInterp *li, int i, const char **name, int *isBit,
+    int *addr)
+{
+    for(; i >= 0 && i < li->symbolsSize; i++) {
+        Symbol *s = &li->symbols[i];
+        if(!s->name) continue;
+        *name = s->name;
+        *isBit = s->isBit;
+        *addr = s->addr;
+        return i + 1;
+    }
+    return -1;
+}
+
+void LdInterpSetPeripherals(LdInterp *li, const LdInterpPeripherals *p)
+{
+    if(p) {
+        li->periph = *p;
+    } else {
+        memset(&li->periph, 0, sizeof(li->periph));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The name of the int16 at addr, for the channels; a linear search, but only
+// when the host is setting up.
+//-----------------------------------------------------------------------------
+static const char *Int16Name(LdInterp *li, WORD addr)
+{
+    int i;
+    for(i = 0; i < li->symbolsSize; i++) {
+        Symbol *s = &li->symbols[i];
+        if(s->name && !s->isBit && s->addr == addr) return s->name;
+    }
+    return NULL;
+}
+
+int LdInterpAdcCount(LdInterp *li)
+{
+    return li->adcCount;
+}
+
+const char *LdInterpAdcName(LdInterp *li, int channel)
+{
+    if(channel < 0 || channel >= li->adcCount) return NULL;
+    return Int16Name(li, li->adcChannels[channel].addr);
+}
+
+int LdInterpPwmCount(LdInterp *li)
+{
+    return li->pwmCount;
+}
+
+const char *LdInterpPwmName(LdInterp *li, int channel)
+{
+    if(channel < 0 || channel >= li->pwmCount) return NULL;
+    return Int16Name(li, li->pwmChannels[channel].addr);
+}
+
+long LdInterpPwmFrequency(LdInterp *li, int channel)
+{
+    if(channel < 0 || channel >= li->pwmCount) return 0;
+    return li->pwmChannels[channel].frequency;
+}
+
+int LdInterpEepromSize(LdInterp *li)
+{
+    return li->eepromSize;
+}
+
+long LdInterpOpsRun(LdInterp *li)
+{
+    return li->opsRun;
+}
+
+int LdInterpIsNative(LdInterp *li)
+{
+#ifdef JIT
+    return li->jitCode != NULL;
+#else
+    (void)li;
+    return 0;
+#endif
+}
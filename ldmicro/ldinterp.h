@@ -0,0 +1,143 @@
+//-----------------------------------------------------------------------------
+// An interpreter for the .int files generated by LDmicro, as a library that
+// you can build into your own program. Each program that you load gets its
+// own LdInterp, with its own variables, so you can run as many of them as
+// you like, side by side; nothing is shared between them, and two threads
+// can run two of them at once. Nothing here depends on Windows.
+//
+// Load the program, find the variables that the ladder logic shares with
+// your code by name, and then call LdInterpRunCycle() once every cycle time:
+//
+//     int error;
+//     LdInterp *li = LdInterpLoadFile("prog.int", &error);
+//     short *a = LdInterpInt16Pointer(li, "a");
+//     int xosc = LdInterpBitAddr(li, "Xosc");
+//     for(;;) {
+//         LdInterpSetBit(li, xosc, ...);
+//         LdInterpRunCycle(li);
+//         ... *a ...
+//     }
+//     LdInterpFree(li);
+//
+// The lookups by name go through a hash table, but they are still best done
+// once, up front; after that, the pointers and the addresses cost no more
+// than an array reference. If the program uses the ADCs, the PWMs, the UART
+// or the EEPROM, then those are up to you too; see LdInterpSetPeripherals().
+// See ldinterpret.c for a complete example.
+//-----------------------------------------------------------------------------
+#ifndef __LDINTERP_H
+#define __LDINTERP_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LdInterpTag LdInterp;
+
+// The errors from loading a program.
+#define LDINTERP_OK             0
+#define LDINTERP_CANT_OPEN      1
+#define LDINTERP_BAD_FORMAT     2
+#define LDINTERP_NO_MEMORY      3
+
+// Load a program from a file, in either the text form (.int) or the binary
+// form (.intb or .intp). On failure these return NULL, and set *error, if
+// error isn't NULL. LdInterpLoadMemory() takes the file's contents instead;
+// a binary image gets used where it is, without a copy, so it has to stay
+// there until LdInterpFree(), and be aligned to 8 bytes, but it can be
+// read-only (in flash, say).
+LdInterp *LdInterpLoadFile(const char *fileName, int *error);
+LdInterp *LdInterpLoadMemory(const void *buf, size_t len, int *error);
+void LdInterpFree(LdInterp *li);
+const char *LdInterpErrorString(int error);
+
+// Run the program once. For the timing to be right, call this once every
+// cycle time, in microseconds, as set when the program was compiled.
+void LdInterpRunCycle(LdInterp *li);
+long LdInterpCycleTime(LdInterp *li);
+
+// The addresses of the named variables, from the $$bits and $$int16s
+// sections, or -1 if the program doesn't use that name.
+int LdInterpBitAddr(LdInterp *li, const char *name);
+int LdInterpInt16Addr(LdInterp *li, const char *name);
+
+// The variables themselves. All of them start out as 0 (or cleared).
+int LdInterpGetBit(LdInterp *li, int addr);
+void LdInterpSetBit(LdInterp *li, int addr, int v);
+short *LdInterpInt16Pointer(LdInterp *li, const char *name);
+short *LdInterpInt16s(LdInterp *li);
+int LdInterpInt16sCount(LdInterp *li);
+int LdInterpBitsCount(LdInterp *li);
+
+// The bit variables directly, one byte each, 0 or 1, or NULL when they are
+// packed into words (if the library was built with PACKED_BITS); write only
+// 0 or 1 to them.
+unsigned char *LdInterpBitPointer(LdInterp *li, const char *name);
+unsigned char *LdInterpBits(LdInterp *li);
+
+// Go through all of the named variables, in no particular order: start with
+// i = 0, and keep passing back what this returns, until it returns -1. Each
+// call gives the name and the address of one variable, and whether it's a
+// bit or an int16.
+int LdInterpNextSymbol(LdInterp *li, int i, const char **name, int *isBit,
+    int *addr);
+
+// The program's ADCs, PWMs, UART and EEPROM are yours, through these
+// callbacks, any of which can be NULL. Each one gets called at most once a
+// cycle, for all of its channels at once, and only from LdInterpRunCycle(),
+// before or after it runs the program, never in the middle:
+//
+//   readAdcs(), before, gets the value of every ADC channel (from 0 to
+//      1023, as on a microcontroller);
+//   uartRecv(), before, puts up to max received bytes in buf, and returns
+//      how many it put there;
+//   eepromRead(), before the first cycle, gets the whole of the EEPROM
+//      that the program uses; without it, the EEPROM stays busy, as in the
+//      simulator, so the program never reads or writes it;
+//   writePwms(), after, gets the duty cycle of every PWM channel (in
+//      percent), if the program changed any; they all start at 0;
+//   uartSend(), after, gets the bytes that the program sent, and returns
+//      how many it took; the rest are kept for next time, and the program
+//      sees the UART busy while they fill the buffer;
+//   eepromWrite(), after, gets the span of the EEPROM that the program
+//      changed, from addr.
+//
+// Each gets user as its first argument.
+typedef struct {
+    void    *user;
+    void    (*readAdcs)(void *user, short *values, int count);
+    int     (*uartRecv)(void *user, unsigned char *buf, int max);
+    void    (*eepromRead)(void *user, unsigned char *buf, int len);
+    void    (*writePwms)(void *user, const short *duty, int count);
+    int     (*uartSend)(void *user, const unsigned char *buf, int len);
+    void    (*eepromWrite)(void *user, int addr, const unsigned char *buf,
+                int len);
+} LdInterpPeripherals;
+void LdInterpSetPeripherals(LdInterp *li, const LdInterpPeripherals *p);
+
+// The channels are numbered from 0, in the order in which the program first
+// uses each one; these say how many there are, and the name of the variable
+// for each, and the frequency of each PWM, in Hz. And the size of the EEPROM
+// that the program uses, in bytes.
+int LdInterpAdcCount(LdInterp *li);
+const char *LdInterpAdcName(LdInterp *li, int channel);
+int LdInterpPwmCount(LdInterp *li);
+const char *LdInterpPwmName(LdInterp *li, int channel);
+long LdInterpPwmFrequency(LdInterp *li, int channel);
+int LdInterpEepromSize(LdInterp *li);
+
+// For debugging: list the program, and count the ops that it has run (only
+// if the library was built with BENCHMARK), and say whether it runs as
+// native code.
+void LdInterpDisassemble(LdInterp *li, FILE *f);
+long LdInterpOpsRun(LdInterp *li);
+int LdInterpIsNative(LdInterp *li);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
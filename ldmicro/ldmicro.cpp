@@ -52,7 +52,10 @@ static BOOL ProgramChangedNotSaved = FALSE;
 #define HEX_PATTERN  "Intel Hex Files (*.hex)\0*.hex\0All files\0*\0\0"
 #define C_PATTERN "C Source Files (*.c)\0*.c\0All Files\0*\0\0"
 #define INTERPRETED_PATTERN \
-    "Interpretable Byte Code Files (*.int)\0*.int\0All Files\0*\0\0"
+    "Interpretable Byte Code Files (*.int)\0*.int\0" \
+    "Binary Interpretable Code (*.intb)\0*.intb\0" \
+    "Packed Binary Interpretable Code (*.intp)\0*.intp\0" \
+    "All Files\0*\0\0"
 char CurrentCompileFile[MAX_PATH];
 
 #define TXT_PATTERN  "Text Files (*.txt)\0*.txt\0All files\0*\0\0"
@@ -199,6 +202,42 @@ static void CompileProgram(BOOL compileAs)
 //    IntDumpListing("t.pl");
 }
 
+//-----------------------------------------------------------------------------
+// Work out how long one scan of the program would take on the selected
+// processor, and how much flash and RAM it would use, and report that,
+// without writing anything.
+//-----------------------------------------------------------------------------
+static void EstimateScanTime(void)
+{
+    if(!GenerateIntermediateCode()) return;
+
+    if(Prog.mcu == NULL) {
+        Error(_("Must choose a target microcontroller before compiling."));
+        return;
+    } 
+
+    if(UartFunctionUsed() && Prog.mcu->uartNeeds.rxPin == 0) {
+        Error(_("UART function used but not supported for this micro."));
+        return;
+    }
+    
+    if(PwmFunctionUsed() && Prog.mcu->pwmNeedsPin == 0) {
+        Error(_("PWM function used but not supported for this micro."));
+        return;
+    }
+
+    switch(Prog.mcu->whichIsa) {
+        case ISA_AVR:           CompileAvr(NULL); break;
+        case ISA_PIC16:         CompilePic16(NULL); break;
+        case ISA_ARDUINO:       CompileArduino(NULL); break;
+
+        default:
+            Error(_("Can only estimate the scan time for a PIC16, AVR or "
+                "Arduino target."));
+            break;
+    }
+}
+
 //-----------------------------------------------------------------------------
 // If the program has been modified then give the user the option to save it
 // or to cancel the operation they are performing. Return TRUE if they want
@@ -549,6 +588,10 @@ cmp:
             CHANGING_PROGRAM(ShowConfDialog());
             break;
 
+        case MNU_SUGGEST_CYCLE_TIME:
+            CHANGING_PROGRAM(SuggestCycleTime());
+            break;
+
         case MNU_SIMULATION_MODE:
             ToggleSimulationMode();
             break;
@@ -573,6 +616,10 @@ cmp:
             CompileProgram(TRUE);
             break;
 
+        case MNU_ESTIMATE:
+            EstimateScanTime();
+            break;
+
         case MNU_MANUAL:
             ShowHelpDialog(FALSE);
             break;
@@ -1064,6 +1111,49 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     while(isspace(*lpCmdLine)) {
         lpCmdLine++;
     }
+    // Before /c or /e, for testing: /t<n> says to generate the rungs on
+    // exactly n threads, and /u not to fuse the ops of interpretable code
+    // into superinstructions.
+    for(;;) {
+        if(memcmp(lpCmdLine, "/t", 2)==0) {
+            RungThreads = atoi(lpCmdLine + 2);
+        } else if(memcmp(lpCmdLine, "/u", 2)==0) {
+            NoSuperinstructions = TRUE;
+        } else {
+            break;
+        }
+        while(!isspace(*lpCmdLine) && *lpCmdLine) {
+            lpCmdLine++;
+        }
+        while(isspace(*lpCmdLine)) {
+            lpCmdLine++;
+        }
+    }
+    if(memcmp(lpCmdLine, "/e", 2)==0) {
+        RunningInBatchMode = TRUE;
+
+        char *source = lpCmdLine + 2;
+        while(isspace(*source)) {
+            source++;
+        }
+        if(*source == '\0') {
+            Error("Bad command line arguments: run 'ldmicro /e src.ld'");
+            exit(-1);
+        }
+        char *end = source;
+        while(!isspace(*end) && *end) {
+            end++;
+        }
+        *end = '\0';
+        if(!LoadProjectFromFile(source)) {
+            Error("Couldn't open '%s', running non-interactively.", source);
+            exit(-1);
+        }
+        strcpy(CurrentCompileFile, source);
+        GenerateIoList(-1);
+        EstimateScanTime();
+        exit(0);
+    }
     if(memcmp(lpCmdLine, "/c", 2)==0) {
         RunningInBatchMode = TRUE;
 
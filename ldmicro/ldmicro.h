@@ -102,6 +102,7 @@ typedef signed long SDWORD;
 #define MNU_INSERT_PWL          0x46
 
 #define MNU_MCU_SETTINGS        0x50
+#define MNU_SUGGEST_CYCLE_TIME  0x51
 #define MNU_PROCESSOR_0         0xa0
 
 #define MNU_SIMULATION_MODE     0x60
@@ -111,6 +112,7 @@ typedef signed long SDWORD;
 
 #define MNU_COMPILE             0x70
 #define MNU_COMPILE_AS          0x71
+#define MNU_ESTIMATE            0x72
 
 #define MNU_MANUAL              0x80
 #define MNU_ABOUT               0x81
@@ -393,6 +395,7 @@ typedef struct PlcProgramTag {
     int         cycleTime;
     int         mcuClock;
     int         baudRate;
+    BOOL        deadlineTimers;
 
 #define MAX_RUNGS 99
     ElemSubcktSeries *rungs[MAX_RUNGS];
@@ -629,6 +632,7 @@ int RungContainingSelected(void);
 BOOL ItemIsLastInCircuit(ElemLeaf *item);
 BOOL UartFunctionUsed(void);
 BOOL PwmFunctionUsed(void);
+BOOL MasterRelayUsed(void);
 void PushRungUp(void);
 void PushRungDown(void);
 void NewProgram(void);
@@ -646,6 +650,7 @@ BOOL CanUndo(void);
 // loadsave.cpp
 BOOL LoadProjectFromFile(char *filename);
 BOOL SaveProjectToFile(char *filename);
+int SaveElemToBuffer(int which, void *any, char *buf);
 
 // iolist.cpp
 int GenerateIoList(int prevSel);
@@ -678,6 +683,8 @@ void ShowPiecewiseLinearDialog(ElemLeaf *l);
 void ShowResetDialog(char *name);
 // confdialog.cpp
 void ShowConfDialog(void);
+// cycletime.cpp
+void SuggestCycleTime(void);
 // helpdialog.cpp
 void ShowHelpDialog(BOOL about);
 
@@ -689,6 +696,7 @@ void ShowHelpDialog(BOOL about);
     }
 void dbp(char *str, ...);
 void Error(char *str, ...);
+extern __declspec(thread) BOOL ErrorsSuppressed;
 void *CheckMalloc(size_t n);
 void CheckFree(void *p);
 extern HANDLE MainHeap;
@@ -704,6 +712,7 @@ void MakeDialogBoxClass(void);
 void NiceFont(HWND h);
 void FixedFont(HWND h);
 void CompileSuccessfulMessage(char *str);
+void ReportMessage(char *title, char *str, BOOL warning);
 extern BOOL RunningInBatchMode;
 extern HFONT MyNiceFont;
 extern HFONT MyFixedFont;
@@ -734,18 +743,42 @@ void AllocStart(void);
 DWORD AllocOctetRam(void);
 void AllocBitRam(DWORD *addr, int *bit);
 void MemForVariable(char *name, DWORD *addrl, DWORD *addrh);
+DWORD MemForArray(char *name, int n);
 BYTE MuxForAdcVariable(char *name);
 void MemForSingleBit(char *name, BOOL forRead, DWORD *addr, int *bit);
 void MemCheckForErrorsPostCompile(void);
 void BuildDirectionRegisters(BYTE *isInput, BYTE *isOutput);
 void ComplainAboutBaudRateError(int divisor, double actual, double err);
 void ComplainAboutBaudRateOverflow(void);
+void SourceMapStart(void);
+void SourceMapMark(DWORD addr, int rung);
+void WriteSourceMap(char *outFile);
+typedef int NextInstructionFn(DWORD addr, DWORD *to, int *cycles,
+    DWORD *call, int *loops);
+void ReportScanTime(NextInstructionFn *next, int clocksPerCycle,
+    DWORD progLen);
+extern double ScanTimeWorstCase;
+extern BOOL ScanTimeQuiet;
 #define CompileError() longjmp(CompileErrorBuf, 1)
-extern jmp_buf CompileErrorBuf;
+extern __declspec(thread) jmp_buf CompileErrorBuf;
 
 // intcode.cpp
 void IntDumpListing(char *outFile);
 BOOL GenerateIntermediateCode(void);
+int TenToThe(int x);
+void PiecewiseLinearSegment(ElemPiecewiseLinear *t, int k, SWORD *seg);
+int MultiplyByLiteralDigits(SWORD lit, int *digit);
+void DivideByLiteralReciprocal(SWORD lit, WORD *m, int *shift);
+int ShiftRegisterRingLength(char *ring);
+extern int RungThreads;
+// intflow.cpp
+void IntFlowAnalyse(void);
+int IntFlowNameIndex(char *name, BOOL isBit);
+BOOL IntFlowLiveIn(int block, int name);
+BOOL IntFlowLiveOut(int block, int name);
+int IntFlowReachingDefinitions(int op, int name, int *defs, int max);
+BOOL IntFlowVariableIsByte(char *name);
+void AllocateIntTemporaries(void);
 // pic16.cpp
 void CompilePic16(char *outFile);
 // avr.cpp
@@ -754,6 +787,7 @@ void CompileAvr(char *outFile);
 void CompileAnsiC(char *outFile);
 // interpreted.c
 void CompileInterpreted(char *outFile);
+extern BOOL NoSuperinstructions;
 //Arduino.cpp
 void CompileArduino(char *outFile);
 
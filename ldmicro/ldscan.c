@@ -0,0 +1,266 @@
+//-----------------------------------------------------------------------------
+// A scan executive for the interpreter, for a POSIX system; see ldscan.h for
+// how to use it, and ldinterpret.c for an example. This needs the real-time
+// parts of POSIX (clock_nanosleep(), sched_setscheduler() and mlockall()),
+// so it isn't built on Windows.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "ldscan.h"
+
+struct LdScanTag {
+    LdInterp        *li;
+
+    // The cycle time, and the release of the next scan, in ns from
+    // CLOCK_MONOTONIC.
+    long long       period;
+    long long       release;
+
+    long long       statsStarted;
+    LdScanStats     stats;
+
+    FILE            *statsFile;
+    long long       statsEvery;
+    long long       nextStats;
+
+    void            (*beforeScan)(void *user);
+    void            (*afterScan)(void *user);
+    void            *user;
+};
+
+static long long Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Touch enough of the stack that it's all there, and locked, before the
+// first scan, instead of faulting in during one.
+//-----------------------------------------------------------------------------
+static void PrefaultStack(void)
+{
+    volatile unsigned char stack[64*1024];
+    size_t i;
+
+    for(i = 0; i < sizeof(stack); i += 1024) {
+        stack[i] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Set up the scheduling and the memory as the options say. If anything
+// fails, then whatever was done already gets undone, so that a caller that
+// carries on without the executive isn't left at real-time priority, or with
+// its memory locked.
+//-----------------------------------------------------------------------------
+LdScan *LdScanNew(LdInterp *li, const LdScanOptions *o, int *error)
+{
+    LdScan *s;
+    struct sched_param oldParam;
+    int oldPolicy, scheduled = 0, locked = 0;
+    int e = LDSCAN_OK;
+
+    if(LdInterpCycleTime(li) <= 0) {
+        e = LDSCAN_NO_CYCLE_TIME;
+        goto fail;
+    }
+    if(o && o->priority > 0) {
+        struct sched_param sp;
+        if(pthread_getschedparam(pthread_self(), &oldPolicy, &oldParam)
+            != 0)
+        {
+            e = LDSCAN_CANT_SCHEDULE;
+            goto fail;
+        }
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = o->priority;
+        if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+            e = LDSCAN_CANT_SCHEDULE;
+            goto fail;
+        }
+        scheduled = 1;
+    }
+    if(o && o->lockMemory) {
+        if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            e = LDSCAN_CANT_LOCK;
+            goto fail;
+        }
+        locked = 1;
+        PrefaultStack();
+    }
+
+    s = (LdScan *)calloc(1, sizeof(*s));
+    if(!s) {
+        e = LDSCAN_NO_MEMORY;
+        goto fail;
+    }
+    s->li = li;
+    s->period = LdInterpCycleTime(li)*1000LL;
+    if(o && o->statsFile && o->statsEvery > 0) {
+        s->statsFile = o->statsFile;
+        s->statsEvery = (long long)(o->statsEvery*1e9);
+    }
+    if(o) {
+        s->beforeScan = o->beforeScan;
+        s->afterScan = o->afterScan;
+        s->user = o->user;
+    }
+    s->release = Now();
+    s->nextStats = s->release + s->statsEvery;
+    LdScanResetStats(s);
+    if(error) *error = LDSCAN_OK;
+    return s;
+
+fail:
+    if(locked) munlockall();
+    if(scheduled) pthread_setschedparam(pthread_self(), oldPolicy, &oldParam);
+    if(error) *error = e;
+    return NULL;
+}
+
+void LdScanFree(LdScan *s)
+{
+    free(s);
+}
+
+const char *LdScanErrorString(int error)
+{
+    switch(error) {
+        case LDSCAN_OK:             return "no error";
+        case LDSCAN_NO_CYCLE_TIME:  return "program has no cycle time";
+        case LDSCAN_CANT_SCHEDULE:  return "couldn't set SCHED_FIFO priority";
+        case LDSCAN_CANT_LOCK:      return "couldn't lock memory";
+        case LDSCAN_NO_MEMORY:      return "out of memory";
+        default:                    return "unknown error";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The bucket for a time in ns: 0 for under 1 us, and otherwise one more
+// than the number of the highest bit set in the time in us.
+//-----------------------------------------------------------------------------
+static int Bucket(long long ns)
+{
+    long long us = ns / 1000;
+    int b = 0;
+
+    while(us > 0 && b < LDSCAN_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+int LdScanCycle(LdScan *s)
+{
+    LdScanStats *st = &s->stats;
+    struct timespec ts;
+    long long start, end, wake, scan;
+    int overrun;
+
+    ts.tv_sec = s->release / 1000000000LL;
+    ts.tv_nsec = s->release % 1000000000LL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+
+    start = Now();
+    if(s->beforeScan) s->beforeScan(s->user);
+    LdInterpRunCycle(s->li);
+    if(s->afterScan) s->afterScan(s->user);
+    end = Now();
+
+    wake = start - s->release;
+    scan = end - start;
+    if(st->scans == 0 || wake < st->wakeMin) st->wakeMin = wake;
+    if(st->scans == 0 || wake > st->wakeMax) st->wakeMax = wake;
+    if(st->scans == 0 || scan < st->scanMin) st->scanMin = scan;
+    if(st->scans == 0 || scan > st->scanMax) st->scanMax = scan;
+    st->wakeSum += wake;
+    st->scanSum += scan;
+    st->wakeHistogram[Bucket(wake)]++;
+    st->scanHistogram[Bucket(scan)]++;
+    st->scans++;
+
+    // The next release is one period on, on the grid. If this scan ran past
+    // it, then that's an overrun, and the next scan starts late; but there's
+    // no point in running a release whose own deadline has gone by too.
+    s->release += s->period;
+    overrun = end > s->release;
+    if(overrun) st->overruns++;
+    while(s->release + s->period <= end) {
+        s->release += s->period;
+        st->skipped++;
+    }
+
+    if(s->statsFile && end >= s->nextStats) {
+        LdScanPrintStats(s, s->statsFile);
+        while(s->nextStats <= end) s->nextStats += s->statsEvery;
+    }
+    return overrun;
+}
+
+void LdScanGetStats(LdScan *s, LdScanStats *stats)
+{
+    *stats = s->stats;
+    stats->elapsed = Now() - s->statsStarted;
+}
+
+void LdScanResetStats(LdScan *s)
+{
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->statsStarted = Now();
+}
+
+//-----------------------------------------------------------------------------
+// Print the statistics, with the times in us, and the histograms only from
+// the first bucket that has anything in it to the last.
+//-----------------------------------------------------------------------------
+void LdScanPrintStats(LdScan *s, FILE *f)
+{
+    LdScanStats st;
+    long n;
+    int i, first, last;
+
+    LdScanGetStats(s, &st);
+    n = st.scans ? st.scans : 1;
+
+    fprintf(f, "%ld scans in %.1f s, cycle time %lld us, %ld overruns, "
+        "%ld skipped\n", st.scans, st.elapsed/1e9, s->period/1000,
+        st.overruns, st.skipped);
+    fprintf(f, "  %-14s %10s %10s %10s\n", "us", "min", "avg", "max");
+    fprintf(f, "  %-14s %10.1f %10.1f %10.1f\n", "scan", st.scanMin/1e3,
+        (double)st.scanSum/n/1e3, st.scanMax/1e3);
+    fprintf(f, "  %-14s %10.1f %10.1f %10.1f\n", "wake-up", st.wakeMin/1e3,
+        (double)st.wakeSum/n/1e3, st.wakeMax/1e3);
+
+    for(first = 0; first < LDSCAN_BUCKETS - 1; first++) {
+        if(st.scanHistogram[first] || st.wakeHistogram[first]) break;
+    }
+    for(last = LDSCAN_BUCKETS - 1; last > first; last--) {
+        if(st.scanHistogram[last] || st.wakeHistogram[last]) break;
+    }
+    fprintf(f, "  %-14s %10s %10s\n", "histogram", "scan", "wake-up");
+    for(i = first; i <= last; i++) {
+        char range[32];
+        if(i == 0) {
+            sprintf(range, "< 1");
+        } else if(i == LDSCAN_BUCKETS - 1) {
+            sprintf(range, ">= %ld", 1L << (i - 1));
+        } else {
+            sprintf(range, "%ld - %ld", 1L << (i - 1), 1L << i);
+        }
+        fprintf(f, "  %-14s %10ld %10ld\n", range, st.scanHistogram[i],
+            st.wakeHistogram[i]);
+    }
+    fflush(f);
+}
@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// A scan executive for the interpreter, for a POSIX system (like Linux): it
+// runs one program once every cycle time, as set when it was compiled, and
+// keeps statistics on how well it managed that.
+//
+// Each scan is released on a fixed grid, one cycle time after the last,
+// and the executive sleeps until the release with an absolute deadline
+// (clock_nanosleep() with TIMER_ABSTIME, on CLOCK_MONOTONIC), so the time
+// that the scan takes doesn't add up into drift. Optionally, the thread that
+// runs the scans gets real-time priority (SCHED_FIFO), and the process gets
+// its memory locked, so that a page fault doesn't hold up a scan:
+//
+//     LdScanOptions o = { 80, 1, stderr, 10, NULL, NULL, NULL };
+//     LdScan *s = LdScanNew(li, &o, &error);
+//     for(;;) {
+//         ... the inputs ...
+//         LdScanCycle(s);
+//         ... the outputs ...
+//     }
+//     LdScanFree(s);
+//
+// A scan that finishes after the next release is an overrun; the next scan
+// starts late, straight away. If a release has gone by completely, then it
+// gets skipped. For every scan, it records the wake-up latency (how long
+// after its release the scan really started) and how long the scan took, in
+// histograms, which you can get or print at any time, or have it print
+// every so often.
+//-----------------------------------------------------------------------------
+#ifndef __LDSCAN_H
+#define __LDSCAN_H
+
+#include <stdio.h>
+
+#include "ldinterp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LdScanTag LdScan;
+
+// The errors from starting the executive.
+#define LDSCAN_OK               0
+#define LDSCAN_NO_CYCLE_TIME    1
+#define LDSCAN_CANT_SCHEDULE    2
+#define LDSCAN_CANT_LOCK        3
+#define LDSCAN_NO_MEMORY        4
+
+// priority is for SCHED_FIFO, from 1 to 99, or 0 to leave the scheduling
+// as it is; that usually takes root, or CAP_SYS_NICE. If lockMemory is set,
+// then all of the process's memory, now and from now on, gets locked into
+// RAM. If statsFile isn't NULL, then the statistics get printed there every
+// statsEvery seconds, after a scan, in the time before the next release.
+// If beforeScan or afterScan isn't NULL, then it gets called, with user,
+// just before or just after each scan, and its time counts as part of the
+// scan; that's the place to latch the inputs and publish the outputs (see
+// ldshm.h).
+typedef struct {
+    int         priority;
+    int         lockMemory;
+    FILE        *statsFile;
+    double      statsEvery;
+    void        (*beforeScan)(void *user);
+    void        (*afterScan)(void *user);
+    void        *user;
+} LdScanOptions;
+
+// Set the executive up to run li, from the calling thread, which is the one
+// that gets the priority, and the one that has to call LdScanCycle(). The
+// options can be NULL, for none of them. On failure this returns NULL, and
+// sets *error, if error isn't NULL. LdScanFree() doesn't free li.
+LdScan *LdScanNew(LdInterp *li, const LdScanOptions *o, int *error);
+void LdScanFree(LdScan *s);
+const char *LdScanErrorString(int error);
+
+// Wait for the next release, and then run one scan. This returns 1 if the
+// scan overran, or else 0. The first release is when LdScanNew() returned.
+int LdScanCycle(LdScan *s);
+
+// The histograms have a bucket for each power of two of microseconds: the
+// first for under 1 us, and then from 1 to 2 us, from 2 to 4 us, and so on,
+// with the last one for anything longer.
+#define LDSCAN_BUCKETS          24
+
+// The statistics since the start, or since they were last reset; all of
+// the times are in ns.
+typedef struct {
+    long        scans;
+    long        overruns;
+    long        skipped;
+    long long   elapsed;
+
+    long long   scanMin;
+    long long   scanMax;
+    long long   scanSum;
+    long        scanHistogram[LDSCAN_BUCKETS];
+
+    long long   wakeMin;
+    long long   wakeMax;
+    long long   wakeSum;
+    long        wakeHistogram[LDSCAN_BUCKETS];
+} LdScanStats;
+
+// These have to be called from the thread that calls LdScanCycle().
+void LdScanGetStats(LdScan *s, LdScanStats *stats);
+void LdScanResetStats(LdScan *s);
+void LdScanPrintStats(LdScan *s, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
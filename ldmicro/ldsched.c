@@ -0,0 +1,406 @@
+//-----------------------------------------------------------------------------
+// A host for many ladder programs at once, on a POSIX system (like Linux).
+// It loads each of the .int files (or .intb or .intp files) named on its
+// command line, and runs each program at its own cycle time, as set when it
+// was compiled, on a pool of worker threads, with each worker pinned to its
+// own core. That takes the place of one process for each program, each one
+// sleeping between its cycles.
+//
+// The scans get scheduled earliest deadline first. Each program is released
+// once every cycle time, on a fixed grid so that it doesn't drift, and has
+// to finish its scan by its next release. Whenever a worker is free, it runs
+// the program that has been released and has the soonest deadline. A scan
+// that finishes after its deadline is an overrun. If a scan takes so long
+// that a release goes by completely, then that release gets skipped.
+//
+// For each program, it reports how many scans it ran, the overruns and the
+// skipped releases, the jitter (how long after its release each scan really
+// started, in microseconds), and the CPU that it used, as a percentage of
+// one core.
+//
+// Build it with something like
+//
+//     gcc -O2 -o ldsched ldsched.c ldinterp.c -lpthread
+//
+// and run it as
+//
+//     ldsched [-w workers] [-t seconds] [-r seconds] xxx.int yyy.int ...
+//
+// where -w gives the number of workers (by default, one for each core), -t
+// how long to run (by default, until interrupted), and -r how often to print
+// the report (by default, every 10 seconds; it prints one at the end too).
+//
+// Like ldinterpret.c, this is only an example. A real host would also connect
+// the programs' variables and peripherals to something, through ldinterp.h,
+// before it started the workers.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ldinterp.h"
+
+// Everything about one program: its interpreter, its schedule, and how it
+// has run so far, with all the times in ns, from CLOCK_MONOTONIC. At any
+// moment a program is either waiting for its release (in Pending), or
+// released and waiting for a worker (in Ready), or being run by exactly one
+// worker.
+typedef struct {
+    const char  *fileName;
+    LdInterp    *li;
+    long long   period;
+    long long   release;
+    long long   deadline;
+
+    long        scans;
+    long        overruns;
+    long        skipped;
+    long long   latencyMin;
+    long long   latencyMax;
+    long long   latencySum;
+    long long   cpu;
+} Program;
+
+// A binary heap of programs, with the soonest first; by release time or by
+// deadline.
+typedef struct {
+    Program     **p;
+    int         n;
+    int         byDeadline;
+} Heap;
+
+static Program *Programs;
+static int ProgramsCount;
+
+// The heaps, the statistics in the programs, and Stopping are all under
+// Lock. Wake gets signalled when a program goes back into Pending, since an
+// idle worker might have to wait for it, and when it's time to stop.
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake;
+static Heap Pending;
+static Heap Ready;
+static int Stopping;
+
+static long long Started;
+static volatile sig_atomic_t Interrupted;
+
+static long long Clock(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static struct timespec Timespec(long long t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000LL;
+    ts.tv_nsec = t % 1000000000LL;
+    return ts;
+}
+
+//-----------------------------------------------------------------------------
+// The heaps. There are never more programs in one than there are programs,
+// so they never grow.
+//-----------------------------------------------------------------------------
+static long long Key(Heap *h, int i)
+{
+    return h->byDeadline ? h->p[i]->deadline : h->p[i]->release;
+}
+
+static void Swap(Heap *h, int i, int j)
+{
+    Program *t = h->p[i];
+    h->p[i] = h->p[j];
+    h->p[j] = t;
+}
+
+static void Push(Heap *h, Program *p)
+{
+    int i = h->n++;
+    h->p[i] = p;
+    while(i > 0 && Key(h, (i - 1)/2) > Key(h, i)) {
+        Swap(h, i, (i - 1)/2);
+        i = (i - 1)/2;
+    }
+}
+
+static Program *Pop(Heap *h)
+{
+    Program *top = h->p[0];
+    int i = 0;
+
+    h->p[0] = h->p[--h->n];
+    for(;;) {
+        int c = 2*i + 1;
+        if(c >= h->n) break;
+        if(c + 1 < h->n && Key(h, c + 1) < Key(h, c)) c++;
+        if(Key(h, i) <= Key(h, c)) break;
+        Swap(h, i, c);
+        i = c;
+    }
+    return top;
+}
+
+//-----------------------------------------------------------------------------
+// Record how a scan went, and work out the program's next release. That's
+// on the grid, one period after this one; but if the scan ran so late that
+// the next release's own deadline has gone by too, then there's no point in
+// running it, so skip ahead to the first release that can still be met.
+//-----------------------------------------------------------------------------
+static void Account(Program *p, long long start, long long end,
+    long long cpu)
+{
+    long long latency = start - p->release;
+
+    if(p->scans == 0 || latency < p->latencyMin) p->latencyMin = latency;
+    if(p->scans == 0 || latency > p->latencyMax) p->latencyMax = latency;
+    p->latencySum += latency;
+    p->cpu += cpu;
+    p->scans++;
+    if(end > p->deadline) p->overruns++;
+
+    p->release += p->period;
+    while(p->release + p->period <= end) {
+        p->release += p->period;
+        p->skipped++;
+    }
+    p->deadline = p->release + p->period;
+}
+
+//-----------------------------------------------------------------------------
+// A worker thread, pinned to the given core (if that's possible here). Each
+// one takes whatever program is ready with the soonest deadline, runs one
+// scan of it, and puts it back to wait for its next release; when nothing is
+// ready, it waits for the soonest release.
+//-----------------------------------------------------------------------------
+static void *Worker(void *arg)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((int)(long)arg, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+
+    pthread_mutex_lock(&Lock);
+    while(!Stopping) {
+        long long now = Clock(CLOCK_MONOTONIC);
+        long long start, end, cpu;
+        Program *p;
+
+        while(Pending.n > 0 && Pending.p[0]->release <= now) {
+            Push(&Ready, Pop(&Pending));
+        }
+        if(Ready.n == 0) {
+            if(Pending.n > 0) {
+                struct timespec ts = Timespec(Pending.p[0]->release);
+                pthread_cond_timedwait(&Wake, &Lock, &ts);
+            } else {
+                pthread_cond_wait(&Wake, &Lock);
+            }
+            continue;
+        }
+
+        p = Pop(&Ready);
+        pthread_mutex_unlock(&Lock);
+
+        start = Clock(CLOCK_MONOTONIC);
+        cpu = Clock(CLOCK_THREAD_CPUTIME_ID);
+        LdInterpRunCycle(p->li);
+        cpu = Clock(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        end = Clock(CLOCK_MONOTONIC);
+
+        pthread_mutex_lock(&Lock);
+        Account(p, start, end, cpu);
+        Push(&Pending, p);
+        pthread_cond_signal(&Wake);
+    }
+    pthread_mutex_unlock(&Lock);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Print the statistics so far. Take a copy under the lock, and print from
+// that, so that the workers don't wait for the printing.
+//-----------------------------------------------------------------------------
+static void Report(FILE *f, int workers)
+{
+    Program *copy = (Program *)malloc(ProgramsCount*sizeof(*copy));
+    double elapsed, total = 0;
+    int i;
+
+    if(!copy) return;
+    pthread_mutex_lock(&Lock);
+    memcpy(copy, Programs, ProgramsCount*sizeof(*copy));
+    elapsed = (double)(Clock(CLOCK_MONOTONIC) - Started);
+    pthread_mutex_unlock(&Lock);
+
+    fprintf(f, "%-24s %9s %9s %8s %8s %9s %9s %9s %6s\n", "program",
+        "cycle us", "scans", "overruns", "skipped", "jit min", "jit avg",
+        "jit max", "cpu %");
+    for(i = 0; i < ProgramsCount; i++) {
+        Program *p = &copy[i];
+        double cpu = elapsed > 0 ? 100*p->cpu/elapsed : 0;
+        long n = p->scans ? p->scans : 1;
+
+        fprintf(f, "%-24s %9lld %9ld %8ld %8ld %9.1f %9.1f %9.1f %6.2f\n",
+            p->fileName, p->period/1000, p->scans, p->overruns, p->skipped,
+            p->latencyMin/1e3, (double)p->latencySum/n/1e3,
+            p->latencyMax/1e3, cpu);
+        total += cpu;
+    }
+    fprintf(f, "%d programs, %d workers, %.1f s, %.2f%% of one core "
+        "(%.2f%% of the workers)\n\n", ProgramsCount, workers, elapsed/1e9,
+        total, total/workers);
+    fflush(f);
+    free(copy);
+}
+
+static void Interrupt(int sig)
+{
+    (void)sig;
+    Interrupted = 1;
+}
+
+static void Usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-w workers] [-t seconds] [-r seconds] "
+        "xxx.int ...\n", argv0);
+    exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = 0;
+    double runFor = 0, reportEvery = 10;
+    long long nextReport, stopAt;
+    pthread_condattr_t attr;
+    pthread_t *threads;
+    sigset_t signals, old;
+    struct sigaction sa;
+    int i, c;
+
+    while((c = getopt(argc, argv, "w:t:r:")) != -1) {
+        switch(c) {
+            case 'w': workers = atoi(optarg); break;
+            case 't': runFor = atof(optarg); break;
+            case 'r': reportEvery = atof(optarg); break;
+            default: Usage(argv[0]);
+        }
+    }
+    if(optind >= argc || workers < 0 || runFor < 0 || reportEvery <= 0) {
+        Usage(argv[0]);
+    }
+    if(cores < 1) cores = 1;
+    if(workers == 0) workers = (int)cores;
+
+    ProgramsCount = argc - optind;
+    Programs = (Program *)calloc(ProgramsCount, sizeof(*Programs));
+    Pending.p = (Program **)calloc(ProgramsCount, sizeof(Program *));
+    Ready.p = (Program **)calloc(ProgramsCount, sizeof(Program *));
+    threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    if(!Programs || !Pending.p || !Ready.p || !threads) {
+        fprintf(stderr, "out of memory.\n");
+        exit(-1);
+    }
+    Ready.byDeadline = 1;
+
+    for(i = 0; i < ProgramsCount; i++) {
+        Program *p = &Programs[i];
+        int error;
+
+        p->fileName = argv[optind + i];
+        p->li = LdInterpLoadFile(p->fileName, &error);
+        if(!p->li) {
+            fprintf(stderr, "couldn't load '%s': %s.\n", p->fileName,
+                LdInterpErrorString(error));
+            exit(-1);
+        }
+        p->period = LdInterpCycleTime(p->li)*1000LL;
+        if(p->period <= 0) {
+            fprintf(stderr, "'%s' has no cycle time.\n", p->fileName);
+            exit(-1);
+        }
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&Wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // The first releases come a little while from now, to give the workers
+    // time to start, and are spread out over each program's cycle time, so
+    // that they don't all come in one burst; after that, each program stays
+    // on its own grid.
+    Started = Clock(CLOCK_MONOTONIC) + 10*1000*1000;
+    for(i = 0; i < ProgramsCount; i++) {
+        Programs[i].release = Started + Programs[i].period*i/ProgramsCount;
+        Programs[i].deadline = Programs[i].release + Programs[i].period;
+        Push(&Pending, &Programs[i]);
+    }
+
+    // Only this thread should see ^C; the workers get started with it
+    // blocked, and inherit that.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old);
+    for(i = 0; i < workers; i++) {
+        if(pthread_create(&threads[i], NULL, Worker,
+            (void *)(long)(i % cores)) != 0)
+        {
+            fprintf(stderr, "couldn't start worker %d.\n", i);
+            exit(-1);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    nextReport = Started + (long long)(reportEvery*1e9);
+    stopAt = runFor > 0 ? Started + (long long)(runFor*1e9) : 0;
+    while(!Interrupted) {
+        long long now = Clock(CLOCK_MONOTONIC);
+        long long until = nextReport;
+        struct timespec ts;
+
+        if(stopAt && now >= stopAt) break;
+        if(now >= nextReport) {
+            Report(stdout, workers);
+            nextReport += (long long)(reportEvery*1e9);
+            continue;
+        }
+        if(stopAt && stopAt < until) until = stopAt;
+        ts = Timespec(until);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    pthread_mutex_lock(&Lock);
+    Stopping = 1;
+    pthread_cond_broadcast(&Wake);
+    pthread_mutex_unlock(&Lock);
+    for(i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Report(stdout, workers);
+
+    for(i = 0; i < ProgramsCount; i++) {
+        LdInterpFree(Programs[i].li);
+    }
+    pthread_cond_destroy(&Wake);
+    free(threads);
+    free(Pending.p);
+    free(Ready.p);
+    free(Programs);
+    return 0;
+}
@@ -0,0 +1,444 @@
+//-----------------------------------------------------------------------------
+// The process image of a program in POSIX shared memory; see ldshm.h for
+// how to use it, and ldinterpret.c for an example. This needs shm_open(),
+// and the __atomic builtins of gcc (or clang), so it isn't built on Windows.
+// It calls into ldinterp.c for the side that runs the program, so the other
+// side has to link with that too, even though it never loads a program.
+//
+// The segment starts with a header, which gives the offsets of everything
+// else, each on its own cache line:
+//
+//   the pending flags, one bit per variable (the int16s first, and then the
+//      bits), in 32-bit words; a writer sets the flag after it stores the
+//      value, and LdShmLatchInputs() clears it when it takes the value;
+//   the values written, for the int16s and then for the bits;
+//   the two copies of the outputs, each with the int16s and then the bits;
+//   the directory, one ShmSymbol for each name, and then the names.
+//
+// The copies of the outputs work like a seqlock, with seq going up by two
+// each time the outputs get published: it's odd while they're being
+// written, and seq/2 says which copy was written last, so the next one to
+// be written is the other one. A reader that started on a copy can keep
+// reading it until seq gets to 3 past where it started, when that copy is
+// being written again.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ldshm.h"
+
+#define SHM_MAGIC       0x4d48534c      // 'LSHM'
+#define SHM_ALIGN       64
+#define ALIGN(x)        (((x) + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1))
+#define PENDING_WORDS(n) (((n) + 31) / 32)
+
+typedef struct {
+    unsigned    magic;
+    unsigned    size;
+    int         bitsCount;
+    int         int16sCount;
+    int         symbolsCount;
+    unsigned    pendingAt;
+    unsigned    inInt16sAt;
+    unsigned    inBitsAt;
+    unsigned    outAt[2];
+    unsigned    symbolsAt;
+    unsigned    namesAt;
+    unsigned    seq;
+} ShmHeader;
+
+typedef struct {
+    unsigned        nameAt;
+    unsigned short  addr;
+    unsigned short  isBit;
+} ShmSymbol;
+
+struct LdShmTag {
+    unsigned char   *base;
+    ShmHeader       *h;
+    unsigned        *pending;
+    short           *inInt16s;
+    unsigned char   *inBits;
+    ShmSymbol       *symbols;
+    const char      *names;
+
+    // Only for the side that runs the program.
+    LdInterp        *li;
+    char            *name;
+};
+
+static void Attach(LdShm *shm, unsigned char *base)
+{
+    ShmHeader *h = (ShmHeader *)base;
+
+    shm->base = base;
+    shm->h = h;
+    shm->pending = (unsigned *)(base + h->pendingAt);
+    shm->inInt16s = (short *)(base + h->inInt16sAt);
+    shm->inBits = base + h->inBitsAt;
+    shm->symbols = (ShmSymbol *)(base + h->symbolsAt);
+    shm->names = (const char *)(base + h->namesAt);
+}
+
+static short *OutInt16s(LdShm *shm, int which)
+{
+    return (short *)(shm->base + shm->h->outAt[which]);
+}
+
+static unsigned char *OutBits(LdShm *shm, int which)
+{
+    return shm->base + shm->h->outAt[which] +
+        shm->h->int16sCount*sizeof(short);
+}
+
+//-----------------------------------------------------------------------------
+// Copy the program's variables into one of the copies of the outputs. The
+// bits come straight across, unless the library keeps them packed.
+//-----------------------------------------------------------------------------
+static void CopyImage(LdShm *shm, int which)
+{
+    unsigned char *bits = OutBits(shm, which);
+    int i;
+
+    memcpy(OutInt16s(shm, which), LdInterpInt16s(shm->li),
+        shm->h->int16sCount*sizeof(short));
+    if(LdInterpBits(shm->li)) {
+        memcpy(bits, LdInterpBits(shm->li), shm->h->bitsCount);
+    } else {
+        for(i = 0; i < shm->h->bitsCount; i++) {
+            bits[i] = (unsigned char)LdInterpGetBit(shm->li, i);
+        }
+    }
+}
+
+LdShm *LdShmCreate(LdInterp *li, const char *name, int mode, int *error)
+{
+    int bits = LdInterpBitsCount(li);
+    int int16s = LdInterpInt16sCount(li);
+    int symbols = 0, isBit, addr, fd, i, j;
+    size_t namesLen = 0, at;
+    unsigned char *base;
+    const char *sym;
+    ShmHeader h;
+    LdShm *shm;
+
+    for(i = 0; (i = LdInterpNextSymbol(li, i, &sym, &isBit, &addr)) >= 0;) {
+        symbols++;
+        namesLen += strlen(sym) + 1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    at = ALIGN(sizeof(h));
+    h.pendingAt = at;
+    at = ALIGN(at + PENDING_WORDS(int16s + bits)*sizeof(unsigned));
+    h.inInt16sAt = at;
+    h.inBitsAt = at + int16s*sizeof(short);
+    at = ALIGN(h.inBitsAt + bits);
+    for(i = 0; i < 2; i++) {
+        h.outAt[i] = at;
+        at = ALIGN(at + int16s*sizeof(short) + bits);
+    }
+    h.symbolsAt = at;
+    h.namesAt = at + symbols*sizeof(ShmSymbol);
+    h.size = h.namesAt + namesLen;
+    h.bitsCount = bits;
+    h.int16sCount = int16s;
+    h.symbolsCount = symbols;
+
+    shm = (LdShm *)calloc(1, sizeof(*shm));
+    if(!shm || !(shm->name = strdup(name))) {
+        free(shm);
+        if(error) *error = LDSHM_NO_MEMORY;
+        return NULL;
+    }
+    shm->li = li;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, (mode_t)mode);
+    if(fd < 0) goto cantOpen;
+    if(ftruncate(fd, h.size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        goto cantOpen;
+    }
+    base = (unsigned char *)mmap(NULL, h.size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        shm_unlink(name);
+        goto cantOpen;
+    }
+
+    // The segment starts out as all zeros, so nothing is pending; fill in
+    // everything else, and the magic number last, so that nobody can open
+    // it half done.
+    memcpy(base, &h, sizeof(h));
+    Attach(shm, base);
+    at = 0;
+    for(i = 0, j = 0; (i = LdInterpNextSymbol(li, i, &sym, &isBit, &addr))
+        >= 0; j++)
+    {
+        shm->symbols[j].nameAt = at;
+        shm->symbols[j].addr = (unsigned short)addr;
+        shm->symbols[j].isBit = (unsigned short)isBit;
+        strcpy((char *)shm->names + at, sym);
+        at += strlen(sym) + 1;
+    }
+    CopyImage(shm, 0);
+    __atomic_store_n(&shm->h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    if(error) *error = LDSHM_OK;
+    return shm;
+
+cantOpen:
+    free(shm->name);
+    free(shm);
+    if(error) *error = LDSHM_CANT_OPEN;
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Take whatever has been written since the last scan. Only the words of
+// the pending flags that have something set cost an exchange; most of the
+// time, that's none of them.
+//-----------------------------------------------------------------------------
+void LdShmLatchInputs(LdShm *shm)
+{
+    ShmHeader *h = shm->h;
+    short *int16s = LdInterpInt16s(shm->li);
+    int words = PENDING_WORDS(h->int16sCount + h->bitsCount);
+    int w;
+
+    for(w = 0; w < words; w++) {
+        unsigned m;
+
+        if(!__atomic_load_n(&shm->pending[w], __ATOMIC_RELAXED)) continue;
+        m = __atomic_exchange_n(&shm->pending[w], 0, __ATOMIC_ACQUIRE);
+        while(m) {
+            int i = w*32 + __builtin_ctz(m);
+            m &= m - 1;
+            if(i < h->int16sCount) {
+                int16s[i] = __atomic_load_n(&shm->inInt16s[i],
+                    __ATOMIC_RELAXED);
+            } else {
+                i -= h->int16sCount;
+                LdInterpSetBit(shm->li, i,
+                    __atomic_load_n(&shm->inBits[i], __ATOMIC_RELAXED));
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the copy of the outputs that wasn't written last time, which the
+// readers have moved off by now (unless they're very slow), between the two
+// increments of seq.
+//-----------------------------------------------------------------------------
+void LdShmPublishOutputs(LdShm *shm)
+{
+    unsigned seq = shm->h->seq;
+
+    __atomic_store_n(&shm->h->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    CopyImage(shm, ((seq >> 1) + 1) & 1);
+    __atomic_store_n(&shm->h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+// Open a segment that some other process created, and check that it all
+// fits, since we can't trust it any more than that process.
+//-----------------------------------------------------------------------------
+static int Within(ShmHeader *h, unsigned at, size_t len)
+{
+    return at <= h->size && len <= h->size - at;
+}
+
+LdShm *LdShmOpen(const char *name, int *error)
+{
+    int e = LDSHM_BAD_FORMAT;
+    unsigned char *base;
+    struct stat st;
+    size_t namesLen;
+    ShmHeader *h;
+    LdShm *shm;
+    int fd, i;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+        if(error) *error = LDSHM_CANT_OPEN;
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShmHeader)) {
+        close(fd);
+        if(error) *error = LDSHM_BAD_FORMAT;
+        return NULL;
+    }
+    base = (unsigned char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        if(error) *error = LDSHM_CANT_OPEN;
+        return NULL;
+    }
+
+    h = (ShmHeader *)base;
+    if(__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        h->size != (size_t)st.st_size || h->bitsCount < 0 ||
+        h->int16sCount < 0 || h->symbolsCount < 0 || h->bitsCount > 65536 ||
+        h->int16sCount > 65536 || h->symbolsCount > 131072 ||
+        (h->pendingAt | h->inInt16sAt | h->outAt[0] | h->outAt[1] |
+            h->symbolsAt) % sizeof(unsigned) != 0 ||
+        !Within(h, h->pendingAt, PENDING_WORDS(h->int16sCount +
+            h->bitsCount)*sizeof(unsigned)) ||
+        !Within(h, h->inInt16sAt, h->int16sCount*sizeof(short)) ||
+        !Within(h, h->inBitsAt, h->bitsCount) ||
+        !Within(h, h->outAt[0], h->int16sCount*sizeof(short) +
+            h->bitsCount) ||
+        !Within(h, h->outAt[1], h->int16sCount*sizeof(short) +
+            h->bitsCount) ||
+        !Within(h, h->symbolsAt, h->symbolsCount*sizeof(ShmSymbol)) ||
+        !Within(h, h->namesAt, 0))
+    {
+        goto fail;
+    }
+
+    // Every name has to be in the names, which have to end in a NUL, and
+    // every address has to be in range.
+    namesLen = h->size - h->namesAt;
+    if(h->symbolsCount > 0 && (namesLen == 0 ||
+        base[h->size - 1] != '\0'))
+    {
+        goto fail;
+    }
+    for(i = 0; i < h->symbolsCount; i++) {
+        ShmSymbol *s = (ShmSymbol *)(base + h->symbolsAt) + i;
+        if(s->nameAt >= namesLen ||
+            s->addr >= (s->isBit ? h->bitsCount : h->int16sCount))
+        {
+            goto fail;
+        }
+    }
+
+    shm = (LdShm *)calloc(1, sizeof(*shm));
+    if(!shm) {
+        e = LDSHM_NO_MEMORY;
+        goto fail;
+    }
+    Attach(shm, base);
+    if(error) *error = LDSHM_OK;
+    return shm;
+
+fail:
+    munmap(base, st.st_size);
+    if(error) *error = e;
+    return NULL;
+}
+
+static int FindAddr(LdShm *shm, const char *name, int isBit)
+{
+    int i;
+    for(i = 0; i < shm->h->symbolsCount; i++) {
+        ShmSymbol *s = &shm->symbols[i];
+        if(!s->isBit == !isBit && strcmp(shm->names + s->nameAt, name) == 0) {
+            return s->addr;
+        }
+    }
+    return -1;
+}
+
+int LdShmBitAddr(LdShm *shm, const char *name)
+{
+    return FindAddr(shm, name, 1);
+}
+
+int LdShmInt16Addr(LdShm *shm, const char *name)
+{
+    return FindAddr(shm, name, 0);
+}
+
+int LdShmBitsCount(LdShm *shm)
+{
+    return shm->h->bitsCount;
+}
+
+int LdShmInt16sCount(LdShm *shm)
+{
+    return shm->h->int16sCount;
+}
+
+//-----------------------------------------------------------------------------
+// A write is the value, and then the pending flag, with release, so that
+// whoever sees the flag sees the value too.
+//-----------------------------------------------------------------------------
+static void SetPending(LdShm *shm, int i)
+{
+    __atomic_fetch_or(&shm->pending[i / 32], 1u << (i % 32),
+        __ATOMIC_RELEASE);
+}
+
+void LdShmWriteBit(LdShm *shm, int addr, int v)
+{
+    if(addr < 0 || addr >= shm->h->bitsCount) return;
+    __atomic_store_n(&shm->inBits[addr], v ? 1 : 0, __ATOMIC_RELAXED);
+    SetPending(shm, shm->h->int16sCount + addr);
+}
+
+void LdShmWriteInt16(LdShm *shm, int addr, short v)
+{
+    if(addr < 0 || addr >= shm->h->int16sCount) return;
+    __atomic_store_n(&shm->inInt16s[addr], v, __ATOMIC_RELAXED);
+    SetPending(shm, addr);
+}
+
+unsigned LdShmReadBegin(LdShm *shm, const unsigned char **bits,
+    const short **int16s)
+{
+    unsigned seq = __atomic_load_n(&shm->h->seq, __ATOMIC_ACQUIRE) & ~1u;
+    int which = (seq >> 1) & 1;
+
+    *bits = OutBits(shm, which);
+    *int16s = OutInt16s(shm, which);
+    return seq;
+}
+
+int LdShmReadRetry(LdShm *shm, unsigned token)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->h->seq, __ATOMIC_RELAXED) - token >= 3;
+}
+
+unsigned LdShmPublished(LdShm *shm)
+{
+    return __atomic_load_n(&shm->h->seq, __ATOMIC_ACQUIRE) >> 1;
+}
+
+int LdShmRemove(const char *name)
+{
+    return shm_unlink(name) == 0 ? 0 : -1;
+}
+
+void LdShmClose(LdShm *shm)
+{
+    if(!shm) return;
+    munmap(shm->base, shm->h->size);
+    if(shm->name) {
+        shm_unlink(shm->name);
+        free(shm->name);
+    }
+    free(shm);
+}
+
+const char *LdShmErrorString(int error)
+{
+    switch(error) {
+        case LDSHM_OK:              return "no error";
+        case LDSHM_CANT_OPEN:       return "couldn't open shared memory";
+        case LDSHM_BAD_FORMAT:      return "bad shared memory format";
+        case LDSHM_NO_MEMORY:       return "out of memory";
+        default:                    return "unknown error";
+    }
+}
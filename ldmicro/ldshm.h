@@ -0,0 +1,104 @@
+//-----------------------------------------------------------------------------
+// The process image of a running program (its bit and int16 variables, and
+// a directory of their names) in POSIX shared memory, so that other
+// processes (an HMI, a fieldbus driver, a logger) can read and write the
+// variables while it runs, without ever holding up its scans.
+//
+// The process that runs the program creates the segment, and then latches
+// the inputs at the start of each scan and publishes the outputs at the end
+// (from the beforeScan and afterScan hooks of ldscan.h, say):
+//
+//     LdShm *shm = LdShmCreate(li, "/prog", 0600, &error);
+//     for(;;) {
+//         LdShmLatchInputs(shm);
+//         LdInterpRunCycle(li);
+//         LdShmPublishOutputs(shm);
+//     }
+//     LdShmClose(shm);
+//
+// Any other process opens it by name, and looks up the variables that it
+// wants once, up front:
+//
+//     LdShm *shm = LdShmOpen("/prog", &error);
+//     int a = LdShmInt16Addr(shm, "a");
+//     int xosc = LdShmBitAddr(shm, "Xosc");
+//     LdShmWriteBit(shm, xosc, 1);
+//     do {
+//         t = LdShmReadBegin(shm, &bits, &int16s);
+//         ... int16s[a] ...
+//     } while(LdShmReadRetry(shm, t));
+//
+// Every variable is both an input and an output. A write goes into the
+// segment, and gets latched into the program at the start of its next scan;
+// after that, the program is free to change the variable, as it would be
+// any other. The outputs are the whole of the process image, as it was at
+// the end of a scan. There are two copies of that, and the program writes
+// the one that the readers aren't reading; the readers read in place,
+// without copying, and have to retry only if they take longer than a whole
+// scan, so that the program writes the copy that they're in too. Neither
+// side ever waits for the other, or takes a lock.
+//-----------------------------------------------------------------------------
+#ifndef __LDSHM_H
+#define __LDSHM_H
+
+#include "ldinterp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LdShmTag LdShm;
+
+// The errors from creating or opening the segment.
+#define LDSHM_OK                0
+#define LDSHM_CANT_OPEN         1
+#define LDSHM_BAD_FORMAT        2
+#define LDSHM_NO_MEMORY         3
+
+// The side that runs the program. LdShmCreate() publishes the variables as
+// they are now; the name is as for shm_open(), so it should start with a
+// slash, and the mode says who can open it, as for open() (0600 for just
+// this user, say, or 0660 for its group too), less the umask. Anyone who
+// can open it can write the program's inputs. It fails if there is already
+// a segment of that name, since another program might be running from it.
+// These all have to be called from the thread that runs li.
+LdShm *LdShmCreate(LdInterp *li, const char *name, int mode, int *error);
+void LdShmLatchInputs(LdShm *shm);
+void LdShmPublishOutputs(LdShm *shm);
+
+// Remove the name of a segment that was left behind by a process that died
+// before it could close it, so that it can be created again; 0 if it did,
+// or -1 if it couldn't. Only the host knows when that's safe.
+int LdShmRemove(const char *name);
+
+// The other side; any number of processes, and any number of threads in
+// each. The addresses are the same as the program's, or -1 if it doesn't
+// have a variable with that name.
+LdShm *LdShmOpen(const char *name, int *error);
+int LdShmBitAddr(LdShm *shm, const char *name);
+int LdShmInt16Addr(LdShm *shm, const char *name);
+int LdShmBitsCount(LdShm *shm);
+int LdShmInt16sCount(LdShm *shm);
+void LdShmWriteBit(LdShm *shm, int addr, int v);
+void LdShmWriteInt16(LdShm *shm, int addr, short v);
+
+// Read the outputs in place: LdShmReadBegin() points bits (one byte each,
+// 0 or 1) and int16s at the latest copy, and returns a token for
+// LdShmReadRetry(), which says whether the copy might have changed while
+// it was being read, so that it has to be read again. And how many times
+// the outputs have been published.
+unsigned LdShmReadBegin(LdShm *shm, const unsigned char **bits,
+    const short **int16s);
+int LdShmReadRetry(LdShm *shm, unsigned token);
+unsigned LdShmPublished(LdShm *shm);
+
+// Either side. The side that created the segment removes its name too, but
+// the processes that have it open keep it until they close it.
+void LdShmClose(LdShm *shm);
+const char *LdShmErrorString(int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -325,7 +325,7 @@ BOOL LoadProjectFromFile(char *filename)
     if(!f) return FALSE;
 
     char line[512];
-    int crystal, cycle, baud;
+    int crystal, cycle, baud, deadline;
 
     while(fgets(line, sizeof(line), f)) {
         if(strcmp(line, "IO LIST\n")==0) {
@@ -339,6 +339,8 @@ BOOL LoadProjectFromFile(char *filename)
             Prog.cycleTime = cycle;
         } else if(sscanf(line, "BAUD=%d", &baud)) {
             Prog.baudRate = baud;
+        } else if(sscanf(line, "DEADLINE_TIMERS=%d", &deadline)) {
+            Prog.deadlineTimers = deadline;
         } else if(memcmp(line, "COMPILED=", 9)==0) {
             line[strlen(line)-1] = '\0';
             strcpy(CurrentCompileFile, line+9);
@@ -383,79 +385,104 @@ failed:
     return FALSE;
 }
 
+//-----------------------------------------------------------------------------
+// Where an element gets saved to: a file, or else a buffer, or if that's
+// NULL too then nowhere, just counting the characters.
+//-----------------------------------------------------------------------------
+typedef struct SaveDestTag {
+    FILE   *f;
+    char   *buf;
+    int     len;
+} SaveDest;
+
+static void Out(SaveDest *d, char *str, ...)
+{
+    va_list v;
+    va_start(v, str);
+    if(d->f) {
+        vfprintf(d->f, str, v);
+    } else {
+        char line[1024];
+        int n = vsprintf(line, str, v);
+        if(d->buf) memcpy(d->buf + d->len, line, n);
+        d->len += n;
+    }
+    va_end(v);
+}
+
 //-----------------------------------------------------------------------------
 // Helper routine for outputting hierarchical representation of the ladder
-// logic: indent on file f, by depth*4 spaces.
+// logic: indent by depth*4 spaces.
 //-----------------------------------------------------------------------------
-static void Indent(FILE *f, int depth)
+static void Indent(SaveDest *d, int depth)
 {
     int i;
     for(i = 0; i < depth; i++) {
-        fprintf(f, "    ");
+        Out(d, "    ");
     }
 }
 
 //-----------------------------------------------------------------------------
-// Save an element to a file. If it is a leaf, then output a single line
-// describing it and return. If it is a subcircuit, call ourselves
-// recursively (with depth+1, so that the indentation is right) to handle
-// the members of the subcircuit. Special case for depth=0: we do not
-// output the SERIES/END delimiters. This is because the root is delimited
-// by RUNG/END markers output elsewhere.
+// Save an element. If it is a leaf, then output a single line describing it
+// and return. If it is a subcircuit, call ourselves recursively (with
+// depth+1, so that the indentation is right) to handle the members of the
+// subcircuit. Special case for depth=0: we do not output the SERIES/END
+// delimiters. This is because the root is delimited by RUNG/END markers
+// output elsewhere.
 //-----------------------------------------------------------------------------
-static void SaveElemToFile(FILE *f, int which, void *any, int depth)
+static void SaveElem(SaveDest *d, int which, void *any, int depth)
 {
     ElemLeaf *l = (ElemLeaf *)any;
     char *s;
 
-    Indent(f, depth);
+    Indent(d, depth);
 
     switch(which) {
         case ELEM_PLACEHOLDER:
-            fprintf(f, "PLACEHOLDER\n");
+            Out(d, "PLACEHOLDER\n");
             break;
 
         case ELEM_COMMENT: {
-            fprintf(f, "COMMENT ");
+            Out(d, "COMMENT ");
             char *s = l->d.comment.str;
             for(; *s; s++) {
                 if(*s == '\\') {
-                    fprintf(f, "\\\\");
+                    Out(d, "\\\\");
                 } else if(*s == '\n') {
-                    fprintf(f, "\\n");
+                    Out(d, "\\n");
                 } else if(*s == '\r') {
-                    fprintf(f, "\\r");
+                    Out(d, "\\r");
                 } else {
-                    fprintf(f, "%c", *s);
+                    Out(d, "%c", *s);
                 }
             }
-            fprintf(f, "\n");
+            Out(d, "\n");
             break;
         }
         case ELEM_OPEN:
-            fprintf(f, "OPEN\n");
+            Out(d, "OPEN\n");
             break;
 
         case ELEM_SHORT:
-            fprintf(f, "SHORT\n");
+            Out(d, "SHORT\n");
             break;
 
         case ELEM_MASTER_RELAY:
-            fprintf(f, "MASTER_RELAY\n");
+            Out(d, "MASTER_RELAY\n");
             break;
         
         case ELEM_SHIFT_REGISTER:
-            fprintf(f, "SHIFT_REGISTER %s %d\n", l->d.shiftRegister.name,
+            Out(d, "SHIFT_REGISTER %s %d\n", l->d.shiftRegister.name,
                 l->d.shiftRegister.stages);
             break;
 
         case ELEM_CONTACTS:
-            fprintf(f, "CONTACTS %s %d\n", l->d.contacts.name,
+            Out(d, "CONTACTS %s %d\n", l->d.contacts.name,
                 l->d.contacts.negated);
             break;
 
         case ELEM_COIL:
-            fprintf(f, "COIL %s %d %d %d\n", l->d.coil.name, l->d.coil.negated,
+            Out(d, "COIL %s %d %d %d\n", l->d.coil.name, l->d.coil.negated,
                 l->d.coil.setOnly, l->d.coil.resetOnly);
             break;
 
@@ -467,7 +494,7 @@ static void SaveElemToFile(FILE *f, int which, void *any, int depth)
             s = "RTO"; goto timer;
 
 timer:
-            fprintf(f, "%s %s %d\n", s, l->d.timer.name, l->d.timer.delay);
+            Out(d, "%s %s %d\n", s, l->d.timer.name, l->d.timer.delay);
             break;
 
         case ELEM_CTU:
@@ -478,15 +505,15 @@ timer:
             s = "CTC"; goto counter;
 
 counter:
-            fprintf(f, "%s %s %d\n", s, l->d.counter.name, l->d.counter.max);
+            Out(d, "%s %s %d\n", s, l->d.counter.name, l->d.counter.max);
             break;
 
         case ELEM_RES:
-            fprintf(f, "RES %s\n", l->d.reset.name);
+            Out(d, "RES %s\n", l->d.reset.name);
             break;
 
         case ELEM_MOVE:
-            fprintf(f, "MOVE %s %s\n", l->d.move.dest, l->d.move.src);
+            Out(d, "MOVE %s %s\n", l->d.move.dest, l->d.move.src);
             break;
 
         case ELEM_ADD: s = "ADD"; goto math;
@@ -494,7 +521,7 @@ counter:
         case ELEM_MUL: s = "MUL"; goto math;
         case ELEM_DIV: s = "DIV"; goto math;
 math:
-            fprintf(f, "%s %s %s %s\n", s, l->d.math.dest, l->d.math.op1,
+            Out(d, "%s %s %s %s\n", s, l->d.math.dest, l->d.math.op1,
                 l->d.math.op2);
             break;
 
@@ -505,72 +532,72 @@ math:
         case ELEM_LES: s = "LES"; goto cmp;
         case ELEM_LEQ: s = "LEQ"; goto cmp;
 cmp:
-            fprintf(f, "%s %s %s\n", s, l->d.cmp.op1, l->d.cmp.op2);
+            Out(d, "%s %s %s\n", s, l->d.cmp.op1, l->d.cmp.op2);
             break;
 
         case ELEM_ONE_SHOT_RISING:
-            fprintf(f, "OSR\n");
+            Out(d, "OSR\n");
             break;
 
         case ELEM_ONE_SHOT_FALLING:
-            fprintf(f, "OSF\n");
+            Out(d, "OSF\n");
             break;
 
         case ELEM_READ_ADC:
-            fprintf(f, "READ_ADC %s\n", l->d.readAdc.name);
+            Out(d, "READ_ADC %s\n", l->d.readAdc.name);
             break;
 
         case ELEM_SET_PWM:
-            fprintf(f, "SET_PWM %s %d\n", l->d.setPwm.name,
+            Out(d, "SET_PWM %s %d\n", l->d.setPwm.name,
                 l->d.setPwm.targetFreq);
             break;
 
         case ELEM_UART_RECV:
-            fprintf(f, "UART_RECV %s\n", l->d.uart.name);
+            Out(d, "UART_RECV %s\n", l->d.uart.name);
             break;
 
         case ELEM_UART_SEND:
-            fprintf(f, "UART_SEND %s\n", l->d.uart.name);
+            Out(d, "UART_SEND %s\n", l->d.uart.name);
             break;
 
         case ELEM_PERSIST:
-            fprintf(f, "PERSIST %s\n", l->d.persist.var);
+            Out(d, "PERSIST %s\n", l->d.persist.var);
             break;
 
         case ELEM_FORMATTED_STRING: {
             int i;
-            fprintf(f, "FORMATTED_STRING ");
+            Out(d, "FORMATTED_STRING ");
             if(*(l->d.fmtdStr.var)) {
-                fprintf(f, "%s", l->d.fmtdStr.var);
+                Out(d, "%s", l->d.fmtdStr.var);
             } else {
-                fprintf(f, "(none)");
+                Out(d, "(none)");
             }
-            fprintf(f, " %d", strlen(l->d.fmtdStr.string));
+            Out(d, " %d", strlen(l->d.fmtdStr.string));
             for(i = 0; i < (int)strlen(l->d.fmtdStr.string); i++) {
-                fprintf(f, " %d", l->d.fmtdStr.string[i]);
+                Out(d, " %d", l->d.fmtdStr.string[i]);
             }
-            fprintf(f, "\n");
+            Out(d, "\n");
             break;
         }
         case ELEM_LOOK_UP_TABLE: {
             int i;
-            fprintf(f, "LOOK_UP_TABLE %s %s %d %d", l->d.lookUpTable.dest,
+            Out(d, "LOOK_UP_TABLE %s %s %d %d", l->d.lookUpTable.dest,
                 l->d.lookUpTable.index, l->d.lookUpTable.count,
                 l->d.lookUpTable.editAsString);
             for(i = 0; i < l->d.lookUpTable.count; i++) {
-                fprintf(f, " %d", l->d.lookUpTable.vals[i]);
+                Out(d, " %d", l->d.lookUpTable.vals[i]);
             }
-            fprintf(f, "\n");
+            Out(d, "\n");
             break;
         }
         case ELEM_PIECEWISE_LINEAR: {
             int i;
-            fprintf(f, "PIECEWISE_LINEAR %s %s %d", l->d.piecewiseLinear.dest,
+            Out(d, "PIECEWISE_LINEAR %s %s %d", l->d.piecewiseLinear.dest,
                 l->d.piecewiseLinear.index, l->d.piecewiseLinear.count);
             for(i = 0; i < l->d.piecewiseLinear.count*2; i++) {
-                fprintf(f, " %d", l->d.piecewiseLinear.vals[i]);
+                Out(d, " %d", l->d.piecewiseLinear.vals[i]);
             }
-            fprintf(f, "\n");
+            Out(d, "\n");
             break;
         }
 
@@ -578,29 +605,29 @@ cmp:
             ElemSubcktSeries *s = (ElemSubcktSeries *)any;
             int i;
             if(depth == 0) {
-                fprintf(f, "RUNG\n");
+                Out(d, "RUNG\n");
             } else {
-                fprintf(f, "SERIES\n");
+                Out(d, "SERIES\n");
             }
             for(i = 0; i < s->count; i++) {
-                SaveElemToFile(f, s->contents[i].which, s->contents[i].d.any,
+                SaveElem(d, s->contents[i].which, s->contents[i].d.any,
                     depth+1);
             }
-            Indent(f, depth);
-            fprintf(f, "END\n");
+            Indent(d, depth);
+            Out(d, "END\n");
             break;
         }
 
         case ELEM_PARALLEL_SUBCKT: {
             ElemSubcktParallel *s = (ElemSubcktParallel *)any;
             int i;
-            fprintf(f, "PARALLEL\n");
+            Out(d, "PARALLEL\n");
             for(i = 0; i < s->count; i++) {
-                SaveElemToFile(f, s->contents[i].which, s->contents[i].d.any,
+                SaveElem(d, s->contents[i].which, s->contents[i].d.any,
                     depth+1);
             }
-            Indent(f, depth);
-            fprintf(f, "END\n");
+            Indent(d, depth);
+            Out(d, "END\n");
             break;
         }
 
@@ -610,6 +637,21 @@ cmp:
     }
 }
 
+//-----------------------------------------------------------------------------
+// Write an element into buf just as it would get saved to a file, without
+// a terminating nul, and return how many characters that took; or with buf
+// NULL, just return how many it would take. The code generator uses this to
+// tell whether a rung has changed.
+//-----------------------------------------------------------------------------
+int SaveElemToBuffer(int which, void *any, char *buf)
+{
+    SaveDest d;
+    memset(&d, 0, sizeof(d));
+    d.buf = buf;
+    SaveElem(&d, which, any, 0);
+    return d.len;
+}
+
 //-----------------------------------------------------------------------------
 // Save the program in memory to the given file. Returns TRUE for success,
 // FALSE otherwise.
@@ -626,6 +668,9 @@ BOOL SaveProjectToFile(char *filename)
     fprintf(f, "CYCLE=%d\n", Prog.cycleTime);
     fprintf(f, "CRYSTAL=%d\n", Prog.mcuClock);
     fprintf(f, "BAUD=%d\n", Prog.baudRate);
+    if(Prog.deadlineTimers) {
+        fprintf(f, "DEADLINE_TIMERS=%d\n", Prog.deadlineTimers);
+    }
     if(strlen(CurrentCompileFile) > 0) {
         fprintf(f, "COMPILED=%s\n", CurrentCompileFile);
     }
@@ -639,9 +684,12 @@ BOOL SaveProjectToFile(char *filename)
     fprintf(f, "\n", Prog.mcuClock);
     fprintf(f, "PROGRAM\n", Prog.mcuClock);
 
+    SaveDest d;
+    memset(&d, 0, sizeof(d));
+    d.f = f;
     int i;
     for(i = 0; i < Prog.numRungs; i++) {
-        SaveElemToFile(f, ELEM_SERIES_SUBCKT, Prog.rungs[i], 0);
+        SaveElem(&d, ELEM_SERIES_SUBCKT, Prog.rungs[i], 0);
     }
 
     fclose(f);
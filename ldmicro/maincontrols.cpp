@@ -345,6 +345,8 @@ HMENU MakeMainWindowMenus(void)
 
     settings = CreatePopupMenu();
     AppendMenu(settings, MF_STRING, MNU_MCU_SETTINGS, _("&MCU Parameters..."));
+    AppendMenu(settings, MF_STRING, MNU_SUGGEST_CYCLE_TIME,
+        _("&Suggest Cycle Time..."));
     ProcessorMenu = CreatePopupMenu();
     for(i = 0; i < NUM_SUPPORTED_MCUS; i++) {
         AppendMenu(ProcessorMenu, MF_STRING, MNU_PROCESSOR_0+i, 
@@ -368,6 +370,8 @@ HMENU MakeMainWindowMenus(void)
     compile = CreatePopupMenu();
     AppendMenu(compile, MF_STRING, MNU_COMPILE, _("&Compile\tF5"));
     AppendMenu(compile, MF_STRING, MNU_COMPILE_AS, _("Compile &As..."));
+    AppendMenu(compile, MF_SEPARATOR, 0, "");
+    AppendMenu(compile, MF_STRING, MNU_ESTIMATE, _("&Estimate Scan Time..."));
 
     help = CreatePopupMenu();
     AppendMenu(help, MF_STRING, MNU_MANUAL, _("&Manual...\tF1"));
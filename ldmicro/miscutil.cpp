@@ -33,6 +33,10 @@ BOOL RunningInBatchMode = FALSE;
 // Allocate memory on a local heap
 HANDLE MainHeap;
 
+// Set on the threads that generate code in the background, which mustn't
+// report errors themselves.
+__declspec(thread) BOOL ErrorsSuppressed;
+
 // Running checksum as we build up IHEX records.
 static int IhexChecksum;
 
@@ -84,6 +88,8 @@ BOOL AttachConsoleDynamic(DWORD base)
 //-----------------------------------------------------------------------------
 void Error(char *str, ...)
 {
+    if(ErrorsSuppressed) return;
+
     va_list f;
     char buf[1024];
     va_start(f, str);
@@ -128,6 +134,24 @@ void CompileSuccessfulMessage(char *str)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Show a report (like the estimate of the scan time) to the user, in a
+// message box, or on the console if we're running non-interactively.
+//-----------------------------------------------------------------------------
+void ReportMessage(char *title, char *str, BOOL warning)
+{
+    if(RunningInBatchMode) {
+        AttachConsoleDynamic(ATTACH_PARENT_PROCESS);
+        HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD written;
+        WriteFile(h, str, strlen(str), &written, NULL);
+        WriteFile(h, "\n", 1, &written, NULL);
+    } else {
+        MessageBox(MainWindow, str, title,
+            MB_OK | (warning ? MB_ICONWARNING : MB_ICONINFORMATION));
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Check the consistency of the heap on which all the PLC program stuff is
 // stored.
@@ -55,11 +55,13 @@ typedef enum Pic16OpTag {
     OP_MOVWF,
     OP_NOP,
     OP_RETFIE,
+    OP_RETLW,
     OP_RETURN,
     OP_RLF,
     OP_RRF,
     OP_SUBLW,
     OP_SUBWF,
+    OP_SWAPF,
     OP_XORWF,
 } Pic16Op;
 
@@ -75,6 +77,10 @@ typedef struct Pic16InstructionTag {
     Pic16Op     op;
     DWORD       arg1;
     DWORD       arg2;
+    // For a call, the subroutine that it calls; and for a branch back to
+    // the top of a loop, the most times that it goes round
+    DWORD       callee;
+    int         loops;
 } Pic16Instruction;
 
 #define MAX_PROGRAM_LEN 128*1024
@@ -90,6 +96,9 @@ static DWORD Scratch4;
 static DWORD Scratch5;
 static DWORD Scratch6;
 static DWORD Scratch7;
+// Only allocated if the program needs the multiply-divide routine
+static DWORD Scratch8;
+static DWORD Scratch9;
 
 // The extra byte to program, for the EEPROM (because we can only set
 // up one byte to program at a time, and we will be writing two-byte
@@ -101,8 +110,21 @@ static int EepromHighByteWaitingBit;
 // Subroutines to do multiply/divide
 static DWORD MultiplyRoutineAddress;
 static DWORD DivideRoutineAddress;
+static DWORD MultiplyDivideRoutineAddress;
+static DWORD FormattedStringRoutineAddress;
 static BOOL MultiplyNeeded;
 static BOOL DivideNeeded;
+static BOOL MultiplyDivideNeeded;
+static BOOL FormattedStringNeeded;
+
+// Truth tables for the combinational rungs, as RETLW tables in flash
+static DWORD TruthTableAddress[MAX_TRUTH_TABLES];
+// and likewise the look-up tables, two RETLWs per entry
+static DWORD LookUpTableAddress[MAX_LOOK_UP_TABLES];
+// and the x0, y0, dy, dx for each segment of the piecewise linear tables
+static DWORD PiecewiseLinearTableAddress[MAX_PIECEWISE_LINEARS];
+// and the formatted string templates, two RETLWs per character
+static DWORD FormattedStringTableAddress[MAX_FORMATTED_STRINGS];
 
 // For yet unresolved references in jumps
 static DWORD FwdAddrCount;
@@ -116,6 +138,7 @@ static DWORD FwdAddrCount;
 // Some useful registers, which I think are mostly in the same place on
 // all the PIC16... devices.
 #define REG_INDF      0x00
+#define REG_PCL       0x02
 #define REG_STATUS    0x03
 #define REG_FSR       0x04
 #define REG_PCLATH    0x0a
@@ -187,6 +210,8 @@ static void Instruction(Pic16Op op, DWORD arg1, DWORD arg2)
     PicProg[PicProgWriteP].op = op;
     PicProg[PicProgWriteP].arg1 = arg1;
     PicProg[PicProgWriteP].arg2 = arg2;
+    PicProg[PicProgWriteP].callee = 0;
+    PicProg[PicProgWriteP].loops = 0;
     PicProgWriteP++;
 }
 
@@ -224,6 +249,9 @@ static void FwdAddrIsNow(DWORD addr)
             seen = TRUE;
         } else if(PicProg[i].arg1 == FWD_LO(addr)) {
             PicProg[i].arg1 = (PicProgWriteP & 0x7ff);
+            // which leaves just the low bits, so keep all of it for
+            // the estimate of the scan time
+            if(PicProg[i].op == OP_CALL) PicProg[i].callee = PicProgWriteP;
             seen = TRUE;
         } else if(PicProg[i].arg1 == FWD_HI(addr)) {
             PicProg[i].arg1 = (PicProgWriteP >> 8);
@@ -328,6 +356,10 @@ static DWORD Assemble(Pic16Op op, DWORD arg1, DWORD arg2)
         case OP_RETFIE:
             return 0x0009;
 
+        case OP_RETLW:
+            CHECK(arg1, 8); CHECK(arg2, 0);
+            return (13 << 10) | arg1;
+
         case OP_RLF:
             CHECK(arg1, 7); CHECK(arg2, 1);
             return (13 << 8) | (arg2 << 7) | arg1;
@@ -338,12 +370,16 @@ static DWORD Assemble(Pic16Op op, DWORD arg1, DWORD arg2)
 
         case OP_SUBLW:
             CHECK(arg1, 8); CHECK(arg2, 0);
-            return (15 << 9) | arg1;
+            return (15 << 10) | arg1;
 
         case OP_SUBWF:
             CHECK(arg1, 7); CHECK(arg2, 1);
             return (2 << 8) | (arg2 << 7) | arg1;
 
+        case OP_SWAPF:
+            CHECK(arg1, 7); CHECK(arg2, 1);
+            return (14 << 8) | (arg2 << 7) | arg1;
+
         case OP_XORWF:
             CHECK(arg1, 7); CHECK(arg2, 1);
             return (6 << 8) | (arg2 << 7) | arg1;
@@ -437,6 +473,15 @@ static void WriteRegister(DWORD reg, BYTE val)
     if(reg & 0x100) Instruction(OP_BCF, REG_STATUS, STATUS_RP1);
 }
 
+//-----------------------------------------------------------------------------
+// Note that the goto that we just wrote goes back to the top of a loop, at
+// most the given number of times, for the estimate of the scan time.
+//-----------------------------------------------------------------------------
+static void LoopsAtMost(int times)
+{
+    PicProg[PicProgWriteP - 1].loops = times;
+}
+
 //-----------------------------------------------------------------------------
 // Call a subroutine, that might be in an arbitrary page, and then put
 // PCLATH back where we want it.
@@ -494,6 +539,363 @@ static void CompileIfBody(DWORD condFalse)
     if(IntCode[IntPc].op != INT_END_IF) oops();
 }
 
+//-----------------------------------------------------------------------------
+// Point FSR at the low octet of a stage of a shift register that's kept as a
+// ring buffer; that's the element at the index in the variable at headAddr,
+// plus the stage, modulo the length of the ring. The rings are all in the
+// first bank, so everything fits in an octet. Trashes W.
+//-----------------------------------------------------------------------------
+static void FsrForRingStage(DWORD base, int length, DWORD headAddr,
+    int stage)
+{
+    if(stage == 0) {
+        Instruction(OP_MOVF, headAddr, DEST_W);
+    } else {
+        // head + stage - length, plus length again if that borrowed
+        Instruction(OP_MOVLW, length - stage, 0);
+        Instruction(OP_SUBWF, headAddr, DEST_W);
+        Instruction(OP_MOVWF, REG_FSR, 0);
+        Instruction(OP_MOVLW, length, 0);
+        Instruction(OP_BTFSS, REG_STATUS, STATUS_C);
+        Instruction(OP_ADDWF, REG_FSR, DEST_F);
+        Instruction(OP_MOVF, REG_FSR, DEST_W);
+    }
+    Instruction(OP_MOVWF, REG_FSR, 0);
+    Instruction(OP_ADDWF, REG_FSR, DEST_F);
+    Instruction(OP_MOVLW, base, 0);
+    Instruction(OP_ADDWF, REG_FSR, DEST_F);
+}
+
+//-----------------------------------------------------------------------------
+// Signed comparison of a variable against a literal; jump to isLess if
+// var < lit, else to notLess.
+//-----------------------------------------------------------------------------
+static void CompareWithLiteral(DWORD addrl, DWORD addrh, SWORD literal,
+    DWORD isLess, DWORD notLess)
+{
+    DWORD lsbDecides = AllocFwdAddr();
+
+    // V = Rd7*(Rr7')*(R7') + (Rd7')*Rr7*R7 ; but only one of the
+    // product terms can be true, and we know which at compile
+    // time
+    BYTE litH = (literal >> 8);
+    BYTE litL = (literal & 0xff);
+
+    // var - lit
+    Instruction(OP_MOVLW, litH, 0);
+    Instruction(OP_SUBWF, addrh, DEST_W);
+    IfBitSet(REG_STATUS, STATUS_Z);
+    Instruction(OP_GOTO, lsbDecides, 0);
+    Instruction(OP_MOVWF, Scratch0, 0);
+    if(litH & 0x80) {
+        Instruction(OP_COMF, addrh, DEST_W);
+        Instruction(OP_ANDWF, Scratch0, DEST_W);
+        Instruction(OP_XORWF, Scratch0, DEST_F);
+    } else {
+        Instruction(OP_COMF, Scratch0, DEST_W);
+        Instruction(OP_ANDWF, addrh, DEST_W);
+        Instruction(OP_XORWF, Scratch0, DEST_F);
+    }
+    IfBitSet(Scratch0, 7); // var - lit < 0, var < lit
+    Instruction(OP_GOTO, isLess, 0);
+    Instruction(OP_GOTO, notLess, 0);
+
+    FwdAddrIsNow(lsbDecides);
+
+    // var - lit < 0
+    // var < lit
+    Instruction(OP_MOVLW, litL, 0);
+    Instruction(OP_SUBWF, addrl, DEST_W);
+    IfBitClear(REG_STATUS, STATUS_C);
+    Instruction(OP_GOTO, isLess, 0);
+    Instruction(OP_GOTO, notLess, 0);
+}
+
+//-----------------------------------------------------------------------------
+// The same for a variable that always fits in a byte, against a literal from
+// 0 to 255; then an unsigned compare of the low octets will do.
+//-----------------------------------------------------------------------------
+static void CompareByteWithLiteral(DWORD addrl, SWORD literal, DWORD isLess,
+    DWORD notLess)
+{
+    Instruction(OP_MOVLW, literal, 0);
+    Instruction(OP_SUBWF, addrl, DEST_W);
+    IfBitClear(REG_STATUS, STATUS_C);
+    Instruction(OP_GOTO, isLess, 0);
+    Instruction(OP_GOTO, notLess, 0);
+}
+
+//-----------------------------------------------------------------------------
+// dest := src + lit, with the literal folded into the instructions. Safe
+// if dest and src are the same variable. If dest always fits in a byte then
+// its high octet is zero, and so is the high octet of the sum.
+//-----------------------------------------------------------------------------
+static void AddLiteral(DWORD addrl, DWORD addrh, DWORD addrl2, DWORD addrh2,
+    WORD literal, BOOL destIsByte)
+{
+    BYTE litH = (literal >> 8);
+    BYTE litL = (literal & 0xff);
+
+    Instruction(OP_MOVLW, litL, 0);
+    Instruction(OP_ADDWF, addrl2, DEST_W);
+    Instruction(OP_MOVWF, addrl, 0);
+    if(destIsByte) return;
+
+    Instruction(OP_MOVLW, litH, 0);
+    IfBitSet(REG_STATUS, STATUS_C);
+    Instruction(OP_MOVLW, (BYTE)(litH + 1), 0);
+    Instruction(OP_ADDWF, addrh2, DEST_W);
+    Instruction(OP_MOVWF, addrh, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Negate a 16-bit quantity in place.
+//-----------------------------------------------------------------------------
+static void Negate(DWORD lo, DWORD hi)
+{
+    Instruction(OP_COMF, lo, DEST_F);
+    Instruction(OP_COMF, hi, DEST_F);
+    Instruction(OP_INCF, lo, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_Z);
+    Instruction(OP_INCF, hi, DEST_F);
+}
+
+//-----------------------------------------------------------------------------
+// Negate a 16-bit quantity in place, if it is negative.
+//-----------------------------------------------------------------------------
+static void NegateIfNegative(DWORD lo, DWORD hi)
+{
+    DWORD positive = AllocFwdAddr();
+
+    Instruction(OP_BTFSS, hi, 7);
+    Instruction(OP_GOTO, positive, 0);
+    Negate(lo, hi);
+    FwdAddrIsNow(positive);
+}
+
+//-----------------------------------------------------------------------------
+// Shift a 16-bit quantity left by n places, a whole octet at a time where we
+// can.
+//-----------------------------------------------------------------------------
+static void ShiftLeft(DWORD lo, DWORD hi, int n)
+{
+    for(; n >= 8; n -= 8) {
+        Instruction(OP_MOVF, lo, DEST_W);
+        Instruction(OP_MOVWF, hi, 0);
+        Instruction(OP_CLRF, lo, 0);
+    }
+    for(; n > 0; n--) {
+        Instruction(OP_BCF, REG_STATUS, STATUS_C);
+        Instruction(OP_RLF, lo, DEST_F);
+        Instruction(OP_RLF, hi, DEST_F);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// dest := src * lit. Start from the top nonzero digit, and then for each
+// digit below it shift left, and add or subtract src if the digit is
+// nonzero; that's built up in Scratch3:2, so it's safe if dest and src are
+// the same variable. If there are a lot of nonzero digits then the multiply
+// routine is shorter, and not that much slower, so use that instead.
+//-----------------------------------------------------------------------------
+static void MultiplyByLiteral(DWORD addrl, DWORD addrh, DWORD addrl2,
+    DWORD addrh2, SWORD lit, BOOL destIsByte)
+{
+    int digit[16];
+    int n = MultiplyByLiteralDigits(lit, digit);
+    if(n > 4) {
+        MultiplyNeeded = TRUE;
+        Instruction(OP_MOVF, addrl2, DEST_W);
+        Instruction(OP_MOVWF, Scratch0, 0);
+        Instruction(OP_MOVF, addrh2, DEST_W);
+        Instruction(OP_MOVWF, Scratch1, 0);
+        Instruction(OP_MOVLW, lit & 0xff, 0);
+        Instruction(OP_MOVWF, Scratch2, 0);
+        Instruction(OP_MOVLW, (lit >> 8) & 0xff, 0);
+        Instruction(OP_MOVWF, Scratch3, 0);
+        CallWithPclath(MultiplyRoutineAddress);
+    } else {
+        Instruction(OP_CLRF, Scratch2, 0);
+        Instruction(OP_CLRF, Scratch3, 0);
+
+        int k = 15;
+        while(k >= 0 && digit[k] == 0) k--;
+        int shift = 0;
+        for(; k >= 0; k--) {
+            if(digit[k] != 0) {
+                ShiftLeft(Scratch2, Scratch3, shift);
+                shift = 0;
+            }
+            if(digit[k] > 0) {
+                Instruction(OP_MOVF, addrl2, DEST_W);
+                Instruction(OP_ADDWF, Scratch2, DEST_F);
+                IfBitSet(REG_STATUS, STATUS_C);
+                Instruction(OP_INCF, Scratch3, DEST_F);
+                Instruction(OP_MOVF, addrh2, DEST_W);
+                Instruction(OP_ADDWF, Scratch3, DEST_F);
+            } else if(digit[k] < 0) {
+                Instruction(OP_MOVF, addrl2, DEST_W);
+                Instruction(OP_SUBWF, Scratch2, DEST_F);
+                IfBitClear(REG_STATUS, STATUS_C);
+                Instruction(OP_DECF, Scratch3, DEST_F);
+                Instruction(OP_MOVF, addrh2, DEST_W);
+                Instruction(OP_SUBWF, Scratch3, DEST_F);
+            }
+            shift++;
+        }
+        if(shift > 0) ShiftLeft(Scratch2, Scratch3, shift - 1);
+    }
+
+    Instruction(OP_MOVF, Scratch2, DEST_W);
+    Instruction(OP_MOVWF, addrl, 0);
+    if(destIsByte) return;
+    Instruction(OP_MOVF, Scratch3, DEST_W);
+    Instruction(OP_MOVWF, addrh, 0);
+}
+
+//-----------------------------------------------------------------------------
+// dest := src / lit, where lit is not zero, truncating toward zero like the
+// divide routine. By a power of two that's an arithmetic shift, once a
+// negative dividend has had the divisor less one added to it, so that it
+// rounds up; by anything else, multiply the magnitude of the dividend by the
+// reciprocal from DivideByLiteralReciprocal(), and then fix up the sign.
+//-----------------------------------------------------------------------------
+static void DivideByLiteral(DWORD addrl, DWORD addrh, DWORD addrl2,
+    DWORD addrh2, SWORD lit, BOOL destIsByte)
+{
+    DWORD d = (lit < 0) ? -lit : lit;
+    DWORD lo, hi;
+
+    Instruction(OP_MOVF, addrl2, DEST_W);
+    Instruction(OP_MOVWF, Scratch0, 0);
+    Instruction(OP_MOVF, addrh2, DEST_W);
+    Instruction(OP_MOVWF, Scratch1, 0);
+
+    if((d & (d - 1)) == 0) {
+        lo = Scratch0;
+        hi = Scratch1;
+
+        int k = 0;
+        while((1ul << k) < d) k++;
+        if(k > 0) {
+            DWORD positive = AllocFwdAddr();
+            IfBitClear(hi, 7);
+            Instruction(OP_GOTO, positive, 0);
+            Instruction(OP_MOVLW, (d - 1) & 0xff, 0);
+            Instruction(OP_ADDWF, lo, DEST_F);
+            IfBitSet(REG_STATUS, STATUS_C);
+            Instruction(OP_INCF, hi, DEST_F);
+            if((d - 1) >> 8) {
+                Instruction(OP_MOVLW, (d - 1) >> 8, 0);
+                Instruction(OP_ADDWF, hi, DEST_F);
+            }
+            FwdAddrIsNow(positive);
+        }
+        if(k >= 8) {
+            Instruction(OP_MOVF, hi, DEST_W);
+            Instruction(OP_MOVWF, lo, 0);
+            Instruction(OP_CLRF, hi, 0);
+            IfBitSet(lo, 7);
+            Instruction(OP_DECF, hi, DEST_F);
+            k -= 8;
+        }
+        for(; k > 0; k--) {
+            // carry := sign bit, to shift in
+            Instruction(OP_RLF, hi, DEST_W);
+            Instruction(OP_RRF, hi, DEST_F);
+            Instruction(OP_RRF, lo, DEST_F);
+        }
+        if(lit < 0) Negate(lo, hi);
+    } else {
+        lo = Scratch4;
+        hi = Scratch5;
+
+        WORD m;
+        int shift;
+        DivideByLiteralReciprocal(lit, &m, &shift);
+
+        // W still holds the high octet of the dividend, so its sign.
+        MultiplyNeeded = TRUE;
+        Instruction(OP_MOVWF, Scratch7, 0);
+        NegateIfNegative(Scratch0, Scratch1);
+        Instruction(OP_MOVLW, m & 0xff, 0);
+        Instruction(OP_MOVWF, Scratch2, 0);
+        Instruction(OP_MOVLW, m >> 8, 0);
+        Instruction(OP_MOVWF, Scratch3, 0);
+        CallWithPclath(MultiplyRoutineAddress);
+
+        // The quotient is the high word of the product, shifted right.
+        shift -= 16;
+        if(shift >= 8) {
+            Instruction(OP_MOVF, hi, DEST_W);
+            Instruction(OP_MOVWF, lo, 0);
+            Instruction(OP_CLRF, hi, 0);
+            shift -= 8;
+        }
+        for(; shift > 0; shift--) {
+            Instruction(OP_BCF, REG_STATUS, STATUS_C);
+            Instruction(OP_RRF, hi, DEST_F);
+            Instruction(OP_RRF, lo, DEST_F);
+        }
+
+        // Negative if exactly one of the dividend and divisor is.
+        DWORD done = AllocFwdAddr();
+        if(lit < 0) {
+            IfBitSet(Scratch7, 7);
+        } else {
+            IfBitClear(Scratch7, 7);
+        }
+        Instruction(OP_GOTO, done, 0);
+        Negate(lo, hi);
+        FwdAddrIsNow(done);
+    }
+
+    Instruction(OP_MOVF, lo, DEST_W);
+    Instruction(OP_MOVWF, addrl, 0);
+    if(destIsByte) return;
+    Instruction(OP_MOVF, hi, DEST_W);
+    Instruction(OP_MOVWF, addrh, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Binary search for the first segment of a piecewise linear table whose upper
+// x is not less than the index, unrolled at compile time; segments lo to hi-1
+// are the candidates, and hi is past the last point. Expects the index in
+// Scratch5:4 with its sign bit flipped, so that an unsigned compare will do,
+// and goes to found with eight times the segment in W, or else to outside.
+//-----------------------------------------------------------------------------
+static void PiecewiseLinearSearch(ElemPiecewiseLinear *t, int lo, int hi,
+    DWORD found, DWORD outside)
+{
+    if(lo == hi) {
+        if(hi == t->count - 1) {
+            Instruction(OP_GOTO, outside, 0);
+        } else {
+            Instruction(OP_MOVLW, lo*8, 0);
+            Instruction(OP_GOTO, found, 0);
+        }
+        return;
+    }
+
+    int mid = (lo + hi)/2;
+    WORD x = ((WORD)t->vals[(mid+1)*2]) ^ 0x8000;
+    DWORD greater = AllocFwdAddr();
+
+    // x - index, which borrows if the index is greater
+    Instruction(OP_MOVF, Scratch4, DEST_W);
+    Instruction(OP_SUBLW, x & 0xff, 0);
+    Instruction(OP_MOVF, Scratch5, DEST_W);
+    IfBitClear(REG_STATUS, STATUS_C);
+    Instruction(OP_INCFSZ, Scratch5, DEST_W);
+    Instruction(OP_SUBLW, x >> 8, 0);
+    IfBitClear(REG_STATUS, STATUS_C);
+    Instruction(OP_GOTO, greater, 0);
+
+    PiecewiseLinearSearch(t, lo, mid, found, outside);
+    FwdAddrIsNow(greater);
+    PiecewiseLinearSearch(t, mid + 1, hi, found, outside);
+}
+
 //-----------------------------------------------------------------------------
 // Compile the intermediate code to PIC16 native code.
 //-----------------------------------------------------------------------------
@@ -511,8 +913,8 @@ static void CompileFromIntermediate(BOOL topLevel)
 
     for(; IntPc < IntCodeLen; IntPc++) {
         // Try for a margin of about 400 words, which is a little bit
-        // wasteful but considering that the formatted output commands
-        // are huge, probably necessary. Of course if we are in our
+        // wasteful but considering that the piecewise linear searches
+        // can be big, probably necessary. Of course if we are in our
         // last section then it is silly to do that, either we make it
         // or we're screwed...
         if(topLevel && (((PicProgWriteP + 400) >> 11) != section) &&
@@ -531,6 +933,7 @@ static void CompileFromIntermediate(BOOL topLevel)
             // should just work
         }
         IntOp *a = &IntCode[IntPc];
+        SourceMapMark(PicProgWriteP, a->rung);
         switch(a->op) {
             case INT_SET_BIT:   
                 MemForSingleBit(a->name1, FALSE, &addr, &bit);
@@ -551,11 +954,18 @@ static void CompileFromIntermediate(BOOL topLevel)
             case INT_SET_VARIABLE_TO_LITERAL:
                 MemForVariable(a->name1, &addrl, &addrh);
                 WriteRegister(addrl, a->literal & 0xff);
-                WriteRegister(addrh, a->literal >> 8);
+                if(!IntFlowVariableIsByte(a->name1)) {
+                    WriteRegister(addrh, a->literal >> 8);
+                }
                 break;
 
             case INT_INCREMENT_VARIABLE: {
                 MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1)) {
+                    // and it won't carry, or it wouldn't fit
+                    Instruction(OP_INCF, addrl, DEST_F);
+                    break;
+                }
                 DWORD noCarry = AllocFwdAddr();
                 Instruction(OP_INCFSZ, addrl, DEST_F);
                 Instruction(OP_GOTO, noCarry, 0);
@@ -563,6 +973,18 @@ static void CompileFromIntermediate(BOOL topLevel)
                 FwdAddrIsNow(noCarry);
                 break;
             }
+            case INT_DECREMENT_VARIABLE:
+                MemForVariable(a->name1, &addrl, &addrh);
+                if(IntFlowVariableIsByte(a->name1)) {
+                    Instruction(OP_DECF, addrl, DEST_F);
+                    break;
+                }
+                Instruction(OP_MOVF, addrl, DEST_F);
+                IfBitSet(REG_STATUS, STATUS_Z);
+                Instruction(OP_DECF, addrh, DEST_F);
+                Instruction(OP_DECF, addrl, DEST_F);
+                break;
+
             case INT_IF_BIT_SET: {
                 DWORD condFalse = AllocFwdAddr();
                 MemForSingleBit(a->name1, TRUE, &addr, &bit);
@@ -582,49 +1004,68 @@ static void CompileFromIntermediate(BOOL topLevel)
             case INT_IF_VARIABLE_LES_LITERAL: {
                 DWORD notTrue = AllocFwdAddr();
                 DWORD isTrue = AllocFwdAddr();
-                DWORD lsbDecides = AllocFwdAddr();
-                
-                // V = Rd7*(Rr7')*(R7') + (Rd7')*Rr7*R7 ; but only one of the
-                // product terms can be true, and we know which at compile
-                // time
-                BYTE litH = (a->literal >> 8);
-                BYTE litL = (a->literal & 0xff);
 
                 MemForVariable(a->name1, &addrl, &addrh);
-
-                // var - lit
-                Instruction(OP_MOVLW, litH, 0);
-                Instruction(OP_SUBWF, addrh, DEST_W);
-                IfBitSet(REG_STATUS, STATUS_Z);
-                Instruction(OP_GOTO, lsbDecides, 0);
-                Instruction(OP_MOVWF, Scratch0, 0);
-                if(litH & 0x80) {
-                    Instruction(OP_COMF, addrh, DEST_W);
-                    Instruction(OP_ANDWF, Scratch0, DEST_W);
-                    Instruction(OP_XORWF, Scratch0, DEST_F);
+                if(IntFlowVariableIsByte(a->name1) && a->literal >= 0 &&
+                    a->literal <= 255)
+                {
+                    CompareByteWithLiteral(addrl, a->literal, isTrue, notTrue);
                 } else {
-                    Instruction(OP_COMF, Scratch0, DEST_W);
-                    Instruction(OP_ANDWF, addrh, DEST_W);
-                    Instruction(OP_XORWF, Scratch0, DEST_F);
+                    CompareWithLiteral(addrl, addrh, a->literal, isTrue,
+                        notTrue);
                 }
-                IfBitSet(Scratch0, 7); // var - lit < 0, var < lit
-                Instruction(OP_GOTO, isTrue, 0);
-                Instruction(OP_GOTO, notTrue, 0);
 
-                FwdAddrIsNow(lsbDecides);
+                FwdAddrIsNow(isTrue);
+                CompileIfBody(notTrue);
+                break;
+            }
+            case INT_IF_VARIABLE_GRT_LITERAL: {
+                DWORD notTrue = AllocFwdAddr();
 
-                // var - lit < 0
-                // var < lit
-                Instruction(OP_MOVLW, litL, 0);
-                Instruction(OP_SUBWF, addrl, DEST_W);
-                IfBitClear(REG_STATUS, STATUS_C);
-                Instruction(OP_GOTO, isTrue, 0);
-                Instruction(OP_GOTO, notTrue, 0);
+                // var > lit is the same as !(var < lit + 1), except that
+                // lit + 1 might not fit; but then nothing is greater.
+                MemForVariable(a->name1, &addrl, &addrh);
+                if(a->literal == 32767) {
+                    Instruction(OP_GOTO, notTrue, 0);
+                } else {
+                    DWORD isTrue = AllocFwdAddr();
+                    if(IntFlowVariableIsByte(a->name1) && a->literal >= 0 &&
+                        a->literal < 255)
+                    {
+                        CompareByteWithLiteral(addrl, a->literal + 1,
+                            notTrue, isTrue);
+                    } else {
+                        CompareWithLiteral(addrl, addrh, a->literal + 1,
+                            notTrue, isTrue);
+                    }
+                    FwdAddrIsNow(isTrue);
+                }
 
-                FwdAddrIsNow(isTrue);
                 CompileIfBody(notTrue);
                 break;
             }
+            case INT_IF_VARIABLE_EQUALS_LITERAL: {
+                DWORD notEqual = AllocFwdAddr();
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                Instruction(OP_MOVLW, a->literal & 0xff, 0);
+                Instruction(OP_XORWF, addrl, DEST_W);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, notEqual, 0);
+                // (the high octet of a byte is zero, as is the literal's)
+                if(IntFlowVariableIsByte(a->name1) && a->literal >= 0 &&
+                    a->literal <= 255)
+                {
+                    CompileIfBody(notEqual);
+                    break;
+                }
+                Instruction(OP_MOVLW, (a->literal >> 8) & 0xff, 0);
+                Instruction(OP_XORWF, addrh, DEST_W);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, notEqual, 0);
+                CompileIfBody(notEqual);
+                break;
+            }
             case INT_IF_VARIABLE_EQUALS_VARIABLE: {
                 DWORD notEqual = AllocFwdAddr();
 
@@ -700,10 +1141,41 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_MOVF, addrl2, DEST_W);
                 Instruction(OP_MOVWF, addrl, 0);
 
+                // If it fits in the destination then the high octet is zero.
+                if(IntFlowVariableIsByte(a->name1)) break;
                 Instruction(OP_MOVF, addrh2, DEST_W);
                 Instruction(OP_MOVWF, addrh, 0);
                 break;
 
+            case INT_SET_VARIABLE_FROM_RING: {
+                int length = ShiftRegisterRingLength(a->name2);
+                DWORD base = MemForArray(a->name2, length);
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name3, &addrl2, &addrh2);
+
+                FsrForRingStage(base, length, addrl2, a->literal);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, addrl, 0);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, REG_INDF, DEST_W);
+                Instruction(OP_MOVWF, addrh, 0);
+                break;
+            }
+            case INT_SET_RING_FROM_VARIABLE: {
+                int length = ShiftRegisterRingLength(a->name1);
+                DWORD base = MemForArray(a->name1, length);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                MemForVariable(a->name3, &addrl, &addrh);
+
+                FsrForRingStage(base, length, addrl2, a->literal);
+                Instruction(OP_MOVF, addrl, DEST_W);
+                Instruction(OP_MOVWF, REG_INDF, 0);
+                Instruction(OP_INCF, REG_FSR, DEST_F);
+                Instruction(OP_MOVF, addrh, DEST_W);
+                Instruction(OP_MOVWF, REG_INDF, 0);
+                break;
+            }
+
             // The add and subtract routines must be written to return correct
             // results if the destination and one of the operands happen to
             // be the same registers (e.g. for B = A - B).
@@ -716,6 +1188,8 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_MOVF, addrl2, DEST_W);
                 Instruction(OP_ADDWF, addrl3, DEST_W);
                 Instruction(OP_MOVWF, addrl, 0);
+                // A sum that fits in a byte has a high octet of zero.
+                if(IntFlowVariableIsByte(a->name1)) break;
                 ClearBit(Scratch0, 0);
                 IfBitSet(REG_STATUS, STATUS_C);
                 SetBit(Scratch0, 0);
@@ -735,6 +1209,7 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_MOVF, addrl3, DEST_W);
                 Instruction(OP_SUBWF, addrl2, DEST_W);
                 Instruction(OP_MOVWF, addrl, 0);
+                if(IntFlowVariableIsByte(a->name1)) break;
                 ClearBit(Scratch0, 0);
                 IfBitSet(REG_STATUS, STATUS_C);
                 SetBit(Scratch0, 0);
@@ -746,6 +1221,20 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_DECF, addrh, DEST_F);
                 break;
 
+            case INT_SET_VARIABLE_ADD_LITERAL:
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                AddLiteral(addrl, addrh, addrl2, addrh2, a->literal,
+                    IntFlowVariableIsByte(a->name1));
+                break;
+
+            case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                AddLiteral(addrl, addrh, addrl2, addrh2, -a->literal,
+                    IntFlowVariableIsByte(a->name1));
+                break;
+
             case INT_SET_VARIABLE_MULTIPLY:
                 MultiplyNeeded = TRUE;
                 
@@ -796,6 +1285,51 @@ static void CompileFromIntermediate(BOOL topLevel)
                 Instruction(OP_MOVWF, addrh, 0);
                 break;
 
+            case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                MultiplyByLiteral(addrl, addrh, addrl2, addrh2, a->literal,
+                    IntFlowVariableIsByte(a->name1));
+                break;
+
+            case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                DivideByLiteral(addrl, addrh, addrl2, addrh2, a->literal,
+                    IntFlowVariableIsByte(a->name1));
+                break;
+
+            case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                MultiplyNeeded = TRUE;
+                MultiplyDivideNeeded = TRUE;
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+                MemForVariable(a->name3, &addrl3, &addrh3);
+
+                Instruction(OP_MOVF, addrl2, DEST_W);
+                Instruction(OP_MOVWF, Scratch0, 0);
+                Instruction(OP_MOVF, addrh2, DEST_W);
+                Instruction(OP_MOVWF, Scratch1, 0);
+
+                Instruction(OP_MOVF, addrl3, DEST_W);
+                Instruction(OP_MOVWF, Scratch2, 0);
+                Instruction(OP_MOVF, addrh3, DEST_W);
+                Instruction(OP_MOVWF, Scratch3, 0);
+
+                Instruction(OP_MOVLW, a->literal & 0xff, 0);
+                Instruction(OP_MOVWF, Scratch8, 0);
+                Instruction(OP_MOVLW, (a->literal >> 8) & 0xff, 0);
+                Instruction(OP_MOVWF, Scratch9, 0);
+
+                CallWithPclath(MultiplyDivideRoutineAddress);
+
+                Instruction(OP_MOVF, Scratch2, DEST_W);
+                Instruction(OP_MOVWF, addrl, 0);
+                Instruction(OP_MOVF, Scratch3, DEST_W);
+                Instruction(OP_MOVWF, addrh, 0);
+                break;
+
             case INT_UART_SEND: {
                 MemForVariable(a->name1, &addrl, &addrh);
                 MemForSingleBit(a->name2, TRUE, &addr, &bit);
@@ -823,6 +1357,88 @@ static void CompileFromIntermediate(BOOL topLevel)
 
                 break;
             }
+            case INT_WRITE_FORMATTED_STRING: {
+                FormattedString *fs = &FormattedStrings[a->literal];
+                DWORD table = FormattedStringTableAddress[a->literal];
+                DWORD addrl3, addrh3;
+                DWORD done = AllocFwdAddr();
+                DWORD notDone = AllocFwdAddr();
+                DWORD notBusy = AllocFwdAddr();
+
+                FormattedStringNeeded = TRUE;
+                DivideNeeded = TRUE;
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(fs->convertState, &addrl3, &addrh3);
+                MemForSingleBit(fs->isLeadingZero, FALSE, &addr, &bit);
+
+                // Nothing to do once we've sent the whole string, or until
+                // the UART can take another character.
+                if(IntFlowVariableIsByte(a->name1) && fs->steps <= 255) {
+                    CompareByteWithLiteral(addrl, fs->steps, notDone, done);
+                } else {
+                    CompareWithLiteral(addrl, addrh, fs->steps, notDone, done);
+                }
+                FwdAddrIsNow(notDone);
+                Instruction(OP_BSF, REG_STATUS, STATUS_RP0);
+                Instruction(OP_BTFSC, REG_TXSTA ^ 0x80, 1);
+                Instruction(OP_GOTO, notBusy, 0);
+                Instruction(OP_BCF, REG_STATUS, STATUS_RP0);
+                Instruction(OP_GOTO, done, 0);
+                FwdAddrIsNow(notBusy);
+                Instruction(OP_BCF, REG_STATUS, STATUS_RP0);
+
+                // The sequencer is less than the number of steps, so just
+                // its low byte will do for the offset of the entry.
+                Instruction(OP_BCF, REG_STATUS, STATUS_C);
+                Instruction(OP_RLF, addrl, DEST_W);
+                Instruction(OP_MOVWF, Scratch6, 0);
+                Instruction(OP_MOVLW, FWD_HI(table), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+                Instruction(OP_MOVF, Scratch6, DEST_W);
+                Instruction(OP_CALL, FWD_LO(table), 0);
+                Instruction(OP_MOVWF, Scratch9, 0);
+                Instruction(OP_INCF, Scratch6, DEST_W);
+                Instruction(OP_CALL, FWD_LO(table), 0);
+                Instruction(OP_MOVWF, Scratch8, 0);
+                Instruction(OP_MOVLW, (PicProgWriteP >> 8), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+
+                IfBitSet(addr, bit);
+                SetBit(Scratch8, 7);
+                Instruction(OP_MOVF, addrl3, DEST_W);
+                Instruction(OP_MOVWF, Scratch0, 0);
+                Instruction(OP_MOVF, addrh3, DEST_W);
+                Instruction(OP_MOVWF, Scratch1, 0);
+                // (A string with nothing interpolated has no variable, but
+                // then the routine never looks at it.)
+                if(*(a->name2)) {
+                    MemForVariable(a->name2, &addrl2, &addrh2);
+                    Instruction(OP_MOVF, addrl2, DEST_W);
+                    Instruction(OP_MOVWF, Scratch2, 0);
+                    Instruction(OP_MOVF, addrh2, DEST_W);
+                    Instruction(OP_MOVWF, Scratch3, 0);
+                }
+
+                CallWithPclath(FormattedStringRoutineAddress);
+
+                Instruction(OP_MOVF, Scratch0, DEST_W);
+                Instruction(OP_MOVWF, addrl3, 0);
+                Instruction(OP_MOVF, Scratch1, DEST_W);
+                Instruction(OP_MOVWF, addrh3, 0);
+                CopyBit(addr, bit, Scratch8, 7);
+
+                Instruction(OP_MOVF, Scratch9, DEST_W);
+                Instruction(OP_MOVWF, REG_TXREG, 0);
+                Instruction(OP_INCF, addrl, DEST_F);
+                if(!IntFlowVariableIsByte(a->name1)) {
+                    IfBitSet(REG_STATUS, STATUS_Z);
+                    Instruction(OP_INCF, addrh, DEST_F);
+                }
+
+                FwdAddrIsNow(done);
+                break;
+            }
             case INT_UART_RECV: {
                 MemForVariable(a->name1, &addrl, &addrh);
                 MemForSingleBit(a->name2, TRUE, &addr, &bit);
@@ -863,6 +1479,169 @@ static void CompileFromIntermediate(BOOL topLevel)
                 FwdAddrIsNow(done);
                 break;
             }
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[a->literal];
+                MemForSingleBit(a->name1, FALSE, &addr, &bit);
+
+                // The inputs past the first three pick the byte of the
+                // table; build that offset in Scratch0.
+                int k;
+                if(t->inputs > 3) {
+                    Instruction(OP_CLRF, Scratch0, 0);
+                    for(k = 3; k < t->inputs; k++) {
+                        MemForSingleBit(t->input[k], TRUE, &addr2, &bit2);
+                        IfBitSet(addr2, bit2);
+                        SetBit(Scratch0, k - 3);
+                    }
+                }
+
+                // Computed goto into the RETLW table; PCLATH must point at
+                // the table's page when we write PCL, so set that up first
+                // and only then load W with the offset.
+                DWORD table = TruthTableAddress[a->literal];
+                Instruction(OP_MOVLW, FWD_HI(table), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+                if(t->inputs > 3) {
+                    Instruction(OP_MOVF, Scratch0, DEST_W);
+                } else {
+                    Instruction(OP_MOVLW, 0, 0);
+                }
+                Instruction(OP_CALL, FWD_LO(table), 0);
+                Instruction(OP_MOVWF, Scratch1, 0);
+                Instruction(OP_MOVLW, (PicProgWriteP >> 8), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+
+                // And the first three inputs pick the bit within that byte;
+                // shift it down into bit 0.
+                for(k = 0; k < t->inputs && k < 3; k++) {
+                    MemForSingleBit(t->input[k], TRUE, &addr2, &bit2);
+                    if(k == 2) {
+                        IfBitSet(addr2, bit2);
+                        Instruction(OP_SWAPF, Scratch1, DEST_F);
+                    } else {
+                        int j;
+                        for(j = 0; j < (1 << k); j++) {
+                            IfBitSet(addr2, bit2);
+                            Instruction(OP_RRF, Scratch1, DEST_F);
+                        }
+                    }
+                }
+                CopyBit(addr, bit, Scratch1, 0);
+                break;
+            }
+            case INT_SET_VARIABLE_FROM_TABLE: {
+                ElemLookUpTable *t = LookUpTables[a->literal];
+                DWORD outOfRange = AllocFwdAddr();
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+
+                // Unsigned compare against the length, so that negative
+                // indices are out of range too.
+                Instruction(OP_MOVF, addrh2, DEST_F);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, outOfRange, 0);
+                Instruction(OP_MOVLW, t->count, 0);
+                Instruction(OP_SUBWF, addrl2, DEST_W);
+                IfBitSet(REG_STATUS, STATUS_C);
+                Instruction(OP_GOTO, outOfRange, 0);
+
+                // The carry is clear, so this is twice the index, the
+                // offset of the entry's low byte.
+                Instruction(OP_RLF, addrl2, DEST_W);
+                Instruction(OP_MOVWF, Scratch0, 0);
+
+                DWORD table = LookUpTableAddress[a->literal];
+                Instruction(OP_MOVLW, FWD_HI(table), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+                Instruction(OP_MOVF, Scratch0, DEST_W);
+                Instruction(OP_CALL, FWD_LO(table), 0);
+                Instruction(OP_MOVWF, addrl, 0);
+                Instruction(OP_INCF, Scratch0, DEST_W);
+                Instruction(OP_CALL, FWD_LO(table), 0);
+                Instruction(OP_MOVWF, addrh, 0);
+                Instruction(OP_MOVLW, (PicProgWriteP >> 8), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+
+                FwdAddrIsNow(outOfRange);
+                break;
+            }
+            case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                ElemPiecewiseLinear *t = PiecewiseLinears[a->literal];
+                DWORD table = PiecewiseLinearTableAddress[a->literal];
+                DWORD found = AllocFwdAddr();
+                DWORD outside = AllocFwdAddr();
+                DWORD divide = AllocFwdAddr();
+                DWORD interpolated = AllocFwdAddr();
+
+                MultiplyNeeded = TRUE;
+                MultiplyDivideNeeded = TRUE;
+
+                MemForVariable(a->name1, &addrl, &addrh);
+                MemForVariable(a->name2, &addrl2, &addrh2);
+
+                // The breakpoints are compiled into the search, so only the
+                // segments go in the table.
+                Instruction(OP_MOVF, addrl2, DEST_W);
+                Instruction(OP_MOVWF, Scratch4, 0);
+                Instruction(OP_MOVLW, 0x80, 0);
+                Instruction(OP_XORWF, addrh2, DEST_W);
+                Instruction(OP_MOVWF, Scratch5, 0);
+                PiecewiseLinearSearch(t, 0, t->count - 1, found, outside);
+
+                FwdAddrIsNow(found);
+                Instruction(OP_MOVWF, Scratch6, 0);
+                Instruction(OP_MOVLW, FWD_HI(table), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+
+                // Scratch1:0 := index - x0; then y0 goes straight into the
+                // destination, since we are done with the index.
+                DWORD into[] = { Scratch0, Scratch1, addrl, addrh,
+                                 Scratch2, Scratch3, Scratch8, Scratch9 };
+                int i;
+                for(i = 0; i < 8; i++) {
+                    if(i > 0) Instruction(OP_INCF, Scratch6, DEST_F);
+                    Instruction(OP_MOVF, Scratch6, DEST_W);
+                    Instruction(OP_CALL, FWD_LO(table), 0);
+                    Instruction(OP_MOVWF, into[i], 0);
+                    if(i == 1) {
+                        Instruction(OP_MOVF, Scratch0, DEST_W);
+                        Instruction(OP_SUBWF, addrl2, DEST_W);
+                        Instruction(OP_MOVWF, Scratch0, 0);
+                        Instruction(OP_MOVF, Scratch1, DEST_W);
+                        IfBitClear(REG_STATUS, STATUS_C);
+                        Instruction(OP_INCF, Scratch1, DEST_W);
+                        Instruction(OP_SUBWF, addrh2, DEST_W);
+                        Instruction(OP_MOVWF, Scratch1, 0);
+                    }
+                }
+                Instruction(OP_MOVLW, (PicProgWriteP >> 8), 0);
+                Instruction(OP_MOVWF, REG_PCLATH, 0);
+
+                // A whole-number slope comes with dx = 1, and then we can
+                // skip the divide; either way the result is in Scratch3:2.
+                Instruction(OP_MOVF, Scratch9, DEST_F);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, divide, 0);
+                Instruction(OP_DECF, Scratch8, DEST_W);
+                IfBitClear(REG_STATUS, STATUS_Z);
+                Instruction(OP_GOTO, divide, 0);
+                CallWithPclath(MultiplyRoutineAddress);
+                Instruction(OP_GOTO, interpolated, 0);
+                FwdAddrIsNow(divide);
+                CallWithPclath(MultiplyDivideRoutineAddress);
+
+                FwdAddrIsNow(interpolated);
+                Instruction(OP_MOVF, Scratch2, DEST_W);
+                Instruction(OP_ADDWF, addrl, DEST_F);
+                IfBitSet(REG_STATUS, STATUS_C);
+                Instruction(OP_INCF, addrh, DEST_F);
+                Instruction(OP_MOVF, Scratch3, DEST_W);
+                Instruction(OP_ADDWF, addrh, DEST_F);
+
+                FwdAddrIsNow(outside);
+                break;
+            }
             case INT_SET_PWM: {
                 int target = atoi(a->name2);
 
@@ -1287,6 +2066,7 @@ static void WriteMultiplyRoutine(void)
 
     Instruction(OP_DECFSZ, counter, DEST_F);
     Instruction(OP_GOTO, top, 0);
+    LoopsAtMost(15);
 
     Instruction(OP_RETURN, 0, 0);
 }
@@ -1376,10 +2156,12 @@ static void WriteDivideRoutine(void)
 
     Instruction(OP_BCF, REG_STATUS, STATUS_C);
     Instruction(OP_GOTO, loop, 0);
+    LoopsAtMost(16);
 
     FwdAddrIsNow(notNegative);
     Instruction(OP_BSF, REG_STATUS, STATUS_C);
     Instruction(OP_GOTO, loop, 0);
+    LoopsAtMost(16);
 
     FwdAddrIsNow(done);
     Instruction(OP_BTFSS, sign, 7);
@@ -1393,27 +2175,389 @@ static void WriteDivideRoutine(void)
     Instruction(OP_RETURN, 0, 0);
 }
 
+//-----------------------------------------------------------------------------
+// Write a subroutine to do a 16*16/16 signed multiply-then-divide, keeping
+// all 32 bits of the product for the divide. Call with the factors in
+// Scratch1:0 and Scratch3:2 and the divisor in Scratch9:8, and get the
+// result in Scratch3:2. Uses the unsigned multiply routine on the
+// magnitudes; the quotient then goes bit by bit into Scratch5:2 as the
+// product is shifted out of it, with the remainder in Scratch1:0.
+//-----------------------------------------------------------------------------
+static void WriteMultiplyDivideRoutine(void)
+{
+    DWORD remainder0 = Scratch0;
+    DWORD remainder1 = Scratch1;
+
+    DWORD divisor0 = Scratch8;
+    DWORD divisor1 = Scratch9;
+
+    DWORD counter = Scratch6;
+    DWORD sign = Scratch7;
+
+    DWORD subtracted = AllocFwdAddr();
+    DWORD next = AllocFwdAddr();
+    DWORD loop;
+
+    FwdAddrIsNow(MultiplyDivideRoutineAddress);
+    Instruction(OP_MOVF, Scratch1, DEST_W);
+    Instruction(OP_XORWF, Scratch3, DEST_W);
+    Instruction(OP_XORWF, divisor1, DEST_W);
+    Instruction(OP_MOVWF, sign, 0);
+
+    NegateIfNegative(Scratch0, Scratch1);
+    NegateIfNegative(Scratch2, Scratch3);
+    NegateIfNegative(divisor0, divisor1);
+
+    CallWithPclath(MultiplyRoutineAddress);
+
+    // The magnitudes are at most 0x8000, so the remainder (which is less
+    // than the divisor) still fits in 16 bits after each shift.
+    Instruction(OP_CLRF, remainder1, 0);
+    Instruction(OP_CLRF, remainder0, 0);
+
+    Instruction(OP_MOVLW, 32, 0);
+    Instruction(OP_MOVWF, counter, 0);
+
+    loop = PicProgWriteP;
+    Instruction(OP_BCF, REG_STATUS, STATUS_C);
+    Instruction(OP_RLF, Scratch2, DEST_F);
+    Instruction(OP_RLF, Scratch3, DEST_F);
+    Instruction(OP_RLF, Scratch4, DEST_F);
+    Instruction(OP_RLF, Scratch5, DEST_F);
+    Instruction(OP_RLF, remainder0, DEST_F);
+    Instruction(OP_RLF, remainder1, DEST_F);
+
+    // remainder -= divisor, with carry clear if that borrowed
+    Instruction(OP_MOVF, divisor0, DEST_W);
+    Instruction(OP_SUBWF, remainder0, DEST_F);
+    Instruction(OP_MOVF, divisor1, DEST_W);
+    Instruction(OP_BTFSS, REG_STATUS, STATUS_C);
+    Instruction(OP_INCFSZ, divisor1, DEST_W);
+    Instruction(OP_SUBWF, remainder1, DEST_F);
+
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_C);
+    Instruction(OP_GOTO, subtracted, 0);
+
+    // it didn't go, so put it back
+    Instruction(OP_MOVF, divisor0, DEST_W);
+    Instruction(OP_ADDWF, remainder0, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_C);
+    Instruction(OP_INCF, remainder1, DEST_F);
+    Instruction(OP_MOVF, divisor1, DEST_W);
+    Instruction(OP_ADDWF, remainder1, DEST_F);
+    Instruction(OP_GOTO, next, 0);
+
+    FwdAddrIsNow(subtracted);
+    Instruction(OP_BSF, Scratch2, 0);
+
+    FwdAddrIsNow(next);
+    Instruction(OP_DECFSZ, counter, DEST_F);
+    Instruction(OP_GOTO, loop, 0);
+    LoopsAtMost(31);
+
+    Instruction(OP_BTFSS, sign, 7);
+    Instruction(OP_RETURN, 0, 0);
+
+    Instruction(OP_COMF, Scratch2, DEST_F);
+    Instruction(OP_COMF, Scratch3, DEST_F);
+    Instruction(OP_INCF, Scratch2, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_Z);
+    Instruction(OP_INCF, Scratch3, DEST_F);
+    Instruction(OP_RETURN, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Get the power of ten of a formatted string's digit into Scratch6, from the
+// kind in Scratch8; we have no andlw, so clear the other bits one by one.
+//-----------------------------------------------------------------------------
+static void PowerOfTenToScratch6(void)
+{
+    Instruction(OP_MOVF, Scratch8, DEST_W);
+    Instruction(OP_MOVWF, Scratch6, 0);
+    int k;
+    for(k = 0; k < 8; k++) {
+        if(!(FMTD_POWER_MASK & (1 << k))) {
+            Instruction(OP_BCF, Scratch6, k);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the subroutine that works out the next character of a formatted
+// string, shared by all of them. Call with the template entry in Scratch9
+// (character) and Scratch8 (kind), with the leading-zero flag in bit 7 of
+// Scratch8, the conversion state in Scratch1:0, and the variable in
+// Scratch3:2. Get the character to send in Scratch9, and the updated flag
+// and conversion state in the same places.
+//-----------------------------------------------------------------------------
+static void WriteFormattedStringRoutine(void)
+{
+    DWORD minus = AllocFwdAddr();
+    DWORD loaded = AllocFwdAddr();
+    DWORD haveDivisor = AllocFwdAddr();
+    DWORD notZero = AllocFwdAddr();
+    DWORD suppressed = AllocFwdAddr();
+    DWORD times10;
+
+    FwdAddrIsNow(FormattedStringRoutineAddress);
+
+    // A literal character goes out as it is.
+    Instruction(OP_BTFSC, Scratch8, FMTD_MINUS);
+    Instruction(OP_GOTO, minus, 0);
+    Instruction(OP_BTFSS, Scratch8, FMTD_DIGIT);
+    Instruction(OP_RETURN, 0, 0);
+
+    Instruction(OP_BTFSC, Scratch8, FMTD_FIRST_DIGIT);
+    Instruction(OP_BSF, Scratch8, 7);
+    Instruction(OP_BTFSS, Scratch8, FMTD_LOAD_VAR);
+    Instruction(OP_GOTO, loaded, 0);
+    Instruction(OP_MOVF, Scratch2, DEST_W);
+    Instruction(OP_MOVWF, Scratch0, 0);
+    Instruction(OP_MOVF, Scratch3, DEST_W);
+    Instruction(OP_MOVWF, Scratch1, 0);
+    FwdAddrIsNow(loaded);
+
+    // Divisor in Scratch3:2 := 10^p, multiplying by ten as we count the
+    // power down in Scratch6 (which the divide only uses later).
+    PowerOfTenToScratch6();
+    Instruction(OP_MOVLW, 1, 0);
+    Instruction(OP_MOVWF, Scratch2, 0);
+    Instruction(OP_CLRF, Scratch3, 0);
+    times10 = PicProgWriteP;
+    Instruction(OP_MOVF, Scratch6, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_Z);
+    Instruction(OP_GOTO, haveDivisor, 0);
+    Instruction(OP_BCF, REG_STATUS, STATUS_C);
+    Instruction(OP_RLF, Scratch2, DEST_F);
+    Instruction(OP_RLF, Scratch3, DEST_F);
+    Instruction(OP_MOVF, Scratch2, DEST_W);
+    Instruction(OP_MOVWF, Scratch4, 0);
+    Instruction(OP_MOVF, Scratch3, DEST_W);
+    Instruction(OP_MOVWF, Scratch5, 0);
+    Instruction(OP_BCF, REG_STATUS, STATUS_C);
+    Instruction(OP_RLF, Scratch2, DEST_F);
+    Instruction(OP_RLF, Scratch3, DEST_F);
+    Instruction(OP_BCF, REG_STATUS, STATUS_C);
+    Instruction(OP_RLF, Scratch2, DEST_F);
+    Instruction(OP_RLF, Scratch3, DEST_F);
+    Instruction(OP_MOVF, Scratch4, DEST_W);
+    Instruction(OP_ADDWF, Scratch2, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_C);
+    Instruction(OP_INCF, Scratch3, DEST_F);
+    Instruction(OP_MOVF, Scratch5, DEST_W);
+    Instruction(OP_ADDWF, Scratch3, DEST_F);
+    Instruction(OP_DECF, Scratch6, DEST_F);
+    Instruction(OP_GOTO, times10, 0);
+    // at most 10^4, for a 16-bit variable
+    LoopsAtMost(4);
+    FwdAddrIsNow(haveDivisor);
+
+    // The quotient is the digit, and what's left is the remainder, with
+    // the sign of the dividend (the divisor being positive).
+    CallWithPclath(DivideRoutineAddress);
+    Instruction(OP_MOVLW, '0', 0);
+    Instruction(OP_ADDWF, Scratch0, DEST_W);
+    Instruction(OP_MOVWF, Scratch9, 0);
+
+    // Suppress all but the last leading zero.
+    PowerOfTenToScratch6();
+    Instruction(OP_MOVF, Scratch6, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_Z);
+    Instruction(OP_GOTO, suppressed, 0);
+    Instruction(OP_MOVF, Scratch0, DEST_W);
+    Instruction(OP_IORWF, Scratch1, DEST_W);
+    Instruction(OP_BTFSS, REG_STATUS, STATUS_Z);
+    Instruction(OP_GOTO, notZero, 0);
+    Instruction(OP_BTFSS, Scratch8, 7);
+    Instruction(OP_GOTO, suppressed, 0);
+    Instruction(OP_MOVLW, ' ', 0);
+    Instruction(OP_MOVWF, Scratch9, 0);
+    Instruction(OP_GOTO, suppressed, 0);
+    FwdAddrIsNow(notZero);
+    Instruction(OP_BCF, Scratch8, 7);
+    FwdAddrIsNow(suppressed);
+
+    Instruction(OP_MOVF, Scratch4, DEST_W);
+    Instruction(OP_MOVWF, Scratch0, 0);
+    Instruction(OP_MOVF, Scratch5, DEST_W);
+    Instruction(OP_MOVWF, Scratch1, 0);
+    Instruction(OP_BTFSS, Scratch7, 7);
+    Instruction(OP_RETURN, 0, 0);
+    Instruction(OP_COMF, Scratch0, DEST_F);
+    Instruction(OP_COMF, Scratch1, DEST_F);
+    Instruction(OP_INCF, Scratch0, DEST_F);
+    Instruction(OP_BTFSC, REG_STATUS, STATUS_Z);
+    Instruction(OP_INCF, Scratch1, DEST_F);
+    Instruction(OP_RETURN, 0, 0);
+
+    // The sign also loads the conversion state with the magnitude.
+    FwdAddrIsNow(minus);
+    Instruction(OP_MOVF, Scratch2, DEST_W);
+    Instruction(OP_MOVWF, Scratch0, 0);
+    Instruction(OP_MOVF, Scratch3, DEST_W);
+    Instruction(OP_MOVWF, Scratch1, 0);
+    Instruction(OP_MOVLW, ' ', 0);
+    Instruction(OP_BTFSC, Scratch1, 7);
+    Instruction(OP_MOVLW, '-', 0);
+    Instruction(OP_MOVWF, Scratch9, 0);
+    NegateIfNegative(Scratch0, Scratch1);
+    Instruction(OP_RETURN, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Write a table of constant bytes, as a computed goto into a list of
+// RETLWs. Call with the byte offset in W and PCLATH set up for the table's
+// page. The addwf to PCL cannot carry into PCLATH, so no table may straddle
+// a 256-word boundary; pad to the next one if it would.
+//-----------------------------------------------------------------------------
+static void WriteRetlwTable(DWORD addr, BYTE *data, int bytes)
+{
+    if((PicProgWriteP >> 8) != ((PicProgWriteP + bytes) >> 8)) {
+        DWORD block = (PicProgWriteP >> 8);
+        while((PicProgWriteP >> 8) == block) {
+            Instruction(OP_MOVLW, 0xab, 0);
+        }
+    }
+
+    FwdAddrIsNow(addr);
+    Instruction(OP_ADDWF, REG_PCL, DEST_F);
+    int j;
+    for(j = 0; j < bytes; j++) {
+        Instruction(OP_RETLW, data[j], 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the truth tables for the combinational rungs, and the tables for the
+// look-up table and piecewise linear instructions and the formatted strings
+// (low byte of each entry first).
+//-----------------------------------------------------------------------------
+static void WriteTables(void)
+{
+    int i;
+    for(i = 0; i < TruthTablesCount; i++) {
+        int bytes = ((1 << TruthTables[i].inputs) + 7) / 8;
+        WriteRetlwTable(TruthTableAddress[i], TruthTables[i].bits, bytes);
+    }
+    for(i = 0; i < LookUpTablesCount; i++) {
+        ElemLookUpTable *t = LookUpTables[i];
+        BYTE data[MAX_LOOK_UP_TABLE_LEN*2];
+        int j;
+        for(j = 0; j < t->count; j++) {
+            data[j*2] = t->vals[j] & 0xff;
+            data[j*2 + 1] = (t->vals[j] >> 8) & 0xff;
+        }
+        WriteRetlwTable(LookUpTableAddress[i], data, t->count*2);
+    }
+    for(i = 0; i < PiecewiseLinearsCount; i++) {
+        ElemPiecewiseLinear *t = PiecewiseLinears[i];
+        BYTE data[(MAX_LOOK_UP_TABLE_LEN/2)*8];
+        int j, k;
+        for(j = 0; j < t->count - 1; j++) {
+            SWORD seg[4];
+            PiecewiseLinearSegment(t, j, seg);
+            for(k = 0; k < 4; k++) {
+                data[j*8 + k*2] = seg[k] & 0xff;
+                data[j*8 + k*2 + 1] = (seg[k] >> 8) & 0xff;
+            }
+        }
+        WriteRetlwTable(PiecewiseLinearTableAddress[i], data,
+            (t->count - 1)*8);
+    }
+    for(i = 0; i < FormattedStringsCount; i++) {
+        FormattedString *fs = &FormattedStrings[i];
+        BYTE data[MAX_FORMATTED_STRING_STEPS*2];
+        int j;
+        for(j = 0; j < fs->steps; j++) {
+            data[j*2] = fs->chars[j] & 0xff;
+            data[j*2 + 1] = (fs->chars[j] >> 8) & 0xff;
+        }
+        WriteRetlwTable(FormattedStringTableAddress[i], data, fs->steps*2);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Where the instruction at addr can go next, and how many cycles it takes to
+// get there, and what it calls, for ReportScanTime(). A return ends the
+// path. The goto to 0 is the jump to the start of the next 2k section, with
+// PCLATH set up for it.
+//-----------------------------------------------------------------------------
+static int NextInstruction(DWORD addr, DWORD *to, int *cycles,
+    DWORD *call, int *loops)
+{
+    Pic16Instruction *p = &PicProg[addr];
+
+    *call = p->callee;
+    *loops = p->loops;
+    to[0] = addr + 1;
+    cycles[0] = 1;
+    switch(p->op) {
+        case OP_BTFSC:
+        case OP_BTFSS:
+        case OP_DECFSZ:
+        case OP_INCFSZ:
+            to[1] = addr + 2;
+            cycles[1] = 2;
+            return 2;
+
+        case OP_GOTO:
+            if(p->arg1 == 0) {
+                to[0] = ((addr >> 11) + 1) << 11;
+            } else {
+                to[0] = p->arg1;
+            }
+            cycles[0] = 2;
+            break;
+
+        case OP_CALL:
+            cycles[0] = 2;
+            break;
+
+        case OP_ADDWF:
+            // At the top of a table, which jumps to one of its retlws;
+            // they all take the same time, so say the first.
+            if(p->arg1 == REG_PCL && p->arg2 == DEST_F) cycles[0] = 2;
+            break;
+
+        case OP_RETURN:
+        case OP_RETLW:
+        case OP_RETFIE:
+            to[0] = addr;
+            cycles[0] = 2;
+            break;
+
+        default:
+            break;
+    }
+    return 1;
+}
+
 //-----------------------------------------------------------------------------
 // Compile the program to PIC16 code for the currently selected processor
 // and write it to the given file. Produce an error message if we cannot
 // write to the file, or if there is something inconsistent about the
-// program.
+// program. If outFile is NULL then don't write anything, but estimate the
+// scan time and report it instead.
 //-----------------------------------------------------------------------------
 void CompilePic16(char *outFile)
 {
-    FILE *f = fopen(outFile, "w");
-    if(!f) {
-        Error(_("Couldn't open file '%s'"), outFile);
-        return;
+    FILE *f = NULL;
+    if(outFile) {
+        f = fopen(outFile, "w");
+        if(!f) {
+            Error(_("Couldn't open file '%s'"), outFile);
+            return;
+        }
     }
 
     if(setjmp(CompileErrorBuf) != 0) {
-        fclose(f);
+        if(f) fclose(f);
         return;
     }
 
     WipeMemory();
 
+    int i;
     AllocStart();
     Scratch0 = AllocOctetRam();
     Scratch1 = AllocOctetRam();
@@ -1423,6 +2567,16 @@ void CompilePic16(char *outFile)
     Scratch5 = AllocOctetRam();
     Scratch6 = AllocOctetRam();
     Scratch7 = AllocOctetRam();
+    for(i = 0; i < IntCodeLen; i++) {
+        if(IntCode[i].op == INT_SET_VARIABLE_MULTIPLY_DIVIDE ||
+            IntCode[i].op == INT_SET_VARIABLE_PIECEWISE_LINEAR ||
+            IntCode[i].op == INT_WRITE_FORMATTED_STRING)
+        {
+            Scratch8 = AllocOctetRam();
+            Scratch9 = AllocOctetRam();
+            break;
+        }
+    }
    
     // Allocate the register used to hold the high byte of the EEPROM word
     // that's queued up to program, plus the bit to indicate that it is
@@ -1461,6 +2615,22 @@ void CompilePic16(char *outFile)
     DivideNeeded = FALSE;
     MultiplyRoutineAddress = AllocFwdAddr();
     MultiplyNeeded = FALSE;
+    MultiplyDivideRoutineAddress = AllocFwdAddr();
+    MultiplyDivideNeeded = FALSE;
+    FormattedStringRoutineAddress = AllocFwdAddr();
+    FormattedStringNeeded = FALSE;
+    for(i = 0; i < TruthTablesCount; i++) {
+        TruthTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < LookUpTablesCount; i++) {
+        LookUpTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < PiecewiseLinearsCount; i++) {
+        PiecewiseLinearTableAddress[i] = AllocFwdAddr();
+    }
+    for(i = 0; i < FormattedStringsCount; i++) {
+        FormattedStringTableAddress[i] = AllocFwdAddr();
+    }
 
     ConfigureTimer1(Prog.cycleTime);
 
@@ -1547,7 +2717,6 @@ void CompilePic16(char *outFile)
         if(i == Prog.mcu->pinCount) oops();
     }
 
-    int i;
     for(i = 0; Prog.mcu->dirRegs[i] != 0; i++) {
         WriteRegister(Prog.mcu->outputRegs[i], 0x00);
         WriteRegister(Prog.mcu->dirRegs[i], ~isOutput[i]);
@@ -1556,7 +2725,7 @@ void CompilePic16(char *outFile)
     if(UartFunctionUsed()) {
         if(Prog.baudRate == 0) {
             Error(_("Zero baud rate not possible."));
-            fclose(f);
+            if(f) fclose(f);
             return;
         }
 
@@ -1591,7 +2760,9 @@ void CompilePic16(char *outFile)
 
     Instruction(OP_CLRWDT, 0, 0);
     IntPc = 0;
+    SourceMapStart();
     CompileFromIntermediate(TRUE);
+    SourceMapMark(PicProgWriteP, -1);
 
     MemCheckForErrorsPostCompile();
 
@@ -1600,7 +2771,7 @@ void CompilePic16(char *outFile)
     Instruction(OP_GOTO, top, 0);
 
     // Once again, let us make sure not to put stuff on a page boundary
-    if((PicProgWriteP >> 11) != ((PicProgWriteP + 150) >> 11)) {
+    if((PicProgWriteP >> 11) != ((PicProgWriteP + 300) >> 11)) {
         DWORD section = (PicProgWriteP >> 11);
         // Just burn the last of this section with NOPs.
         while((PicProgWriteP >> 11) == section) {
@@ -1608,11 +2779,23 @@ void CompilePic16(char *outFile)
         }
     }
 
+    // The multiply-divide routine calls the multiply routine, and the
+    // formatted string routine calls the divide routine, so they must come
+    // first, while those addresses are still forward references.
+    if(FormattedStringNeeded) WriteFormattedStringRoutine();
+    if(MultiplyDivideNeeded) WriteMultiplyDivideRoutine();
     if(MultiplyNeeded) WriteMultiplyRoutine();
     if(DivideNeeded) WriteDivideRoutine();
+    WriteTables();
+
+    if(!outFile) {
+        ReportScanTime(NextInstruction, 4, PicProgWriteP);
+        return;
+    }
 
     WriteHexFile(f);
     fclose(f);
+    WriteSourceMap(outFile);
 
     char str[MAX_PATH+500];
     sprintf(str, _("Compile successful; wrote IHEX for PIC16 to '%s'.\r\n\r\n"
@@ -0,0 +1,138 @@
+#!/usr/bin/perl
+
+# How fast the interpreter runs the tests and the samples. Each program gets
+# compiled as interpretable code twice, with superinstructions and without
+# (/u), and then run flat out by ldinterpret.c, built with BENCHMARK against
+# each of the ways that ldinterp.c can be built; see run-tests.pl. This needs
+# a C compiler, named by CC; and the number of cycles to run each program
+# for can be given, a million by default.
+#
+# For each program, this reports the ops that each cycle ran, without the
+# superinstructions (ops-u) and with them (ops), and what fraction of them
+# were left; and then the time for each cycle, in ns, in each build, and in
+# the switch without superinstructions (switch-u), and how many times faster
+# than that the native code was. At the end, it gives the same figures for
+# all the programs together, as geometric means.
+#
+# The builds that count ops pay an increment for each one, so they come out
+# a little slow; the native code doesn't count them. The times also depend
+# on the machine, and on what else it's doing, so compare them only against
+# others from the same run.
+
+$cc = $ENV{'CC'} || 'gcc';
+$cycles = $ARGV[0] || 1000000;
+
+@builds = (
+    [ 'switch',     '-DNO_JIT -DNO_COMPUTED_GOTO' ],
+    [ 'threaded',   '-DNO_JIT' ],
+    [ 'native',     '' ],
+    [ 'packed',     '-DPACKED_BITS' ],
+);
+
+if (not -d 'results-bench/') {
+    mkdir 'results-bench';
+}
+
+for $test (<tests/*.ld>, <../sample/*.ld>) {
+    $base = $test;
+    $base =~ s/^.*\//results-bench\//;
+    $base =~ s/\.ld$//;
+
+    # Some of the samples don't say what they're for, and those get the
+    # interpreter too, after the first line.
+    open(TEST, $test) or die;
+    @lines = <TEST>;
+    close(TEST);
+    if(not grep /^MICRO=/, @lines) {
+        splice(@lines, 1, 0, "MICRO=\r\n");
+    }
+    open(INT, ">$base.ld") or die;
+    for(@lines) {
+        s/^MICRO=[^\r\n]*/MICRO=Interpretable Byte Code/;
+        print INT;
+    }
+    close(INT);
+
+    unlink "$base.int", "$base-unfused.int";
+    system "../ldmicro.exe /c $base.ld $base.int";
+    system "../ldmicro.exe /u /c $base.ld $base-unfused.int";
+    if (-f "$base.int" and -f "$base-unfused.int") {
+        push @bases, $base;
+    } else {
+        print "couldn't compile $test\n";
+    }
+}
+
+for $build (@builds) {
+    ($name, $flags) = @$build;
+    $exe = "results-bench/bench-$name.exe";
+    $run = $exe;
+    $run =~ s/\//\\/g if $^O eq 'MSWin32';
+    $cmd = "$cc -DBENCHMARK $flags -O2 -o $exe ../ldinterpret.c ../ldinterp.c";
+    if(system($cmd) != 0) {
+        die "couldn't build the $name interpreter\n";
+    }
+    $runs{$name} = $run;
+    push @exes, $exe;
+}
+
+# Run a program, and return the ops that each cycle ran (if they got
+# counted) and the ns that each cycle took.
+sub bench {
+    my ($run, $program) = @_;
+
+    $_ = `$run $program $cycles`;
+    if(/([0-9.]+) ops per cycle, ([0-9.]+) ns per op/) {
+        return ($1, $1*$2);
+    } elsif(/([0-9.]+) ns per cycle/) {
+        return (0, $1);
+    }
+    die "couldn't run $program: $_";
+}
+
+printf "%-20s %7s %7s %5s", 'program', 'ops-u', 'ops', 'left';
+for $build (@builds) {
+    printf " %8s", $$build[0];
+}
+printf " %8s %7s\n", 'switch-u', 'speedup';
+
+sub report {
+    my ($title, $unfused, $fused, $ns, $nsUnfused) = @_;
+
+    printf "%-20s %7.1f %7.1f %5.2f", $title, $unfused, $fused,
+        $fused/$unfused;
+    for $build (@builds) {
+        printf " %8.1f", $$ns{$$build[0]};
+    }
+    printf " %8.1f %6.1fx\n", $nsUnfused, $nsUnfused/$$ns{'native'};
+}
+
+$n = 0;
+for $base (@bases) {
+    ($unfused, $nsUnfused) = bench($runs{'switch'}, "$base-unfused.int");
+    ($fused) = bench($runs{'switch'}, "$base.int");
+    %ns = ();
+    for $build (@builds) {
+        ($ops, $ns{$$build[0]}) = bench($runs{$$build[0]}, "$base.int");
+    }
+
+    $title = $base;
+    $title =~ s/^results-bench\///;
+    report($title, $unfused, $fused, \%ns, $nsUnfused);
+
+    $logUnfused += log($unfused);
+    $logFused += log($fused);
+    for $build (@builds) {
+        $logNs{$$build[0]} += log($ns{$$build[0]});
+    }
+    $logNsUnfused += log($nsUnfused);
+    $n++;
+}
+
+for $build (@builds) {
+    $mean{$$build[0]} = exp($logNs{$$build[0]}/$n);
+}
+report('(all)', exp($logUnfused/$n), exp($logFused/$n), \%mean,
+    exp($logNsUnfused/$n));
+
+unlink @exes;
@@ -0,0 +1,86 @@
+//-----------------------------------------------------------------------------
+// Run the C that LDmicro generated for tests/ctc-wrap.ld against a model of
+// the circular counter as it was first written, which stepped the count and
+// then set it back to zero if it had gone past the maximum. The generated
+// code now tests against the maximum before it steps, so that the count
+// never holds more than that, even for a moment; the two have to agree, for
+// every value that the count could start from.
+//
+// They differ in two places, and this checks those against what the new
+// code should do instead. With a maximum of 32767, the old code compared
+// against 32768, which doesn't fit in 16 bits, so it went back to zero on
+// every count. And a count of 32767 with a smaller maximum (which the
+// counter can only get from a MOV) went round to -32768, where the new code
+// sets it to zero, like any other count past the maximum.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+
+#include "../results/ctc-wrap.c"
+
+static BOOL Xc;
+
+BOOL Read_U_b_Xc(void)
+{
+    return Xc;
+}
+
+static struct {
+    const char  *name;
+    SWORD       *count;
+    int         max;
+} Counters[] = {
+    { "C1",         &U_i_C1,        1 },
+    { "C9",         &U_i_C9,        9 },
+    { "C254",       &U_i_C254,      254 },
+    { "C255",       &U_i_C255,      255 },
+    { "C32766",     &U_i_C32766,    32766 },
+    { "C32767",     &U_i_C32767,    32767 },
+};
+#define COUNTERS (int)(sizeof(Counters)/sizeof(Counters[0]))
+
+//-----------------------------------------------------------------------------
+// One count, as the old code did it, in 16 bits.
+//-----------------------------------------------------------------------------
+static SWORD OldCount(SWORD c, int max)
+{
+    c = (SWORD)(c + 1);
+    if(!(c < (SWORD)(max + 1))) c = 0;
+    return c;
+}
+
+int main(void)
+{
+    long v;
+    int i, failed = 0;
+
+    for(v = -32768; v <= 32767; v++) {
+        for(i = 0; i < COUNTERS; i++) {
+            *Counters[i].count = (SWORD)v;
+        }
+        // A rising edge on Xc, so one count.
+        Xc = 0;
+        PlcCycle();
+        Xc = 1;
+        PlcCycle();
+
+        for(i = 0; i < COUNTERS; i++) {
+            int max = Counters[i].max;
+            SWORD want;
+            if(max == 32767 || v == 32767) {
+                want = (SWORD)(v < max ? v + 1 : 0);
+            } else {
+                want = OldCount((SWORD)v, max);
+            }
+            if(*Counters[i].count != want) {
+                if(failed < 20) {
+                    printf("ctc-wrap: %s from %ld counted to %d, not %d\n",
+                        Counters[i].name, v, *Counters[i].count, want);
+                }
+                failed++;
+            }
+        }
+    }
+
+    printf("ctc-wrap: %s\n", failed ? "FAIL" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,4 @@
+// For the checks, which build the C that LDmicro generated for their tests
+// into themselves; see run-tests.pl.
+typedef signed short SWORD;
+typedef unsigned char BOOL;
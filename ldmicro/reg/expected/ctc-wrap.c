@@ -0,0 +1,211 @@
+/* This is auto-generated code from LDmicro. Do not edit this file! Go
+   back to the ladder diagram source for changes in the logic, and make
+   any C additions either in ladder.h or in additional .c files linked
+   against this one. */
+
+/* You must provide ladder.h; there you must provide:
+      * a typedef for SWORD and BOOL, signed 16 bit and boolean types
+        (probably typedef signed short SWORD; typedef unsigned char BOOL;)
+
+   You must also provide implementations of all the I/O read/write
+   either as inlines in the header file or in another source file. (The
+   I/O functions are all declared extern.)
+
+   See the generated source code (below) for function names. */
+#include "ladder.h"
+
+/* Define EXTERN_EVERYTHING in ladder.h if you want all symbols extern.
+   This could be useful to implement `magic variables,' so that for
+   example when you write to the ladder variable duty_cycle, your PLC
+   runtime can look at the C variable U_duty_cycle and use that to set
+   the PWM duty cycle on the micro. That way you can add support for
+   peripherals that LDmicro doesn't know about. */
+#ifdef EXTERN_EVERYTHING
+#define STATIC 
+#else
+#define STATIC static
+#endif
+
+/* Define NO_PROTOTYPES if you don't want LDmicro to provide prototypes for
+   all the I/O functions (Read_U_xxx, Write_U_xxx) that you must provide.
+   If you define this then you must provide your own prototypes for these
+   functions in ladder.h, or provide definitions (e.g. as inlines or macros)
+   for them in ladder.h. */
+#ifdef NO_PROTOTYPES
+#define PROTO(x)
+#else
+#define PROTO(x) x
+#endif
+
+/* U_xxx symbols correspond to user-defined names. There is such a symbol
+   for every internal relay, variable, timer, and so on in the ladder
+   program. I_xxx symbols are internally generated. */
+STATIC BOOL I_b_mcr = 0;
+#define Read_I_b_mcr() I_b_mcr
+#define Write_I_b_mcr(x) I_b_mcr = x
+STATIC BOOL I_b_rung_top = 0;
+#define Read_I_b_rung_top() I_b_rung_top
+#define Write_I_b_rung_top(x) I_b_rung_top = x
+
+/* You provide this function. */
+PROTO(extern BOOL Read_U_b_Xc(void);)
+
+STATIC BOOL I_b_oneShot_01_0000 = 0;
+#define Read_I_b_oneShot_01_0000() I_b_oneShot_01_0000
+#define Write_I_b_oneShot_01_0000(x) I_b_oneShot_01_0000 = x
+STATIC SWORD U_i_C1 = 0;
+STATIC BOOL I_b_oneShot_02_0000 = 0;
+#define Read_I_b_oneShot_02_0000() I_b_oneShot_02_0000
+#define Write_I_b_oneShot_02_0000(x) I_b_oneShot_02_0000 = x
+STATIC SWORD U_i_C9 = 0;
+STATIC BOOL I_b_oneShot_03_0000 = 0;
+#define Read_I_b_oneShot_03_0000() I_b_oneShot_03_0000
+#define Write_I_b_oneShot_03_0000(x) I_b_oneShot_03_0000 = x
+STATIC SWORD U_i_C254 = 0;
+STATIC BOOL I_b_oneShot_04_0000 = 0;
+#define Read_I_b_oneShot_04_0000() I_b_oneShot_04_0000
+#define Write_I_b_oneShot_04_0000(x) I_b_oneShot_04_0000 = x
+STATIC SWORD U_i_C255 = 0;
+STATIC BOOL I_b_oneShot_05_0000 = 0;
+#define Read_I_b_oneShot_05_0000() I_b_oneShot_05_0000
+#define Write_I_b_oneShot_05_0000(x) I_b_oneShot_05_0000 = x
+STATIC SWORD U_i_C32766 = 0;
+STATIC BOOL I_b_oneShot_06_0000 = 0;
+#define Read_I_b_oneShot_06_0000() I_b_oneShot_06_0000
+#define Write_I_b_oneShot_06_0000(x) I_b_oneShot_06_0000 = x
+STATIC SWORD U_i_C32767 = 0;
+
+
+/* Call this function once per PLC cycle. You are responsible for calling
+   it at the interval that you specified in the MCU configuration when you
+   generated this code. */
+void PlcCycle(void)
+{
+    Write_I_b_mcr(1);
+    
+    /* start rung 2 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_01_0000()) {
+            if(U_i_C1 < 1) {
+                U_i_C1++;
+            } else {
+                U_i_C1 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_01_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 3 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_02_0000()) {
+            if(U_i_C9 < 9) {
+                U_i_C9++;
+            } else {
+                U_i_C9 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_02_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 4 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_03_0000()) {
+            if(U_i_C254 < 254) {
+                U_i_C254++;
+            } else {
+                U_i_C254 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_03_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 5 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_04_0000()) {
+            if(U_i_C255 < 255) {
+                U_i_C255++;
+            } else {
+                U_i_C255 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_04_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 6 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_05_0000()) {
+            if(U_i_C32766 < 32766) {
+                U_i_C32766++;
+            } else {
+                U_i_C32766 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_05_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 7 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xc()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(!Read_I_b_oneShot_06_0000()) {
+            if(U_i_C32767 < 32767) {
+                U_i_C32767++;
+            } else {
+                U_i_C32767 = 0;
+            }
+        }
+    }
+    Write_I_b_oneShot_06_0000(Read_I_b_rung_top());
+    
+    /* ] finish series */
+}
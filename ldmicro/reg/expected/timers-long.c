@@ -0,0 +1,198 @@
+/* This is auto-generated code from LDmicro. Do not edit this file! Go
+   back to the ladder diagram source for changes in the logic, and make
+   any C additions either in ladder.h or in additional .c files linked
+   against this one. */
+
+/* You must provide ladder.h; there you must provide:
+      * a typedef for SWORD and BOOL, signed 16 bit and boolean types
+        (probably typedef signed short SWORD; typedef unsigned char BOOL;)
+
+   You must also provide implementations of all the I/O read/write
+   either as inlines in the header file or in another source file. (The
+   I/O functions are all declared extern.)
+
+   See the generated source code (below) for function names. */
+#include "ladder.h"
+
+/* Define EXTERN_EVERYTHING in ladder.h if you want all symbols extern.
+   This could be useful to implement `magic variables,' so that for
+   example when you write to the ladder variable duty_cycle, your PLC
+   runtime can look at the C variable U_duty_cycle and use that to set
+   the PWM duty cycle on the micro. That way you can add support for
+   peripherals that LDmicro doesn't know about. */
+#ifdef EXTERN_EVERYTHING
+#define STATIC 
+#else
+#define STATIC static
+#endif
+
+/* Define NO_PROTOTYPES if you don't want LDmicro to provide prototypes for
+   all the I/O functions (Read_U_xxx, Write_U_xxx) that you must provide.
+   If you define this then you must provide your own prototypes for these
+   functions in ladder.h, or provide definitions (e.g. as inlines or macros)
+   for them in ladder.h. */
+#ifdef NO_PROTOTYPES
+#define PROTO(x)
+#else
+#define PROTO(x) x
+#endif
+
+/* U_xxx symbols correspond to user-defined names. There is such a symbol
+   for every internal relay, variable, timer, and so on in the ladder
+   program. I_xxx symbols are internally generated. */
+STATIC BOOL I_b_mcr = 0;
+#define Read_I_b_mcr() I_b_mcr
+#define Write_I_b_mcr(x) I_b_mcr = x
+STATIC SWORD I_i_tick4_prescale = 0;
+STATIC SWORD I_i_tick4 = 0;
+STATIC SWORD I_i_tick15_prescale = 0;
+STATIC SWORD I_i_tick15 = 0;
+STATIC BOOL I_b_rung_top = 0;
+#define Read_I_b_rung_top() I_b_rung_top
+#define Write_I_b_rung_top(x) I_b_rung_top = x
+
+/* You provide this function. */
+PROTO(extern BOOL Read_U_b_Xin(void);)
+
+STATIC SWORD U_i_Ton = 0;
+STATIC SWORD I_i_Ton_start = 0;
+
+/* You provide these functions. */
+PROTO(BOOL Read_U_b_Yon(void);)
+PROTO(void Write_U_b_Yon(BOOL v);)
+
+STATIC BOOL I_b_Toff_antiglitch = 0;
+#define Read_I_b_Toff_antiglitch() I_b_Toff_antiglitch
+#define Write_I_b_Toff_antiglitch(x) I_b_Toff_antiglitch = x
+STATIC SWORD U_i_Toff = 0;
+STATIC SWORD I_i_Toff_start = 0;
+
+/* You provide these functions. */
+PROTO(BOOL Read_U_b_Yoff(void);)
+PROTO(void Write_U_b_Yoff(BOOL v);)
+
+STATIC SWORD U_i_Trto = 0;
+STATIC BOOL I_b_Trto_running = 0;
+#define Read_I_b_Trto_running() I_b_Trto_running
+#define Write_I_b_Trto_running(x) I_b_Trto_running = x
+STATIC SWORD I_i_Trto_start = 0;
+
+/* You provide these functions. */
+PROTO(BOOL Read_U_b_Yrto(void);)
+PROTO(void Write_U_b_Yrto(BOOL v);)
+
+
+/* You provide this function. */
+PROTO(extern BOOL Read_U_b_Xres(void);)
+
+
+
+/* Call this function once per PLC cycle. You are responsible for calling
+   it at the interval that you specified in the MCU configuration when you
+   generated this code. */
+void PlcCycle(void)
+{
+    Write_I_b_mcr(1);
+    if(I_i_tick4_prescale == 15) {
+        I_i_tick4_prescale = 0;
+        I_i_tick4++;
+    } else {
+        I_i_tick4_prescale++;
+    }
+    if(I_i_tick15_prescale == 32767) {
+        I_i_tick15_prescale = 0;
+        I_i_tick15++;
+    } else {
+        I_i_tick15_prescale++;
+    }
+    
+    /* start rung 2 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xin()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        if(U_i_Ton < 22887) {
+            U_i_Ton = I_i_tick15 - I_i_Ton_start;
+            Write_I_b_rung_top(0);
+        }
+    } else {
+        U_i_Ton = 0;
+        I_i_Ton_start = I_i_tick15;
+    }
+    
+    Write_U_b_Yon(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 3 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xin()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(!Read_I_b_Toff_antiglitch()) {
+        U_i_Toff = 22887;
+    }
+    Write_I_b_Toff_antiglitch(1);
+    if(!Read_I_b_rung_top()) {
+        if(U_i_Toff < 22887) {
+            U_i_Toff = I_i_tick15 - I_i_Toff_start;
+            Write_I_b_rung_top(1);
+        }
+    } else {
+        U_i_Toff = 0;
+        I_i_Toff_start = I_i_tick15;
+    }
+    
+    Write_U_b_Yoff(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 4 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xin()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(U_i_Trto < 18749) {
+        if(Read_I_b_rung_top()) {
+            if(!Read_I_b_Trto_running()) {
+                I_i_Trto_start = I_i_tick4 - U_i_Trto;
+                Write_I_b_Trto_running(1);
+            }
+            U_i_Trto = I_i_tick4 - I_i_Trto_start;
+        } else {
+            Write_I_b_Trto_running(0);
+        }
+        Write_I_b_rung_top(0);
+    } else {
+        Write_I_b_rung_top(1);
+    }
+    
+    Write_U_b_Yrto(Read_I_b_rung_top());
+    
+    /* ] finish series */
+    
+    /* start rung 5 */
+    Write_I_b_rung_top(Read_I_b_mcr());
+    
+    /* start series [ */
+    if(!Read_U_b_Xres()) {
+        Write_I_b_rung_top(0);
+    }
+    
+    if(Read_I_b_rung_top()) {
+        U_i_Trto = 0;
+        Write_I_b_Trto_running(0);
+    }
+    
+    /* ] finish series */
+}
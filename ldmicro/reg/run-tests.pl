@@ -1,29 +1,131 @@
 #!/usr/bin/perl
 
-if (not -d 'results/') {
-    mkdir 'results';
-}
+# Compile every test into the given directory, with the given options.
+sub compile_tests {
+    my ($dir, $options) = @_;
 
-$c = 0;
-for $test (<tests/*.ld>) {
-    $output = $test;
-    $output =~ s/^tests/results/;
-    $output =~ s/\.ld$/.hex/;
+    if (not -d "$dir/") {
+        mkdir $dir;
+    }
+    for $test (<tests/*.ld>) {
+        # The C target writes source, not a hex file.
+        open(TEST, $test) or die;
+        $ext = (grep /^MICRO=ANSI C/, <TEST>) ? '.c' : '.hex';
+        close(TEST);
+
+        $output = $test;
+        $output =~ s/^tests/$dir/;
+        $output =~ s/\.ld$/$ext/;
 
-    unlink $output;
+        unlink $output;
 
-    $cmd = "../ldmicro.exe /c $test $output";
-    system $cmd;
-    $c++;
+        $cmd = "../ldmicro.exe $options /c $test $output";
+        system $cmd;
+        $c++;
+    }
 }
 
+compile_tests('results', '');
+
 print "\ndifferences follow:\n";
-@diff = `diff -q results expected`;
+# The source maps that get written along with the hex files aren't
+# checked.
+@diff = `diff -q -x '*.map' results expected`;
+
+# The rungs get generated on several threads at once if there are enough of
+# them, but that mustn't change the code at all; so compile everything
+# again on just one thread, and then on as many as there can be, and check
+# that against the first time.
+for $threads (1, 8) {
+    compile_tests("results-t$threads", "/t$threads");
+    push @diff, `diff -q -x '*.map' results results-t$threads`;
+}
+
 for(@diff) {
     print "    $_";
 }
 $fc = scalar @diff;
 print "($fc difference(s)/$c)\n";
+
+# A check runs the C generated for one of the tests, which it builds into
+# itself from results/, against a model of what that C should do. This needs
+# a C compiler, named by CC.
+$cc = $ENV{'CC'} || 'gcc';
+for $check (<checks/*.c>) {
+    $exe = $check;
+    $exe =~ s/^checks/results/;
+    $exe =~ s/\.c$/.exe/;
+    $run = $exe;
+    $run =~ s/\//\\/g if $^O eq 'MSWin32';
+    if(system("$cc -Ichecks -o $exe $check") != 0 || system($run) != 0) {
+        print "    $check failed\n";
+        $fc++;
+    }
+    unlink $exe;
+}
+
+# And every test goes through the interpreter too: compile it again as
+# interpretable code, in each of its three forms, and in the text form
+# without superinstructions, and run each of those through each of the ways
+# that ldinterp.c can be built, with the same inputs. They must all do just
+# what the code without superinstructions does in the switch, cycle by
+# cycle.
+@builds = (
+    [ 'switch',     '-DNO_JIT -DNO_COMPUTED_GOTO' ],
+    [ 'threaded',   '-DNO_JIT' ],
+    [ 'native',     '' ],
+    [ 'packed',     '-DPACKED_BITS' ],
+);
+@forms = ('-unfused.int', '.int', '.intb', '.intp');
+
+if (not -d 'results-int/') {
+    mkdir 'results-int';
+}
+for $test (<tests/*.ld>) {
+    $base = $test;
+    $base =~ s/^tests/results-int/;
+    $base =~ s/\.ld$//;
+
+    open(TEST, $test) or die;
+    open(INT, ">$base.ld") or die;
+    while(<TEST>) {
+        s/^MICRO=[^\r\n]*/MICRO=Interpretable Byte Code/;
+        print INT;
+    }
+    close(INT);
+    close(TEST);
+
+    for $form (@forms) {
+        $options = ($form eq '-unfused.int') ? '/u' : '';
+        unlink "$base$form";
+        system "../ldmicro.exe $options /c $base.ld $base$form";
+    }
+    push @bases, $base;
+}
+
+for $build (@builds) {
+    ($name, $flags) = @$build;
+    $exe = "results-int/trace-$name.exe";
+    $run = $exe;
+    $run =~ s/\//\\/g if $^O eq 'MSWin32';
+    if(system("$cc $flags -O2 -o $exe trace-int.c ../ldinterp.c") != 0) {
+        print "    couldn't build the $name interpreter\n";
+        $fc++;
+        next;
+    }
+    for $base (@bases) {
+        for $form (@forms) {
+            $trace = "$base$form.$name";
+            system "$run $base$form 2000 > $trace";
+            if(`diff -q $base-unfused.int.switch $trace`) {
+                print "    $trace differs\n";
+                $fc++;
+            }
+        }
+    }
+    unlink $exe;
+}
+
 if($fc == 0) {
     print "pass!\n";
     exit(0);
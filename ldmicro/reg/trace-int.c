@@ -0,0 +1,177 @@
+//-----------------------------------------------------------------------------
+// Run an interpretable program through the interpreter in ldinterp.c, for
+// the given number of cycles, and print every variable after each one (but
+// not the internal ones, whose names start with $, since only the binary
+// forms of the program list those). For run-tests.pl, which builds this
+// against each of the ways that ldinterp.c can be built (a switch, threaded
+// code, native code, and relays packed into words), and checks that they all
+// print the same thing.
+//
+// The inputs (the bits whose names start with X) change at random, but
+// seldom, so that the timers get the chance to run out; and the ADCs and
+// the UART get random values too. It's all from the same fixed seed, so
+// each run is the same as the last.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ldinterp.h"
+
+static unsigned long Seed = 1;
+
+//-----------------------------------------------------------------------------
+// A random number from 0 to 32767, the same sequence every time.
+//-----------------------------------------------------------------------------
+static int Random(void)
+{
+    Seed = Seed*1103515245 + 12345;
+    return (int)((Seed >> 16) & 0x7fff);
+}
+
+typedef struct {
+    const char  *name;
+    int         isBit;
+    int         addr;
+} Variable;
+
+static int CompareVariables(const void *a, const void *b)
+{
+    return strcmp(((const Variable *)a)->name, ((const Variable *)b)->name);
+}
+
+static void ReadAdcs(void *user, short *values, int count)
+{
+    int i;
+    (void)user;
+    for(i = 0; i < count; i++) {
+        values[i] = (short)(Random() % 1024);
+    }
+}
+
+static int UartRecv(void *user, unsigned char *buf, int max)
+{
+    (void)user;
+    if(max < 1 || Random() % 8 != 0) return 0;
+    buf[0] = (unsigned char)Random();
+    return 1;
+}
+
+static void EepromRead(void *user, unsigned char *buf, int len)
+{
+    (void)user;
+    memset(buf, 0, len);
+}
+
+static void WritePwms(void *user, const short *duty, int count)
+{
+    int i;
+    (void)user;
+    printf("    pwm");
+    for(i = 0; i < count; i++) {
+        printf(" %d", duty[i]);
+    }
+    printf("\n");
+}
+
+static int UartSend(void *user, const unsigned char *buf, int len)
+{
+    int i;
+    (void)user;
+    printf("    uart");
+    for(i = 0; i < len; i++) {
+        printf(" %02x", buf[i]);
+    }
+    printf("\n");
+    return len;
+}
+
+static void EepromWrite(void *user, int addr, const unsigned char *buf,
+    int len)
+{
+    int i;
+    (void)user;
+    printf("    eeprom %d", addr);
+    for(i = 0; i < len; i++) {
+        printf(" %02x", buf[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    LdInterp *li;
+    LdInterpPeripherals p;
+    Variable *vars;
+    const char *name;
+    short *int16s;
+    int count, i, j, isBit, addr, error;
+    long cycle, cycles;
+
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s xxx.int cycles\n", argv[0]);
+        return -1;
+    }
+    cycles = atol(argv[2]);
+
+    li = LdInterpLoadFile(argv[1], &error);
+    if(!li) {
+        fprintf(stderr, "couldn't load '%s': %s.\n", argv[1],
+            LdInterpErrorString(error));
+        return -1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.readAdcs = ReadAdcs;
+    p.uartRecv = UartRecv;
+    p.eepromRead = EepromRead;
+    p.writePwms = WritePwms;
+    p.uartSend = UartSend;
+    p.eepromWrite = EepromWrite;
+    LdInterpSetPeripherals(li, &p);
+
+    // The symbols come in no particular order, so sort them by name, so
+    // that the output doesn't depend on the hash table.
+    count = 0;
+    for(i = 0; (i = LdInterpNextSymbol(li, i, &name, &isBit, &addr)) >= 0;) {
+        count++;
+    }
+    vars = (Variable *)malloc((count + 1)*sizeof(Variable));
+    count = 0;
+    for(i = 0; (i = LdInterpNextSymbol(li, i, &name, &isBit, &addr)) >= 0;) {
+        if(name[0] == '$') continue;
+        vars[count].name = name;
+        vars[count].isBit = isBit;
+        vars[count].addr = addr;
+        count++;
+    }
+    qsort(vars, count, sizeof(Variable), CompareVariables);
+
+    int16s = LdInterpInt16s(li);
+    for(cycle = 0; cycle < cycles; cycle++) {
+        for(j = 0; j < count; j++) {
+            if(vars[j].isBit && vars[j].name[0] == 'X' &&
+                Random() % 32 == 0)
+            {
+                LdInterpSetBit(li, vars[j].addr,
+                    !LdInterpGetBit(li, vars[j].addr));
+            }
+        }
+
+        printf("%ld\n", cycle);
+        LdInterpRunCycle(li);
+
+        for(j = 0; j < count; j++) {
+            if(vars[j].isBit) {
+                printf("    %s %d\n", vars[j].name,
+                    LdInterpGetBit(li, vars[j].addr));
+            } else {
+                printf("    %s %d\n", vars[j].name, int16s[vars[j].addr]);
+            }
+        }
+    }
+
+    free(vars);
+    LdInterpFree(li);
+    return 0;
+}
@@ -184,6 +184,51 @@ SWORD GetSimulationVariable(char *name)
     return GetSimulationVariable(name);
 }
 
+//-----------------------------------------------------------------------------
+// Work out the character at position i of a formatted string, advancing the
+// integer-to-string conversion as we go; the same thing that the back ends'
+// shared routines do.
+//-----------------------------------------------------------------------------
+static BYTE FormattedStringCharacter(FormattedString *fs, int i)
+{
+    BYTE c = fs->chars[i] & 0xff;
+    int kind = fs->chars[i] >> 8;
+
+    if(kind & (1 << FMTD_MINUS)) {
+        SWORD v = GetSimulationVariable(fs->var);
+        SetSimulationVariable(fs->convertState, v);
+        c = ' ';
+        if(v < 0) {
+            c = '-';
+            SetSimulationVariable(fs->convertState, (SWORD)(0 - v));
+        }
+    } else if(kind & (1 << FMTD_DIGIT)) {
+        if(kind & (1 << FMTD_FIRST_DIGIT)) {
+            SetSingleBit(fs->isLeadingZero, TRUE);
+        }
+        if(kind & (1 << FMTD_LOAD_VAR)) {
+            SetSimulationVariable(fs->convertState,
+                GetSimulationVariable(fs->var));
+        }
+        int power = kind & FMTD_POWER_MASK;
+        SWORD divisor = TenToThe(power);
+        SWORD v = GetSimulationVariable(fs->convertState);
+        SWORD q = v / divisor;
+        SetSimulationVariable(fs->convertState, (SWORD)(v - q*divisor));
+        c = (BYTE)(q + '0');
+
+        // Suppress all but the last leading zero.
+        if(power != 0) {
+            if(q == 0) {
+                if(SingleBitOn(fs->isLeadingZero)) c = ' ';
+            } else {
+                SetSingleBit(fs->isLeadingZero, FALSE);
+            }
+        }
+    }
+    return c;
+}
+
 //-----------------------------------------------------------------------------
 // Set the shadow copy of a variable associated with a READ ADC operation. This
 // will get committed to the real copy when the rung-in condition to the
@@ -535,10 +580,28 @@ static void SimulateIntCode(void)
                     GetSimulationVariable(a->name2));
                 break;
 
+            case INT_SET_VARIABLE_FROM_RING:
+            case INT_SET_RING_FROM_VARIABLE:
+                // The simulator shows each stage by name, so it never gets
+                // the rings; see FindShiftRegisterCandidates().
+                oops();
+                break;
+
             case INT_INCREMENT_VARIABLE:
                 IncrementVariable(a->name1);
                 break;
 
+            case INT_SET_BIT_FROM_TRUTH_TABLE: {
+                TruthTable *t = &TruthTables[a->literal];
+                int i, index = 0;
+                for(i = 0; i < t->inputs; i++) {
+                    if(SingleBitOn(t->input[i])) index |= (1 << i);
+                }
+                SetSingleBit(a->name1,
+                    (t->bits[index >> 3] >> (index & 7)) & 1);
+                break;
+            }
+
             {
                 SWORD v;
                 case INT_SET_VARIABLE_ADD:
@@ -553,6 +616,62 @@ static void SimulateIntCode(void)
                     v = GetSimulationVariable(a->name2) *
                         GetSimulationVariable(a->name3);
                     goto math;
+                case INT_SET_VARIABLE_ADD_LITERAL:
+                    v = GetSimulationVariable(a->name2) + a->literal;
+                    goto math;
+                case INT_SET_VARIABLE_SUBTRACT_LITERAL:
+                    v = GetSimulationVariable(a->name2) - a->literal;
+                    goto math;
+                case INT_SET_VARIABLE_MULTIPLY_LITERAL:
+                    v = GetSimulationVariable(a->name2) * a->literal;
+                    goto math;
+                case INT_SET_VARIABLE_DIVIDE_LITERAL:
+                    v = GetSimulationVariable(a->name2) / a->literal;
+                    goto math;
+                case INT_DECREMENT_VARIABLE:
+                    v = GetSimulationVariable(a->name1) - 1;
+                    goto math;
+                case INT_SET_VARIABLE_FROM_TABLE: {
+                    ElemLookUpTable *t = LookUpTables[a->literal];
+                    SWORD index = GetSimulationVariable(a->name2);
+                    if(index < 0 || index >= t->count) break;
+                    v = t->vals[index];
+                    goto math;
+                }
+                case INT_SET_VARIABLE_PIECEWISE_LINEAR: {
+                    ElemPiecewiseLinear *t = PiecewiseLinears[a->literal];
+                    SWORD x = GetSimulationVariable(a->name2);
+                    // find the first point past the first one whose x is
+                    // not less than the index
+                    int lo = 1, hi = t->count;
+                    while(lo < hi) {
+                        int mid = (lo + hi)/2;
+                        if(x <= t->vals[mid*2]) {
+                            hi = mid;
+                        } else {
+                            lo = mid + 1;
+                        }
+                    }
+                    if(lo >= t->count) break;
+                    SWORD seg[4];
+                    PiecewiseLinearSegment(t, lo - 1, seg);
+                    v = (SWORD)(x - seg[0]);
+                    v = (SWORD)(((long)v * seg[2]) / seg[3]);
+                    v += seg[1];
+                    goto math;
+                }
+                case INT_SET_VARIABLE_MULTIPLY_DIVIDE:
+                    // the product is kept to 32 bits, and only the quotient
+                    // is truncated
+                    if(a->literal != 0) {
+                        v = (SWORD)(((long)GetSimulationVariable(a->name2) *
+                            GetSimulationVariable(a->name3)) / a->literal);
+                    } else {
+                        v = 0;
+                        Error(_("Division by zero; halting simulation"));
+                        StopSimulation();
+                    }
+                    goto math;
                 case INT_SET_VARIABLE_DIVIDE:
                     if(GetSimulationVariable(a->name3) != 0) {
                         v = GetSimulationVariable(a->name2) /
@@ -598,6 +717,16 @@ math:
                     IF_BODY
                 break;
 
+            case INT_IF_VARIABLE_EQUALS_LITERAL:
+                if(GetSimulationVariable(a->name1) == a->literal)
+                    IF_BODY
+                break;
+
+            case INT_IF_VARIABLE_GRT_LITERAL:
+                if(GetSimulationVariable(a->name1) > a->literal)
+                    IF_BODY
+                break;
+
             case INT_IF_VARIABLE_GRT_VARIABLE:
                 if(GetSimulationVariable(a->name1) >
                     GetSimulationVariable(a->name2))
@@ -643,6 +772,20 @@ math:
                 }
                 break;
 
+            case INT_WRITE_FORMATTED_STRING:
+                if(GetSimulationVariable(a->name1) <
+                    FormattedStrings[a->literal].steps &&
+                    SimulateUartTxCountdown == 0)
+                {
+                    SimulateUartTxCountdown = 2;
+                    AppendToUartSimulationTextControl(
+                        FormattedStringCharacter(
+                            &FormattedStrings[a->literal],
+                            GetSimulationVariable(a->name1)));
+                    IncrementVariable(a->name1);
+                }
+                break;
+
             case INT_UART_RECV:
                 if(QueuedUartCharacter >= 0) {
                     SetSingleBit(a->name2, TRUE);